@@ -0,0 +1,543 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCCachedTileSet.h"
+#include "QGCCacheTile.h"
+#include "QGCMapTasks.h"
+#include "QGCMapUrlEngine.h"
+#include "QGCSqlStatementCache.h"
+#include "QGCTileBlobStore.h"
+#include "QGCTileCacheWorker.h"
+#include "QGCTileKey.h"
+#include "QGCTileKeyFilter.h"
+#include "QGCTileLookup.h"
+#include "QGCTileMemoryCache.h"
+#include "QGCTileSet.h"
+#include "QGCTileWriteBuffer.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QHash>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTimer>
+#include <QtCore/QtMath>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+#include <QtTest/QTest>
+
+#include <cmath>
+
+namespace {
+
+const QString kMapType = QStringLiteral("Google Street Map");
+constexpr int kTaskTimeout = 30 * 60 * 1000;    // 5M 瓦片集合的删除可能需要数分钟
+
+// 视口：12 x 8 个瓦片，约为 1080p 屏幕加一圈预取
+constexpr int kViewportWidth = 12;
+constexpr int kViewportHeight = 8;
+constexpr int kViewportZoom = 15;
+constexpr int kViewportX = 26000;
+constexpr int kViewportY = 12000;
+
+constexpr int kThroughputTiles = 256;
+constexpr int kSmallCacheTiles = 100000;
+constexpr int kLargeCacheTiles = 5000000;
+constexpr int kGeneratedBlobs = 1024;
+constexpr int kGeneratedBlobSize = 4 * 1024;
+constexpr int kGenerateZoom = 20;
+constexpr int kGenerateRowWidth = 4096;
+constexpr int kGenerateTransaction = 100000;
+
+/// 大小与熵接近真实 PNG 瓦片的图像，每个瓦片内容不同，不被去重
+QByteArray tileImage(quint64 key, qsizetype size = 16 * 1024) {
+    QByteArray img(size, Qt::Uninitialized);
+    QRandomGenerator rng(static_cast<quint32>(key ^ (key >> 32)));
+    rng.fillRange(reinterpret_cast<quint32 *>(img.data()), size / static_cast<qsizetype>(sizeof(quint32)));
+    return img;
+}
+
+/// 单独的缓存工作线程；析构时停止
+class BenchmarkCache
+{
+public:
+    explicit BenchmarkCache(const QString &path, int readers = 0) {
+        // 过滤器是进程级的，换用另一个数据库时重新载入
+        QGCTileKeyFilter::instance()->invalidate();
+        _worker.setDatabaseFile(path);
+        _worker.setReaderCount(readers);
+    }
+    ~BenchmarkCache() {
+        _worker.stop();
+        (void)_worker.wait();
+    }
+
+    QGCCacheWorker &worker() { return _worker; }
+
+    bool open() { return run(new QGCMapTask(QGCMapTask::taskInit)); }
+
+    /// 执行任务并等待工作线程释放它；之前保存的瓦片在任务开始前写入
+    bool run(QGCMapTask *task) {
+        bool ok = true;
+        QEventLoop loop;
+        (void)QObject::connect(task, &QGCMapTask::error, &loop, [&ok](QGCMapTask::TaskType, const QString &errorString) {
+            qWarning() << "Task failed:" << errorString;
+            ok = false;
+        });
+        (void)QObject::connect(task, &QObject::destroyed, &loop, &QEventLoop::quit);
+        QTimer::singleShot(kTaskTimeout, &loop, [&loop, &ok]() {
+            ok = false;
+            loop.quit();
+        });
+        if (!_worker.enqueueTask(task)) {
+            return false;
+        }
+        (void)loop.exec();
+        return ok;
+    }
+
+    /// 写后缓冲中的瓦片写入数据库
+    bool flush() { return run(new QGCMapTask(QGCMapTask::taskInit)); }
+
+    /// 查询全部瓦片并等待回调，返回命中数
+    int fetch(const QList<quint64> &keys, QObject *context) {
+        int pending = static_cast<int>(keys.size());
+        int hits = 0;
+        QEventLoop loop;
+        for (const quint64 key : keys) {
+            (void)_worker.enqueueLookup(QGCTileLookup::create(key, context, [&](QGCCacheTile *tile, const QString &) {
+                if (tile) {
+                    hits++;
+                    delete tile;
+                }
+                if (--pending == 0) {
+                    loop.quit();
+                }
+            }));
+        }
+        if (pending > 0) {
+            (void)loop.exec();
+        }
+        return hits;
+    }
+
+    /// 创建覆盖 keys 所在范围的离线集合，返回 setID
+    quint64 createSet(const QString &name, int zoom, const QGCTileSet &range) {
+        QGCCachedTileSet *const set = new QGCCachedTileSet(name);
+        set->setMapTypeStr(kMapType);
+        set->setType(kMapType);
+        set->setTopleftLon(tileLon(range.tileX0, zoom));
+        set->setTopleftLat(tileLat(range.tileY0, zoom));
+        set->setBottomRightLon(tileLon(range.tileX1 + 1, zoom) - 1e-9);
+        set->setBottomRightLat(tileLat(range.tileY1 + 1, zoom) + 1e-9);
+        set->setMinZoom(zoom);
+        set->setMaxZoom(zoom);
+        set->setTotalTileCount(static_cast<quint32>(range.tileCount));
+
+        quint64 setID = 0;
+        QGCCreateTileSetTask *const task = new QGCCreateTileSetTask(set);
+        (void)QObject::connect(task, &QGCCreateTileSetTask::tileSetSaved, task, [&setID](QGCCachedTileSet *saved) {
+            setID = saved->id();
+            saved->deleteLater();
+        }, Qt::DirectConnection);
+        return run(task) ? setID : 0;
+    }
+
+    static double tileLon(int x, int zoom) {
+        return (x / static_cast<double>(1 << zoom)) * 360. - 180.;
+    }
+    static double tileLat(int y, int zoom) {
+        const double n = M_PI - ((2. * M_PI * y) / static_cast<double>(1 << zoom));
+        return qRadiansToDegrees(std::atan(std::sinh(n)));
+    }
+
+private:
+    QGCCacheWorker _worker;
+};
+
+QList<quint64> viewportKeys(int dx = 0) {
+    QList<quint64> keys;
+    keys.reserve(kViewportWidth * kViewportHeight);
+    for (int y = 0; y < kViewportHeight; y++) {
+        for (int x = 0; x < kViewportWidth; x++) {
+            keys.append(UrlFactory::getTileKey(kMapType, kViewportX + dx + x, kViewportY + y, kViewportZoom));
+        }
+    }
+    return keys;
+}
+
+} // namespace
+
+/**
+ * @brief 瓦片缓存基准
+ * coldViewportFill：一屏瓦片全部来自数据库时的填充时间，逐个查询与合并为 IN (...) 对比。
+ * generateCache 及其后的用例：合成 10 万与 500 万瓦片的数据库（QGC_BENCHMARK_TILES 可改变后者），
+ * 集合统计、下载列表、清理与删除集合的耗时不应随缓存总量增长。
+ * save/fetch/updateState：语句缓存开启与关闭时工作线程的吞吐量。
+ */
+class QGCCacheBenchmark : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void coldViewportFill_data();
+    void coldViewportFill();
+
+    void generateCache_data();
+    void generateCache();
+    void setTotals_data();
+    void setTotals();
+    void downloadList_data();
+    void downloadList();
+    void pruneCache_data();
+    void pruneCache();
+    void deleteTileSet_data();
+    void deleteTileSet();
+
+    void save_data();
+    void save();
+    void fetch_data();
+    void fetch();
+    void updateState_data();
+    void updateState();
+
+private:
+    void _cacheSizes();
+    void _statementCache();
+    bool _generate(const QString &path, int tiles, quint64 &offlineSetID);
+
+    QTemporaryDir _dir;
+    QString _viewportPath;
+    QString _throughputPath;
+    QHash<int, QString> _generated;
+    QHash<int, quint64> _offlineSets;
+    quint64 _nextKey = 0;
+};
+
+void QGCCacheBenchmark::initTestCase() {
+    QVERIFY(_dir.isValid());
+    // 冷启动：已编码瓦片的内存 LRU 关闭，保存的瓦片在下一次任务前写入
+    QGCTileMemoryCache::instance()->setBudget(0);
+    QGCTileWriteBuffer::instance()->setWindow(60 * 1000, 64 * 1024 * 1024);
+
+    _viewportPath = _dir.filePath(QStringLiteral("viewport.db"));
+    BenchmarkCache cache(_viewportPath);
+    QVERIFY(cache.open());
+    for (int dx = 0; dx < (kViewportWidth * 64); dx += kViewportWidth) {
+        for (const quint64 key : viewportKeys(dx)) {
+            QVERIFY(cache.worker().saveTile(key, tileImage(key), QStringLiteral("png"), kMapType, UINT64_MAX));
+        }
+    }
+    QVERIFY(cache.flush());
+}
+
+void QGCCacheBenchmark::cleanupTestCase() {
+    QGCSqlStatementCache::setEnabled(true);
+}
+
+void QGCCacheBenchmark::coldViewportFill_data() {
+    QTest::addColumn<int>("batchSize");
+    QTest::newRow("per-tile") << 1;
+    QTest::newRow("batched") << 32;
+}
+
+void QGCCacheBenchmark::coldViewportFill() {
+    QFETCH(int, batchSize);
+
+    BenchmarkCache cache(_viewportPath, 2);
+    cache.worker().setFetchBatchSize(batchSize);
+    QVERIFY(cache.open());
+
+    // 每次填充平移到一屏从未查询过的瓦片
+    int dx = 0;
+    QBENCHMARK {
+        const QList<quint64> keys = viewportKeys(dx);
+        QCOMPARE(cache.fetch(keys, this), keys.size());
+        dx = (dx + kViewportWidth) % (kViewportWidth * 64);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void QGCCacheBenchmark::_cacheSizes() {
+    QTest::addColumn<int>("tiles");
+    const int large = qEnvironmentVariableIsSet("QGC_BENCHMARK_TILES")
+        ? qEnvironmentVariableIntValue("QGC_BENCHMARK_TILES") : kLargeCacheTiles;
+    QTest::newRow("100k tiles") << kSmallCacheTiles;
+    QTest::newRow(qPrintable(QStringLiteral("%1 tiles").arg(large))) << large;
+}
+
+bool QGCCacheBenchmark::_generate(const QString &path, int tiles, quint64 &offlineSetID) {
+    // 离线集合由工作线程创建，下载计划与正常流程相同；其余行直接批量写入
+    QGCTileSet range;
+    range.tileX0 = 1 << (kGenerateZoom - 1);
+    range.tileY0 = 1 << (kGenerateZoom - 1);
+    range.tileX1 = range.tileX0 + kGenerateRowWidth - 1;
+    range.tileY1 = range.tileY0 + ((tiles / 10) / kGenerateRowWidth);
+    range.tileCount = static_cast<quint64>(range.tileX1 - range.tileX0 + 1) * static_cast<quint64>(range.tileY1 - range.tileY0 + 1);
+    {
+        BenchmarkCache cache(path);
+        if (!cache.open()) {
+            return false;
+        }
+        offlineSetID = cache.createSet(QStringLiteral("Benchmark"), kGenerateZoom, range);
+        if (offlineSetID == 0) {
+            return false;
+        }
+    }
+
+    const QString session = QStringLiteral("QGCCacheBenchmarkGenerator");
+    bool ok = false;
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QStringLiteral("QSQLITE"), session);
+        db.setDatabaseName(path);
+        if (!db.open()) {
+            qWarning() << "Could not open" << path << db.lastError().text();
+            QSqlDatabase::removeDatabase(session);
+            return false;
+        }
+
+        QSqlQuery query(db);
+        (void)query.exec(QStringLiteral("PRAGMA synchronous=OFF"));
+        (void)query.exec(QStringLiteral("SELECT setID FROM TileSets WHERE defaultSet = 1"));
+        const quint64 defaultSetID = query.next() ? query.value(0).toULongLong() : 0;
+        query.finish();
+        const quint32 provider = QGCProviderRegistry::instance()->id(kMapType);
+        (void)QGCProviderRegistry::instance()->persist(db);
+
+        ok = (defaultSetID != 0) && (provider != 0) && db.transaction();
+
+        // 少量不同的图像被大量瓦片引用，文件大小保持在几十 MB 以内
+        QList<qint64> blobs;
+        QSqlQuery blob(db);
+        (void)blob.prepare(QStringLiteral("INSERT INTO Blobs(hash, size, tile) VALUES(?, ?, ?)"));
+        for (int i = 0; ok && (i < kGeneratedBlobs); i++) {
+            const QByteArray img = tileImage(i, kGeneratedBlobSize);
+            blob.addBindValue(static_cast<qint64>(QGCTileBlobStore::contentHash(img)));
+            blob.addBindValue(img.size());
+            blob.addBindValue(img);
+            ok = blob.exec();
+            blobs.append(blob.lastInsertId().toLongLong());
+        }
+
+        QSqlQuery tile(db);
+        QSqlQuery setTile(db);
+        (void)tile.prepare(QStringLiteral("INSERT INTO Tiles(tileID, format, blobID, size, date) VALUES(?, ?, ?, ?, ?)"));
+        (void)setTile.prepare(QStringLiteral("INSERT INTO SetTiles(tileID, setID) VALUES(?, ?)"));
+        const qint64 date = QDateTime::currentSecsSinceEpoch();
+        for (int i = 0; ok && (i < tiles); i++) {
+            const quint64 key = QGCTileKey::make(provider, range.tileX0 + (i % kGenerateRowWidth),
+                                                 range.tileY0 + (i / kGenerateRowWidth), kGenerateZoom);
+            tile.addBindValue(key);
+            tile.addBindValue(QStringLiteral("png"));
+            tile.addBindValue(blobs.at(i % blobs.size()));
+            tile.addBindValue(kGeneratedBlobSize);
+            tile.addBindValue(date - (i % 86400));
+            setTile.addBindValue(key);
+            setTile.addBindValue(defaultSetID);
+            ok = tile.exec() && setTile.exec();
+            // 前 10% 的瓦片同时属于离线集合，集合的下载计划只完成了一部分
+            if (ok && (i < (tiles / 10))) {
+                setTile.addBindValue(key);
+                setTile.addBindValue(offlineSetID);
+                ok = setTile.exec();
+            }
+            if (ok && (((i + 1) % kGenerateTransaction) == 0)) {
+                ok = db.commit() && db.transaction();
+            }
+        }
+        if (!ok) {
+            qWarning() << "Generate failed:" << tile.lastError().text() << setTile.lastError().text() << db.lastError().text();
+        }
+        ok = ok && db.commit();
+        (void)query.exec(QStringLiteral("PRAGMA wal_checkpoint(TRUNCATE)"));
+        (void)query.exec(QStringLiteral("ANALYZE"));
+    }
+    QSqlDatabase::removeDatabase(session);
+    return ok;
+}
+
+void QGCCacheBenchmark::generateCache_data() { _cacheSizes(); }
+
+void QGCCacheBenchmark::generateCache() {
+    QFETCH(int, tiles);
+
+    const QString path = _dir.filePath(QStringLiteral("generated-%1.db").arg(tiles));
+    quint64 setID = 0;
+    QBENCHMARK_ONCE {
+        QVERIFY(_generate(path, tiles, setID));
+    }
+    _generated.insert(tiles, path);
+    _offlineSets.insert(tiles, setID);
+}
+
+void QGCCacheBenchmark::setTotals_data() { _cacheSizes(); }
+
+void QGCCacheBenchmark::setTotals() {
+    QFETCH(int, tiles);
+    if (!_generated.contains(tiles)) {
+        QSKIP("Cache not generated");
+    }
+
+    BenchmarkCache cache(_generated.value(tiles));
+    QVERIFY(cache.open());
+    QBENCHMARK {
+        QGCFetchTileSetTask *const task = new QGCFetchTileSetTask();
+        (void)connect(task, &QGCFetchTileSetTask::tileSetFetched, task, [](QGCCachedTileSet *set) {
+            set->deleteLater();
+        }, Qt::DirectConnection);
+        QVERIFY(cache.run(task));
+    }
+}
+
+void QGCCacheBenchmark::downloadList_data() { _cacheSizes(); }
+
+void QGCCacheBenchmark::downloadList() {
+    QFETCH(int, tiles);
+    if (!_generated.contains(tiles)) {
+        QSKIP("Cache not generated");
+    }
+
+    BenchmarkCache cache(_generated.value(tiles));
+    QVERIFY(cache.open());
+    QBENCHMARK {
+        QGCGetTileDownloadListTask *const task = new QGCGetTileDownloadListTask(_offlineSets.value(tiles), 100);
+        (void)connect(task, &QGCGetTileDownloadListTask::tileListFetched, task, [](QQueue<QGCTile*> list) {
+            qDeleteAll(list);
+        }, Qt::DirectConnection);
+        QVERIFY(cache.run(task));
+    }
+}
+
+void QGCCacheBenchmark::pruneCache_data() { _cacheSizes(); }
+
+void QGCCacheBenchmark::pruneCache() {
+    QFETCH(int, tiles);
+    if (!_generated.contains(tiles)) {
+        QSKIP("Cache not generated");
+    }
+
+    // 每次清理约 256 个最久未访问的瓦片
+    BenchmarkCache cache(_generated.value(tiles));
+    QVERIFY(cache.open());
+    QBENCHMARK {
+        QVERIFY(cache.run(new QGCPruneCacheTask(256 * kGeneratedBlobSize)));
+    }
+}
+
+void QGCCacheBenchmark::deleteTileSet_data() { _cacheSizes(); }
+
+void QGCCacheBenchmark::deleteTileSet() {
+    QFETCH(int, tiles);
+    if (!_generated.contains(tiles)) {
+        QSKIP("Cache not generated");
+    }
+
+    BenchmarkCache cache(_generated.value(tiles));
+    QVERIFY(cache.open());
+    QBENCHMARK_ONCE {
+        QVERIFY(cache.run(new QGCDeleteTileSetTask(_offlineSets.value(tiles))));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void QGCCacheBenchmark::_statementCache() {
+    QTest::addColumn<bool>("statementCache");
+    QTest::newRow("statement cache on") << true;
+    QTest::newRow("statement cache off") << false;
+}
+
+void QGCCacheBenchmark::save_data() { _statementCache(); }
+
+void QGCCacheBenchmark::save() {
+    QFETCH(bool, statementCache);
+    QGCSqlStatementCache::setEnabled(statementCache);
+
+    if (_throughputPath.isEmpty()) {
+        _throughputPath = _dir.filePath(QStringLiteral("throughput.db"));
+    }
+    BenchmarkCache cache(_throughputPath);
+    QVERIFY(cache.open());
+
+    // 每轮保存新瓦片，写后缓冲在一个事务内写入
+    const quint32 provider = QGCProviderRegistry::instance()->id(kMapType);
+    QList<QPair<quint64, QByteArray>> batch;
+    QBENCHMARK {
+        batch.clear();
+        for (int i = 0; i < kThroughputTiles; i++, _nextKey++) {
+            const quint64 key = QGCTileKey::make(provider, static_cast<int>(_nextKey % kGenerateRowWidth),
+                                                 static_cast<int>(_nextKey / kGenerateRowWidth), 18);
+            batch.append({key, tileImage(key)});
+        }
+        for (const QPair<quint64, QByteArray> &tile : std::as_const(batch)) {
+            QVERIFY(cache.worker().saveTile(tile.first, tile.second, QStringLiteral("png"), kMapType, UINT64_MAX));
+        }
+        QVERIFY(cache.flush());
+    }
+}
+
+void QGCCacheBenchmark::fetch_data() { _statementCache(); }
+
+void QGCCacheBenchmark::fetch() {
+    QFETCH(bool, statementCache);
+    QGCSqlStatementCache::setEnabled(statementCache);
+
+    // 逐个查询，每个瓦片执行一次语句
+    BenchmarkCache cache(_viewportPath, 1);
+    cache.worker().setFetchBatchSize(1);
+    QVERIFY(cache.open());
+    const QList<quint64> keys = viewportKeys();
+    QBENCHMARK {
+        QCOMPARE(cache.fetch(keys, this), keys.size());
+    }
+}
+
+void QGCCacheBenchmark::updateState_data() { _statementCache(); }
+
+void QGCCacheBenchmark::updateState() {
+    QFETCH(bool, statementCache);
+    QGCSqlStatementCache::setEnabled(statementCache);
+
+    const QString path = _dir.filePath(QStringLiteral("state-%1.db").arg(statementCache ? 1 : 0));
+    BenchmarkCache cache(path);
+    QVERIFY(cache.open());
+
+    QGCTileSet range;
+    range.tileX0 = kViewportX;
+    range.tileY0 = kViewportY;
+    range.tileX1 = kViewportX + 63;
+    range.tileY1 = kViewportY + 63;
+    range.tileCount = 64 * 64;
+    const quint64 setID = cache.createSet(QStringLiteral("State"), kViewportZoom, range);
+    QVERIFY(setID != 0);
+
+    // 每轮标记一批瓦片完成后 rewind，下一轮重新标记同一批
+    QList<quint64> keys;
+    for (int i = 0; i < kThroughputTiles; i++) {
+        keys.append(UrlFactory::getTileKey(kMapType, kViewportX + (i % 64), kViewportY + (i / 64), kViewportZoom));
+    }
+    QBENCHMARK {
+        for (const quint64 key : std::as_const(keys)) {
+            (void)cache.worker().enqueueTask(new QGCUpdateTileDownloadStateTask(setID, QGCTile::StateComplete, key));
+        }
+        (void)cache.worker().enqueueTask(new QGCUpdateTileDownloadStateTask(setID, QGCTile::StatePending,
+                                                                            QGCUpdateTileDownloadStateTask::kAllTiles));
+        QVERIFY(cache.flush());
+    }
+}
+
+QTEST_GUILESS_MAIN(QGCCacheBenchmark)
+
+#include "QGCCacheBenchmark.moc"
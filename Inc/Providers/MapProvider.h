@@ -16,6 +16,8 @@
 
 #include "QGCTileSet.h"
 
+#include <atomic>
+
 Q_DECLARE_LOGGING_CATEGORY(MapProviderLog)
 
 #define MAX_MAP_ZOOM 21
@@ -57,6 +59,10 @@ public:
                                     double topleftLat, double bottomRightLon,
                                     double bottomRightLat) const;
 
+    /// HTTP/2 下所有瓦片走同一主机的多路复用连接，不再按 x/y 分散到各分片主机
+    static void setSingleHost(bool singleHost) { _singleHost = singleHost; }
+    static bool singleHost() { return _singleHost; }
+
 protected:
     QString _tileXYToQuadKey(int tileX, int tileY, int levelOfDetail) const;
     int _getServerNum(int x, int y, int max) const;
@@ -75,4 +81,5 @@ protected:
 
 private:
     static int _mapIdIndex;
+    static std::atomic_bool _singleHost;
 };
@@ -0,0 +1,80 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QSet>
+
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCCacheEvictorLog)
+
+class QSqlDatabase;
+
+/**
+ * @brief 默认瓦片集的持续淘汰
+ * 命中（内存 LRU 或数据库）的瓦片键先在内存中累积，由缓存工作线程批量写入 Tiles.access。
+ * 默认集合的独有瓦片超过高水位后开始淘汰，降到低水位以下停止；
+ * 每次只删除一小块，工作线程空闲时执行，读连接在 WAL 下不受影响。
+ * 淘汰顺序为 (access, date)：保存后从未再被查看的瓦片（access = 0）最先淘汰。
+ */
+class QGCCacheEvictor
+{
+public:
+    struct Stats {
+        quint64 touched = 0;        ///< 写入的访问记录数
+        quint64 evictedTiles = 0;
+        quint64 evictedBytes = 0;
+        quint64 chunks = 0;
+    };
+
+    static QGCCacheEvictor *instance();
+
+    /// 记录一次瓦片访问，任意线程调用
+    void touch(quint64 key);
+    bool hasPendingAccess() const;
+    qsizetype pendingAccess() const;
+    /// 将累积的访问时间写入数据库（工作线程）
+    bool flushAccess(QSqlDatabase &db);
+    /// 丢弃未写入的访问记录（数据库被替换或重置）
+    void clearPendingAccess();
+
+    /// 单位为字节，high 为 0 时不淘汰
+    void setWatermarks(quint64 high, quint64 low);
+    quint64 highWatermark() const { return _high; }
+    quint64 lowWatermark() const { return _low; }
+    /// 按默认集合独有瓦片大小更新滞回状态，返回是否需要继续淘汰
+    bool needsEviction(quint64 defaultSize);
+
+    /// 删除默认集合中最久未访问的独有瓦片，最多 kChunkTiles 个、不超过 amount 字节所需，
+    /// 返回释放的字节数，出错返回 -1
+    qint64 evictChunk(QSqlDatabase &db, quint64 defaultSetID, quint64 amount);
+
+    Stats stats() const;
+
+    static constexpr int kChunkTiles = 256;
+    static constexpr qsizetype kFlushThreshold = 4096;
+
+private:
+    QGCCacheEvictor() = default;
+
+    mutable QMutex _accessMutex;
+    QSet<quint64> _pending;
+
+    std::atomic<quint64> _high = 0;
+    std::atomic<quint64> _low = 0;
+    bool _evicting = false;     // 仅工作线程访问
+
+    std::atomic<quint64> _touched = 0;
+    std::atomic<quint64> _evictedTiles = 0;
+    std::atomic<quint64> _evictedBytes = 0;
+    std::atomic<quint64> _chunks = 0;
+};
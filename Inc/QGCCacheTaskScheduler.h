@@ -0,0 +1,105 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QQueue>
+
+#include <array>
+
+class QGCMapTask;
+class QGCTileLookup;
+
+/**
+ * @brief 交互式瓦片查询队列
+ * 后进先出（最新的可见瓦片先查），相同瓦片键的旧请求通过哈希表 O(1) 替换。
+ * 被替换的条目留在栈中作为墓碑，出栈时按序号识别并跳过。
+ * 非线程安全，由持有者加锁。
+ */
+class QGCFetchTaskLane
+{
+public:
+    /// 入栈，若替换了同一瓦片的旧查询则返回旧查询（调用者负责完成）
+    /// stamp 为调用者附带的入队时间戳，出栈时原样返回
+    QGCTileLookup *push(QGCTileLookup *lookup, qint64 stamp = 0);
+    QGCTileLookup *pop(qint64 *stamp = nullptr);
+    QList<QGCTileLookup*> takeAll();
+
+    bool isEmpty() const { return _index.isEmpty(); }
+    qsizetype count() const { return _index.size(); }
+
+private:
+    struct Slot {
+        QGCTileLookup *lookup = nullptr;
+        quint64 seq = 0;
+        qint64 stamp = 0;
+    };
+    struct Entry {
+        quint64 key = 0;
+        quint64 seq = 0;
+    };
+
+    QList<Entry> _stack;    // 尾部为栈顶
+    QHash<quint64, Slot> _index;
+    quint64 _seq = 0;
+};
+
+/**
+ * @brief 缓存工作线程的多通道任务调度器
+ * 交互式查询严格优先；其余通道（保存、离线下载记账、维护）按权重轮转出队，
+ * 避免一次导出或清理阻塞全部请求，同时保证低优先级任务不会饿死。
+ * 非线程安全，由持有者加锁。
+ */
+class QGCCacheTaskScheduler
+{
+public:
+    enum Lane {
+        LaneFetch,
+        LaneSave,
+        LaneDownload,
+        LaneMaintenance,
+        LaneCount
+    };
+
+    /// 瓦片查询以 QGCTileLookup 排队，不经过本函数
+    static Lane laneForTask(const QGCMapTask *task);
+
+    void enqueue(QGCMapTask *task);
+    /// 查询入队，若替换了同一瓦片的旧查询则返回旧查询（调用者负责完成）
+    QGCTileLookup *enqueueFetch(QGCTileLookup *lookup);
+    /// 取出下一个非查询任务；查询由 takeFetchBatch 优先取出
+    QGCMapTask *takeNext();
+    /// 分片执行的长任务放回所在通道的队首，同一通道的后续任务不会越过它
+    void resume(QGCMapTask *task);
+    bool hasFetches() const { return !_fetch.isEmpty(); }
+    /// 取出最多 max 个查询，供合并查询
+    QList<QGCTileLookup*> takeFetchBatch(qsizetype max);
+    /// 取出离线下载通道队首连续的至多 max 个下载状态任务，供合并记账
+    QList<QGCMapTask*> takeDownloadStateBatch(qsizetype max);
+    QList<QGCMapTask*> takeAll();
+    QList<QGCTileLookup*> takeAllFetches() { return _fetch.takeAll(); }
+
+    bool isEmpty() const { return count() == 0; }
+    qsizetype count() const;
+    qsizetype count(Lane lane) const;
+
+private:
+    QQueue<QGCMapTask*> &_queue(Lane lane) { return _queues[lane - LaneSave]; }
+    const QQueue<QGCMapTask*> &_queue(Lane lane) const { return _queues[lane - LaneSave]; }
+
+    QGCFetchTaskLane _fetch;
+    std::array<QQueue<QGCMapTask*>, LaneCount - LaneSave> _queues;
+    std::array<int, LaneCount> _credits = {};
+    int _cursor = LaneSave;
+
+    // 每轮可出队次数：保存 > 离线下载记账 > 维护
+    static constexpr std::array<int, LaneCount> kWeights = {0, 4, 2, 1};
+};
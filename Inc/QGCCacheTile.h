@@ -16,28 +16,28 @@
 class QGCCacheTile
 {
 public:
-    QGCCacheTile(const QString &hash, const QByteArray &img, const QString &format, const QString &type, quint64 tileSet = UINT64_MAX)
+    QGCCacheTile(quint64 key, const QByteArray &img, const QString &format, const QString &type, quint64 tileSet = UINT64_MAX)
         : m_tileSet(tileSet)
-        , m_hash(hash)
+        , m_key(key)
         , m_img(img)
         , m_format(format)
         , m_type(type)
     {}
-    QGCCacheTile(const QString &hash, quint64 tileSet)
+    QGCCacheTile(quint64 key, quint64 tileSet)
         : m_tileSet(tileSet)
-        , m_hash(hash)
+        , m_key(key)
     {}
     ~QGCCacheTile() = default;
 
     quint64 tileSet() const { return m_tileSet; }
-    const QString &hash() const { return m_hash; }
+    quint64 key() const { return m_key; }
     const QByteArray &img() const { return m_img; }
     const QString &format() const { return m_format; }
     const QString &type() const { return m_type; }
 
 private:
     const quint64 m_tileSet = 0;
-    const QString m_hash;
+    const quint64 m_key = 0;
     const QByteArray m_img;
     const QString m_format;
     const QString m_type;
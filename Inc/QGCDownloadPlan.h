@@ -0,0 +1,90 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QPoint>
+#include <QtCore/QSet>
+
+#include <functional>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCDownloadPlanLog)
+
+class QGCSqlStatementCache;
+class QSqlDatabase;
+
+/**
+ * @brief 按瓦片范围保存的离线下载计划
+ * 每个瓦片集按缩放级别保存矩形范围（DownloadRanges），完成情况保存在按页划分的位图中
+ * （DownloadPages，每页 kPageBits 位，全零的页不保存）。
+ * 范围内的瓦片按 x 再按 y 编号，cursor 之前的瓦片已发出下载；恢复下载时 cursor 归零，
+ * 重新扫描位图，之前出错的瓦片随之重试。
+ * 创建、删除、恢复与统计剩余瓦片只涉及范围行，与瓦片数无关。
+ */
+class QGCDownloadPlan
+{
+public:
+    explicit QGCDownloadPlan(QGCSqlStatementCache &statements);
+
+    /// 加入一个矩形范围（包含边界）。pending 非空时只有其中的瓦片待下载，其余视为已完成
+    bool addRange(quint64 setID, quint32 provider, int z, int x0, int y0, int x1, int y1,
+                  const QList<QPoint> &pending = {});
+
+    /// 按顺序取出至多 count 个待下载的瓦片键，少于 count 表示计划已全部发出。
+    /// 扫描到的已缓存瓦片直接加入 SetTiles 并标记完成；每扫描一块调用一次 yield
+    bool next(quint64 setID, int count, QList<quint64> &keys,
+              const std::function<void()> &yield = {});
+    /// 标记瓦片下载完成；每个范围的页与剩余数各写一次，调用者负责事务
+    bool complete(quint64 setID, const QList<quint64> &keys);
+    /// 从头重新扫描未完成的瓦片
+    bool rewind(quint64 setID);
+    bool remove(quint64 setID);
+    /// 尚未完成的瓦片数
+    qint64 remaining(quint64 setID);
+
+    static constexpr qint64 kPageBits = 32768;
+    static constexpr qsizetype kScanChunk = 16384;
+
+private:
+    struct Range {
+        qint64 rangeID = 0;
+        quint32 provider = 0;
+        int z = 0;
+        int x0 = 0;
+        int y0 = 0;
+        int x1 = 0;
+        int y1 = 0;
+        qint64 cursor = 0;
+        qint64 remaining = 0;
+
+        qint64 height() const { return static_cast<qint64>(y1) - y0 + 1; }
+        qint64 size() const { return (static_cast<qint64>(x1) - x0 + 1) * height(); }
+        quint64 key(qint64 index) const;
+        qint64 index(int x, int y) const { return (static_cast<qint64>(x) - x0) * height() + (y - y0); }
+    };
+
+    /// 页缓存：页号 -> 位图，dirty 中的页在块结束时写回
+    struct Pages {
+        QHash<qint64, QByteArray> bits;
+        QList<qint64> dirty;
+    };
+
+    bool _scanChunk(quint64 setID, Range &range, int count, QList<quint64> &keys);
+    bool _test(qint64 rangeID, Pages &pages, qint64 index);
+    bool _set(qint64 rangeID, Pages &pages, qint64 index);
+    bool _storePages(qint64 rangeID, Pages &pages);
+    bool _findCached(quint64 setID, const QList<quint64> &candidates, QSet<quint64> &cached);
+
+    QGCSqlStatementCache &_statements;
+    QSqlDatabase &_db;
+};
@@ -0,0 +1,103 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QDeadlineTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtNetwork/QNetworkReply>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCHostConcurrencyLog)
+
+class QUrl;
+
+/**
+ * @brief 按服务器自适应的并发下载窗口（AIMD）
+ * 每个瓦片服务器维护一个并发窗口：成功且延迟没有明显上升时加性增大（每完成一个窗口的请求加 1），
+ * 收到 429/503 或超时、连接被断开时减半，每个冷却期只减一次；带 Retry-After 时保持最小窗口到期满。
+ * 404 等普通错误只计入错误率，不调整窗口。
+ * HTTP/1.1 下 QNetworkAccessManager 每个主机只开 6 个连接，多出的请求只会在其内部排队，
+ * 因此窗口上限为 6；响应确认使用 HTTP/2 多路复用后才放宽到 kMaxWindow。
+ * 同一服务的分片主机（a/b/c、t0~t7、mt1 等）共用一个窗口。
+ * 每个服务正在进行的下载数也在这里统计，地图调度与离线下载据此共用同一窗口。
+ * 线程安全，下载发出与完成时由 QGCTileDownloads 记录。
+ */
+class QGCHostConcurrency
+{
+public:
+    struct HostStats {
+        QString host;
+        int window = 0;             ///< 当前并发窗口
+        double latencyMs = 0.;      ///< 平均延迟（指数滑动）
+        double minLatencyMs = 0.;   ///< 观察到的最小延迟，作为基线
+        double throughput = 0.;     ///< 平均单请求吞吐（字节/秒）
+        double errorRate = 0.;      ///< 错误率（指数滑动）
+        quint64 completed = 0;
+        quint64 throttled = 0;      ///< 429/503 次数
+        int inFlight = 0;           ///< 正在进行的下载数
+        bool http2 = false;         ///< 最近的响应使用了 HTTP/2
+    };
+
+    static QGCHostConcurrency *instance();
+
+    /// 同一服务的分片主机合并为一个键
+    static QString hostKey(const QUrl &url);
+
+    /// 当前允许的并发下载数
+    int window(const QString &host);
+    /// 窗口中尚未使用的名额（可能为负）
+    int available(const QString &host);
+    /// 下载发出与结束（完成、中止或回复被销毁）各调用一次
+    void acquire(const QString &host);
+    void release(const QString &host);
+    /// 下载完成，statusCode 为 0 表示没有 HTTP 响应；http2 为响应是否使用了 HTTP/2
+    void record(const QString &host, qint64 latencyMs, qint64 bytes, int statusCode,
+                QNetworkReply::NetworkError error, int retryAfterSeconds = 0, bool http2 = false);
+
+    QList<HostStats> stats() const;
+
+private:
+    QGCHostConcurrency() = default;
+
+    struct Host {
+        double window = kInitialWindow;
+        double latencyMs = 0.;
+        double minLatencyMs = 0.;
+        double throughput = 0.;
+        double errorRate = 0.;
+        quint64 completed = 0;
+        quint64 throttled = 0;
+        QDeadlineTimer cooldown = QDeadlineTimer(0);    ///< 减半后的冷却期
+        QDeadlineTimer hold = QDeadlineTimer(0);        ///< Retry-After 期间保持最小窗口
+        int inFlight = 0;
+        bool http2 = false;
+    };
+
+    static int _window(const Host &h);
+    static int _maxWindow(const Host &h) { return h.http2 ? kMaxWindow : kMaxHttp1Window; }
+    static int _clamp(double window, int maxWindow);
+    static bool _isCongestion(int statusCode, QNetworkReply::NetworkError error);
+
+    mutable QMutex _mutex;
+    QHash<QString, Host> _hosts;
+
+    static constexpr double kInitialWindow = 6.;    // 从 HTTP/1.1 的上限开始
+    static constexpr int kMinWindow = 1;
+    static constexpr int kMaxHttp1Window = 6;       // HTTP/1.1 下 QNetworkAccessManager 的每主机连接数
+    static constexpr int kMaxWindow = 24;           // HTTP/2 多路复用时
+    static constexpr double kDecrease = 0.5;
+    static constexpr double kLatencyInflation = 2.; // 延迟超过基线的倍数时停止增大
+    static constexpr double kAlpha = 0.2;           // 指数滑动系数
+    static constexpr int kCooldown = 1000;          // 毫秒
+    static constexpr int kMaxRetryAfter = 60;       // 秒
+};
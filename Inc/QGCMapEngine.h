@@ -22,10 +22,14 @@
 #include <QtCore/QObject>
 #include <QtCore/QLoggingCategory>
 
+#include "QGCTileCacheWorker.h"
+#include "QGCTilePackStore.h"
+
 Q_DECLARE_LOGGING_CATEGORY(QGCMapEngineLog)
 
 class QGCMapTask;
 class QGCCacheWorker;
+class QGCTileLookup;
 
 class QGCMapEngine : public QObject
 {
@@ -35,22 +39,24 @@ public:
     explicit QGCMapEngine(QObject *parent = nullptr);
     ~QGCMapEngine();
 
-    void init(const QString &databasePath);
+    void init(const QString &databasePath, QGCTileStorage storage = QGCTileStorage::SQLite,
+              QGCCacheIdlePolicy idlePolicy = QGCCacheIdlePolicy::Persistent);
     bool addTask(QGCMapTask *task);
+    /// 高频的瓦片查询与保存不创建 QGCMapTask
+    bool addLookup(QGCTileLookup *lookup);
+    bool saveTile(quint64 key, const QByteArray &img, const QString &format, const QString &type, quint64 set);
 
     static QGCMapEngine *instance();
 
 signals:
-    void updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize);
+    void updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize, double dedupratio);
 
 private slots:
-    void _updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize);
-    void _pruned() { m_prunning = false; }
+    void _updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize, double dedupratio);
     void shutdown();
 
 private:
     QGCCacheWorker *m_worker = nullptr;
-    bool m_prunning = false;
 };
 
 extern QGCMapEngine *getQGCMapEngine();
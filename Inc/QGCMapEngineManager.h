@@ -18,6 +18,7 @@
 
 // #include <QtQmlIntegration/QtQmlIntegration>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QPointer>
 
 Q_DECLARE_LOGGING_CATEGORY(QGCMapEngineManagerLog)
 
@@ -45,6 +46,7 @@ class QGCMapEngineManager : public QObject
     Q_PROPERTY(QStringList          elevationProviderList   READ elevationProviderList              CONSTANT)
     Q_PROPERTY(quint64              tileCount       READ tileCount                                  NOTIFY tileCountChanged)
     Q_PROPERTY(quint64              tileSize        READ tileSize                                   NOTIFY tileSizeChanged)
+    Q_PROPERTY(double               dedupRatio      READ dedupRatio                                 NOTIFY dedupRatioChanged)
 
 public:
     QGCMapEngineManager(QObject *parent = nullptr);
@@ -60,6 +62,8 @@ public:
     Q_ENUM(ImportAction)
 
     Q_INVOKABLE bool exportSets(const QString &path = QString());
+    /// 取消进行中的导入或导出，已导入的瓦片保留
+    Q_INVOKABLE void cancelAction();
     Q_INVOKABLE bool findName(const QString &name) const;
     Q_INVOKABLE bool importSets(const QString &path = QString());
     Q_INVOKABLE QString getUniqueName() const;
@@ -85,6 +89,8 @@ public:
     QString tileSizeStr() const;
     quint64 tileCount() const { return (_imageSet.tileCount + _elevationSet.tileCount); }
     quint64 tileSize() const { return (_imageSet.tileSize + _elevationSet.tileSize); }
+    /// 缓存中瓦片总大小与去重后实际存储大小之比
+    double dedupRatio() const { return _dedupRatio; }
 
     void setActionProgress(int percentage) { if (percentage != _actionProgress) { _actionProgress = percentage; emit actionProgressChanged(); } }
     void setErrorMessage(const QString &error) { if (error != _errorMessage) { _errorMessage = error; emit errorMessageChanged(); } }
@@ -96,6 +102,7 @@ public:
 
 signals:
     void actionProgressChanged();
+    void dedupRatioChanged();
     void errorMessageChanged();
     void fetchElevationChanged();
     void freeDiskSpaceChanged();
@@ -116,7 +123,7 @@ private slots:
     void _tileSetDeleted(quint64 setID);
     void _tileSetFetched(QGCCachedTileSet *tileSets);
     void _tileSetSaved(QGCCachedTileSet *set);
-    void _updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize);
+    void _updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize, double dedupratio);
 
 private:
     QmlObjectListModel *_tileSets = nullptr;
@@ -130,8 +137,10 @@ private:
     int _minZoom = 0;
     int _maxZoom = 0;
     int _actionProgress = 0;
+    double _dedupRatio = 1.;
     quint64 _setID = UINT64_MAX;
     QString _errorMessage;
+    QPointer<QGCMapTask> _actionTask;
     bool _fetchElevation = true;
     bool _importReplace = false;
 
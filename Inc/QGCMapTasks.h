@@ -22,6 +22,8 @@
 #include <QtCore/QQueue>
 #include <QtCore/QString>
 
+#include <atomic>
+
 #include "QGCTile.h"
 #include "QGCCacheTile.h"
 #include "QGCCachedTileSet.h"
@@ -56,6 +58,11 @@ public:
 
     TaskType type() const { return m_type; }
 
+    /// 请求取消，可在任意线程调用。导入、导出与创建集合在下一片开始前结束，
+    /// 删除集合与重置开始后不响应
+    void cancel() { m_cancelled = true; }
+    bool isCancelled() const { return m_cancelled; }
+
     void setError(const QString &errorString = QString())
     {
         emit error(m_type, errorString);
@@ -66,6 +73,7 @@ signals:
 
 private:
     const TaskType m_type = TaskType::taskInit;
+    std::atomic_bool m_cancelled = false;
 };
 
 //-----------------------------------------------------------------------------
@@ -131,9 +139,9 @@ class QGCFetchTileTask : public QGCMapTask
     Q_OBJECT
 
 public:
-    explicit QGCFetchTileTask(const QString &hash, QObject *parent = nullptr)
+    explicit QGCFetchTileTask(quint64 key, QObject *parent = nullptr)
         : QGCMapTask(QGCMapTask::taskFetchTile, parent)
-        , m_hash(hash)
+        , m_key(key)
     {}
     ~QGCFetchTileTask() = default;
 
@@ -142,13 +150,13 @@ public:
         emit tileFetched(tile);
     }
 
-    QString hash() const { return m_hash; }
+    quint64 key() const { return m_key; }
 
 signals:
     void tileFetched(QGCCacheTile *tile);
 
 private:
-    const QString m_hash;
+    const quint64 m_key = 0;
 };
 
 //-----------------------------------------------------------------------------
@@ -210,22 +218,25 @@ class QGCUpdateTileDownloadStateTask : public QGCMapTask
     Q_OBJECT
 
 public:
-    QGCUpdateTileDownloadStateTask(quint64 setID, QGCTile::TileState state, const QString &hash, QObject *parent = nullptr)
+    /// key 为 kAllTiles 时更新整个集合
+    static constexpr quint64 kAllTiles = 0;
+
+    QGCUpdateTileDownloadStateTask(quint64 setID, QGCTile::TileState state, quint64 key, QObject *parent = nullptr)
         : QGCMapTask(QGCMapTask::taskUpdateTileDownloadState, parent)
         , m_setID(setID)
         , m_state(state)
-        , m_hash(hash)
+        , m_key(key)
     {}
     ~QGCUpdateTileDownloadStateTask() = default;
 
-    QString hash() const { return m_hash; }
+    quint64 key() const { return m_key; }
     quint64 setID() const { return m_setID; }
     QGCTile::TileState state() const { return m_state; }
 
 private:
     const quint64 m_setID = 0;
     const QGCTile::TileState m_state = QGCTile::StatePending;
-    const QString m_hash;
+    const quint64 m_key = 0;
 };
 
 //-----------------------------------------------------------------------------
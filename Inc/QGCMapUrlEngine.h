@@ -51,11 +51,13 @@ public:
     static QString getProviderTypeFromQtMapId(int qtMapId);
     static std::shared_ptr<const MapProvider> getMapProviderFromQtMapId(int qtMapId);
     static std::shared_ptr<const MapProvider> getMapProviderFromProviderType(QStringView type);
-    static QString providerTypeFromHash(int hash);
 
+    // v1 缓存 schema 的字符串 hash，仅用于迁移和导入旧数据库
+    static QString providerTypeFromHash(int hash);
     static int hashFromProviderType(QStringView type);
-    static QString tileHashToType(QStringView tileHash);
-    static QString getTileHash(QStringView type, int x, int y, int z);
+
+    static QString tileKeyToType(quint64 tileKey);
+    static quint64 getTileKey(const QString &type, int x, int y, int z);
 
 private:
     static const QList<std::shared_ptr<const MapProvider>> _providers;
@@ -0,0 +1,65 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QString>
+
+#include <atomic>
+#include <memory>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCSqlStatementCacheLog)
+
+class QSqlDatabase;
+class QSqlQuery;
+
+/**
+ * @brief 单个连接上已准备语句的缓存
+ * 以 SQL 文本为键，首次使用时准备，之后复用同一个 QSqlQuery，只重新绑定参数，
+ * SQLite 不再重复解析和生成执行计划。返回的语句为只进游标。
+ * 缓存的语句不会被单独淘汰，SQL 文本中不能拼接参数值；返回的引用在 clear() 或析构前有效。
+ * 必须在连接关闭之前 clear() 或析构。非线程安全，每个连接一个实例。
+ * setEnabled(false) 后每次 prepare() 都重新准备同一个 QSqlQuery，用于对比测试。
+ */
+class QGCSqlStatementCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 prepares = 0;
+        qsizetype size = 0;
+    };
+
+    explicit QGCSqlStatementCache(QSqlDatabase &db);
+    ~QGCSqlStatementCache();
+
+    QSqlDatabase &database() { return _db; }
+
+    /// 返回已准备的语句，并结束它上一次的结果集。准备失败时不缓存，exec() 会返回错误
+    QSqlQuery &prepare(const QString &sql);
+    void clear();
+
+    Stats stats() const;
+
+    /// 进程级开关，对已有实例立即生效
+    static void setEnabled(bool enabled) { _enabled = enabled; }
+    static bool enabled() { return _enabled; }
+
+private:
+    QSqlDatabase &_db;
+    QHash<QString, std::shared_ptr<QSqlQuery>> _statements;
+    QList<std::shared_ptr<QSqlQuery>> _failed;  ///< 准备失败的语句，保留到 clear() 以免引用失效
+    quint64 _hits = 0;
+    quint64 _prepares = 0;
+
+    static std::atomic_bool _enabled;
+};
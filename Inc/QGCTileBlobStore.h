@@ -0,0 +1,60 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QString>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileBlobStoreLog)
+
+class QSqlDatabase;
+class QSqlQuery;
+class QGCSqlStatementCache;
+class QGCTilePackStore;
+
+/**
+ * @brief 按内容去重的瓦片图像存储
+ * 图像保存在 Blobs 表中，以 64 位内容哈希索引，Tiles.blobID 指向对应记录。
+ * 海洋、沙漠、"无数据"等瓦片在各地图源中字节完全相同，只保存一份。
+ * 哈希相同时再逐字节比较，冲突的图像各自保存。
+ * 引用计数由 Tiles 上的触发器维护，删除最后一个引用时图像随之删除。
+ * 给定包文件存储时，新图像追加到包文件，Blobs 只记录位置（pack > 0）。
+ * 语句取自连接的语句缓存，构造开销很小，只在该连接所在线程使用。
+ */
+class QGCTileBlobStore
+{
+public:
+    explicit QGCTileBlobStore(QGCSqlStatementCache &statements, QGCTilePackStore *packs = nullptr);
+
+    /// 返回内容相同的已有图像，或写入新图像，返回 blobID；出错返回 0。
+    /// 新图像的引用计数为 0，由插入 Tiles 的触发器增加
+    qint64 store(const QByteArray &img);
+
+    /// 写入瓦片；瓦片键已存在时不做任何修改并返回 true，inserted 指示是否新增
+    bool insertTile(quint64 key, const QString &format, const QByteArray &img,
+                    qint64 date, bool *inserted = nullptr);
+
+    /// 稳定的 64 位内容哈希（MurmurHash64A），写入数据库，不能随 Qt 版本变化
+    static quint64 contentHash(const QByteArray &img);
+
+    /// 按 Blobs 的 (tile, pack, packOffset, size) 取得图像，包文件中的图像从映射读取
+    static QByteArray image(const QByteArray &tile, qint64 pack, qint64 offset, qint64 size);
+
+private:
+    QGCTilePackStore *_packs = nullptr;
+    QSqlDatabase &_db;
+    QSqlQuery &_findTile;
+    QSqlQuery &_findBlob;
+    QSqlQuery &_insertBlob;
+    QSqlQuery &_insertPacked;
+    QSqlQuery &_insertTile;
+    QSqlQuery &_dropBlob;
+};
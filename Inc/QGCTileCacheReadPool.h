@@ -0,0 +1,116 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QWaitCondition>
+
+#include <atomic>
+
+#include "QGCCacheTaskScheduler.h"
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileCacheReadPoolLog)
+
+class QGCSqlStatementCache;
+class QGCTileLookup;
+class QThread;
+
+/**
+ * @brief 只读连接池
+ * 数据库处于 WAL 模式，读取不会被写事务阻塞。
+ * 每个读线程持有独立的只读 SQLite 连接，专门处理瓦片查询（QGCTileLookup），
+ * 写入与维护任务仍由 QGCCacheWorker 的单一连接串行执行。
+ */
+class QGCTileCacheReadPool
+{
+public:
+    struct Stats {
+        quint64 fetched = 0;        ///< 已完成的瓦片查询数
+        quint64 batches = 0;        ///< 执行的 SQL 查询数
+        quint64 hits = 0;           ///< 命中数
+        qsizetype queueDepth = 0;   ///< 当前排队数
+        qsizetype maxQueueDepth = 0;///< 排队峰值
+        double avgWaitMs = 0.;      ///< 平均排队时间
+        double avgQueryMs = 0.;     ///< 每次 SQL 查询的平均耗时
+        double avgBatchSize = 0.;   ///< 每次 SQL 查询合并的瓦片数
+        quint64 executed = 0;       ///< 实际执行的查询数（含写后缓冲命中，读线程与工作线程合计）
+        quint64 cancelled = 0;      ///< 回复已中止、未执行即跳过的查询数
+        quint64 used = 0;           ///< 结果被仍然存活的回复使用的查询数
+    };
+
+    QGCTileCacheReadPool();
+    ~QGCTileCacheReadPool();
+
+    void setDatabaseFile(const QString &path) { _databasePath = path; }
+    void setReaderCount(int count);
+    int readerCount() const { return _readerCount; }
+    /// 每次查询最多合并的瓦片数，1 表示逐个查询
+    void setBatchSize(int size) { _batchSize = qBound(1, size, kMaxBatchSize); }
+    int batchSize() const { return _batchSize; }
+
+    bool enqueue(QGCTileLookup *lookup);
+    /// 数据库文件被替换或重建后调用，读线程会在下一次查询前重新打开连接
+    void invalidate() { _generation++; }
+    /// 阻塞到所有读线程释放连接；之后的查询由调用者自行处理，直到 reopen()
+    void close();
+    /// 结束 close()，读线程在下一次查询前重新打开连接
+    void reopen();
+    void stop();
+
+    Stats stats() const;
+
+    /// 在给定连接上用一条 IN (...) 查询读取多个瓦片并逐个完成查询，返回命中数。
+    /// 工作线程与读线程共用
+    /// 已取消的查询直接跳过，不执行也不回调
+    static int readTiles(QGCSqlStatementCache &statements, const QList<QGCTileLookup*> &lookups);
+    /// 回复收到查询结果时调用，用于统计查询的有效比例
+    static void recordUsed();
+
+private:
+    class Reader;
+    friend class Reader;
+
+    struct Entry {
+        QGCTileLookup *lookup = nullptr;
+        qint64 enqueuedNs = 0;
+    };
+
+    /// connected 为调用的读线程是否持有连接；关闭期间返回空列表，要求其释放连接
+    bool _take(QList<Entry> &entries, bool connected);
+    void _record(qsizetype count, qint64 waitNs, qint64 queryNs, int hits);
+
+    QString _databasePath;
+    int _readerCount = 2;
+    std::atomic_int _batchSize = kDefaultBatchSize;
+    QList<Reader*> _readers;
+    mutable QMutex _queueMutex;
+    QGCFetchTaskLane _queue;
+    QWaitCondition _waitc;
+    QWaitCondition _parkedc;
+    qsizetype _parked = 0;          ///< 没有连接、正在等待的读线程数
+    qsizetype _maxQueueDepth = 0;
+
+    std::atomic_int _generation = 0;
+    std::atomic_bool _stop = false;
+    std::atomic_bool _closed = false;
+    std::atomic<quint64> _fetched = 0;
+    std::atomic<quint64> _batches = 0;
+    std::atomic<quint64> _hits = 0;
+    std::atomic<qint64> _totalWaitNs = 0;
+    std::atomic<qint64> _totalQueryNs = 0;
+
+    static constexpr int kMaxReaders = 8;
+    static constexpr int kDefaultBatchSize = 32;
+    static constexpr int kMaxBatchSize = 256;    // 低于 SQLite 默认的绑定参数上限
+    static constexpr quint64 kStatsInterval = 1000;
+};
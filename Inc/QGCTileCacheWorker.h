@@ -18,19 +18,35 @@
 
 #pragma once
 
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
 #include <QtCore/QLoggingCategory>
 #include <QtCore/QList>
 #include <QtCore/QMutex>
 #include <QtCore/QString>
 #include <QtCore/QThread>
+#include <QtCore/QVariant>
 #include <QtCore/QWaitCondition>
 
+#include "QGCCacheTaskScheduler.h"
+#include "QGCTileCacheReadPool.h"
+#include "QGCTilePackStore.h"
+
 Q_DECLARE_LOGGING_CATEGORY(QGCTileCacheWorkerLog)
 
 class QGCMapTask;
 class QGCCachedTileSet;
+class QGCSqlStatementCache;
+class QGCTileLookup;
 class QSqlDatabase;
 
+/// 工作线程空闲时的处理方式，由 QGCMapEngine::init 选择
+enum class QGCCacheIdlePolicy {
+    Persistent, ///< 在等待条件上休眠，保持连接、页缓存与已准备的语句
+    LowPower    ///< 空闲超过超时后写回状态并关闭连接，下一个任务到达时重新打开
+};
+
 class QGCCacheWorker : public QThread
 {
     Q_OBJECT
@@ -39,58 +55,136 @@ public:
     explicit QGCCacheWorker(QObject *parent = nullptr);
     ~QGCCacheWorker();
 
-    void setDatabaseFile(const QString &path) { _databasePath = path; }
+    void setDatabaseFile(const QString &path) { _databasePath = path; _readPool.setDatabaseFile(path); }
+    void setReaderCount(int count) { _readPool.setReaderCount(count); }
+    void setFetchBatchSize(int size) { _readPool.setBatchSize(size); }
+    /// 默认瓦片集独有瓦片的淘汰水位（字节）
+    void setEvictionWatermarks(quint64 high, quint64 low);
+    /// 新图像的存储位置；与现有数据不同时，已有图像在空闲时逐块转换
+    void setStorage(QGCTileStorage storage) { _storage = storage; }
+    /// 线程启动后只在空闲时读取，超时（毫秒）只用于低功耗模式
+    void setIdlePolicy(QGCCacheIdlePolicy policy, int idleTimeout = kIdleTimeout);
+    QGCTileCacheReadPool::Stats readPoolStats() const { return _readPool.stats(); }
+
+    /// 瓦片查询与保存不创建任务对象，可在任意线程调用
+    bool enqueueLookup(QGCTileLookup *lookup);
+    bool saveTile(quint64 key, const QByteArray &img, const QString &format, const QString &type, quint64 set);
 
 public slots:
     bool enqueueTask(QGCMapTask *task);
     void stop();
 
 signals:
-    void updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize);
+    void updateTotals(quint32 totaltiles, quint64 totalsize, quint32 defaulttiles, quint64 defaultsize, double dedupratio);
 
 protected:
     void run() final;
 
 private:
-    void _runTask(QGCMapTask *task);
-
-    void _saveTile(QGCMapTask *task);
-    void _saveTilesBatch(QList<QGCMapTask *> &tasks);
-    void _getTile(QGCMapTask *task);
+    /// 返回 false 表示长任务只完成了一片，需要重新排队
+    bool _runTask(QGCMapTask *task);
+    bool _hasIdleWork();
+    bool _wantsEviction();
+    void _runIdleWork();
+
+    /// 唤醒或启动工作线程
+    void _wake();
+    void _flushWriteBuffer();
+    bool _insertRows(const QString &sql, const QString &row, const QList<QVariantList> &rows);
+    static QString _placeholders(qsizetype count, const QString &item);
+    void _getTiles(const QList<QGCTileLookup*> &lookups);
     void _getTileSets(QGCMapTask *task);
-    void _createTileSet(QGCMapTask *task);
+    bool _createTileSet(QGCMapTask *task);
+    void _yieldToFetches();
     void _getTileDownloadList(QGCMapTask *task);
     void _updateTileDownloadState(QGCMapTask *task);
+    void _updateTileDownloadStates(const QList<QGCMapTask *> &tasks);
     void _pruneCache(QGCMapTask *task);
-    void _deleteTileSet(QGCMapTask *task);
+    bool _deleteTileSet(QGCMapTask *task);
     void _renameTileSet(QGCMapTask *task);
-    void _resetCacheDatabase(QGCMapTask *task);
-    void _importSets(QGCMapTask *task);
-    void _exportSets(QGCMapTask *task);
+    bool _resetCacheDatabase(QGCMapTask *task);
+    bool _importSets(QGCMapTask *task);
+    bool _exportSets(QGCMapTask *task);
     bool _testTask(QGCMapTask *task);
 
     bool _connectDB();
+    static bool _enableWAL(QSqlDatabase &db);
+    /// 删除数据库及其 WAL/共享内存/回滚日志文件（连接须已关闭）
+    void _removeDatabaseFiles();
     void _disconnectDB();
+    /// 写回访问时间与过滤器后关闭连接
+    void _closeDB();
     bool _createDB(QSqlDatabase &db, bool createDefault = true);
+    bool _createSchema(QSqlDatabase &db);
+    bool _migrate(QSqlDatabase &db, int version);
+    bool _migrateToV2(QSqlDatabase &db);
+    bool _migrateToV3(QSqlDatabase &db);
+    bool _migrateToV5(QSqlDatabase &db);
+    /// v6 的数据搬移：图像分块移入 Blobs，每块单独提交，可从中断处继续
+    bool _moveTileImages(QSqlDatabase &db);
+    bool _migrateToV6(QSqlDatabase &db);
+    bool _migrateToV7(QSqlDatabase &db);
+    bool _migrateToV8(QSqlDatabase &db);
+    bool _createStats(QSqlDatabase &db);
+    bool _createBlobs(QSqlDatabase &db);
+    bool _createDownloadPlans(QSqlDatabase &db);
+    bool _rebuildStats(QSqlDatabase &db);
+    static int _schemaVersion(QSqlDatabase &db);
     bool _findTileSetID(const QString &name, quint64 &setID);
     bool _init();
-    quint64 _findTile(const QString &hash);
+    void _openPacks();
+    QGCTilePackStore *_packs() const;
+    void _openKeyFilter();
+    QString _keyFilterPath() const;
     quint64 _getDefaultTileSet();
     void _deleteBingNoTileTiles();
     void _deleteTileSet(quint64 id);
+    /// 删除集合的一片，集合删除完成或失败时返回 true；失败时 ok 为 false，集合保留
+    bool _deleteTileSetSlice(quint64 id, bool &ok);
     void _updateSetTotals(QGCCachedTileSet *set);
     void _updateTotals();
+    static QString _uniqueTileIDs();
+
+    struct SetStats {
+        quint32 count = 0;
+        quint64 size = 0;
+        quint32 uniqueCount = 0;
+        quint64 uniqueSize = 0;
+    };
+    /// 读取 CacheStats 中的一行，setID 0 为整个缓存，kBlobStatsID 为去重后的图像存储
+    bool _getSetStats(qint64 setID, SetStats &stats);
+
+    struct Job;
+    struct CreateJob;
+    struct ImportJob;
+    struct ExportJob;
+    /// 取得任务的进度，第一片时创建
+    template <typename T>
+    T &_job(const QGCMapTask *task);
+    void _endJob(const QGCMapTask *task);
+    /// 数据库被重置或替换后，其他进行中的长任务在下一片结束
+    void _abortJobs(const QGCMapTask *except);
+    static bool _sliceExpired(const QElapsedTimer &slice, int rows);
 
     std::shared_ptr<QSqlDatabase> _db = nullptr;
+    std::unique_ptr<QGCSqlStatementCache> _statements;
     QMutex _taskQueueMutex;
-    QList<QGCMapTask*> _taskQueue;  // 改为 QList 以支持 LIFO 和 FIFO
+    QGCCacheTaskScheduler _taskQueue;
+    QHash<const QGCMapTask*, std::shared_ptr<Job>> _jobs;
     QWaitCondition _waitc;
     QString _databasePath;
+    QGCTileCacheReadPool _readPool;
     quint32 _defaultCount = 0;
     quint32 _totalCount = 0;
     quint64 _defaultSet = UINT64_MAX;
     quint64 _defaultSize = 0;
     quint64 _totalSize = 0;
+    quint64 _evictStalledSize = 0;
+    QGCTileStorage _storage = QGCTileStorage::SQLite;
+    std::atomic<QGCCacheIdlePolicy> _idlePolicy = QGCCacheIdlePolicy::Persistent;
+    std::atomic_int _idleTimeout = kIdleTimeout;
+    bool _convertPending = false;
+    bool _compactPending = false;
     QElapsedTimer _updateTimer;
     int _updateTimeout = kShortTimeout;
     std::atomic_bool _failed = false;
@@ -99,6 +193,22 @@ private:
 
     static constexpr const char *kSession = "QGeoTileWorkerSession";
     static constexpr const char *kExportSession = "QGeoTileExportSession";
+    static constexpr const char *kPackDirectory = "TilePacks";
+    static constexpr const char *kKeyFilterSuffix = ".keys";
+    // PRAGMA user_version: 1 = 字符串 hash, 2 = 整数瓦片键, 3 = SetTiles/TilesDownload 索引,
+    // 4 = CacheStats 统计表, 5 = Tiles.access 访问时间, 6 = Blobs 去重存储, 7 = 包文件存储,
+    // 8 = 按范围保存的下载计划
+    static constexpr int kSchemaVersion = 8;
+    static constexpr int kKeyedSchemaVersion = 2;
+    static constexpr int kBlobSchemaVersion = 6;
+    static constexpr qint64 kBlobStatsID = -1;
+    static constexpr int kMigrationChunk = 1024;
+    static constexpr int kIdleTimeout = 5000;
     static constexpr int kShortTimeout = 2;
     static constexpr int kLongTimeout = 5;
+    static constexpr qsizetype kMaxSaveBatch = 50;   // 每条多行语句的瓦片数
+    static constexpr qsizetype kMaxStateBatch = 512;
+    // 长任务每片最多处理的行数与时间（毫秒）
+    static constexpr int kSliceRows = 500;
+    static constexpr int kSliceTime = 20;
 };
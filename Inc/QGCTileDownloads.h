@@ -0,0 +1,78 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtNetwork/QNetworkRequest>
+
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileDownloadsLog)
+
+class QGCTileDownloadFlight;
+class QGCTileNetworkScheduler;
+class QGeoTileSpec;
+class QNetworkAccessManager;
+class QNetworkReply;
+
+/**
+ * @brief 进程级的瓦片下载合并
+ * 地图回复、多图层回复、离线下载以及另一个地图控件的引擎可能同时下载同一瓦片。
+ * 正在下载的瓦片登记在表中，之后的请求者不再发出网络请求，而是得到一个跟随同一次下载的回复，
+ * 完成时所有请求者读到同一个 QByteArray。瓦片 URL 由提供者与 x/y/z 唯一确定
+ * （服务器编号同样由 x/y 决定），因此以 URL 为键。
+ * 只合并同一线程内的请求：其他线程的请求者直接由自己的 QNetworkAccessManager 下载，
+ * 不参与合并，也不计入 QGCHostConcurrency 的统计。全部请求者放弃后底层请求被中止；
+ * 发起下载的 QNetworkAccessManager 被销毁时，其他引擎的请求者改用自己的重新下载。
+ * 地图瓦片的下载先交给 QGCTileNetworkScheduler 排队，获得名额后才发出。
+ */
+class QGCTileDownloads
+{
+public:
+    struct Stats {
+        quint64 started = 0;    ///< 实际发出的网络请求数
+        quint64 coalesced = 0;  ///< 合并到进行中下载的请求数
+        quint64 savedBytes = 0; ///< 合并省下的下载字节数
+        qsizetype inFlight = 0; ///< 进行中（含排队中）的下载数
+    };
+
+    static QGCTileDownloads *instance();
+
+    /// 替代 QNetworkAccessManager::get。返回的回复只属于调用者，由调用者释放，
+    /// 其 request() 为调用者传入的请求。同一 URL 正在其他线程下载时返回 manager->get() 的回复
+    QNetworkReply *get(QNetworkAccessManager *manager, const QNetworkRequest &request);
+    /// 同上，新的下载由 scheduler 按瓦片位置排队；离开预取范围时回复以 OperationCanceledError 结束
+    QNetworkReply *get(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                       QGCTileNetworkScheduler *scheduler, const QGeoTileSpec &spec);
+
+    Stats stats() const;
+
+private:
+    friend class QGCTileDownloadFlight;
+
+    QGCTileDownloads() = default;
+
+    QNetworkReply *_get(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                        QGCTileNetworkScheduler *scheduler, const QGeoTileSpec *spec);
+
+    void _remove(const QString &url, const QGCTileDownloadFlight *flight);
+    void _recordFinished(qsizetype requesters, qsizetype bytes);
+
+    mutable QMutex _mutex;
+    QHash<QString, QGCTileDownloadFlight*> _flights;
+    std::atomic<quint64> _started = 0;
+    std::atomic<quint64> _coalesced = 0;
+    std::atomic<quint64> _savedBytes = 0;
+
+    static constexpr quint64 kStatsInterval = 100;
+};
@@ -0,0 +1,98 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileHedgingLog)
+
+/**
+ * @brief 缓存查询与网络请求的对冲策略
+ * 磁盘繁忙时缓存查询可能比网络下载还慢。开启后，缓存查询超过期限仍未返回的瓦片
+ * 同时发出网络请求，先到的结果生效。期限取缓存查询 p99 与网络下载 p50 中较小者
+ * （不低于下限），随两条路径的延迟自动调整；额外请求受预算限制：
+ * 每次缓存查询积累 budget 个令牌，每次对冲消耗一个。
+ * 线程安全。
+ */
+class QGCTileHedging
+{
+public:
+    struct Stats {
+        quint64 hedged = 0;         ///< 发出的对冲请求数
+        quint64 networkWon = 0;     ///< 网络先于缓存返回
+        quint64 cacheWon = 0;       ///< 缓存先返回，对冲请求被放弃
+        quint64 denied = 0;         ///< 超出预算未发出
+        qint64 cacheP50 = 0;        ///< 缓存查询延迟（毫秒）
+        qint64 cacheP99 = 0;
+        qint64 networkP50 = 0;      ///< 网络下载延迟（毫秒）
+        qint64 networkP99 = 0;
+        int deadline = 0;           ///< 当前对冲期限（毫秒）
+    };
+
+    static QGCTileHedging *instance();
+
+    /// delay 为初始期限（毫秒），budget 为额外请求占缓存查询的比例上限
+    void configure(bool enabled, int delay, double budget);
+    bool enabled() const { return _enabled; }
+
+    /// 缓存查询进入工作线程时调用，返回对冲期限（毫秒）
+    int beginLookup();
+    /// 期限已到，预算允许时返回 true 并计入一次对冲
+    bool tryHedge();
+
+    /// 缓存查询返回时的延迟；网络先返回而放弃的查询记录放弃时已用的时间（下限）
+    void recordCache(qint64 latencyMs);
+    void recordNetwork(qint64 latencyMs);
+    void recordNetworkWon() { _networkWon++; }
+    void recordCacheWon() { _cacheWon++; }
+
+    Stats stats() const;
+
+private:
+    QGCTileHedging() = default;
+
+    struct Samples {
+        QList<qint64> values;
+        qsizetype next = 0;
+
+        void add(qint64 value);
+        qint64 percentile(double p) const;
+    };
+
+    void _tune();
+
+    std::atomic_bool _enabled = false;
+
+    mutable QMutex _mutex;
+    Samples _cache;
+    Samples _network;
+    quint64 _cacheSamples = 0;
+    int _delay = kDefaultDelay;
+    int _deadline = kDefaultDelay;
+    double _budget = kDefaultBudget;
+    double _tokens = kMaxTokens;
+
+    std::atomic<quint64> _hedged = 0;
+    std::atomic<quint64> _networkWon = 0;
+    std::atomic<quint64> _cacheWon = 0;
+    std::atomic<quint64> _denied = 0;
+
+    static constexpr int kDefaultDelay = 100;       // 毫秒
+    static constexpr int kMinDeadline = 20;         // 毫秒
+    static constexpr int kMaxDeadline = 2000;       // 毫秒
+    static constexpr double kDefaultBudget = 0.05;
+    static constexpr double kMaxTokens = 10.;       // 允许的突发对冲数
+    static constexpr qsizetype kMaxSamples = 256;
+    static constexpr quint64 kTuneInterval = 32;    // 每多少个缓存样本重新计算期限
+};
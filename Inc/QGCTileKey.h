@@ -0,0 +1,111 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QString>
+#include <QtCore/QStringView>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileKeyLog)
+
+class QSqlDatabase;
+
+/**
+ * @brief 瓦片键
+ * 将 (provider, z, x, y) 打包为 64 位整数，直接作为 Tiles 表的主键。
+ * 布局: provider(15 位) | z(6 位) | x(21 位) | y(21 位)，最高位保持为 0，
+ * 因此在 SQLite 的有符号 INTEGER 中始终为正数。0 表示无效键。
+ */
+class QGCTileKey
+{
+public:
+    static constexpr int kCoordBits = 21;
+    static constexpr int kZoomBits = 6;
+    static constexpr int kProviderBits = 15;
+
+    static constexpr int kXShift = kCoordBits;
+    static constexpr int kZoomShift = kCoordBits * 2;
+    static constexpr int kProviderShift = kZoomShift + kZoomBits;
+
+    static constexpr quint64 kCoordMask = (Q_UINT64_C(1) << kCoordBits) - 1;
+    static constexpr quint64 kZoomMask = (Q_UINT64_C(1) << kZoomBits) - 1;
+    static constexpr quint64 kProviderMask = (Q_UINT64_C(1) << kProviderBits) - 1;
+
+    static constexpr quint64 kInvalid = 0;
+
+    static constexpr quint64 make(quint32 provider, int x, int y, int z)
+    {
+        if ((provider == 0) || (provider > kProviderMask) ||
+            (x < 0) || (static_cast<quint64>(x) > kCoordMask) ||
+            (y < 0) || (static_cast<quint64>(y) > kCoordMask) ||
+            (z < 0) || (static_cast<quint64>(z) > kZoomMask)) {
+            return kInvalid;
+        }
+
+        return (static_cast<quint64>(provider) << kProviderShift) |
+               (static_cast<quint64>(z) << kZoomShift) |
+               (static_cast<quint64>(x) << kXShift) |
+               static_cast<quint64>(y);
+    }
+
+    static constexpr bool isValid(quint64 key) { return provider(key) != 0; }
+    static constexpr quint32 provider(quint64 key) { return static_cast<quint32>((key >> kProviderShift) & kProviderMask); }
+    static constexpr int z(quint64 key) { return static_cast<int>((key >> kZoomShift) & kZoomMask); }
+    static constexpr int x(quint64 key) { return static_cast<int>((key >> kXShift) & kCoordMask); }
+    static constexpr int y(quint64 key) { return static_cast<int>(key & kCoordMask); }
+
+    /// 替换键中的 provider id（导入其他数据库时重新映射）
+    static constexpr quint64 withProvider(quint64 key, quint32 provider)
+    {
+        return make(provider, x(key), y(key), z(key));
+    }
+};
+
+/**
+ * @brief 地图类型名称与瓦片键中 provider id 的映射
+ * 持久化在 Providers 表中，保证同一缓存数据库内 id 稳定（MapProvider::getMapId()
+ * 按注册顺序分配，版本间不稳定，不能写入数据库）。
+ * 由缓存工作线程加载；加载前 id() 返回 0，相应瓦片既不读也不写缓存。
+ * 多图层合成瓦片以 compositeName() 作为名称登记。
+ */
+class QGCProviderRegistry
+{
+public:
+    static QGCProviderRegistry *instance();
+
+    /// 读取 Providers 表并登记所有已知地图类型
+    bool load(QSqlDatabase &db);
+    /// 写入运行时新登记的名称（合成瓦片），保存瓦片前调用
+    bool persist(QSqlDatabase &db);
+    /// 将全部映射写入另一个数据库（导出）
+    bool save(QSqlDatabase &db) const;
+    void clear();
+
+    /// 返回名称对应的 id，未登记时分配新 id
+    quint32 id(const QString &name);
+    QString name(quint32 id) const;
+
+    static QString compositeName(const QString &layerStackKey);
+    /// 将 v1 schema 的字符串 hash 转换为瓦片键，无法识别时返回 QGCTileKey::kInvalid
+    quint64 keyFromLegacyHash(QStringView hash);
+
+private:
+    QGCProviderRegistry() = default;
+
+    mutable QReadWriteLock _lock;
+    QHash<QString, quint32> _ids;
+    QHash<quint32, QString> _names;
+    QList<quint32> _pending;
+    quint32 _next = 1;
+    bool _loaded = false;
+};
@@ -0,0 +1,84 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QString>
+
+#include <atomic>
+#include <memory>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileKeyFilterLog)
+
+class QSqlDatabase;
+
+/**
+ * @brief 缓存中瓦片键的 Bloom 过滤器
+ * mayContain() 返回 false 时瓦片一定不在数据库中，回复对象不经过工作线程直接请求网络。
+ * 保存瓦片时加入；删除不清除位（只增加误判），插入数超过容量时在空闲时重建。
+ * 工作线程退出时写入数据库旁的文件，下次启动时若瓦片数一致则直接载入；
+ * 载入后立即删除该文件，进程异常退出时下次启动重新扫描 Tiles。
+ * 未就绪时 mayContain() 总是返回 true。插入与重建只在工作线程执行，查询可在任意线程。
+ */
+class QGCTileKeyFilter
+{
+public:
+    struct Stats {
+        quint64 lookups = 0;
+        quint64 skipped = 0;    ///< 确定未缓存、跳过工作线程的查询
+        quint64 keys = 0;
+        quint64 bits = 0;
+    };
+
+    static QGCTileKeyFilter *instance();
+
+    bool isReady() const { return _ready; }
+    bool mayContain(quint64 key) const;
+    void insert(quint64 key);
+    /// 清空并保持就绪（缓存被重置）
+    void clear();
+    /// 标记为未就绪（数据库被替换），之后需要 load() 或 rebuild()
+    void invalidate();
+    /// 插入数超过容量，误判率明显上升
+    bool isFull() const { return _ready && (_keys > (_bits / kBitsPerKey)); }
+
+    /// 读取持久化的过滤器，tiles 与保存时的瓦片数不一致时放弃，成功与否都删除文件
+    bool load(const QString &path, quint64 tiles);
+    /// 保存到文件，tiles 为当前瓦片数
+    bool save(const QString &path, quint64 tiles) const;
+    /// 扫描 Tiles 重建，tiles 为当前瓦片数，用于确定大小（工作线程）
+    bool rebuild(QSqlDatabase &db, quint64 tiles);
+
+    Stats stats() const;
+
+    static constexpr quint64 kBitsPerKey = 10;
+    static constexpr int kHashes = 7;
+    static constexpr quint64 kMinBits = Q_UINT64_C(1) << 20;
+
+private:
+    QGCTileKeyFilter() = default;
+
+    using Words = std::unique_ptr<std::atomic<quint64>[]>;
+
+    static Words _allocate(quint64 bits);
+    static quint64 _bitsFor(quint64 keys);
+    static void _set(std::atomic<quint64> *words, quint64 mask, quint64 key);
+    void _install(Words words, quint64 bits, quint64 keys);
+
+    mutable QReadWriteLock _lock;
+    Words _words;
+    quint64 _bits = 0;
+    std::atomic<quint64> _keys = 0;
+    std::atomic_bool _ready = false;
+
+    mutable std::atomic<quint64> _lookups = 0;
+    mutable std::atomic<quint64> _skipped = 0;
+};
@@ -0,0 +1,80 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QObject>
+#include <QtCore/QPointer>
+#include <QtCore/QString>
+
+#include <atomic>
+#include <functional>
+
+class QGCCacheTile;
+class QGCFetchTileTask;
+
+/**
+ * @brief 轻量瓦片查询
+ * 每个可见瓦片一次的缓存查询不构造 QObject、不建立信号连接、也不经过 deleteLater：
+ * 查询对象从对象池取得，读线程或工作线程完成后按发起线程收集结果，
+ * 每批只向发起线程投递一个事件，在发起线程依次调用完成回调，然后归还对象池。
+ * 调用 cancel() 或 context 销毁后不再回调，排队中的查询直接跳过。
+ */
+class QGCTileLookup
+{
+public:
+    /// tile 为 nullptr 表示未命中，errorString 给出原因；tile 由回调负责释放
+    using Callback = std::function<void(QGCCacheTile *tile, const QString &errorString)>;
+
+    struct Stats {
+        quint64 created = 0;    ///< 创建的查询数
+        quint64 reused = 0;     ///< 其中从对象池复用的数量
+        quint64 batches = 0;    ///< 投递到发起线程的事件数
+    };
+
+    /// 在 context 所在线程调用，回调在该线程执行。
+    /// 回调之前（或取消之前）返回的指针一直有效，回调之后不得再访问
+    static QGCTileLookup *create(quint64 key, QObject *context, Callback callback);
+    /// QGCFetchTileTask 的适配：结果转为任务的信号，随后释放任务
+    static QGCTileLookup *create(QGCFetchTileTask *task);
+
+    quint64 key() const { return _key; }
+
+    /// 发起线程调用，调用后不得再访问对象；查询线程只读取标志
+    void cancel() { _cancelled = true; }
+    bool isCancelled() const { return _cancelled; }
+
+    /// 以下由完成查询的线程调用，每个查询只调用其中一个，调用后不得再访问对象
+    void setTileFetched(QGCCacheTile *tile);
+    void setError(const QString &errorString = QString());
+    /// 已取消的查询不执行，直接归还
+    void discard();
+
+    static Stats stats();
+
+private:
+    class Dispatcher;
+
+    QGCTileLookup() = default;
+
+    static QGCTileLookup *_acquire();
+    static void _release(QGCTileLookup *lookup);
+    void _finish(QGCCacheTile *tile, const QString &errorString);
+
+    quint64 _key = 0;
+    std::atomic_bool _cancelled = false;
+    QPointer<QObject> _context;
+    Callback _callback;
+    QGCCacheTile *_tile = nullptr;
+    QString _errorString;
+    Dispatcher *_dispatcher = nullptr;
+    QGCTileLookup *_next = nullptr;     ///< 对象池空闲链表
+
+    static constexpr int kMaxPooled = 1024;
+};
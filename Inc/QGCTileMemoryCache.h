@@ -0,0 +1,86 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <array>
+#include <atomic>
+#include <list>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileMemoryCacheLog)
+
+class QGCCacheTile;
+
+/**
+ * @brief 已编码瓦片的进程内 LRU 缓存
+ * 位于 QGeoFileTileCacheQGC 与缓存工作线程之间，按字节预算淘汰。
+ * 按瓦片键分片加锁，GUI 线程与读线程可同时访问不同分片。
+ */
+class QGCTileMemoryCache
+{
+public:
+    struct Stats {
+        quint64 hits = 0;
+        quint64 misses = 0;
+        quint64 evictions = 0;
+        quint64 bytes = 0;
+        quint64 budget = 0;
+        qsizetype count = 0;
+    };
+
+    static QGCTileMemoryCache *instance();
+
+    void setBudget(quint64 bytes);
+    quint64 budget() const { return _budget; }
+
+    void insert(quint64 key, const QByteArray &img, const QString &format, const QString &type);
+    /// 命中时返回新分配的瓦片（调用者负责释放），未命中返回 nullptr
+    QGCCacheTile *lookup(quint64 key);
+    void clear();
+
+    Stats stats() const;
+
+private:
+    QGCTileMemoryCache() = default;
+
+    static constexpr size_t kShardCount = 16;
+    static constexpr quint64 kEntryOverhead = 128;
+    static constexpr quint64 kDefaultBudget = 32 * 1024 * 1024;
+
+    struct Entry {
+        quint64 key = 0;
+        QByteArray img;
+        QString format;
+        QString type;
+    };
+
+    struct Shard {
+        mutable QMutex mutex;
+        std::list<Entry> lru;   // 头部为最近使用
+        QHash<quint64, std::list<Entry>::iterator> index;
+        quint64 bytes = 0;
+    };
+
+    Shard &_shard(quint64 key) { return _shards[qHash(key) % kShardCount]; }
+    void _evict(Shard &shard, quint64 limit);
+
+    static quint64 _cost(const Entry &entry) { return static_cast<quint64>(entry.img.size()) + kEntryOverhead; }
+
+    std::array<Shard, kShardCount> _shards;
+    std::atomic<quint64> _budget = kDefaultBudget;
+    std::atomic<quint64> _hits = 0;
+    std::atomic<quint64> _misses = 0;
+    std::atomic<quint64> _evictions = 0;
+};
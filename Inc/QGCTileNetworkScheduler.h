@@ -0,0 +1,108 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMap>
+#include <QtCore/QObject>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QTimer>
+#include <QtLocation/private/qgeotilespec_p.h>
+
+#include <atomic>
+#include <functional>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileNetworkSchedulerLog)
+
+class QNetworkReply;
+
+/**
+ * @brief 地图瓦片的网络调度
+ * 位于瓦片回复与 QNetworkAccessManager 之间：下载先在这里排队，每个服务器只放行
+ * QGCHostConcurrency 给出的并发数（与离线下载、其他引擎共用），其余按到当前视口中心的距离和缩放级别差排序，
+ * 屏幕中央、当前缩放级别的瓦片最先发出。视口变化后已离开预取范围的瓦片在发出前丢弃。
+ * 视口来自地图的可见瓦片；同一引擎的多个地图共用最后更新的视口。只在所属线程使用。
+ */
+class QGCTileNetworkScheduler : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Stats {
+        quint64 dispatched = 0;     ///< 已发出的下载数
+        quint64 dropped = 0;        ///< 离开预取范围而丢弃的下载数
+        quint64 cancelled = 0;      ///< 发出前被请求者取消的下载数
+        qsizetype pending = 0;
+        qsizetype running = 0;
+    };
+
+    /// 获得名额时调用，返回实际发出的回复（nullptr 表示没有发出）
+    using Start = std::function<QNetworkReply*()>;
+    /// 离开预取范围时调用
+    using Drop = std::function<void()>;
+
+    explicit QGCTileNetworkScheduler(QObject *parent = nullptr);
+    ~QGCTileNetworkScheduler();
+
+    /// 排队一个下载，返回值用于 cancel()
+    quint64 submit(const QGeoTileSpec &spec, const QString &host, Start start, Drop drop);
+    /// 请求者放弃尚未发出的下载，不再回调
+    void cancel(quint64 ticket);
+
+    /// 地图当前可见的瓦片
+    void setViewport(const QSet<QGeoTileSpec> &visibleTiles);
+
+    Stats stats() const;
+
+private:
+    struct Request {
+        int x = 0;
+        int y = 0;
+        int zoom = 0;
+        QString host;
+        Start start;
+        Drop drop;
+        quint64 generation = 0;     ///< 排队时的视口版本
+    };
+
+    void _schedule();
+    void _dispatch();
+    void _release(QNetworkReply *reply);
+    /// 到视口中心的距离，以半个视口为单位（1 表示屏幕边缘）
+    double _distance(const Request &request) const;
+    double _score(const Request &request) const;
+    bool _isStale(const Request &request) const;
+    void _logStats() const;
+
+    QMap<quint64, Request> _pending;    ///< 按排队顺序，分数相同时先到先发
+    QSet<QNetworkReply*> _running;
+    quint64 _nextTicket = 1;
+    bool _dispatchQueued = false;
+    QTimer _retryTimer;             ///< 窗口被其他请求者占满时稍后重试
+
+    bool _hasViewport = false;
+    quint64 _generation = 0;
+    int _zoom = 0;
+    double _centerX = 0.;
+    double _centerY = 0.;
+    double _halfWidth = 1.;
+    double _halfHeight = 1.;
+
+    std::atomic<quint64> _dispatched = 0;
+    std::atomic<quint64> _dropped = 0;
+    std::atomic<quint64> _cancelled = 0;
+
+    static constexpr double kZoomPenalty = 1.;      // 相邻缩放级别按远一个半屏计
+    static constexpr double kStaleDistance = 2.;    // 超出屏幕边缘半个屏幕视为离开预取范围
+    static constexpr int kStaleZoom = 1;            // 预取相邻的两个缩放级别
+    static constexpr int kRetryInterval = 100;      // 毫秒
+    static constexpr quint64 kStatsInterval = 500;
+};
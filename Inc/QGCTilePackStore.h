@@ -0,0 +1,127 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTilePackStoreLog)
+
+class QFile;
+class QSqlDatabase;
+
+/// 瓦片图像的存储位置，由 QGCMapEngine::init 选择
+enum class QGCTileStorage {
+    SQLite,     ///< 图像内嵌在 Blobs.tile
+    Pack        ///< 图像追加到包文件，Blobs 只保存 (pack, packOffset, size)
+};
+
+/**
+ * @brief 只追加的瓦片包文件
+ * 图像按顺序追加，包文件每次扩展 kGrowSize，最大 kPackSize，映射随之重建。读取在读锁内从映射复制一次，
+ * 不经过 SQLite 的页缓存与 BLOB 缓冲；返回的数据不引用映射，重建或解除映射只需等待正在进行的读取结束。
+ * 写入位置记录在 Packs 表中，与 Blobs 在同一事务中提交；提交前先用 sync() 把追加的字节写入磁盘，
+ * 断电后数据库不会引用未落盘的图像。事务回滚时追加的字节成为空洞，由压缩回收。
+ * 删除瓦片只减少包内的有效字节，有效比例低于 kCompactRatio 的包由工作线程空闲时搬空后解除映射并删除。
+ * 追加、压缩与转换只在工作线程执行，read() 可在任意线程调用。
+ */
+class QGCTilePackStore
+{
+public:
+    struct Location {
+        qint64 pack = 0;        ///< 0 表示写入失败
+        qint64 offset = 0;
+    };
+
+    struct Stats {
+        quint64 appended = 0;
+        quint64 appendedBytes = 0;
+        quint64 movedBlobs = 0;     ///< 压缩与转换搬运的图像数
+        quint64 retiredPacks = 0;
+    };
+
+    static QGCTilePackStore *instance();
+
+    /// 映射 Packs 表中的包文件，删除目录中不再引用的文件；
+    /// 丢失的包文件中的瓦片从数据库删除（工作线程）
+    bool open(QSqlDatabase &db, const QString &directory);
+    bool isOpen() const { return _open; }
+    /// 删除目录中的全部包文件（数据库被替换）
+    void discard();
+
+    /// 新图像是否写入包文件
+    void setAppendEnabled(bool enabled) { _appendEnabled = enabled; }
+    bool appendEnabled() const { return _open && _appendEnabled; }
+
+    /// 追加图像并记录写入位置，调用者负责事务
+    Location append(QSqlDatabase &db, const QByteArray &img);
+    /// 将上次同步以来追加的字节写入磁盘，在提交引用它们的事务之前调用
+    bool sync();
+    /// 返回图像数据的副本，位置无效时返回空
+    QByteArray read(qint64 pack, qint64 offset, qint64 size) const;
+
+    /// 搬空一个有效比例过低的包，返回搬运或删除的数量，无事可做返回 0，出错返回 -1
+    int compactStep(QSqlDatabase &db);
+    /// 在内嵌与包文件之间转换一块图像，返回转换数量，全部完成返回 0，出错返回 -1
+    int convertStep(QSqlDatabase &db, bool toPacks);
+
+    Stats stats() const;
+
+    static constexpr qint64 kPackSize = 64 * 1024 * 1024;
+    static constexpr qint64 kGrowSize = 4 * 1024 * 1024;
+    /// 更大的图像仍内嵌保存，避免单个图像占去包的大部分空间
+    static constexpr qint64 kMaxPacked = kPackSize / 64;
+    static constexpr double kCompactRatio = 0.5;
+    static constexpr int kChunkBlobs = 256;
+
+private:
+    QGCTilePackStore() = default;
+    ~QGCTilePackStore();
+
+    struct Pack {
+        QFile *file = nullptr;
+        uchar *data = nullptr;
+        qint64 size = 0;        ///< 文件与映射的长度
+    };
+
+    QString _path(qint64 pack) const;
+    bool _map(qint64 pack, bool create);
+    bool _grow(qint64 pack, qint64 bytes);
+    static void _unmap(const Pack &pack);
+    void _closeAll();
+    void _retire(qint64 pack);
+    bool _move(QSqlDatabase &db, qint64 blobID, const QByteArray &img);
+    static bool _fsync(QFile *file);
+
+    mutable QReadWriteLock _lock;
+    QHash<qint64, Pack> _packs;
+
+    // 仅工作线程访问
+    QString _directory;
+    qint64 _active = 0;
+    qint64 _activeBytes = 0;
+    qint64 _lastPack = 0;
+    QSet<qint64> _unsynced;
+
+    std::atomic_bool _open = false;
+    std::atomic_bool _appendEnabled = false;
+
+    std::atomic<quint64> _appended = 0;
+    std::atomic<quint64> _appendedBytes = 0;
+    std::atomic<quint64> _movedBlobs = 0;
+    std::atomic<quint64> _retiredPacks = 0;
+};
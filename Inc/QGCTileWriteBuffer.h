@@ -0,0 +1,106 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#pragma once
+
+#include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+
+#include <atomic>
+
+Q_DECLARE_LOGGING_CATEGORY(QGCTileWriteBufferLog)
+
+class QGCCacheTile;
+
+/**
+ * @brief 瓦片保存的写后缓冲
+ * 待保存的瓦片按瓦片键收集，最早的条目等待超过时间窗口或累计字节超过上限时，
+ * 由缓存工作线程在一个事务内写入。地图、预取与离线下载重复保存的同一瓦片只保留一份图像，
+ * 所属集合合并。写入完成前读取直接从缓冲返回，写入数据库后才移除；
+ * 写入失败的条目留到下一个窗口重试，连续失败 kMaxAttempts 次后放弃。
+ * 线程安全，GUI 线程、读线程与工作线程共用一个实例。
+ */
+class QGCTileWriteBuffer
+{
+public:
+    struct Entry {
+        quint64 key = 0;
+        QByteArray img;
+        QString format;
+        QString type;
+        QList<quint64> sets;    ///< UINT64_MAX 为默认瓦片集
+        quint64 seq = 0;        ///< 每次修改递增，写入期间被修改的条目留到下一次
+        int attempts = 0;       ///< 连续写入失败的次数
+    };
+
+    struct Stats {
+        quint64 saves = 0;      ///< 收到的保存请求数
+        quint64 duplicates = 0; ///< 与缓冲中已有瓦片合并的请求数
+        quint64 flushes = 0;    ///< 写入事务数
+        quint64 flushed = 0;    ///< 写入的瓦片数
+        quint64 failed = 0;     ///< 写入失败的事务数
+        quint64 dropped = 0;    ///< 多次写入失败后放弃的瓦片数
+        quint64 bytes = 0;
+        qsizetype count = 0;
+    };
+
+    static QGCTileWriteBuffer *instance();
+
+    /// 时间窗口（毫秒）与字节上限，窗口为 0 时每个保存请求在下一次调度时写入
+    void setWindow(int ms, quint64 bytes);
+    int window() const { return _windowMs; }
+
+    /// 加入缓冲。返回 true 表示需要唤醒工作线程：窗口内的第一个条目或已达到字节上限
+    bool add(quint64 key, const QByteArray &img, const QString &format, const QString &type, quint64 set);
+    /// 命中时返回新分配的瓦片（调用者负责释放），未命中返回 nullptr
+    QGCCacheTile *lookup(quint64 key) const;
+    bool contains(quint64 key) const;
+
+    bool isEmpty() const;
+    bool isDue() const;
+    /// 距离到期的毫秒数，缓冲为空时返回 -1
+    qint64 remainingTime() const;
+
+    /// 待写入条目的快照，条目保留在缓冲中供读取
+    QList<Entry> pending() const;
+    /// 快照写入后调用，移除期间未被修改的条目
+    void committed(const QList<Entry> &entries);
+    /// 快照写入失败后调用，条目留到下一个窗口重试，超过重试次数的移除
+    void failed(const QList<Entry> &entries);
+    void clear();
+
+    Stats stats() const;
+
+private:
+    QGCTileWriteBuffer() = default;
+
+    static constexpr quint64 kEntryOverhead = 128;
+    static constexpr int kDefaultWindow = 250;
+    static constexpr quint64 kDefaultBytes = 4 * 1024 * 1024;
+    static constexpr int kMaxAttempts = 3;
+
+    mutable QMutex _mutex;
+    QHash<quint64, Entry> _entries;
+    QElapsedTimer _oldest;
+    quint64 _bytes = 0;
+    quint64 _seq = 0;
+    std::atomic_int _windowMs = kDefaultWindow;
+    std::atomic<quint64> _maxBytes = kDefaultBytes;
+    std::atomic<quint64> _saves = 0;
+    std::atomic<quint64> _duplicates = 0;
+    std::atomic<quint64> _flushes = 0;
+    std::atomic<quint64> _flushed = 0;
+    std::atomic<quint64> _failed = 0;
+    std::atomic<quint64> _dropped = 0;
+};
@@ -12,8 +12,13 @@
 #include <QtLocation/private/qgeofiletilecache_p.h>
 #include <QtCore/QLoggingCategory>
 
+#include "QGCTileCacheWorker.h"
+#include "QGCTileLookup.h"
+#include "QGCTilePackStore.h"
+
 Q_DECLARE_LOGGING_CATEGORY(QGeoFileTileCacheQGCLog)
 
+class QGCCacheTile;
 class QGCFetchTileTask;
 
 class QGeoFileTileCacheQGC : public QGeoFileTileCache
@@ -25,9 +30,20 @@ public:
     ~QGeoFileTileCacheQGC();
 
     static quint32 getMaxDiskCacheSetting();
+    /// "mapping.cache.storage"：pack 使用包文件存储图像，其余为 SQLite
+    static QGCTileStorage getStorage(const QVariantMap &parameters);
+    /// "mapping.cache.idle"：lowpower 在空闲时关闭缓存连接，其余为常驻
+    static QGCCacheIdlePolicy getIdlePolicy(const QVariantMap &parameters);
     static void cacheTile(const QString &type, int x, int y, int z, const QByteArray &image, const QString &format, qulonglong set = UINT64_MAX);
-    static void cacheTile(const QString &type, const QString &hash, const QByteArray &image, const QString &format, qulonglong set = UINT64_MAX);
+    static void cacheTile(const QString &type, quint64 key, const QByteArray &image, const QString &format, qulonglong set = UINT64_MAX);
     static QGCFetchTileTask *createFetchTileTask(const QString &type, int x, int y, int z);
+    // 提交轻量查询，回调在调用线程执行；返回的查询可用于取消
+    static QGCTileLookup *fetchTile(const QString &type, int x, int y, int z,
+                                    QObject *context, QGCTileLookup::Callback callback);
+    // 内存 LRU 命中时同步返回瓦片（调用者负责释放），无需创建任务
+    static QGCCacheTile *getCachedTile(const QString &type, int x, int y, int z);
+    // 瓦片键过滤器确定未缓存时返回 false，调用者直接请求网络
+    static bool mayBeCached(const QString &type, int x, int y, int z);
     static QString getDatabaseFilePath() { return _databaseFilePath; }
     static QString getCachePath() { return _cachePath; }
     
@@ -35,6 +51,10 @@ public:
     static void cacheCompositeTile(const QString &layerStackKey, int x, int y, int z, 
                                     const QByteArray &image, const QString &format);
     static QGCFetchTileTask *createFetchCompositeTileTask(const QString &layerStackKey, int x, int y, int z);
+    static QGCTileLookup *fetchCompositeTile(const QString &layerStackKey, int x, int y, int z,
+                                             QObject *context, QGCTileLookup::Callback callback);
+    static QGCCacheTile *getCachedCompositeTile(const QString &layerStackKey, int x, int y, int z);
+    static bool mayBeCachedComposite(const QString &layerStackKey, int x, int y, int z);
 
 private:
     // QString tileSpecToFilename(const QGeoTileSpec &spec, const QString &format, const QString &directory) const final;
@@ -46,8 +66,16 @@ private:
 
     static QString _getCachePath(const QVariantMap &parameters);
     static uint32_t _getMemLimit(const QVariantMap &Parameters);
+    static quint64 _getEncodedMemLimit(const QVariantMap &parameters);
+    static void _setWriteWindow(const QVariantMap &parameters);
+    static quint64 _compositeKey(const QString &layerStackKey, int x, int y, int z);
+    static QGCTileLookup *_fetch(quint64 key, QObject *context, QGCTileLookup::Callback callback);
+    static QGCCacheTile *_lookupMemory(quint64 key);
+    static bool _mayBeCached(quint64 key);
 
     static uint32_t _getDefaultMaxMemLimit() { return (30 * pow(1024, 2)); }
+    static quint64 _getDefaultEncodedMemLimit() { return (32 * pow(1024, 2)); }
+    static quint64 _getDefaultWriteLimit() { return (4 * pow(1024, 2)); }
     static uint32_t _getDefaultMaxDiskCache() { return (60 * pow(1024, 2));}
     static uint32_t _getDefaultExtraTexture() { return (60 * pow(1024, 2)); }
     static uint32_t _getDefaultMinTexture() { return 0; }
@@ -59,4 +87,5 @@ private:
     static bool _cacheWasReset;
 
     static constexpr const char *kCachePathVersion = "300";
+    static constexpr int kMaxWriteWindow = 10000;
 };
@@ -9,15 +9,19 @@
 
 #pragma once
 
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QLoggingCategory>
+#include <QtCore/QPointer>
 #include <QtLocation/private/qgeotiledmapreply_p.h>
 #include <QtNetwork/QNetworkReply>
 #include <QtNetwork/QNetworkRequest>
 
 #include "QGCMapTasks.h"
+#include "QGCTileLookup.h"
 
 Q_DECLARE_LOGGING_CATEGORY(QGeoTiledMapReplyQGCLog)
 
+class QGCTileNetworkScheduler;
 class QNetworkAccessManager;
 class QSslError;
 
@@ -26,9 +30,9 @@ class QGeoTiledMapReplyQGC : public QGeoTiledMapReply
     Q_OBJECT
 
 public:
-    QGeoTiledMapReplyQGC(QNetworkAccessManager *networkManager, const QNetworkRequest &request, const QGeoTileSpec &spec, QObject *parent = nullptr);
+    QGeoTiledMapReplyQGC(QNetworkAccessManager *networkManager, QGCTileNetworkScheduler *networkScheduler, const QNetworkRequest &request, const QGeoTileSpec &spec, QObject *parent = nullptr);
     // 延迟初始化构造函数（用于子类）
-    QGeoTiledMapReplyQGC(QNetworkAccessManager *networkManager, const QGeoTileSpec &spec, QObject *parent = nullptr);
+    QGeoTiledMapReplyQGC(QNetworkAccessManager *networkManager, QGCTileNetworkScheduler *networkScheduler, const QGeoTileSpec &spec, QObject *parent = nullptr);
     ~QGeoTiledMapReplyQGC();
 
     void abort();
@@ -39,6 +43,8 @@ public:
 protected:
     // 允许子类访问
     QNetworkAccessManager *_networkManager = nullptr;
+    // 网络请求按视口排队（为空时直接发出）
+    QPointer<QGCTileNetworkScheduler> _networkScheduler;
     QNetworkRequest _request;
 
     // 辅助方法：创建网络请求（供子类复用）
@@ -46,6 +52,10 @@ protected:
     QNetworkReply* createNetworkRequest(const QNetworkRequest &request, bool connectSignals = true);
     // 辅助方法：处理单个网络回复的验证和解析（供子类复用）
     bool processNetworkReply(QNetworkReply *reply, int mapId, QByteArray &image, QString &format);
+    // 辅助方法：取消尚未完成的缓存查询并清空指针（回复中止或析构时调用）
+    static void cancelCacheLookup(QGCTileLookup *&lookup);
+
+    void timerEvent(QTimerEvent *event) override;
 
 protected slots:
     // 允许子类重写
@@ -57,6 +67,17 @@ protected slots:
 
 private:
     static void _initDataFromResources();
+    // 缓存查询超过期限时同时请求网络
+    void _hedge();
+    // 缓存先返回时放弃对冲的网络请求
+    void _cancelHedge();
+    void _stopHedgeTimer();
+
+    QGCTileLookup *_cacheLookup = nullptr;
+    QElapsedTimer _cacheElapsed;
+    QElapsedTimer _networkElapsed;
+    QPointer<QNetworkReply> _hedgeReply;
+    int _hedgeTimerId = 0;
 
     static QByteArray _bingNoTileImage;
     static QByteArray _badTile;
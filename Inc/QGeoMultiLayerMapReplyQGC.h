@@ -31,7 +31,8 @@ class QGeoMultiLayerMapReplyQGC : public QGeoTiledMapReplyQGC
     Q_OBJECT
 
 public:
-    QGeoMultiLayerMapReplyQGC(QNetworkAccessManager *networkManager, 
+    QGeoMultiLayerMapReplyQGC(QNetworkAccessManager *networkManager,
+                               QGCTileNetworkScheduler *networkScheduler,
                                const QGeoTileSpec &spec,
                                const MapLayerStack &layerStack,
                                int compositeMapId = -1,
@@ -45,8 +46,6 @@ private slots:
     void _networkReplyFinished() override;
     void _networkReplyError(QNetworkReply::NetworkError error) override;
     void _networkReplySslErrors(const QList<QSslError> &errors) override;
-    void _cacheReply(QGCCacheTile *tile) override;
-    void _cacheError(QGCMapTask::TaskType type, QStringView errorString) override;
 
 private:
     void _startFetching();
@@ -55,6 +54,9 @@ private:
     // 辅助方法：为指定图层创建并连接网络请求
     void _createLayerNetworkRequest(int mapId, int x, int y, int zoom);
     void _handleSingleLayerReply(int mapId, const QByteArray &image, const QString &format);
+    void _layerCacheReply(int mapId, QGCCacheTile *tile);
+    void _layerCacheMiss(int mapId);
+    void _cancelCacheLookups();
 
     MapLayerStack _layerStack;
     QList<MapLayer> _visibleLayers;
@@ -64,8 +66,10 @@ private:
     QHash<int, QNetworkReply*> _replies;
     // 存储每个图层的瓦片数据
     QHash<int, TileImageData> _tiles;
-    // 存储每个图层的缓存任务
-    QHash<int, QGCFetchTileTask*> _cacheTasks;
+    // 存储每个图层尚未完成的缓存查询
+    QHash<int, QGCTileLookup*> _cacheLookups;
+    // 合成瓦片的缓存查询
+    QGCTileLookup *_compositeLookup = nullptr;
     
     int _pendingReplies = 0;
     bool _compositing = false;
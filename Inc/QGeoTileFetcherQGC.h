@@ -14,8 +14,11 @@
 #include <QtNetwork/QNetworkRequest>
 #include "QGCMapLayerConfig.h"
 
+#include <atomic>
+
 Q_DECLARE_LOGGING_CATEGORY(QGeoTileFetcherQGCLog)
 
+class QGCTileNetworkScheduler;
 class QGeoTiledMappingManagerEngineQGC;
 class QGeoTiledMapReplyQGC;
 class QGeoMultiLayerMapReplyQGC;
@@ -32,8 +35,14 @@ public:
 
     static QNetworkRequest getNetworkRequest(int mapId, int x, int y, int zoom);
     /* Note: QNetworkAccessManager queues the requests it receives. The number of requests executed in parallel is dependent on the protocol.
-     * Currently, for the HTTP protocol on desktop platforms, 6 requests are executed in parallel for one host/port combination. */
-    static uint32_t concurrentDownloads(const QString &type) { Q_UNUSED(type); return 6; }
+     * The window adapts per host (see QGCHostConcurrency): it starts at 6, grows while latency holds (beyond 6 only over HTTP/2) and halves on 429/503 or timeouts. */
+    static uint32_t concurrentDownloads(const QString &type);
+
+    /// 开启后每个提供者只使用一个主机，请求复用同一连接（Qt 6 默认协商 HTTP/2），并在引擎创建时预连接
+    static void setHttp2Enabled(bool enabled);
+    static bool http2Enabled() { return s_http2; }
+    /// 预先建立到提供者主机的连接（含 TLS 握手），首屏瓦片不再等待握手；只在 setHttp2Enabled(true) 时由引擎调用
+    static void preconnect(QNetworkAccessManager *networkManager, const QList<int> &mapIds);
 
 private:
     QGeoTiledMapReply* getTileImage(const QGeoTileSpec &spec) final;
@@ -45,10 +54,13 @@ private:
     // 多图层支持
     QGeoTiledMapReply* getMultiLayerTileImage(const QGeoTileSpec &spec, const MapLayerStack &layerStack);
     MapLayerStack getLayerStackForMapId(int mapId) const;
+    QGCTileNetworkScheduler *networkScheduler() const;
 
     QNetworkAccessManager *m_networkManager = nullptr;
     QGeoTiledMappingManagerEngineQGC *m_engine = nullptr;
 
+    static std::atomic_bool s_http2;
+
 #if defined Q_OS_MACOS
     static constexpr const char* s_userAgent = "Mozilla/5.0 (Macintosh; Intel Mac OS X 14.5; rv:125.0) Gecko/20100101 Firefox/125.0";
 #elif defined Q_OS_WIN
@@ -25,4 +25,10 @@ public:
     ~QGeoTiledMapQGC();
 
     QGeoMap::Capabilities capabilities() const final;
+
+protected:
+    void evaluateCopyrights(const QSet<QGeoTileSpec> &visibleTiles) final;
+
+private:
+    QGeoTiledMappingManagerEngineQGC *m_engine = nullptr;
 };
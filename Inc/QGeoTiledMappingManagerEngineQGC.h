@@ -16,6 +16,7 @@
 
 Q_DECLARE_LOGGING_CATEGORY(QGeoTiledMappingManagerEngineQGCLog)
 
+class QGCTileNetworkScheduler;
 class QNetworkAccessManager;
 
 class QGeoTiledMappingManagerEngineQGC : public QGeoTiledMappingManagerEngine
@@ -28,6 +29,7 @@ public:
 
     QGeoMap* createMap() final;
     QNetworkAccessManager* networkManager() const { return m_networkManager; }
+    QGCTileNetworkScheduler* networkScheduler() const { return m_networkScheduler; }
 
     // 图层配置管理
     const MapLayerStack& layerStack() const { return m_layerStack; }
@@ -37,8 +39,10 @@ public:
 
 private:
     void parseLayerConfiguration(const QVariantMap &parameters);
+    void parseNetworkConfiguration(const QVariantMap &parameters);
 
     QNetworkAccessManager *m_networkManager = nullptr;
+    QGCTileNetworkScheduler *m_networkScheduler = nullptr;  // 地图瓦片下载按视口排队
     MapLayerStack m_layerStack;  // 全局图层配置
     QHash<int, MapLayerStack> m_mapIdToLayerStack;  // mapId 到图层配置的映射
     int m_compositeMapId = -1;  // 多图层合成瓦片的 mapId
@@ -15,6 +15,7 @@ Q_LOGGING_CATEGORY(MapProviderLog, "qgc.qtlocationplugin.mapprovider")
 
 // QtLocation expects MapIds to start at 1 and be sequential.
 int MapProvider::_mapIdIndex = 1;
+std::atomic_bool MapProvider::_singleHost = false;
 
 MapProvider::MapProvider(const QString &mapName, const QString &referrer,
                          const QString &imageFormat, quint32 averageSize,
@@ -79,6 +80,9 @@ QString MapProvider::_tileXYToQuadKey(int tileX, int tileY,
 }
 
 int MapProvider::_getServerNum(int x, int y, int max) const {
+    if (_singleHost) {
+        return 0;
+    }
     return (x + 2 * y) % max;
 }
 
@@ -0,0 +1,177 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCCacheEvictor.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QList>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+Q_LOGGING_CATEGORY(QGCCacheEvictorLog, "qgc.qtlocationplugin.qgccacheevictor")
+
+QGCCacheEvictor *QGCCacheEvictor::instance() {
+    static QGCCacheEvictor evictor;
+    return &evictor;
+}
+
+void QGCCacheEvictor::touch(quint64 key) {
+    QMutexLocker lock(&_accessMutex);
+    (void)_pending.insert(key);
+}
+
+bool QGCCacheEvictor::hasPendingAccess() const {
+    QMutexLocker lock(&_accessMutex);
+    return !_pending.isEmpty();
+}
+
+qsizetype QGCCacheEvictor::pendingAccess() const {
+    QMutexLocker lock(&_accessMutex);
+    return _pending.size();
+}
+
+void QGCCacheEvictor::clearPendingAccess() {
+    QMutexLocker lock(&_accessMutex);
+    _pending.clear();
+}
+
+bool QGCCacheEvictor::flushAccess(QSqlDatabase &db) {
+    QSet<quint64> keys;
+    {
+        QMutexLocker lock(&_accessMutex);
+        keys.swap(_pending);
+    }
+    if (keys.isEmpty()) {
+        return true;
+    }
+
+    // 同一批访问使用同一时间戳，秒级精度足够排序
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    if (!db.transaction()) {
+        qCWarning(QGCCacheEvictorLog)
+            << "Map Cache SQL error (begin access update):" << db.lastError().text();
+        return false;
+    }
+
+    QSqlQuery query(db);
+    (void)query.prepare("UPDATE Tiles SET access = ? WHERE tileID = ?");
+    for (const quint64 key : std::as_const(keys)) {
+        query.addBindValue(now);
+        query.addBindValue(key);
+        if (!query.exec()) {
+            qCWarning(QGCCacheEvictorLog)
+                << "Map Cache SQL error (update access):" << query.lastError().text();
+            (void)db.rollback();
+            return false;
+        }
+    }
+
+    if (!db.commit()) {
+        qCWarning(QGCCacheEvictorLog)
+            << "Map Cache SQL error (commit access update):" << db.lastError().text();
+        (void)db.rollback();
+        return false;
+    }
+
+    _touched += keys.size();
+    return true;
+}
+
+void QGCCacheEvictor::setWatermarks(quint64 high, quint64 low) {
+    _high = high;
+    _low = qMin(low, high);
+    qCDebug(QGCCacheEvictorLog) << "Cache eviction watermarks:" << _high << _low;
+}
+
+bool QGCCacheEvictor::needsEviction(quint64 defaultSize) {
+    const quint64 high = _high;
+    if (high == 0) {
+        _evicting = false;
+    } else if (defaultSize > high) {
+        _evicting = true;
+    } else if (defaultSize <= _low) {
+        _evicting = false;
+    }
+
+    return _evicting;
+}
+
+qint64 QGCCacheEvictor::evictChunk(QSqlDatabase &db, quint64 defaultSetID, quint64 amount) {
+    if (amount == 0) {
+        return 0;
+    }
+
+    // 沿 (access, date) 索引顺序扫描，只取属于默认集合且不被其他集合引用的瓦片
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    (void)query.prepare("SELECT T.tileID, T.size FROM Tiles T "
+                        "WHERE EXISTS (SELECT 1 FROM SetTiles S "
+                        "WHERE S.tileID = T.tileID AND S.setID = ?) "
+                        "AND NOT EXISTS (SELECT 1 FROM SetTiles S "
+                        "WHERE S.tileID = T.tileID AND S.setID != ?) "
+                        "ORDER BY T.access ASC, T.date ASC LIMIT ?");
+    query.addBindValue(defaultSetID);
+    query.addBindValue(defaultSetID);
+    query.addBindValue(kChunkTiles);
+    if (!query.exec()) {
+        qCWarning(QGCCacheEvictorLog)
+            << "Map Cache SQL error (select eviction chunk):" << query.lastError().text();
+        return -1;
+    }
+
+    QList<quint64> victims;
+    quint64 freed = 0;
+    while ((freed < amount) && query.next()) {
+        victims.append(query.value(0).toULongLong());
+        freed += query.value(1).toULongLong();
+    }
+    query.finish();
+    if (victims.isEmpty()) {
+        return 0;
+    }
+
+    // 一条语句删除整块；SetTiles 与 CacheStats 由触发器同步
+    QString placeholders(victims.size() * 2 - 1, QLatin1Char(','));
+    for (qsizetype i = 0; i < placeholders.size(); i += 2) {
+        placeholders[i] = QLatin1Char('?');
+    }
+
+    if (!db.transaction()) {
+        qCWarning(QGCCacheEvictorLog)
+            << "Map Cache SQL error (begin eviction):" << db.lastError().text();
+        return -1;
+    }
+
+    (void)query.prepare(QStringLiteral("DELETE FROM Tiles WHERE tileID IN (%1)").arg(placeholders));
+    for (const quint64 key : std::as_const(victims)) {
+        query.addBindValue(key);
+    }
+    if (!query.exec() || !db.commit()) {
+        qCWarning(QGCCacheEvictorLog)
+            << "Map Cache SQL error (evict tiles):" << query.lastError().text();
+        (void)db.rollback();
+        return -1;
+    }
+
+    _evictedTiles += victims.size();
+    _evictedBytes += freed;
+    _chunks++;
+    qCDebug(QGCCacheEvictorLog) << "Evicted" << victims.size() << "tiles," << freed << "bytes";
+    return static_cast<qint64>(freed);
+}
+
+QGCCacheEvictor::Stats QGCCacheEvictor::stats() const {
+    Stats s;
+    s.touched = _touched;
+    s.evictedTiles = _evictedTiles;
+    s.evictedBytes = _evictedBytes;
+    s.chunks = _chunks;
+    return s;
+}
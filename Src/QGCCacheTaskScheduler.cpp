@@ -0,0 +1,161 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCCacheTaskScheduler.h"
+#include "QGCMapTasks.h"
+#include "QGCTileLookup.h"
+
+QGCTileLookup *QGCFetchTaskLane::push(QGCTileLookup *lookup, qint64 stamp) {
+    const quint64 seq = ++_seq;
+    QGCTileLookup *replaced = nullptr;
+
+    Slot &slot = _index[lookup->key()];
+    if (slot.lookup) {
+        replaced = slot.lookup;
+    }
+    slot.lookup = lookup;
+    slot.seq = seq;
+    slot.stamp = stamp;
+
+    _stack.append({lookup->key(), seq});
+    return replaced;
+}
+
+QGCTileLookup *QGCFetchTaskLane::pop(qint64 *stamp) {
+    while (!_stack.isEmpty()) {
+        const Entry entry = _stack.takeLast();
+        const auto found = _index.constFind(entry.key);
+        // 已被同一瓦片的新请求替换的墓碑条目
+        if ((found == _index.constEnd()) || (found->seq != entry.seq)) {
+            continue;
+        }
+
+        QGCTileLookup *const lookup = found->lookup;
+        if (stamp) {
+            *stamp = found->stamp;
+        }
+        (void)_index.erase(found);
+        return lookup;
+    }
+
+    return nullptr;
+}
+
+QList<QGCTileLookup*> QGCFetchTaskLane::takeAll() {
+    QList<QGCTileLookup*> lookups;
+    lookups.reserve(_index.size());
+    for (const Slot &slot : std::as_const(_index)) {
+        lookups.append(slot.lookup);
+    }
+    _index.clear();
+    _stack.clear();
+    return lookups;
+}
+
+//-----------------------------------------------------------------------------
+
+QGCCacheTaskScheduler::Lane QGCCacheTaskScheduler::laneForTask(const QGCMapTask *task) {
+    switch (task->type()) {
+    case QGCMapTask::taskFetchTile:
+        return LaneFetch;
+    case QGCMapTask::taskCacheTile:
+        return LaneSave;
+    case QGCMapTask::taskFetchTileSets:
+    case QGCMapTask::taskCreateTileSet:
+    case QGCMapTask::taskGetTileDownloadList:
+    case QGCMapTask::taskUpdateTileDownloadState:
+    case QGCMapTask::taskRenameTileSet:
+        return LaneDownload;
+    case QGCMapTask::taskInit:
+    case QGCMapTask::taskDeleteTileSet:
+    case QGCMapTask::taskPruneCache:
+    case QGCMapTask::taskReset:
+    case QGCMapTask::taskExport:
+    case QGCMapTask::taskImport:
+    default:
+        return LaneMaintenance;
+    }
+}
+
+void QGCCacheTaskScheduler::enqueue(QGCMapTask *task) {
+    const Lane lane = laneForTask(task);
+    Q_ASSERT(lane != LaneFetch);
+    _queue(lane).enqueue(task);
+}
+
+QGCTileLookup *QGCCacheTaskScheduler::enqueueFetch(QGCTileLookup *lookup) {
+    return _fetch.push(lookup);
+}
+
+QGCMapTask *QGCCacheTaskScheduler::takeNext() {
+    // 加权轮转：每个通道在一轮内最多出队 kWeights 次，所有非空通道用完额度后开始新一轮
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < (LaneCount - LaneSave); i++) {
+            const Lane lane = static_cast<Lane>(_cursor);
+            if (!_queue(lane).isEmpty() && (_credits[lane] > 0)) {
+                _credits[lane]--;
+                return _queue(lane).dequeue();
+            }
+            _cursor = (_cursor + 1 < LaneCount) ? (_cursor + 1) : LaneSave;
+        }
+
+        _credits = kWeights;
+    }
+
+    return nullptr;
+}
+
+void QGCCacheTaskScheduler::resume(QGCMapTask *task) {
+    const Lane lane = laneForTask(task);
+    Q_ASSERT(lane != LaneFetch);
+    _queue(lane).prepend(task);
+}
+
+QList<QGCTileLookup*> QGCCacheTaskScheduler::takeFetchBatch(qsizetype max) {
+    QList<QGCTileLookup*> lookups;
+    while (!_fetch.isEmpty() && (lookups.size() < max)) {
+        lookups.append(_fetch.pop());
+    }
+    return lookups;
+}
+
+QList<QGCMapTask*> QGCCacheTaskScheduler::takeDownloadStateBatch(qsizetype max) {
+    // 只取队首连续的一段，与其后的下载列表请求保持原有顺序
+    QList<QGCMapTask*> tasks;
+    QQueue<QGCMapTask*> &queue = _queue(LaneDownload);
+    while (!queue.isEmpty() && (tasks.size() < max) &&
+           (queue.head()->type() == QGCMapTask::taskUpdateTileDownloadState)) {
+        tasks.append(queue.dequeue());
+    }
+    return tasks;
+}
+
+QList<QGCMapTask*> QGCCacheTaskScheduler::takeAll() {
+    QList<QGCMapTask*> tasks;
+    for (QQueue<QGCMapTask*> &queue : _queues) {
+        tasks.append(queue);
+        queue.clear();
+    }
+    return tasks;
+}
+
+qsizetype QGCCacheTaskScheduler::count() const {
+    qsizetype total = _fetch.count();
+    for (const QQueue<QGCMapTask*> &queue : _queues) {
+        total += queue.size();
+    }
+    return total;
+}
+
+qsizetype QGCCacheTaskScheduler::count(Lane lane) const {
+    if (lane == LaneFetch) {
+        return _fetch.count();
+    }
+    return _queue(lane).size();
+}
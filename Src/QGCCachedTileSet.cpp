@@ -18,15 +18,15 @@
 #include "QGCCachedTileSet.h"
 
 #include "ElevationMapProvider.h"
+#include "QGCHostConcurrency.h"
 #include "QGCMapEngine.h"
 #include "QGCMapEngineManager.h"
 #include "QGCMapTasks.h"
 #include "QGCMapUrlEngine.h"
+#include "QGCTileDownloads.h"
 #include "QGeoFileTileCacheQGC.h"
 #include "QGeoTileFetcherQGC.h"
 
-#include <QGCFileDownload.h>
-
 #include <QtNetwork/QNetworkProxy>
 
 Q_LOGGING_CATEGORY(QGCCachedTileSetLog, "qgc.qtlocation.qgccachedtileset")
@@ -79,7 +79,8 @@ void QGCCachedTileSet::createDownloadTask() {
 void QGCCachedTileSet::resumeDownloadTask() {
     _cancelPending = false;
     QGCUpdateTileDownloadStateTask *const task =
-        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StatePending, "*");
+        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StatePending,
+                                           QGCUpdateTileDownloadStateTask::kAllTiles);
     getQGCMapEngine()->addTask(task);
     createDownloadTask();
 }
@@ -140,32 +141,37 @@ void QGCCachedTileSet::_prepareDownload() {
         return;
     }
 
-    for (qsizetype i = _replies.count();
-         i < QGeoTileFetcherQGC::concurrentDownloads(_type); i++) {
+    const qsizetype concurrent = QGeoTileFetcherQGC::concurrentDownloads(_type);
+    for (qsizetype i = _replies.count(); i < concurrent; i++) {
         if (_tilesToDownload.isEmpty()) {
             break;
         }
 
-        QGCTile *const tile = _tilesToDownload.dequeue();
+        QGCTile *const tile = _tilesToDownload.head();
         const int mapId = UrlFactory::getQtMapIdFromProviderType(tile->type());
         QNetworkRequest request = QGeoTileFetcherQGC::getNetworkRequest(
             mapId, tile->x(), tile->y(), tile->z());
+        // 与地图共用服务的并发窗口；没有进行中的下载时仍发出一个，之后在其完成时继续
+        if (!_replies.isEmpty() &&
+            (QGCHostConcurrency::instance()->available(QGCHostConcurrency::hostKey(request.url())) <= 0)) {
+            break;
+        }
+        (void)_tilesToDownload.dequeue();
         request.setOriginatingObject(this);
-        request.setAttribute(QNetworkRequest::User, tile->hash());
+        request.setAttribute(QNetworkRequest::User, tile->key());
 
-        QNetworkReply *const reply = _networkManager->get(request);
+        // 地图正在显示的瓦片不再重复下载
+        QNetworkReply *const reply = QGCTileDownloads::instance()->get(_networkManager, request);
         reply->setParent(this);
-        QGCFileDownload::setIgnoreSSLErrorsIfNeeded(*reply);
         (void)connect(reply, &QNetworkReply::finished, this,
                        &QGCCachedTileSet::_networkReplyFinished);
         (void)connect(reply, &QNetworkReply::errorOccurred, this,
                        &QGCCachedTileSet::_networkReplyError);
-        (void)_replies.insert(tile->hash(), reply);
+        (void)_replies.insert(tile->key(), reply);
 
         delete tile;
         if (!_batchRequested && !_noMoreTiles &&
-            (_tilesToDownload.count() <
-                                                  (QGeoTileFetcherQGC::concurrentDownloads(_type) * 10))) {
+            (_tilesToDownload.count() < (concurrent * 10))) {
             createDownloadTask();
         }
     }
@@ -188,20 +194,20 @@ void QGCCachedTileSet::_networkReplyFinished() {
         return;
     }
 
-    const QString hash =
-        reply->request().attribute(QNetworkRequest::User).toString();
-    if (hash.isEmpty()) {
-        qCWarning(QGCCachedTileSetLog) << Q_FUNC_INFO << "Empty Hash";
+    const quint64 key =
+        reply->request().attribute(QNetworkRequest::User).toULongLong();
+    if (key == 0) {
+        qCWarning(QGCCachedTileSetLog) << Q_FUNC_INFO << "Empty Key";
         return;
     }
 
-    if (_replies.contains(hash)) {
-        (void)_replies.remove(hash);
+    if (_replies.contains(key)) {
+        (void)_replies.remove(key);
     } else {
         qCWarning(QGCCachedTileSetLog)
-            << Q_FUNC_INFO << "Reply not in list: " << hash;
+            << Q_FUNC_INFO << "Reply not in list: " << key;
     }
-    qCDebug(QGCCachedTileSetLog) << "Tile fetched:" << hash;
+    qCDebug(QGCCachedTileSetLog) << "Tile fetched:" << key;
 
     QByteArray image = reply->readAll();
     if (image.isEmpty()) {
@@ -209,7 +215,7 @@ void QGCCachedTileSet::_networkReplyFinished() {
         return;
     }
 
-    const QString type = UrlFactory::tileHashToType(hash);
+    const QString type = UrlFactory::tileKeyToType(key);
     const SharedMapProvider mapProvider =
         UrlFactory::getMapProviderFromProviderType(type);
     Q_CHECK_PTR(mapProvider);
@@ -231,10 +237,10 @@ void QGCCachedTileSet::_networkReplyFinished() {
         return;
     }
 
-    QGeoFileTileCacheQGC::cacheTile(type, hash, image, format, _id);
+    QGeoFileTileCacheQGC::cacheTile(type, key, image, format, _id);
 
     QGCUpdateTileDownloadStateTask *const task =
-        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StateComplete, hash);
+        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StateComplete, key);
     getQGCMapEngine()->addTask(task);
 
     setSavedTileSize(_savedTileSize + image.size());
@@ -259,18 +265,18 @@ void QGCCachedTileSet::_networkReplyError(QNetworkReply::NetworkError error) {
 
     setErrorCount(_errorCount + 1);
 
-    const QString hash =
-        reply->request().attribute(QNetworkRequest::User).toString();
-    if (hash.isEmpty()) {
-        qCWarning(QGCCachedTileSetLog) << Q_FUNC_INFO << "Empty Hash";
+    const quint64 key =
+        reply->request().attribute(QNetworkRequest::User).toULongLong();
+    if (key == 0) {
+        qCWarning(QGCCachedTileSetLog) << Q_FUNC_INFO << "Empty Key";
         return;
     }
 
-    if (_replies.contains(hash)) {
-        (void)_replies.remove(hash);
+    if (_replies.contains(key)) {
+        (void)_replies.remove(key);
     } else {
         qCWarning(QGCCachedTileSetLog)
-            << Q_FUNC_INFO << "Reply not in list:" << hash;
+            << Q_FUNC_INFO << "Reply not in list:" << key;
     }
 
     if (error != QNetworkReply::OperationCanceledError) {
@@ -279,7 +285,7 @@ void QGCCachedTileSet::_networkReplyError(QNetworkReply::NetworkError error) {
     }
 
     QGCUpdateTileDownloadStateTask *const task =
-        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StateError, hash);
+        new QGCUpdateTileDownloadStateTask(_id, QGCTile::StateError, key);
     getQGCMapEngine()->addTask(task);
 
     _prepareDownload();
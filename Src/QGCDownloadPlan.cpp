@@ -0,0 +1,405 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCDownloadPlan.h"
+#include "QGCSqlStatementCache.h"
+#include "QGCTileKey.h"
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+Q_LOGGING_CATEGORY(QGCDownloadPlanLog, "qgc.qtlocationplugin.qgcdownloadplan")
+
+namespace {
+
+constexpr qsizetype kPageBytes = QGCDownloadPlan::kPageBits / 8;
+constexpr qsizetype kCandidateRows = 256;
+
+} // namespace
+
+quint64 QGCDownloadPlan::Range::key(qint64 index) const {
+    const qint64 h = height();
+    return QGCTileKey::make(provider, x0 + static_cast<int>(index / h), y0 + static_cast<int>(index % h), z);
+}
+
+QGCDownloadPlan::QGCDownloadPlan(QGCSqlStatementCache &statements)
+    : _statements(statements)
+    , _db(statements.database()) {}
+
+bool QGCDownloadPlan::addRange(quint64 setID, quint32 provider, int z, int x0, int y0,
+                               int x1, int y1, const QList<QPoint> &pending) {
+    Range range;
+    range.provider = provider;
+    range.z = z;
+    range.x0 = x0;
+    range.y0 = y0;
+    range.x1 = x1;
+    range.y1 = y1;
+    if ((provider == 0) || (x1 < x0) || (y1 < y0)) {
+        return true;
+    }
+
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "INSERT INTO DownloadRanges(setID, provider, z, x0, y0, x1, y1, remaining) "
+        "VALUES(?, ?, ?, ?, ?, ?, ?, ?)"));
+    query.addBindValue(setID);
+    query.addBindValue(provider);
+    query.addBindValue(z);
+    query.addBindValue(x0);
+    query.addBindValue(y0);
+    query.addBindValue(x1);
+    query.addBindValue(y1);
+    query.addBindValue(pending.isEmpty() ? range.size() : pending.size());
+    if (!query.exec()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (add download range):" << query.lastError().text();
+        return false;
+    }
+    if (pending.isEmpty()) {
+        return true;
+    }
+
+    // 只有部分瓦片待下载：其余位全部置 1，再清除待下载的位
+    range.rangeID = query.lastInsertId().toLongLong();
+    const qint64 pageCount = (range.size() + kPageBits - 1) / kPageBits;
+    Pages pages;
+    for (qint64 page = 0; page < pageCount; page++) {
+        pages.bits.insert(page, QByteArray(kPageBytes, '\xff'));
+        pages.dirty.append(page);
+    }
+    for (const QPoint &tile : pending) {
+        const qint64 index = range.index(tile.x(), tile.y());
+        uchar &byte = reinterpret_cast<uchar &>(pages.bits[index / kPageBits][(index % kPageBits) / 8]);
+        byte &= static_cast<uchar>(~(1u << (index % 8)));
+    }
+
+    return _storePages(range.rangeID, pages);
+}
+
+bool QGCDownloadPlan::next(quint64 setID, int count, QList<quint64> &keys,
+                           const std::function<void()> &yield) {
+    keys.clear();
+
+    QList<Range> ranges;
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "SELECT rangeID, provider, z, x0, y0, x1, y1, cursor, remaining "
+        "FROM DownloadRanges WHERE setID = ? AND remaining > 0 "
+        "AND cursor < (x1 - x0 + 1) * (y1 - y0 + 1) ORDER BY rangeID"));
+    query.addBindValue(setID);
+    if (!query.exec()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (read download ranges):" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        Range range;
+        range.rangeID = query.value(0).toLongLong();
+        range.provider = query.value(1).toUInt();
+        range.z = query.value(2).toInt();
+        range.x0 = query.value(3).toInt();
+        range.y0 = query.value(4).toInt();
+        range.x1 = query.value(5).toInt();
+        range.y1 = query.value(6).toInt();
+        range.cursor = query.value(7).toLongLong();
+        range.remaining = query.value(8).toLongLong();
+        ranges.append(range);
+    }
+    query.finish();
+
+    for (Range &range : ranges) {
+        while ((keys.size() < count) && (range.cursor < range.size()) && (range.remaining > 0)) {
+            if (!_scanChunk(setID, range, count, keys)) {
+                return false;
+            }
+            // 大片已缓存的区域可能连续扫描多块，块之间让出给交互请求
+            if ((keys.size() < count) && yield) {
+                yield();
+            }
+        }
+        if (keys.size() >= count) {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool QGCDownloadPlan::_scanChunk(quint64 setID, Range &range, int count, QList<quint64> &keys) {
+    Pages pages;
+    QList<qint64> indexes;
+    QList<quint64> candidates;
+    qint64 index = range.cursor;
+    for (; (index < range.size()) && (candidates.size() < kScanChunk); index++) {
+        if (_test(range.rangeID, pages, index)) {
+            continue;
+        }
+        const quint64 key = range.key(index);
+        if (QGCTileKey::isValid(key)) {
+            indexes.append(index);
+            candidates.append(key);
+        }
+    }
+
+    if (!_db.transaction()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (begin download scan):" << _db.lastError().text();
+        return false;
+    }
+
+    // 已缓存的瓦片全部标记完成（包括本次不发出的部分），其余按顺序发出，
+    // cursor 停在第一个未发出的瓦片上
+    QSet<quint64> cached;
+    bool ok = _findCached(setID, candidates, cached);
+    qint64 cursor = index;
+    for (qsizetype i = 0; ok && (i < candidates.size()); i++) {
+        if (cached.contains(candidates.at(i))) {
+            if (_set(range.rangeID, pages, indexes.at(i))) {
+                range.remaining--;
+            }
+        } else if (keys.size() < count) {
+            keys.append(candidates.at(i));
+        } else if (cursor == index) {
+            cursor = indexes.at(i);
+        }
+    }
+
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "UPDATE DownloadRanges SET cursor = ?, remaining = ? WHERE rangeID = ?"));
+    query.addBindValue(cursor);
+    query.addBindValue(range.remaining);
+    query.addBindValue(range.rangeID);
+    ok = ok && _storePages(range.rangeID, pages) && query.exec() && _db.commit();
+    if (!ok) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (update download range):" << query.lastError().text();
+        (void)_db.rollback();
+        return false;
+    }
+
+    range.cursor = cursor;
+    return true;
+}
+
+bool QGCDownloadPlan::complete(quint64 setID, const QList<quint64> &keys) {
+    if (keys.isEmpty()) {
+        return true;
+    }
+
+    // 范围按 (提供者, 缩放级别) 分组，瓦片在内存中匹配
+    QHash<quint64, QList<Range>> ranges;
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "SELECT rangeID, provider, z, x0, y0, x1, y1 FROM DownloadRanges "
+        "WHERE setID = ? AND remaining > 0"));
+    query.addBindValue(setID);
+    if (!query.exec()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (find download ranges):" << query.lastError().text();
+        return false;
+    }
+    while (query.next()) {
+        Range range;
+        range.rangeID = query.value(0).toLongLong();
+        range.provider = query.value(1).toUInt();
+        range.z = query.value(2).toInt();
+        range.x0 = query.value(3).toInt();
+        range.y0 = query.value(4).toInt();
+        range.x1 = query.value(5).toInt();
+        range.y1 = query.value(6).toInt();
+        ranges[QGCTileKey::make(range.provider, 0, 0, range.z)].append(range);
+    }
+    query.finish();
+
+    QHash<qint64, Pages> pages;
+    QHash<qint64, qint64> done;
+    for (const quint64 key : keys) {
+        const int x = QGCTileKey::x(key);
+        const int y = QGCTileKey::y(key);
+        const auto found = ranges.constFind(QGCTileKey::make(QGCTileKey::provider(key), 0, 0, QGCTileKey::z(key)));
+        if (found == ranges.constEnd()) {
+            continue;
+        }
+        for (const Range &range : *found) {
+            if ((x >= range.x0) && (x <= range.x1) && (y >= range.y0) && (y <= range.y1) &&
+                _set(range.rangeID, pages[range.rangeID], range.index(x, y))) {
+                done[range.rangeID]++;
+            }
+        }
+    }
+
+    QSqlQuery &update = _statements.prepare(QStringLiteral(
+        "UPDATE DownloadRanges SET remaining = remaining - ? WHERE rangeID = ?"));
+    for (auto it = done.constBegin(); it != done.constEnd(); ++it) {
+        if (!_storePages(it.key(), pages[it.key()])) {
+            return false;
+        }
+        update.addBindValue(it.value());
+        update.addBindValue(it.key());
+        if (!update.exec()) {
+            qCWarning(QGCDownloadPlanLog)
+                << "Map Cache SQL error (complete download tiles):" << update.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QGCDownloadPlan::rewind(quint64 setID) {
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "UPDATE DownloadRanges SET cursor = 0 WHERE setID = ? AND remaining > 0"));
+    query.addBindValue(setID);
+    if (!query.exec()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (rewind download plan):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool QGCDownloadPlan::remove(quint64 setID) {
+    // 页由 DownloadRanges 的删除触发器一并删除
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "DELETE FROM DownloadRanges WHERE setID = ?"));
+    query.addBindValue(setID);
+    if (!query.exec()) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (delete download plan):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+qint64 QGCDownloadPlan::remaining(quint64 setID) {
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "SELECT IFNULL(SUM(remaining), 0) FROM DownloadRanges WHERE setID = ?"));
+    query.addBindValue(setID);
+    if (!query.exec() || !query.next()) {
+        return 0;
+    }
+
+    return query.value(0).toLongLong();
+}
+
+bool QGCDownloadPlan::_test(qint64 rangeID, Pages &pages, qint64 index) {
+    const qint64 page = index / kPageBits;
+    auto found = pages.bits.find(page);
+    if (found == pages.bits.end()) {
+        QSqlQuery &query = _statements.prepare(QStringLiteral(
+            "SELECT bits FROM DownloadPages WHERE rangeID = ? AND page = ?"));
+        query.addBindValue(rangeID);
+        query.addBindValue(page);
+        QByteArray bits;
+        if (query.exec() && query.next()) {
+            bits = query.value(0).toByteArray();
+        }
+        bits.resize(kPageBytes, '\0');
+        found = pages.bits.insert(page, bits);
+    }
+
+    const uchar byte = static_cast<uchar>(found->at((index % kPageBits) / 8));
+    return (byte & (1u << (index % 8))) != 0;
+}
+
+bool QGCDownloadPlan::_set(qint64 rangeID, Pages &pages, qint64 index) {
+    if (_test(rangeID, pages, index)) {
+        return false;
+    }
+
+    const qint64 page = index / kPageBits;
+    uchar &byte = reinterpret_cast<uchar &>(pages.bits[page][(index % kPageBits) / 8]);
+    byte |= static_cast<uchar>(1u << (index % 8));
+    if (!pages.dirty.contains(page)) {
+        pages.dirty.append(page);
+    }
+    return true;
+}
+
+bool QGCDownloadPlan::_storePages(qint64 rangeID, Pages &pages) {
+    if (pages.dirty.isEmpty()) {
+        return true;
+    }
+
+    QSqlQuery &query = _statements.prepare(QStringLiteral(
+        "INSERT OR REPLACE INTO DownloadPages(rangeID, page, bits) VALUES(?, ?, ?)"));
+    for (const qint64 page : std::as_const(pages.dirty)) {
+        query.addBindValue(rangeID);
+        query.addBindValue(page);
+        query.addBindValue(pages.bits.value(page));
+        if (!query.exec()) {
+            qCWarning(QGCDownloadPlanLog)
+                << "Map Cache SQL error (store download page):" << query.lastError().text();
+            return false;
+        }
+    }
+    pages.dirty.clear();
+    return true;
+}
+
+bool QGCDownloadPlan::_findCached(quint64 setID, const QList<quint64> &candidates, QSet<quint64> &cached) {
+    if (candidates.isEmpty()) {
+        return true;
+    }
+
+    // 临时表随连接存在，建表之后相关语句才能准备
+    QSqlQuery query(_db);
+    if (!query.exec("CREATE TEMP TABLE IF NOT EXISTS SetCandidates ("
+                    "tileID INTEGER PRIMARY KEY NOT NULL)")) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (prepare tile set candidates):" << query.lastError().text();
+        return false;
+    }
+    QSqlQuery &clear = _statements.prepare(QStringLiteral("DELETE FROM temp.SetCandidates"));
+
+    // 多行 VALUES 减少语句执行次数
+    for (qsizetype i = 0; i < candidates.size(); i += kCandidateRows) {
+        const qsizetype rows = qMin(kCandidateRows, candidates.size() - i);
+        QString values = QStringLiteral("(?)");
+        values.reserve(rows * 4);
+        for (qsizetype r = 1; r < rows; r++) {
+            values += QStringLiteral(",(?)");
+        }
+        QSqlQuery &insert = _statements.prepare(
+            QStringLiteral("INSERT OR IGNORE INTO temp.SetCandidates(tileID) VALUES %1").arg(values));
+        for (qsizetype r = 0; r < rows; r++) {
+            insert.addBindValue(candidates.at(i + r));
+        }
+        if (!insert.exec()) {
+            qCWarning(QGCDownloadPlanLog)
+                << "Map Cache SQL error (add tile set candidates):" << insert.lastError().text();
+            (void)clear.exec();
+            return false;
+        }
+    }
+
+    // 一次连接找出已缓存的瓦片并加入集合
+    QSqlQuery &setTiles = _statements.prepare(QStringLiteral(
+        "INSERT OR IGNORE INTO SetTiles(setID, tileID) "
+        "SELECT ?, C.tileID FROM temp.SetCandidates C "
+        "JOIN Tiles T ON T.tileID = C.tileID"));
+    setTiles.addBindValue(setID);
+    QSqlQuery &select = _statements.prepare(QStringLiteral(
+        "SELECT C.tileID FROM temp.SetCandidates C "
+        "JOIN Tiles T ON T.tileID = C.tileID"));
+    const bool ok = setTiles.exec() && select.exec();
+    while (ok && select.next()) {
+        cached.insert(select.value(0).toULongLong());
+    }
+    select.finish();
+    if (!ok) {
+        qCWarning(QGCDownloadPlanLog)
+            << "Map Cache SQL error (resolve cached tiles):"
+            << setTiles.lastError().text() << select.lastError().text();
+    }
+
+    (void)clear.exec();
+    return ok;
+}
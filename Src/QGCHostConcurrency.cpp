@@ -0,0 +1,175 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCHostConcurrency.h"
+
+#include <QtCore/QRegularExpression>
+#include <QtCore/QStringList>
+#include <QtCore/QUrl>
+
+Q_LOGGING_CATEGORY(QGCHostConcurrencyLog,
+                   "qgc.qtlocationplugin.qgchostconcurrency")
+
+QGCHostConcurrency *QGCHostConcurrency::instance() {
+    static QGCHostConcurrency concurrency;
+    return &concurrency;
+}
+
+QString QGCHostConcurrency::hostKey(const QUrl &url) {
+    // 分片标签：单个字母或字母加数字，例如 a、t3、mt1、webrd02
+    static const QRegularExpression shard(QStringLiteral("^([a-z]|[a-z]{0,6}\\d{1,2})$"));
+
+    QStringList labels = url.host().toLower().split(QLatin1Char('.'));
+    // 注册域名（最后两段）保持不变
+    for (qsizetype i = 0; i < (labels.size() - 2); i++) {
+        if (shard.match(labels.at(i)).hasMatch()) {
+            labels[i] = QStringLiteral("*");
+        }
+    }
+    return labels.join(QLatin1Char('.'));
+}
+
+int QGCHostConcurrency::window(const QString &host) {
+    QMutexLocker lock(&_mutex);
+    const auto found = _hosts.constFind(host);
+    if (found == _hosts.constEnd()) {
+        return _window(Host());
+    }
+
+    return _window(found.value());
+}
+
+int QGCHostConcurrency::available(const QString &host) {
+    QMutexLocker lock(&_mutex);
+    const auto found = _hosts.constFind(host);
+    if (found == _hosts.constEnd()) {
+        return _window(Host());
+    }
+
+    return _window(found.value()) - found->inFlight;
+}
+
+void QGCHostConcurrency::acquire(const QString &host) {
+    QMutexLocker lock(&_mutex);
+    _hosts[host].inFlight++;
+}
+
+void QGCHostConcurrency::release(const QString &host) {
+    QMutexLocker lock(&_mutex);
+    const auto found = _hosts.find(host);
+    if ((found != _hosts.end()) && (found->inFlight > 0)) {
+        found->inFlight--;
+    }
+}
+
+void QGCHostConcurrency::record(const QString &host, qint64 latencyMs, qint64 bytes, int statusCode,
+                                QNetworkReply::NetworkError error, int retryAfterSeconds, bool http2) {
+    const bool failed = (error != QNetworkReply::NoError);
+    const bool throttled = (statusCode == 429) || (statusCode == 503);
+
+    QMutexLocker lock(&_mutex);
+    Host &h = _hosts[host];
+    h.completed++;
+    h.errorRate = ((1. - kAlpha) * h.errorRate) + (kAlpha * (failed ? 1. : 0.));
+
+    if (!failed && (latencyMs > 0)) {
+        const double latency = static_cast<double>(latencyMs);
+        h.latencyMs = (h.latencyMs == 0.) ? latency : (((1. - kAlpha) * h.latencyMs) + (kAlpha * latency));
+        h.minLatencyMs = (h.minLatencyMs == 0.) ? latency : qMin(h.minLatencyMs, latency);
+        if (bytes > 0) {
+            const double throughput = (static_cast<double>(bytes) * 1000.) / latency;
+            h.throughput = (h.throughput == 0.) ? throughput : (((1. - kAlpha) * h.throughput) + (kAlpha * throughput));
+        }
+    }
+
+    const int before = _window(h);
+    // 只有收到响应才知道协议；HTTP/1.1 时收回超出连接数的窗口
+    if (statusCode != 0) {
+        h.http2 = http2;
+        h.window = qMin(h.window, static_cast<double>(_maxWindow(h)));
+    }
+
+    if (_isCongestion(statusCode, error)) {
+        if (throttled) {
+            h.throttled++;
+            if (retryAfterSeconds > 0) {
+                h.hold.setRemainingTime(qMin(retryAfterSeconds, kMaxRetryAfter) * 1000);
+            }
+        }
+        // 同一窗口内的请求往往一起失败，冷却期内只减一次
+        if (h.cooldown.hasExpired()) {
+            h.window = qMax(static_cast<double>(kMinWindow), h.window * kDecrease);
+            h.cooldown.setRemainingTime(kCooldown);
+        }
+    } else if (!failed && h.cooldown.hasExpired() &&
+               (h.latencyMs <= (h.minLatencyMs * kLatencyInflation))) {
+        // 每完成一个窗口的请求加 1；延迟明显上升说明服务器已经排队，不再增大
+        h.window = qMin(static_cast<double>(_maxWindow(h)), h.window + (1. / h.window));
+    }
+
+    const int after = _window(h);
+    if (after != before) {
+        qCDebug(QGCHostConcurrencyLog) << host << "window" << before << "->" << after
+                                       << "latency ms" << h.latencyMs << "min latency ms" << h.minLatencyMs
+                                       << "throughput" << h.throughput << "error rate" << h.errorRate
+                                       << "throttled" << h.throttled << "http2" << h.http2;
+    }
+}
+
+QList<QGCHostConcurrency::HostStats> QGCHostConcurrency::stats() const {
+    QList<HostStats> list;
+
+    QMutexLocker lock(&_mutex);
+    list.reserve(_hosts.size());
+    for (auto it = _hosts.constBegin(); it != _hosts.constEnd(); ++it) {
+        HostStats s;
+        s.host = it.key();
+        s.window = _window(it.value());
+        s.latencyMs = it->latencyMs;
+        s.minLatencyMs = it->minLatencyMs;
+        s.throughput = it->throughput;
+        s.errorRate = it->errorRate;
+        s.completed = it->completed;
+        s.throttled = it->throttled;
+        s.inFlight = it->inFlight;
+        s.http2 = it->http2;
+        list.append(s);
+    }
+    return list;
+}
+
+int QGCHostConcurrency::_window(const Host &h) {
+    if (!h.hold.hasExpired()) {
+        return kMinWindow;
+    }
+
+    return _clamp(h.window, _maxWindow(h));
+}
+
+int QGCHostConcurrency::_clamp(double window, int maxWindow) {
+    return qBound(kMinWindow, static_cast<int>(window), maxWindow);
+}
+
+bool QGCHostConcurrency::_isCongestion(int statusCode, QNetworkReply::NetworkError error) {
+    if ((statusCode == 429) || (statusCode == 503)) {
+        return true;
+    }
+
+    // 传输超时在 Qt 中表现为请求被中止
+    switch (error) {
+    case QNetworkReply::TimeoutError:
+    case QNetworkReply::OperationCanceledError:
+    case QNetworkReply::RemoteHostClosedError:
+    case QNetworkReply::TemporaryNetworkFailureError:
+    case QNetworkReply::ProxyTimeoutError:
+        return true;
+    default:
+        return false;
+    }
+}
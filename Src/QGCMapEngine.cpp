@@ -65,8 +65,17 @@ QGCMapEngine::~QGCMapEngine() {
 
 QGCMapEngine *QGCMapEngine::instance() { return _mapEngine(); }
 
-void QGCMapEngine::init(const QString &databasePath) {
+void QGCMapEngine::init(const QString &databasePath, QGCTileStorage storage,
+                        QGCCacheIdlePolicy idlePolicy) {
     m_worker->setDatabaseFile(databasePath);
+    m_worker->setStorage(storage);
+    m_worker->setIdlePolicy(idlePolicy);
+
+    // 默认瓦片集超过上限时由工作线程在空闲时持续淘汰，降到上限的 90% 为止
+    const quint64 maxSize =
+        static_cast<quint64>(QGeoFileTileCacheQGC::getMaxDiskCacheSetting()) *
+        pow(1024, 2);
+    m_worker->setEvictionWatermarks(maxSize, maxSize / 10 * 9);
 
     QGCMapTask *const task = new QGCMapTask(QGCMapTask::taskInit);
     (void)addTask(task);
@@ -76,22 +85,19 @@ bool QGCMapEngine::addTask(QGCMapTask *task) {
     return m_worker->enqueueTask(task);
 }
 
-void QGCMapEngine::_updateTotals(quint32 totaltiles, quint64 totalsize,
-                                 quint32 defaulttiles, quint64 defaultsize) {
-    emit updateTotals(totaltiles, totalsize, defaulttiles, defaultsize);
+bool QGCMapEngine::addLookup(QGCTileLookup *lookup) {
+    return m_worker->enqueueLookup(lookup);
+}
 
-    const quint64 maxSize =
-        static_cast<quint64>(QGeoFileTileCacheQGC::getMaxDiskCacheSetting()) *
-        pow(1024, 2);
-    if (!m_prunning && (defaultsize > maxSize)) {
-        m_prunning = true;
-
-        const quint64 amountToPrune = defaultsize - maxSize;
-        QGCPruneCacheTask *const task = new QGCPruneCacheTask(amountToPrune);
-        (void)connect(task, &QGCPruneCacheTask::pruned, this,
-                       &QGCMapEngine::_pruned);
-        (void)addTask(task);
-    }
+bool QGCMapEngine::saveTile(quint64 key, const QByteArray &img, const QString &format,
+                            const QString &type, quint64 set) {
+    return m_worker->saveTile(key, img, format, type, set);
+}
+
+void QGCMapEngine::_updateTotals(quint32 totaltiles, quint64 totalsize,
+                                 quint32 defaulttiles, quint64 defaultsize,
+                                 double dedupratio) {
+    emit updateTotals(totaltiles, totalsize, defaulttiles, defaultsize, dedupratio);
 }
 
 void QGCMapEngine::shutdown() {
@@ -296,6 +296,9 @@ void QGCMapEngineManager::taskError(QGCMapTask::TaskType type,
     case QGCMapTask::taskExport:
         task = QStringLiteral("Export Tile Sets");
         break;
+    case QGCMapTask::taskImport:
+        task = QStringLiteral("Import Tile Sets");
+        break;
     default:
         task = QStringLiteral("Database Error");
         break;
@@ -312,7 +315,13 @@ void QGCMapEngineManager::taskError(QGCMapTask::TaskType type,
 
 void QGCMapEngineManager::_updateTotals(quint32 totaltiles, quint64 totalsize,
                                         quint32 defaulttiles,
-                                        quint64 defaultsize) {
+                                        quint64 defaultsize,
+                                        double dedupratio) {
+    if (!qFuzzyCompare(dedupratio, _dedupRatio)) {
+        _dedupRatio = dedupratio;
+        emit dedupRatioChanged();
+    }
+
     for (qsizetype i = 0; i < _tileSets->count(); i++) {
         QGCCachedTileSet *const set =
             qobject_cast<QGCCachedTileSet *>(_tileSets->get(i));
@@ -388,6 +397,7 @@ bool QGCMapEngineManager::importSets(const QString &path) {
                    &QGCMapEngineManager::_actionProgressHandler);
     (void)connect(task, &QGCMapTask::error, this,
                    &QGCMapEngineManager::taskError);
+    _actionTask = task;
     (void)getQGCMapEngine()->addTask(task);
 
     return true;
@@ -423,11 +433,19 @@ bool QGCMapEngineManager::exportSets(const QString &path) {
                    &QGCMapEngineManager::_actionProgressHandler);
     (void)connect(task, &QGCMapTask::error, this,
                    &QGCMapEngineManager::taskError);
+    _actionTask = task;
     (void)getQGCMapEngine()->addTask(task);
 
     return true;
 }
 
+void QGCMapEngineManager::cancelAction() {
+    // 工作线程在下一片开始前结束任务，并照常发出 actionCompleted
+    if (_actionTask) {
+        _actionTask->cancel();
+    }
+}
+
 void QGCMapEngineManager::_actionCompleted() {
     const ImportAction oldState = _importAction;
     setImportAction(ActionDone);
@@ -15,6 +15,7 @@
  */
 
 #include "QGCMapUrlEngine.h"
+#include "QGCTileKey.h"
 #include "BingMapProvider.h"
 #include "ElevationMapProvider.h"
 #include "EsriMapProvider.h"
@@ -275,12 +276,10 @@ int UrlFactory::hashFromProviderType(QStringView type) {
     return static_cast<int>(hash);
 }
 
-QString UrlFactory::tileHashToType(QStringView tileHash) {
-    const int providerHash = tileHash.mid(0, 10).toInt();
-    return providerTypeFromHash(providerHash);
+QString UrlFactory::tileKeyToType(quint64 tileKey) {
+    return QGCProviderRegistry::instance()->name(QGCTileKey::provider(tileKey));
 }
 
-QString UrlFactory::getTileHash(QStringView type, int x, int y, int z) {
-    const int hash = hashFromProviderType(type);
-    return QString::asprintf("%010d%08d%08d%03d", hash, x, y, z);
+quint64 UrlFactory::getTileKey(const QString &type, int x, int y, int z) {
+    return QGCTileKey::make(QGCProviderRegistry::instance()->id(type), x, y, z);
 }
@@ -0,0 +1,75 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCSqlStatementCache.h"
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+Q_LOGGING_CATEGORY(QGCSqlStatementCacheLog, "qgc.qtlocationplugin.qgcsqlstatementcache")
+
+std::atomic_bool QGCSqlStatementCache::_enabled = true;
+
+QGCSqlStatementCache::QGCSqlStatementCache(QSqlDatabase &db)
+    : _db(db) {}
+
+QGCSqlStatementCache::~QGCSqlStatementCache() {
+    clear();
+}
+
+QSqlQuery &QGCSqlStatementCache::prepare(const QString &sql) {
+    const auto found = _statements.constFind(sql);
+    if (found != _statements.constEnd()) {
+        QSqlQuery &query = **found;
+        query.finish();
+        if (_enabled) {
+            _hits++;
+            return query;
+        }
+
+        // 关闭缓存时重新解析同一个对象，调用者持有的引用保持有效
+        _prepares++;
+        if (!query.prepare(sql)) {
+            qCWarning(QGCSqlStatementCacheLog)
+                << "Map Cache SQL error (prepare statement):" << query.lastError().text() << sql;
+        }
+        return query;
+    }
+
+    std::shared_ptr<QSqlQuery> query = std::make_shared<QSqlQuery>(_db);
+    query->setForwardOnly(true);
+    _prepares++;
+    if (!query->prepare(sql)) {
+        qCWarning(QGCSqlStatementCacheLog)
+            << "Map Cache SQL error (prepare statement):" << query->lastError().text() << sql;
+        _failed.append(query);
+        return *query;
+    }
+
+    _statements.insert(sql, query);
+    return *query;
+}
+
+void QGCSqlStatementCache::clear() {
+    if (!_statements.isEmpty() || !_failed.isEmpty()) {
+        qCDebug(QGCSqlStatementCacheLog)
+            << "Statement cache:" << _statements.size() << "statements," << _hits << "hits," << _prepares << "prepares";
+    }
+    _statements.clear();
+    _failed.clear();
+}
+
+QGCSqlStatementCache::Stats QGCSqlStatementCache::stats() const {
+    Stats stats;
+    stats.hits = _hits;
+    stats.prepares = _prepares;
+    stats.size = _statements.size();
+    return stats;
+}
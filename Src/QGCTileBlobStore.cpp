@@ -0,0 +1,178 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileBlobStore.h"
+#include "QGCSqlStatementCache.h"
+#include "QGCTileKeyFilter.h"
+#include "QGCTilePackStore.h"
+
+#include <QtCore/QtEndian>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY(QGCTileBlobStoreLog, "qgc.qtlocationplugin.qgctileblobstore")
+
+QGCTileBlobStore::QGCTileBlobStore(QGCSqlStatementCache &statements, QGCTilePackStore *packs)
+    : _packs(packs)
+    , _db(statements.database())
+    , _findTile(statements.prepare(QStringLiteral("SELECT 1 FROM Tiles WHERE tileID = ?")))
+    , _findBlob(statements.prepare(
+          QStringLiteral("SELECT blobID, tile, pack, packOffset, size FROM Blobs WHERE hash = ?")))
+    , _insertBlob(statements.prepare(
+          QStringLiteral("INSERT INTO Blobs(hash, size, tile) VALUES(?, ?, ?)")))
+    , _insertPacked(statements.prepare(
+          QStringLiteral("INSERT INTO Blobs(hash, size, tile, pack, packOffset) VALUES(?, ?, X'', ?, ?)")))
+    , _insertTile(statements.prepare(
+          QStringLiteral("INSERT INTO Tiles(tileID, format, blobID, size, date) VALUES(?, ?, ?, ?, ?)")))
+    , _dropBlob(statements.prepare(
+          QStringLiteral("DELETE FROM Blobs WHERE blobID = ? AND refs <= 0"))) {}
+
+qint64 QGCTileBlobStore::store(const QByteArray &img) {
+    // SQLite 的 INTEGER 为有符号数，按位保存
+    const qint64 hash = static_cast<qint64>(contentHash(img));
+    _findBlob.addBindValue(hash);
+    if (!_findBlob.exec()) {
+        qCWarning(QGCTileBlobStoreLog)
+            << "Map Cache SQL error (find blob):" << _findBlob.lastError().text();
+        return 0;
+    }
+    while (_findBlob.next()) {
+        if (image(_findBlob.value(1).toByteArray(), _findBlob.value(2).toLongLong(),
+                  _findBlob.value(3).toLongLong(), _findBlob.value(4).toLongLong()) == img) {
+            const qint64 blobID = _findBlob.value(0).toLongLong();
+            _findBlob.finish();
+            return blobID;
+        }
+    }
+    _findBlob.finish();
+
+    // 包文件写入失败或图像过大时仍内嵌保存
+    const QGCTilePackStore::Location location =
+        _packs ? _packs->append(_db, img) : QGCTilePackStore::Location();
+    if (location.pack > 0) {
+        _insertPacked.addBindValue(hash);
+        _insertPacked.addBindValue(img.size());
+        _insertPacked.addBindValue(location.pack);
+        _insertPacked.addBindValue(location.offset);
+        if (!_insertPacked.exec()) {
+            qCWarning(QGCTileBlobStoreLog)
+                << "Map Cache SQL error (add packed blob):" << _insertPacked.lastError().text();
+            return 0;
+        }
+        return _insertPacked.lastInsertId().toLongLong();
+    }
+
+    _insertBlob.addBindValue(hash);
+    _insertBlob.addBindValue(img.size());
+    _insertBlob.addBindValue(img);
+    if (!_insertBlob.exec()) {
+        qCWarning(QGCTileBlobStoreLog)
+            << "Map Cache SQL error (add blob):" << _insertBlob.lastError().text();
+        return 0;
+    }
+
+    return _insertBlob.lastInsertId().toLongLong();
+}
+
+bool QGCTileBlobStore::insertTile(quint64 key, const QString &format, const QByteArray &img,
+                                  qint64 date, bool *inserted) {
+    if (inserted) {
+        *inserted = false;
+    }
+
+    // 瓦片已存在时不计算哈希，也不会留下没有引用的图像
+    _findTile.addBindValue(key);
+    if (!_findTile.exec()) {
+        qCWarning(QGCTileBlobStoreLog)
+            << "Map Cache SQL error (find tile):" << _findTile.lastError().text();
+        return false;
+    }
+    const bool exists = _findTile.next();
+    _findTile.finish();
+    if (exists) {
+        return true;
+    }
+
+    const qint64 blobID = store(img);
+    if (blobID == 0) {
+        return false;
+    }
+
+    _insertTile.addBindValue(key);
+    _insertTile.addBindValue(format);
+    _insertTile.addBindValue(blobID);
+    _insertTile.addBindValue(img.size());
+    _insertTile.addBindValue(date);
+    if (!_insertTile.exec()) {
+        qCWarning(QGCTileBlobStoreLog)
+            << "Map Cache SQL error (add tile):" << _insertTile.lastError().text();
+        _dropBlob.addBindValue(blobID);
+        (void)_dropBlob.exec();
+        return false;
+    }
+
+    QGCTileKeyFilter::instance()->insert(key);
+    if (inserted) {
+        *inserted = true;
+    }
+    return true;
+}
+
+QByteArray QGCTileBlobStore::image(const QByteArray &tile, qint64 pack, qint64 offset, qint64 size) {
+    if (pack <= 0) {
+        return tile;
+    }
+
+    return QGCTilePackStore::instance()->read(pack, offset, size);
+}
+
+quint64 QGCTileBlobStore::contentHash(const QByteArray &img) {
+    // MurmurHash64A (Austin Appleby, public domain)
+    constexpr quint64 m = Q_UINT64_C(0xc6a4a7935bd1e995);
+    constexpr int r = 47;
+    constexpr quint64 seed = Q_UINT64_C(0x9747b28c);
+
+    const uchar *data = reinterpret_cast<const uchar *>(img.constData());
+    const size_t len = static_cast<size_t>(img.size());
+    quint64 h = seed ^ (len * m);
+
+    const uchar *const end = data + (len / 8) * 8;
+    for (; data != end; data += 8) {
+        quint64 k;
+        std::memcpy(&k, data, sizeof(k));
+        k = qFromLittleEndian(k);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= static_cast<quint64>(data[6]) << 48; Q_FALLTHROUGH();
+    case 6: h ^= static_cast<quint64>(data[5]) << 40; Q_FALLTHROUGH();
+    case 5: h ^= static_cast<quint64>(data[4]) << 32; Q_FALLTHROUGH();
+    case 4: h ^= static_cast<quint64>(data[3]) << 24; Q_FALLTHROUGH();
+    case 3: h ^= static_cast<quint64>(data[2]) << 16; Q_FALLTHROUGH();
+    case 2: h ^= static_cast<quint64>(data[1]) << 8; Q_FALLTHROUGH();
+    case 1: h ^= static_cast<quint64>(data[0]);
+            h *= m;
+            break;
+    default:
+        break;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
@@ -0,0 +1,385 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileCacheReadPool.h"
+#include "QGCCacheEvictor.h"
+#include "QGCCacheTile.h"
+#include "QGCMapUrlEngine.h"
+#include "QGCSqlStatementCache.h"
+#include "QGCTileBlobStore.h"
+#include "QGCTileLookup.h"
+#include "QGCTileMemoryCache.h"
+#include "QGCTileWriteBuffer.h"
+
+#include <QtCore/QThread>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#include <chrono>
+#include <memory>
+
+Q_LOGGING_CATEGORY(QGCTileCacheReadPoolLog,
+                   "qgc.qtlocationplugin.qgctilecachereadpool")
+
+namespace {
+
+qint64 nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+constexpr const char *kReaderSession = "QGeoTileReaderSession";
+
+// readTiles 为静态函数，工作线程的回退路径同样经过这里，计数为进程级
+std::atomic<quint64> executedLookups = 0;
+std::atomic<quint64> cancelledLookups = 0;
+std::atomic<quint64> usedLookups = 0;
+
+} // namespace
+
+class QGCTileCacheReadPool::Reader : public QThread
+{
+public:
+    Reader(QGCTileCacheReadPool *pool, int index) : _pool(pool), _index(index) {}
+
+protected:
+    void run() final;
+
+private:
+    bool _connect(std::unique_ptr<QSqlDatabase> &db, const QString &session);
+
+    QGCTileCacheReadPool *const _pool;
+    const int _index;
+};
+
+bool QGCTileCacheReadPool::Reader::_connect(std::unique_ptr<QSqlDatabase> &db,
+                                            const QString &session) {
+    if (db) {
+        db.reset();
+        QSqlDatabase::removeDatabase(session);
+    }
+
+    db.reset(new QSqlDatabase(QSqlDatabase::addDatabase("QSQLITE", session)));
+    db->setDatabaseName(_pool->_databasePath);
+    // 只读连接，不使用共享缓存：共享缓存会退化为表级锁，失去 WAL 的并发读能力
+    db->setConnectOptions("QSQLITE_OPEN_READONLY;QSQLITE_BUSY_TIMEOUT=5000");
+    if (!db->open()) {
+        qCWarning(QGCTileCacheReadPoolLog)
+            << "Map Cache SQL error (open read connection):" << db->lastError();
+        return false;
+    }
+
+    QSqlQuery query(*db);
+    (void)query.exec("PRAGMA cache_size=-4096");
+    return true;
+}
+
+void QGCTileCacheReadPool::Reader::run() {
+    const QString session = QStringLiteral("%1%2").arg(kReaderSession).arg(_index);
+    std::unique_ptr<QSqlDatabase> db;
+    std::unique_ptr<QGCSqlStatementCache> statements;
+    int generation = -1;
+    bool connected = false;
+
+    QList<Entry> entries;
+    QList<QGCTileLookup*> lookups;
+    while (_pool->_take(entries, db != nullptr)) {
+        if (entries.isEmpty()) {
+            // 连接池关闭，数据库文件将被删除或替换
+            statements.reset();
+            db.reset();
+            QSqlDatabase::removeDatabase(session);
+            connected = false;
+            generation = -1;
+            continue;
+        }
+
+        const qint64 startNs = nowNs();
+        if (generation != _pool->_generation) {
+            generation = _pool->_generation;
+            // 缓存的语句属于旧连接，必须先于连接释放
+            statements.reset();
+            connected = _connect(db, session);
+            if (connected) {
+                statements = std::make_unique<QGCSqlStatementCache>(*db);
+            }
+        }
+
+        lookups.clear();
+        qint64 waitNs = 0;
+        for (const Entry &entry : std::as_const(entries)) {
+            lookups.append(entry.lookup);
+            waitNs += startNs - entry.enqueuedNs;
+        }
+
+        int hits = 0;
+        if (connected) {
+            hits = QGCTileCacheReadPool::readTiles(*statements, lookups);
+        } else {
+            for (QGCTileLookup *lookup : std::as_const(lookups)) {
+                lookup->setError("No Cache Database");
+            }
+        }
+
+        _pool->_record(lookups.size(), waitNs, nowNs() - startNs, hits);
+    }
+
+    statements.reset();
+    if (db) {
+        db.reset();
+        QSqlDatabase::removeDatabase(session);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+QGCTileCacheReadPool::QGCTileCacheReadPool() {}
+
+QGCTileCacheReadPool::~QGCTileCacheReadPool() { stop(); }
+
+void QGCTileCacheReadPool::setReaderCount(int count) {
+    QMutexLocker lock(&_queueMutex);
+    if (_readers.isEmpty()) {
+        _readerCount = qBound(0, count, kMaxReaders);
+    }
+}
+
+bool QGCTileCacheReadPool::enqueue(QGCTileLookup *lookup) {
+    if (_stop || _closed || (_readerCount == 0)) {
+        return false;
+    }
+
+    QMutexLocker lock(&_queueMutex);
+    // 同一瓦片的旧请求被新请求替换，新请求优先处理
+    QGCTileLookup *const replaced = _queue.push(lookup, nowNs());
+    if (replaced) {
+        replaced->setError("Superseded by a newer request");
+    }
+    _maxQueueDepth = qMax(_maxQueueDepth, _queue.count());
+
+    // 读线程常驻并在等待条件上休眠，只需在首次使用时启动
+    if (_readers.isEmpty()) {
+        for (int i = 0; i < _readerCount; i++) {
+            Reader *const reader = new Reader(this, i);
+            _readers.append(reader);
+            reader->start(QThread::HighPriority);
+        }
+    }
+    lock.unlock();
+
+    _waitc.wakeOne();
+    return true;
+}
+
+bool QGCTileCacheReadPool::_take(QList<Entry> &entries, bool connected) {
+    entries.clear();
+
+    QMutexLocker lock(&_queueMutex);
+    while (!_stop) {
+        if (_closed) {
+            if (connected) {
+                return true;
+            }
+        } else if (!_queue.isEmpty()) {
+            break;
+        }
+
+        if (!connected) {
+            _parked++;
+            _parkedc.wakeAll();
+        }
+        (void)_waitc.wait(lock.mutex());
+        if (!connected) {
+            _parked--;
+        }
+    }
+
+    if (_stop) {
+        return false;
+    }
+
+    // 一次取走当前排队的一批请求（同一帧的可见瓦片），合并为一条查询
+    const int batchSize = _batchSize;
+    while (!_queue.isEmpty() && (entries.size() < batchSize)) {
+        Entry entry;
+        entry.lookup = _queue.pop(&entry.enqueuedNs);
+        entries.append(entry);
+    }
+    return true;
+}
+
+void QGCTileCacheReadPool::_record(qsizetype count, qint64 waitNs, qint64 queryNs, int hits) {
+    _totalWaitNs += waitNs;
+    _totalQueryNs += queryNs;
+    _hits += hits;
+    _batches++;
+
+    const quint64 fetched = (_fetched += count);
+    if ((fetched / kStatsInterval) != ((fetched - count) / kStatsInterval)) {
+        const Stats s = stats();
+        const QGCTileLookup::Stats lookups = QGCTileLookup::stats();
+        qCDebug(QGCTileCacheReadPoolLog)
+            << "fetched" << s.fetched << "hits" << s.hits << "queue" << s.queueDepth
+            << "max queue" << s.maxQueueDepth << "avg wait ms" << s.avgWaitMs
+            << "avg query ms" << s.avgQueryMs << "avg batch" << s.avgBatchSize
+            << "executed" << s.executed << "cancelled" << s.cancelled << "used" << s.used
+            << "lookups reused" << lookups.reused << "of" << lookups.created << "deliveries" << lookups.batches;
+    }
+}
+
+QGCTileCacheReadPool::Stats QGCTileCacheReadPool::stats() const {
+    Stats s;
+    s.fetched = _fetched;
+    s.batches = _batches;
+    s.hits = _hits;
+    s.executed = executedLookups;
+    s.cancelled = cancelledLookups;
+    s.used = usedLookups;
+    {
+        QMutexLocker lock(&_queueMutex);
+        s.queueDepth = _queue.count();
+        s.maxQueueDepth = _maxQueueDepth;
+    }
+    if (s.fetched > 0) {
+        s.avgWaitMs = (static_cast<double>(_totalWaitNs) / s.fetched) / 1e6;
+    }
+    if (s.batches > 0) {
+        s.avgQueryMs = (static_cast<double>(_totalQueryNs) / s.batches) / 1e6;
+        s.avgBatchSize = static_cast<double>(s.fetched) / s.batches;
+    }
+    return s;
+}
+
+void QGCTileCacheReadPool::close() {
+    QMutexLocker lock(&_queueMutex);
+    _closed = true;
+    _waitc.wakeAll();
+    // 正在查询的读线程完成当前批次后释放连接，之后与空闲的读线程一起等待 reopen()
+    while (!_stop && (_parked < _readers.size())) {
+        (void)_parkedc.wait(lock.mutex());
+    }
+}
+
+void QGCTileCacheReadPool::reopen() {
+    {
+        QMutexLocker lock(&_queueMutex);
+        _closed = false;
+        _generation++;
+    }
+    _waitc.wakeAll();
+}
+
+void QGCTileCacheReadPool::stop() {
+    QMutexLocker lock(&_queueMutex);
+    _stop = true;
+    _parkedc.wakeAll();
+    const QList<Reader*> readers = _readers;
+    _readers.clear();
+    const QList<QGCTileLookup*> pending = _queue.takeAll();
+    lock.unlock();
+
+    for (QGCTileLookup *lookup : pending) {
+        lookup->setError("Cache Stopped");
+    }
+
+    _waitc.wakeAll();
+    for (Reader *reader : readers) {
+        reader->wait();
+        delete reader;
+    }
+}
+
+int QGCTileCacheReadPool::readTiles(QGCSqlStatementCache &statements, const QList<QGCTileLookup*> &requested) {
+    // 写后缓冲中尚未提交的瓦片直接回复，不查询数据库
+    int hits = 0;
+    QList<QGCTileLookup*> lookups;
+    lookups.reserve(requested.size());
+    for (QGCTileLookup *lookup : requested) {
+        // 回复已中止，结果不会再被使用
+        if (lookup->isCancelled()) {
+            cancelledLookups++;
+            lookup->discard();
+            continue;
+        }
+
+        executedLookups++;
+        QGCCacheTile *const tile = QGCTileWriteBuffer::instance()->lookup(lookup->key());
+        if (tile) {
+            lookup->setTileFetched(tile);
+            hits++;
+        } else {
+            lookups.append(lookup);
+        }
+    }
+    if (lookups.isEmpty()) {
+        return hits;
+    }
+
+    struct Row {
+        QByteArray img;
+        QString format;
+    };
+    QHash<quint64, Row> rows;
+    rows.reserve(lookups.size());
+
+    QString placeholders(lookups.size() * 2 - 1, QLatin1Char(','));
+    for (qsizetype i = 0; i < placeholders.size(); i += 2) {
+        placeholders[i] = QLatin1Char('?');
+    }
+
+    // 每种批量大小对应一条缓存的语句
+    QSqlQuery &query = statements.prepare(QStringLiteral("SELECT T.tileID, B.tile, T.format, B.pack, B.packOffset, B.size "
+                                                         "FROM Tiles T "
+                                                         "JOIN Blobs B ON B.blobID = T.blobID "
+                                                         "WHERE T.tileID IN (%1)")
+                                              .arg(placeholders));
+    for (const QGCTileLookup *lookup : std::as_const(lookups)) {
+        query.addBindValue(lookup->key());
+    }
+    if (query.exec()) {
+        while (query.next()) {
+            // 包文件中的图像从映射复制一次，不经过 SQLite 的 BLOB 缓冲
+            const QByteArray img = QGCTileBlobStore::image(
+                query.value(1).toByteArray(), query.value(3).toLongLong(),
+                query.value(4).toLongLong(), query.value(5).toLongLong());
+            if (!img.isEmpty()) {
+                rows.insert(query.value(0).toULongLong(), {img, query.value(2).toString()});
+            }
+        }
+    } else {
+        qCWarning(QGCTileCacheReadPoolLog)
+            << "Map Cache SQL error (fetch tiles):" << query.lastError().text();
+    }
+    // 结束结果集，只读连接不再持有 WAL 快照
+    query.finish();
+
+    for (QGCTileLookup *lookup : std::as_const(lookups)) {
+        const quint64 key = lookup->key();
+        const auto found = rows.constFind(key);
+        if (found == rows.constEnd()) {
+            lookup->setError("Tile not in cache database");
+            continue;
+        }
+
+        const QString type = UrlFactory::tileKeyToType(key);
+        QGCTileMemoryCache::instance()->insert(key, found->img, found->format, type);
+        QGCCacheEvictor::instance()->touch(key);
+        QGCCacheTile *tile = new QGCCacheTile(key, found->img, found->format, type);
+        lookup->setTileFetched(tile);
+        hits++;
+    }
+
+    return hits;
+}
+
+void QGCTileCacheReadPool::recordUsed() {
+    usedLookups++;
+}
@@ -8,36 +8,163 @@
  ****************************************************************************/
 
 #include "QGCTileCacheWorker.h"
+#include "QGCCacheEvictor.h"
 #include "QGCCachedTileSet.h"
+#include "QGCDownloadPlan.h"
 #include "QGCMapTasks.h"
 #include "QGCMapUrlEngine.h"
+#include "QGCSqlStatementCache.h"
+#include "QGCTileBlobStore.h"
+#include "QGCTileKey.h"
+#include "QGCTileKeyFilter.h"
+#include "QGCTileLookup.h"
+#include "QGCTileMemoryCache.h"
+#include "QGCTileWriteBuffer.h"
 
 #include <QtCore/QCoreApplication>
 #include <QtCore/QDateTime>
+#include <QtCore/QDir>
 #include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSet>
 #include <QtCore/QSettings>
+#include <QtCore/QVersionNumber>
 #include <QtSql/QSqlDatabase>
 #include <QtSql/QSqlError>
 #include <QtSql/QSqlQuery>
 
+#include <limits>
+
 Q_LOGGING_CATEGORY(QGCTileCacheWorkerLog,
                    "qgc.qtlocationplugin.qgctilecacheworker")
 
+/// 分片执行的长任务在两片之间保存的进度
+struct QGCCacheWorker::Job
+{
+    virtual ~Job() = default;
+
+    bool aborted = false;   ///< 数据库已被重置或替换，任务不能继续
+};
+
+struct QGCCacheWorker::CreateJob : QGCCacheWorker::Job
+{
+    quint64 setID = 0;
+    int zoom = 0;
+};
+
+struct QGCCacheWorker::ImportJob : QGCCacheWorker::Job
+{
+    struct Set {
+        QString name;
+        quint64 setID = 0;
+        QString mapType;
+        double topleftLat = 0.;
+        double topleftLon = 0.;
+        double bottomRightLat = 0.;
+        double bottomRightLon = 0.;
+        int minZoom = 0;
+        int maxZoom = 0;
+        int type = 0;
+        quint32 numTiles = 0;
+        int defaultSet = 0;
+    };
+
+    ~ImportJob() override
+    {
+        statements.reset();
+        if (db) {
+            db.reset();
+            QSqlDatabase::removeDatabase(kExportSession);
+        }
+    }
+
+    std::unique_ptr<QSqlDatabase> db;
+    std::unique_ptr<QGCSqlStatementCache> statements;
+    bool legacy = false;
+    bool blobs = false;
+    QHash<quint32, quint32> providers;
+    QList<Set> sets;
+    qsizetype set = 0;
+    quint64 insertSetID = UINT64_MAX;
+    QVariant cursor;        ///< 当前集合中已处理的最大 tileID
+    quint64 tileCount = 0;
+    quint64 currentCount = 0;
+    quint64 tilesFound = 0;
+    quint64 tilesSaved = 0;
+    int lastProgress = -1;
+};
+
+struct QGCCacheWorker::ExportJob : QGCCacheWorker::Job
+{
+    ~ExportJob() override
+    {
+        statements.reset();
+        if (db) {
+            db.reset();
+            QSqlDatabase::removeDatabase(kExportSession);
+        }
+    }
+
+    std::unique_ptr<QSqlDatabase> db;
+    std::unique_ptr<QGCSqlStatementCache> statements;
+    qsizetype set = 0;
+    quint64 exportSetID = 0;
+    QVariant cursor;        ///< 当前集合中已导出的最大 tileID
+    quint64 tileCount = 0;
+    quint64 currentCount = 0;
+    int lastProgress = -1;
+};
+
 QGCCacheWorker::QGCCacheWorker(QObject *parent) : QThread(parent) {}
 
 QGCCacheWorker::~QGCCacheWorker() {}
 
+template <typename T>
+T &QGCCacheWorker::_job(const QGCMapTask *task) {
+    std::shared_ptr<Job> &job = _jobs[task];
+    if (!job) {
+        job = std::make_shared<T>();
+    }
+    return static_cast<T &>(*job);
+}
+
+void QGCCacheWorker::_endJob(const QGCMapTask *task) {
+    (void)_jobs.remove(task);
+}
+
+void QGCCacheWorker::_abortJobs(const QGCMapTask *except) {
+    for (auto it = _jobs.begin(); it != _jobs.end(); ++it) {
+        if (it.key() != except) {
+            it.value()->aborted = true;
+        }
+    }
+}
+
+bool QGCCacheWorker::_sliceExpired(const QElapsedTimer &slice, int rows) {
+    return (rows >= kSliceRows) || slice.hasExpired(kSliceTime);
+}
+
 void QGCCacheWorker::stop() {
     _stop = true;
+    _readPool.stop();
     QMutexLocker lock(&_taskQueueMutex);
-    qDeleteAll(_taskQueue);
+    qDeleteAll(_taskQueue.takeAll());
+    const QList<QGCTileLookup*> lookups = _taskQueue.takeAllFetches();
     lock.unlock();
 
+    for (QGCTileLookup *lookup : lookups) {
+        lookup->setError("Cache Stopped");
+    }
+
     if (isRunning()) {
         _waitc.wakeAll();
     }
 }
 
+void QGCCacheWorker::setEvictionWatermarks(quint64 high, quint64 low) {
+    QGCCacheEvictor::instance()->setWatermarks(high, low);
+}
+
 bool QGCCacheWorker::enqueueTask(QGCMapTask *task) {
     if (_stop)
         return (false);
@@ -48,104 +175,148 @@ bool QGCCacheWorker::enqueueTask(QGCMapTask *task) {
         return false;
     }
 
-    QMutexLocker lock(&_taskQueueMutex);
-    
-    // 对于获取瓦片的任务（taskFetchTile），检查是否已存在相同 hash 的任务
-    // 如果存在，移除旧任务（避免重复查询），添加新任务（确保最新的信号连接）
+    // 查询与保存任务只是适配：转为轻量查询或直接进入写后缓冲
     if (task->type() == QGCMapTask::taskFetchTile) {
-        QGCFetchTileTask *fetchTask = qobject_cast<QGCFetchTileTask *>(task);
-        if (fetchTask) {
-            QString newHash = fetchTask->hash();
-            // 查找并移除队列中相同 hash 的旧任务
-            for (auto it = _taskQueue.begin(); it != _taskQueue.end(); ++it) {
-                QGCFetchTileTask *existingTask = qobject_cast<QGCFetchTileTask *>(*it);
-                if (existingTask && existingTask->hash() == newHash) {
-                    // 移除旧任务（会被 deleteLater 删除）
-                    _taskQueue.erase(it);
-                    existingTask->deleteLater();
-                    break;
-                }
-            }
-        }
-        // 将新任务插入到队列前面，优先处理最新的请求
-        _taskQueue.prepend(task);
-    } else {
-        // 其他任务添加到队列尾部，保持 FIFO 顺序
-        _taskQueue.append(task);
+        return enqueueLookup(QGCTileLookup::create(static_cast<QGCFetchTileTask *>(task)));
     }
-    
+    if (task->type() == QGCMapTask::taskCacheTile) {
+        const QGCCacheTile *const tile = static_cast<QGCSaveTileTask *>(task)->tile();
+        const bool saved = tile && saveTile(tile->key(), tile->img(), tile->format(),
+                                            tile->type(), tile->tileSet());
+        task->deleteLater();
+        return saved;
+    }
+
+    QMutexLocker lock(&_taskQueueMutex);
+    _taskQueue.enqueue(task);
+    lock.unlock();
+
+    _wake();
+    return true;
+}
+
+bool QGCCacheWorker::enqueueLookup(QGCTileLookup *lookup) {
+    if (_stop) {
+        lookup->setError("Cache Stopped");
+        return false;
+    }
+
+    if (!_valid) {
+        lookup->setError(tr("Database Not Initialized"));
+        return false;
+    }
+
+    // 数据库就绪后，瓦片查询交给只读连接池，不再排在写入和维护任务之后
+    if (_readPool.enqueue(lookup)) {
+        return true;
+    }
+
+    QMutexLocker lock(&_taskQueueMutex);
+    // 同一瓦片的旧查询被新请求替换，旧查询以错误结束，由其发起者改走网络
+    QGCTileLookup *const replaced = _taskQueue.enqueueFetch(lookup);
+    lock.unlock();
+    if (replaced) {
+        replaced->setError("Superseded by a newer request");
+    }
+
+    _wake();
+    return true;
+}
+
+bool QGCCacheWorker::saveTile(quint64 key, const QByteArray &img, const QString &format,
+                              const QString &type, quint64 set) {
+    if (_stop || !_valid) {
+        return false;
+    }
+
+    // 在队列锁内加入写后缓冲，工作线程计算等待时间时不会漏掉唤醒
+    QMutexLocker lock(&_taskQueueMutex);
+    const bool wake = QGCTileWriteBuffer::instance()->add(key, img, format, type, set);
     lock.unlock();
 
+    if (wake || !isRunning()) {
+        _wake();
+    }
+    return true;
+}
+
+void QGCCacheWorker::_wake() {
     if (isRunning()) {
         _waitc.wakeAll();
     } else {
         start(QThread::HighPriority);
     }
+}
 
-    return true;
+void QGCCacheWorker::setIdlePolicy(QGCCacheIdlePolicy policy, int idleTimeout) {
+    _idlePolicy = policy;
+    _idleTimeout = qMax(0, idleTimeout);
 }
 
 void QGCCacheWorker::run() {
     if (!_valid && !_failed) {
+        // 初始化成功后连接保持打开；线程常驻，旧数据的清理只在启动时做一次
         if (!_init()) {
             qCWarning(QGCTileCacheWorkerLog) << "Failed To Init Database";
             return;
         }
+        _deleteBingNoTileTiles();
+        _openKeyFilter();
     }
 
-    if (_valid) {
-        if (_connectDB()) {
-            _deleteBingNoTileTiles();
-        }
-    }
-
+    QGCTileWriteBuffer *const buffer = QGCTileWriteBuffer::instance();
     QMutexLocker lock(&_taskQueueMutex);
     while (!_stop) {
-        if (!_taskQueue.isEmpty()) {
-            // 批量处理优化：收集连续的 saveTile 任务，批量插入数据库
-            QGCMapTask *firstTask = _taskQueue.first();
-            
-            // 如果第一个任务是 saveTile，尝试收集更多连续的 saveTile 任务
-            if (firstTask && firstTask->type() == QGCMapTask::taskCacheTile) {
-                QList<QGCMapTask *> batchTasks;
-                const int maxBatchSize = 50; // 每批最多处理 50 个瓦片
-                while (!_taskQueue.isEmpty() && 
-                       batchTasks.size() < maxBatchSize &&
-                       _taskQueue.first() &&
-                       _taskQueue.first()->type() == QGCMapTask::taskCacheTile) {
-                    batchTasks.append(_taskQueue.takeFirst());
+        const bool flushDue = buffer->isDue();
+        if (flushDue || !_taskQueue.isEmpty()) {
+            if (_valid && !_db) {
+                // 低功耗模式在空闲时关闭了连接
+                lock.unlock();
+                if (_connectDB()) {
+                    _openKeyFilter();
                 }
-                
-                if (batchTasks.size() > 1) {
-                    // 批量处理多个 saveTile 任务
-                    lock.unlock();
-                    _saveTilesBatch(batchTasks);
-                    lock.relock();
-                    // 批量删除任务
-                    for (QGCMapTask *task : batchTasks) {
-                        if (task) {
-                            task->deleteLater();
-                        }
-                    }
-                } else if (batchTasks.size() == 1) {
-                    // 只有一个任务，使用原有逻辑（任务已经在 batchTasks 中）
-                    QGCMapTask *const task = batchTasks.first();
-                    lock.unlock();
-                    if (task) {
-                        _runTask(task);
-                        task->deleteLater();
-                    }
-                    lock.relock();
+                lock.relock();
+            }
+        }
+
+        if (flushDue && _valid && _db) {
+            lock.unlock();
+            _flushWriteBuffer();
+            lock.relock();
+        } else if (_taskQueue.hasFetches()) {
+            // 只读连接池关闭时，排队的查询同样合并为一条 SQL
+            const QList<QGCTileLookup*> lookups =
+                _taskQueue.takeFetchBatch(_readPool.batchSize());
+            lock.unlock();
+            _getTiles(lookups);
+            lock.relock();
+        } else if (!_taskQueue.isEmpty()) {
+            QGCMapTask *const task = _taskQueue.takeNext();
+            if (task && (task->type() == QGCMapTask::taskUpdateTileDownloadState)) {
+                // 离线下载每个瓦片完成时各发一个任务，排队的一段合并为一个事务
+                QList<QGCMapTask*> batchTasks =
+                    _taskQueue.takeDownloadStateBatch(kMaxStateBatch - 1);
+                batchTasks.prepend(task);
+                lock.unlock();
+                _updateTileDownloadStates(batchTasks);
+                for (QGCMapTask *batchTask : std::as_const(batchTasks)) {
+                    batchTask->deleteLater();
                 }
-            } else {
-                // 非 saveTile 任务，使用原有逻辑
-                QGCMapTask *const task = _taskQueue.takeFirst();
+                lock.relock();
+            } else if (task) {
                 lock.unlock();
-                if (task) {
-                    _runTask(task);
-                    task->deleteLater();
+                // 集合、导入导出与清理任务需要看到此前保存的瓦片
+                if (_valid && _db && (task->type() != QGCMapTask::taskReset)) {
+                    _flushWriteBuffer();
                 }
+                const bool done = _runTask(task);
                 lock.relock();
+                if (done) {
+                    task->deleteLater();
+                } else {
+                    // 长任务做完一片，放回通道队首，下一片之前先处理排队的交互请求
+                    _taskQueue.resume(task);
+                }
             }
 
             const qsizetype count = _taskQueue.count();
@@ -162,34 +333,115 @@ void QGCCacheWorker::run() {
                     lock.relock();
                 }
             }
-        } else {
-            (void)_waitc.wait(lock.mutex(), 5000);
-            if (_taskQueue.isEmpty()) {
-                break;
+
+            // 持续浏览时队列可能一直不空，访问记录积累过多时不等空闲直接写入
+            if (_valid && (QGCCacheEvictor::instance()->pendingAccess() >= QGCCacheEvictor::kFlushThreshold)) {
+                lock.unlock();
+                (void)QGCCacheEvictor::instance()->flushAccess(*_db);
+                lock.relock();
+            }
+        } else if (_valid && _db && _hasIdleWork()) {
+            // 空闲时每次只做一小块，做完回到循环顶部检查新任务
+            lock.unlock();
+            _runIdleWork();
+            lock.relock();
+        } else if (!flushDue && !buffer->isEmpty()) {
+            // 等到写后缓冲的时间窗口结束，期间的新任务照常唤醒
+            (void)_waitc.wait(lock.mutex(), buffer->remainingTime());
+        } else if (_db && (_idlePolicy == QGCCacheIdlePolicy::LowPower)) {
+            if (!_waitc.wait(lock.mutex(), _idleTimeout) && _taskQueue.isEmpty() && !_stop) {
+                lock.unlock();
+                _closeDB();
+                lock.relock();
             }
+        } else {
+            // 休眠到有新任务或 stop()，连接、页缓存与已准备的语句保持可用
+            (void)_waitc.wait(lock.mutex());
         }
     }
     lock.unlock();
 
+    // 未完成的长任务在本线程关闭各自的连接
+    _jobs.clear();
+
+    // 退出前写入缓冲中的瓦片
+    if (_valid && !_db && !buffer->isEmpty()) {
+        (void)_connectDB();
+    }
+    _closeDB();
+}
+
+void QGCCacheWorker::_closeDB() {
+    if (_valid && _db) {
+        _flushWriteBuffer();
+        (void)QGCCacheEvictor::instance()->flushAccess(*_db);
+        SetStats stats;
+        if (_getSetStats(0, stats)) {
+            (void)QGCTileKeyFilter::instance()->save(_keyFilterPath(), stats.count);
+        }
+    }
     _disconnectDB();
 }
 
-void QGCCacheWorker::_runTask(QGCMapTask *task) {
+bool QGCCacheWorker::_hasIdleWork() {
+    return QGCCacheEvictor::instance()->hasPendingAccess() || _wantsEviction() ||
+           _convertPending || _compactPending || QGCTileKeyFilter::instance()->isFull();
+}
+
+bool QGCCacheWorker::_wantsEviction() {
+    // 上一块没有删掉任何瓦片时，等默认集合大小变化后再试，避免空转
+    return (_defaultSize != _evictStalledSize) &&
+           QGCCacheEvictor::instance()->needsEviction(_defaultSize);
+}
+
+void QGCCacheWorker::_runIdleWork() {
+    QGCCacheEvictor *const evictor = QGCCacheEvictor::instance();
+    // 先写入访问时间，避免刚看过的瓦片被当作未访问淘汰
+    if (!evictor->flushAccess(*_db)) {
+        evictor->clearPendingAccess();
+    }
+
+    if (_wantsEviction()) {
+        const quint64 low = evictor->lowWatermark();
+        const quint64 amount = (_defaultSize > low) ? (_defaultSize - low) : 0;
+        const qint64 freed = evictor->evictChunk(*_db, _getDefaultTileSet(), amount);
+        _evictStalledSize = (freed > 0) ? 0 : _defaultSize;
+        _compactPending = _compactPending || (freed > 0);
+        _updateTotals();
+        return;
+    }
+
+    // 过滤器写满后误判增多，按当前瓦片数重建
+    QGCTileKeyFilter *const filter = QGCTileKeyFilter::instance();
+    if (filter->isFull()) {
+        SetStats stats;
+        (void)_getSetStats(0, stats);
+        (void)filter->rebuild(*_db, stats.count);
+        return;
+    }
+
+    // 已有图像转换到所选存储，完成后回收空出的包文件
+    QGCTilePackStore *const packs = QGCTilePackStore::instance();
+    if (_convertPending) {
+        _convertPending = (packs->convertStep(*_db, _storage == QGCTileStorage::Pack) > 0);
+        _compactPending = _compactPending || !_convertPending;
+    } else if (_compactPending) {
+        _compactPending = (packs->compactStep(*_db) > 0);
+    }
+}
+
+bool QGCCacheWorker::_runTask(QGCMapTask *task) {
     switch (task->type()) {
     case QGCMapTask::taskInit:
-        break;
+    // 查询与保存在入队时已转为轻量查询或写后缓冲条目
     case QGCMapTask::taskCacheTile:
-        _saveTile(task);
-        break;
     case QGCMapTask::taskFetchTile:
-        _getTile(task);
         break;
     case QGCMapTask::taskFetchTileSets:
         _getTileSets(task);
         break;
     case QGCMapTask::taskCreateTileSet:
-        _createTileSet(task);
-        break;
+        return _createTileSet(task);
     case QGCMapTask::taskGetTileDownloadList:
         _getTileDownloadList(task);
         break;
@@ -197,8 +449,7 @@ void QGCCacheWorker::_runTask(QGCMapTask *task) {
         _updateTileDownloadState(task);
         break;
     case QGCMapTask::taskDeleteTileSet:
-        _deleteTileSet(task);
-        break;
+        return _deleteTileSet(task);
     case QGCMapTask::taskRenameTileSet:
         _renameTileSet(task);
         break;
@@ -206,19 +457,18 @@ void QGCCacheWorker::_runTask(QGCMapTask *task) {
         _pruneCache(task);
         break;
     case QGCMapTask::taskReset:
-        _resetCacheDatabase(task);
-        break;
+        return _resetCacheDatabase(task);
     case QGCMapTask::taskExport:
-        _exportSets(task);
-        break;
+        return _exportSets(task);
     case QGCMapTask::taskImport:
-        _importSets(task);
-        break;
+        return _importSets(task);
     default:
         qCWarning(QGCTileCacheWorkerLog)
             << "given unhandled task type" << task->type();
         break;
     }
+
+    return true;
 }
 
 void QGCCacheWorker::_deleteBingNoTileTiles() {
@@ -245,39 +495,40 @@ void QGCCacheWorker::_deleteBingNoTileTiles() {
     const QByteArray noTileBytes = file.readAll();
     file.close();
 
-    QSqlQuery query(*_db);
-    QList<quint64> idsToDelete;
-    // Select tiles in default set only, sorted by oldest.
-    QString s =
-        QStringLiteral(
-                    "SELECT tileID, tile, hash FROM Tiles WHERE LENGTH(tile) = %1")
-                    .arg(noTileBytes.length());
-    if (!query.exec(s)) {
+    QSqlQuery &query = _statements->prepare(
+        QStringLiteral("SELECT blobID, tile, pack, packOffset, size FROM Blobs WHERE hash = ?"));
+    QList<qint64> idsToDelete;
+    // Identical images are stored once, so look the blob up by content hash.
+    query.addBindValue(static_cast<qint64>(QGCTileBlobStore::contentHash(noTileBytes)));
+    if (!query.exec()) {
         qCWarning(QGCTileCacheWorkerLog) << "query failed";
         return;
     }
 
     while (query.next()) {
-        if (query.value(1).toByteArray() == noTileBytes) {
-            idsToDelete.append(query.value(0).toULongLong());
+        if (QGCTileBlobStore::image(query.value(1).toByteArray(), query.value(2).toLongLong(),
+                                    query.value(3).toLongLong(), query.value(4).toLongLong()) == noTileBytes) {
+            idsToDelete.append(query.value(0).toLongLong());
         }
     }
 
-    for (const quint64 tileId : idsToDelete) {
-        s = QStringLiteral("DELETE FROM Tiles WHERE tileID = %1").arg(tileId);
-        if (!query.exec(s)) {
+    query.finish();
+    QSqlQuery &remove = _statements->prepare(QStringLiteral("DELETE FROM Tiles WHERE blobID = ?"));
+    for (const qint64 blobId : idsToDelete) {
+        remove.addBindValue(blobId);
+        if (!remove.exec()) {
             qCWarning(QGCTileCacheWorkerLog) << "Delete failed";
         }
     }
+    _compactPending = _compactPending || !idsToDelete.isEmpty();
 }
 
 bool QGCCacheWorker::_findTileSetID(const QString &name, quint64 &setID) {
-    QSqlQuery query(*_db);
-    const QString s =
-        QStringLiteral("SELECT setID FROM TileSets WHERE name = \"%1\"")
-                          .arg(name);
-    if (query.exec(s) && query.next()) {
+    QSqlQuery &query = _statements->prepare(QStringLiteral("SELECT setID FROM TileSets WHERE name = ?"));
+    query.addBindValue(name);
+    if (query.exec() && query.next()) {
         setID = query.value(0).toULongLong();
+        query.finish();
         return true;
     }
 
@@ -289,198 +540,138 @@ quint64 QGCCacheWorker::_getDefaultTileSet() {
         return _defaultSet;
     }
 
-    QSqlQuery query(*_db);
-    const QString s =
-        QStringLiteral("SELECT setID FROM TileSets WHERE defaultSet = 1");
-    if (query.exec(s) && query.next()) {
+    QSqlQuery &query = _statements->prepare(QStringLiteral("SELECT setID FROM TileSets WHERE defaultSet = 1"));
+    if (query.exec() && query.next()) {
         _defaultSet = query.value(0).toULongLong();
+        query.finish();
         return _defaultSet;
     }
 
     return 1L;
 }
 
-void QGCCacheWorker::_saveTile(QGCMapTask *mtask) {
-    if (!_valid) {
-        qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (saveTile() open db):" << _db->lastError();
-        return;
-    }
-
-    QGCSaveTileTask *task = static_cast<QGCSaveTileTask *>(mtask);
-    QSqlQuery query(*_db);
-    // 使用 INSERT OR IGNORE 避免 UNIQUE constraint 错误
-    // 如果 hash 已存在，则忽略插入（不更新现有记录）
-    (void)query.prepare("INSERT OR IGNORE INTO Tiles(hash, format, tile, size, type, date) "
-                         "VALUES(?, ?, ?, ?, ?, ?)");
-    query.addBindValue(task->tile()->hash());
-    query.addBindValue(task->tile()->format());
-    query.addBindValue(task->tile()->img());
-    query.addBindValue(task->tile()->img().size());
-    query.addBindValue(task->tile()->type());
-    query.addBindValue(QDateTime::currentSecsSinceEpoch());
-    if (!query.exec()) {
-        qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (add data into Tiles):"
-            << query.lastError().text();
-        return;
-    }
-    
-    // 检查是否实际插入了新行（affectedRows() > 0 表示插入了新行）
-    // 如果 hash 已存在，affectedRows() 为 0，不需要添加到 SetTiles
-    if (query.numRowsAffected() == 0) {
-        // 瓦片已存在，尝试获取现有的 tileID
-        QSqlQuery findQuery(*_db);
-        findQuery.prepare("SELECT tileID FROM Tiles WHERE hash = ?");
-        findQuery.addBindValue(task->tile()->hash());
-        if (findQuery.exec() && findQuery.next()) {
-            const quint64 tileID = findQuery.value(0).toULongLong();
-            const quint64 setID = task->tile()->tileSet() == UINT64_MAX
-                                      ? _getDefaultTileSet()
-                                      : task->tile()->tileSet();
-            // 使用 INSERT OR IGNORE 避免 SetTiles 重复
-            const QString s =
-                QStringLiteral("INSERT OR IGNORE INTO SetTiles(tileID, setID) VALUES(%1, %2)")
-                              .arg(tileID)
-                              .arg(setID);
-            (void)query.prepare(s);
-            if (!query.exec()) {
-                qCWarning(QGCTileCacheWorkerLog)
-                    << "Map Cache SQL error (add tile into SetTiles):"
-                    << query.lastError().text();
-            }
-        }
-        return;
-    }
-
-    const quint64 tileID = query.lastInsertId().toULongLong();
-    const quint64 setID = task->tile()->tileSet() == UINT64_MAX
-                              ? _getDefaultTileSet()
-                              : task->tile()->tileSet();
-    const QString s =
-        QStringLiteral("INSERT INTO SetTiles(tileID, setID) VALUES(%1, %2)")
-                          .arg(tileID)
-                          .arg(setID);
-    (void)query.prepare(s);
-    if (!query.exec()) {
-        qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (add tile into SetTiles):"
-            << query.lastError().text();
-    }
-}
-
-void QGCCacheWorker::_saveTilesBatch(QList<QGCMapTask *> &tasks) {
-    if (!_valid || tasks.isEmpty() || !_db) {
+void QGCCacheWorker::_flushWriteBuffer() {
+    QGCTileWriteBuffer *const buffer = QGCTileWriteBuffer::instance();
+    const QList<QGCTileWriteBuffer::Entry> entries = buffer->pending();
+    if (entries.isEmpty()) {
         return;
     }
 
-    // 开始事务，批量插入可以大幅提高性能
+    // 开始事务，整个窗口内的瓦片一次提交
     if (!_db->transaction()) {
         qCWarning(QGCTileCacheWorkerLog)
             << "Map Cache SQL error (begin transaction):" << _db->lastError().text();
+        buffer->failed(entries);
         return;
     }
 
+    (void)QGCProviderRegistry::instance()->persist(*_db);
     const quint64 defaultSetID = _getDefaultTileSet();
     const qint64 currentTime = QDateTime::currentSecsSinceEpoch();
-    
-    int insertedCount = 0;
-    int skippedCount = 0;
-
-    for (QGCMapTask *mtask : tasks) {
-        if (!mtask) {
-            continue;
-        }
-        
-        QGCSaveTileTask *task = qobject_cast<QGCSaveTileTask *>(mtask);
-        if (!task) {
-            continue;
-        }
-        
-        // 安全获取 tile 对象
-        QGCCacheTile *tile = task->tile();
-        if (!tile) {
-            continue;
+    QGCTileBlobStore store(*_statements, _packs());
+    QList<quint64> inserted;
+    bool ok = true;
+    for (qsizetype start = 0; ok && (start < entries.size()); start += kMaxSaveBatch) {
+        const qsizetype count = qMin(kMaxSaveBatch, entries.size() - start);
+
+        // 已在数据库中的瓦片只需要关联到集合
+        QSqlQuery &find = _statements->prepare(
+            QStringLiteral("SELECT tileID FROM Tiles WHERE tileID IN (%1)")
+                .arg(_placeholders(count, QStringLiteral("?"))));
+        for (qsizetype i = start; i < (start + count); i++) {
+            find.addBindValue(entries.at(i).key);
         }
-
-        // 为每个瓦片创建新的查询对象，避免重用导致的错误
-        QSqlQuery insertQuery(*_db);
-        (void)insertQuery.prepare("INSERT OR IGNORE INTO Tiles(hash, format, tile, size, type, date) "
-                                  "VALUES(?, ?, ?, ?, ?, ?)");
-        insertQuery.addBindValue(tile->hash());
-        insertQuery.addBindValue(tile->format());
-        insertQuery.addBindValue(tile->img());
-        insertQuery.addBindValue(tile->img().size());
-        insertQuery.addBindValue(tile->type());
-        insertQuery.addBindValue(currentTime);
-        
-        if (!insertQuery.exec()) {
+        QSet<quint64> existing;
+        if (!find.exec()) {
             qCWarning(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (batch insert tile):"
-                << insertQuery.lastError().text();
-            continue;
+                << "Map Cache SQL error (find buffered tiles):" << find.lastError().text();
+            ok = false;
+            break;
         }
-
-        quint64 tileID = 0;
-        if (insertQuery.numRowsAffected() > 0) {
-            // 新插入的瓦片
-            tileID = insertQuery.lastInsertId().toULongLong();
-            insertedCount++;
-        } else {
-            // 瓦片已存在，查询现有的 tileID
-            QSqlQuery findQuery(*_db);
-            findQuery.prepare("SELECT tileID FROM Tiles WHERE hash = ?");
-            findQuery.addBindValue(tile->hash());
-            if (findQuery.exec() && findQuery.next()) {
-                tileID = findQuery.value(0).toULongLong();
-                skippedCount++;
-            } else {
-                continue;
+        while (find.next()) {
+            existing.insert(find.value(0).toULongLong());
+        }
+        find.finish();
+
+        // 新瓦片与集合关联各用一条多行语句写入
+        QList<QVariantList> tiles;
+        QList<QVariantList> setTiles;
+        for (qsizetype i = start; ok && (i < (start + count)); i++) {
+            const QGCTileWriteBuffer::Entry &entry = entries.at(i);
+            if (!existing.contains(entry.key)) {
+                const qint64 blobID = store.store(entry.img);
+                if (blobID == 0) {
+                    ok = false;
+                    break;
+                }
+                tiles.append({entry.key, entry.format, blobID, entry.img.size(), currentTime});
+                inserted.append(entry.key);
+            }
+            for (const quint64 set : entry.sets) {
+                setTiles.append({entry.key, (set == UINT64_MAX) ? defaultSetID : set});
             }
         }
 
-        // 添加到 SetTiles
-        const quint64 setID = tile->tileSet() == UINT64_MAX
-                                  ? defaultSetID
-                                  : tile->tileSet();
-        QSqlQuery setTilesQuery(*_db);
-        setTilesQuery.prepare("INSERT OR IGNORE INTO SetTiles(tileID, setID) VALUES(?, ?)");
-        setTilesQuery.addBindValue(tileID);
-        setTilesQuery.addBindValue(setID);
-        if (!setTilesQuery.exec()) {
-            qCWarning(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (batch insert SetTiles):"
-                << setTilesQuery.lastError().text();
-        }
+        ok = ok && _insertRows(QStringLiteral("INSERT OR IGNORE INTO Tiles(tileID, format, blobID, size, date) VALUES %1"),
+                               QStringLiteral("(?, ?, ?, ?, ?)"), tiles);
+        ok = ok && _insertRows(QStringLiteral("INSERT OR IGNORE INTO SetTiles(tileID, setID) VALUES %1"),
+                               QStringLiteral("(?, ?)"), setTiles);
     }
 
-    // 提交事务
-    if (!_db->commit()) {
+    if (!ok || !QGCTilePackStore::instance()->sync() || !_db->commit()) {
         qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (commit transaction):" << _db->lastError().text();
-        _db->rollback();
+            << "Map Cache SQL error (flush buffered tiles):" << _db->lastError().text();
+        (void)_db->rollback();
+        // 留在缓冲中下一个窗口重试，仍可从缓冲读取
+        buffer->failed(entries);
+        return;
+    }
+
+    for (const quint64 key : std::as_const(inserted)) {
+        QGCTileKeyFilter::instance()->insert(key);
     }
+    buffer->committed(entries);
 }
 
-void QGCCacheWorker::_getTile(QGCMapTask *mtask) {
-    if (!_testTask(mtask)) {
-        return;
+bool QGCCacheWorker::_insertRows(const QString &sql, const QString &row, const QList<QVariantList> &rows) {
+    if (rows.isEmpty()) {
+        return true;
     }
 
-    QGCFetchTileTask *task = static_cast<QGCFetchTileTask *>(mtask);
-    QSqlQuery query(*_db);
-    // 使用参数化查询以提高性能和安全性
-    query.prepare("SELECT tile, format, type FROM Tiles WHERE hash = ?");
-    query.addBindValue(task->hash());
-    if (query.exec() && query.next()) {
-        const QByteArray &arrray = query.value(0).toByteArray();
-        const QString &format = query.value(1).toString();
-        const QString &type = query.value(2).toString();
-        QGCCacheTile *tile = new QGCCacheTile(task->hash(), arrray, format, type);
-        task->setTileFetched(tile);
+    // 每种行数对应一条缓存的语句
+    QSqlQuery &query = _statements->prepare(sql.arg(_placeholders(rows.size(), row)));
+    for (const QVariantList &values : rows) {
+        for (const QVariant &value : values) {
+            query.addBindValue(value);
+        }
+    }
+    if (!query.exec()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (insert rows):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+QString QGCCacheWorker::_placeholders(qsizetype count, const QString &item) {
+    QStringList items;
+    items.reserve(count);
+    for (qsizetype i = 0; i < count; i++) {
+        items.append(item);
+    }
+    return items.join(QLatin1String(", "));
+}
+
+void QGCCacheWorker::_getTiles(const QList<QGCTileLookup*> &lookups) {
+    if (!_valid || !_db) {
+        for (QGCTileLookup *lookup : lookups) {
+            lookup->setError("No Cache Database");
+        }
         return;
     }
-    task->setError("Tile not in cache database");
+
+    (void)QGCTileCacheReadPool::readTiles(*_statements, lookups);
 }
 
 void QGCCacheWorker::_getTileSets(QGCMapTask *mtask) {
@@ -533,19 +724,13 @@ void QGCCacheWorker::_updateSetTotals(QGCCachedTileSet *set) {
         return;
     }
 
-    QSqlQuery subquery(*_db);
-    QString sq =
-        QStringLiteral("SELECT COUNT(size), SUM(size) FROM Tiles A INNER JOIN "
-                       "SetTiles B on A.tileID = B.tileID WHERE B.setID = %1")
-                     .arg(set->id());
-
-    if (!subquery.exec(sq) || !subquery.next()) {
-        qCDebug(QGCTileCacheWorkerLog) << sq << subquery.lastError().text();
+    SetStats stats;
+    if (!_getSetStats(set->id(), stats)) {
         return;
     }
 
-    set->setSavedTileCount(subquery.value(0).toUInt());
-    set->setSavedTileSize(subquery.value(1).toULongLong());
+    set->setSavedTileCount(stats.count);
+    set->setSavedTileSize(stats.size);
     // Update (estimated) size
     quint64 avg = UrlFactory::averageSizeForType(set->type());
     if (set->totalTileCount() <= set->savedTileCount()) {
@@ -560,18 +745,9 @@ void QGCCacheWorker::_updateSetTotals(QGCCachedTileSet *set) {
     }
 
     // Now figure out the count for tiles unique to this set
-    quint32 ucount = 0;
-    quint64 usize = 0;
-    sq = QStringLiteral(
-             "SELECT COUNT(size), SUM(size) FROM Tiles WHERE tileID IN (SELECT "
-             "A.tileID FROM SetTiles A join SetTiles B on A.tileID = B.tileID "
-             "WHERE B.setID = %1 GROUP by A.tileID HAVING COUNT(A.tileID) = 1)")
-             .arg(set->id());
-    if (subquery.exec(sq) && subquery.next()) {
-        // This is only accurate when all tiles are downloaded
-        ucount = subquery.value(0).toUInt();
-        usize = subquery.value(1).toULongLong();
-    }
+    // This is only accurate when all tiles are downloaded
+    const quint32 ucount = stats.uniqueCount;
+    quint64 usize = stats.uniqueSize;
 
     // If we haven't downloaded it all, estimate size of unique tiles
     quint32 expectedUcount = set->totalTileCount() - set->savedTileCount();
@@ -585,25 +761,24 @@ void QGCCacheWorker::_updateSetTotals(QGCCachedTileSet *set) {
 }
 
 void QGCCacheWorker::_updateTotals() {
-    QSqlQuery query(*_db);
-    QString s = QStringLiteral("SELECT COUNT(size), SUM(size) FROM Tiles");
+    SetStats stats;
+    if (_getSetStats(0, stats)) {
+        _totalCount = stats.count;
+        _totalSize = stats.size;
+    }
 
-    if (query.exec(s) && query.next()) {
-        _totalCount = query.value(0).toUInt();
-        _totalSize = query.value(1).toULongLong();
+    if (_getSetStats(_getDefaultTileSet(), stats)) {
+        _defaultCount = stats.uniqueCount;
+        _defaultSize = stats.uniqueSize;
     }
 
-    s = QStringLiteral(
-            "SELECT COUNT(size), SUM(size) FROM Tiles WHERE tileID IN (SELECT "
-            "A.tileID FROM SetTiles A join SetTiles B on A.tileID = B.tileID "
-            "WHERE B.setID = %1 GROUP by A.tileID HAVING COUNT(A.tileID) = 1)")
-            .arg(_getDefaultTileSet());
-    if (query.exec(s) && query.next()) {
-        _defaultCount = query.value(0).toUInt();
-        _defaultSize = query.value(1).toULongLong();
+    // 瓦片总大小与去重后实际存储的图像大小之比
+    double dedupRatio = 1.;
+    if (_getSetStats(kBlobStatsID, stats) && (stats.size > 0)) {
+        dedupRatio = static_cast<double>(_totalSize) / static_cast<double>(stats.size);
     }
 
-    emit updateTotals(_totalCount, _totalSize, _defaultCount, _defaultSize);
+    emit updateTotals(_totalCount, _totalSize, _defaultCount, _defaultSize, dedupRatio);
     if (!_updateTimer.isValid()) {
         _updateTimer.start();
     } else {
@@ -611,110 +786,97 @@ void QGCCacheWorker::_updateTotals() {
     }
 }
 
-quint64 QGCCacheWorker::_findTile(const QString &hash) {
-    quint64 tileID = 0;
-
-    QSqlQuery query(*_db);
-    // 使用参数化查询以提高性能
-    query.prepare("SELECT tileID FROM Tiles WHERE hash = ?");
-    query.addBindValue(hash);
-    if (query.exec() && query.next()) {
-        tileID = query.value(0).toULongLong();
-    }
-
-    return tileID;
-}
-
-void QGCCacheWorker::_createTileSet(QGCMapTask *mtask) {
-    if (!_valid) {
-        mtask->setError("Error saving tile set");
-        return;
-    }
-
-    // Create Tile Set
+bool QGCCacheWorker::_createTileSet(QGCMapTask *mtask) {
     QGCCreateTileSetTask *task = static_cast<QGCCreateTileSetTask *>(mtask);
-    QSqlQuery query(*_db);
-    (void)query.prepare("INSERT INTO TileSets("
-                         "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
-                         "bottomRightLon, minZoom, maxZoom, type, numTiles, date"
-                         ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
-    query.addBindValue(task->tileSet()->name());
-    query.addBindValue(task->tileSet()->mapTypeStr());
-    query.addBindValue(task->tileSet()->topleftLat());
-    query.addBindValue(task->tileSet()->topleftLon());
-    query.addBindValue(task->tileSet()->bottomRightLat());
-    query.addBindValue(task->tileSet()->bottomRightLon());
-    query.addBindValue(task->tileSet()->minZoom());
-    query.addBindValue(task->tileSet()->maxZoom());
-    query.addBindValue(
-        UrlFactory::getQtMapIdFromProviderType(task->tileSet()->type()));
-    query.addBindValue(task->tileSet()->totalTileCount());
-    query.addBindValue(QDateTime::currentSecsSinceEpoch());
-    if (!query.exec()) {
-        qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (add tileSet into TileSets):"
-            << query.lastError().text();
+    CreateJob &job = _job<CreateJob>(mtask);
+    if (!_valid || job.aborted) {
+        _endJob(mtask);
         mtask->setError("Error saving tile set");
-        return;
+        return true;
+    }
+    if (task->isCancelled()) {
+        if (job.setID != 0) {
+            _deleteTileSet(job.setID);
+        }
+        _endJob(mtask);
+        mtask->setError("Tile set creation cancelled");
+        return true;
     }
 
-    // Get just created (auto-incremented) setID
-    const quint64 setID = query.lastInsertId().toULongLong();
-    task->tileSet()->setId(setID);
-    // Prepare Download List
-    (void)_db->transaction();
-    for (int z = task->tileSet()->minZoom(); z <= task->tileSet()->maxZoom();
-         z++) {
+    if (job.setID == 0) {
+        // Create Tile Set
+        QSqlQuery query(*_db);
+        (void)query.prepare("INSERT INTO TileSets("
+                             "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
+                             "bottomRightLon, minZoom, maxZoom, type, numTiles, date"
+                             ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+        query.addBindValue(task->tileSet()->name());
+        query.addBindValue(task->tileSet()->mapTypeStr());
+        query.addBindValue(task->tileSet()->topleftLat());
+        query.addBindValue(task->tileSet()->topleftLon());
+        query.addBindValue(task->tileSet()->bottomRightLat());
+        query.addBindValue(task->tileSet()->bottomRightLon());
+        query.addBindValue(task->tileSet()->minZoom());
+        query.addBindValue(task->tileSet()->maxZoom());
+        query.addBindValue(
+            UrlFactory::getQtMapIdFromProviderType(task->tileSet()->type()));
+        query.addBindValue(task->tileSet()->totalTileCount());
+        query.addBindValue(QDateTime::currentSecsSinceEpoch());
+        if (!query.exec()) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (add tileSet into TileSets):"
+                << query.lastError().text();
+            _endJob(mtask);
+            mtask->setError("Error saving tile set");
+            return true;
+        }
+
+        // Get just created (auto-incremented) setID
+        job.setID = query.lastInsertId().toULongLong();
+        job.zoom = task->tileSet()->minZoom();
+        task->tileSet()->setId(job.setID);
+        (void)QGCProviderRegistry::instance()->persist(*_db);
+    }
+
+    // Prepare Download List: 每个缩放级别保存一个瓦片范围，已缓存的瓦片在生成下载批次时识别
+    const QString type = task->tileSet()->type();
+    const quint32 provider = QGCProviderRegistry::instance()->id(type);
+    QGCDownloadPlan plan(*_statements);
+    QElapsedTimer slice;
+    slice.start();
+    bool ok = _db->transaction();
+    for (int rows = 0; ok && (job.zoom <= task->tileSet()->maxZoom()) && !_sliceExpired(slice, rows); rows++) {
         const QGCTileSet set = UrlFactory::getTileCount(
-            z, task->tileSet()->topleftLon(), task->tileSet()->topleftLat(),
+            job.zoom, task->tileSet()->topleftLon(), task->tileSet()->topleftLat(),
             task->tileSet()->bottomRightLon(), task->tileSet()->bottomRightLat(),
-            task->tileSet()->type());
-        const QString type = task->tileSet()->type();
-        for (int x = set.tileX0; x <= set.tileX1; x++) {
-            for (int y = set.tileY0; y <= set.tileY1; y++) {
-                // See if tile is already downloaded
-                const QString hash = UrlFactory::getTileHash(type, x, y, z);
-                const quint64 tileID = _findTile(hash);
-                if (tileID == 0) {
-                    // Set to download
-                    (void)query.prepare(
-                        "INSERT OR IGNORE INTO TilesDownload(setID, hash, type, x, y, z, "
-                        "state) VALUES(?, ?, ?, ?, ? ,? ,?)");
-                    query.addBindValue(setID);
-                    query.addBindValue(hash);
-                    query.addBindValue(UrlFactory::getQtMapIdFromProviderType(type));
-                    query.addBindValue(x);
-                    query.addBindValue(y);
-                    query.addBindValue(z);
-                    query.addBindValue(0);
-                    if (!query.exec()) {
-                        qCWarning(QGCTileCacheWorkerLog)
-                            << "Map Cache SQL error (add tile into TilesDownload):"
-                            << query.lastError().text();
-                        mtask->setError("Error creating tile set download list");
-                        return;
-                    }
-                } else {
-                    // Tile already in the database. No need to dowload.
-                    const QString s =
-                        QStringLiteral("INSERT OR IGNORE INTO SetTiles(tileID, setID) "
-                                       "VALUES(%1, %2)")
-                                          .arg(tileID)
-                                          .arg(setID);
-                    (void)query.prepare(s);
-                    if (!query.exec()) {
-                        qCWarning(QGCTileCacheWorkerLog)
-                            << "Map Cache SQL error (add tile into SetTiles):"
-                            << query.lastError().text();
-                    }
-                    qCDebug(QGCTileCacheWorkerLog) << "Already Cached HASH:" << hash;
-                }
-            }
-        }
+            type);
+        ok = plan.addRange(job.setID, provider, job.zoom, set.tileX0, set.tileY0, set.tileX1, set.tileY1);
+        job.zoom++;
+    }
+    if (!ok || !_db->commit()) {
+        (void)_db->rollback();
+        _deleteTileSet(job.setID);
+        _endJob(mtask);
+        mtask->setError("Error creating tile set download list");
+        return true;
     }
-    (void)_db->commit();
+    if (job.zoom <= task->tileSet()->maxZoom()) {
+        return false;
+    }
+
+    _endJob(mtask);
     _updateSetTotals(task->tileSet());
     task->setTileSetSaved();
+    return true;
+}
+
+void QGCCacheWorker::_yieldToFetches() {
+    QMutexLocker lock(&_taskQueueMutex);
+    const QList<QGCTileLookup*> lookups = _taskQueue.takeFetchBatch(_readPool.batchSize());
+    lock.unlock();
+    if (!lookups.isEmpty()) {
+        _getTiles(lookups);
+    }
 }
 
 void QGCCacheWorker::_getTileDownloadList(QGCMapTask *mtask) {
@@ -725,68 +887,66 @@ void QGCCacheWorker::_getTileDownloadList(QGCMapTask *mtask) {
     QQueue<QGCTile *> tiles;
     QGCGetTileDownloadListTask *task =
         static_cast<QGCGetTileDownloadListTask *>(mtask);
-    QSqlQuery query(*_db);
-    QString s = QStringLiteral("SELECT hash, type, x, y, z FROM TilesDownload "
-                               "WHERE setID = %1 AND state = 0 LIMIT %2")
-                    .arg(task->setID())
-                    .arg(task->count());
-    if (query.exec(s)) {
-        while (query.next()) {
-            QGCTile *tile = new QGCTile;
-            // tile->setTileSet(task->setID());
-            tile->setHash(query.value("hash").toString());
-            tile->setType(
-                UrlFactory::getProviderTypeFromQtMapId(query.value("type").toInt()));
-            tile->setX(query.value("x").toInt());
-            tile->setY(query.value("y").toInt());
-            tile->setZ(query.value("z").toInt());
-            tiles.enqueue(tile);
-        }
-
-        for (int i = 0; i < tiles.size(); i++) {
-            s = QStringLiteral("UPDATE TilesDownload SET state = %1 WHERE setID = %2 "
-                               "and hash = \"%3\"")
-                    .arg(static_cast<int>(QGCTile::StateDownloading))
-                    .arg(task->setID())
-                    .arg(tiles[i]->hash());
-            if (!query.exec(s)) {
-                qCWarning(QGCTileCacheWorkerLog)
-                    << "Map Cache SQL error (set TilesDownload state):"
-                    << query.lastError().text();
-            }
-        }
+    QGCDownloadPlan plan(*_statements);
+    QList<quint64> keys;
+    // 大片已缓存的区域需要扫描多块，块之间处理排队的瓦片查询
+    (void)plan.next(task->setID(), task->count(), keys, [this]() { _yieldToFetches(); });
+    for (const quint64 key : std::as_const(keys)) {
+        QGCTile *tile = new QGCTile;
+        // tile->setTileSet(task->setID());
+        tile->setKey(key);
+        tile->setType(UrlFactory::tileKeyToType(key));
+        tile->setX(QGCTileKey::x(key));
+        tile->setY(QGCTileKey::y(key));
+        tile->setZ(QGCTileKey::z(key));
+        tiles.enqueue(tile);
     }
     task->setTileListFetched(tiles);
 }
 
 void QGCCacheWorker::_updateTileDownloadState(QGCMapTask *mtask) {
-    if (!_testTask(mtask)) {
+    QList<QGCMapTask*> tasks = {mtask};
+    _updateTileDownloadStates(tasks);
+}
+
+void QGCCacheWorker::_updateTileDownloadStates(const QList<QGCMapTask *> &tasks) {
+    if (tasks.isEmpty() || !_testTask(tasks.constFirst())) {
         return;
     }
 
-    QGCUpdateTileDownloadStateTask *task =
-        static_cast<QGCUpdateTileDownloadStateTask *>(mtask);
-    QSqlQuery query(*_db);
-    QString s;
-    if (task->state() == QGCTile::StateComplete) {
-        s = QStringLiteral(
-                "DELETE FROM TilesDownload WHERE setID = %1 AND hash = \"%2\"")
-                .arg(task->setID())
-                .arg(task->hash());
-    } else if (task->hash() == "*") {
-        s = QStringLiteral("UPDATE TilesDownload SET state = %1 WHERE setID = %2")
-                .arg(static_cast<int>(task->state()))
-                .arg(task->setID());
-    } else {
-        s = QStringLiteral("UPDATE TilesDownload SET state = %1 WHERE setID = %2 "
-                           "AND hash = \"%3\"")
-                .arg(static_cast<int>(task->state()))
-                .arg(task->setID())
-                .arg(task->hash());
+    // 完成的瓦片按集合合并，一个事务内每个范围只写一次；
+    // 标记完成与 rewind 互不影响，顺序无关。出错的瓦片保持未完成，恢复下载时 rewind 后重新发出
+    QHash<quint64, QList<quint64>> completed;
+    QList<quint64> rewound;
+    for (QGCMapTask *mtask : tasks) {
+        const QGCUpdateTileDownloadStateTask *task =
+            static_cast<QGCUpdateTileDownloadStateTask *>(mtask);
+        if (task->state() == QGCTile::StateComplete) {
+            completed[task->setID()].append(task->key());
+        } else if ((task->key() == QGCUpdateTileDownloadStateTask::kAllTiles) &&
+                   (task->state() == QGCTile::StatePending) && !rewound.contains(task->setID())) {
+            rewound.append(task->setID());
+        }
     }
 
-    if (!query.exec(s)) {
-        qCWarning(QGCTileCacheWorkerLog) << "Error:" << query.lastError().text();
+    if (!_db->transaction()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (begin transaction):" << _db->lastError().text();
+        return;
+    }
+
+    QGCDownloadPlan plan(*_statements);
+    bool ok = true;
+    for (auto it = completed.constBegin(); ok && (it != completed.constEnd()); ++it) {
+        ok = plan.complete(it.key(), it.value());
+    }
+    for (const quint64 setID : std::as_const(rewound)) {
+        ok = ok && plan.rewind(setID);
+    }
+    if (!ok || !_db->commit()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (update download state):" << _db->lastError().text();
+        (void)_db->rollback();
     }
 }
 
@@ -796,62 +956,97 @@ void QGCCacheWorker::_pruneCache(QGCMapTask *mtask) {
     }
 
     QGCPruneCacheTask *task = static_cast<QGCPruneCacheTask *>(mtask);
-    QSqlQuery query(*_db);
-    // Select tiles in default set only, sorted by oldest.
-    QString s =
-        QStringLiteral("SELECT tileID, size, hash FROM Tiles WHERE tileID IN "
-                               "(SELECT A.tileID FROM SetTiles A join SetTiles B on "
-                               "A.tileID = B.tileID WHERE B.setID = %1 GROUP by A.tileID "
-                               "HAVING COUNT(A.tileID) = 1) ORDER BY DATE ASC LIMIT 128")
-                    .arg(_getDefaultTileSet());
-    if (!query.exec(s)) {
-        return;
-    }
-
-    QList<quint64> tlist;
-    qint64 amount = static_cast<qint64>(task->amount());
-    while (query.next() && (amount >= 0)) {
-        tlist << query.value(0).toULongLong();
-        amount -= query.value(1).toULongLong();
-    }
-
-    while (!tlist.isEmpty()) {
-        s = QStringLiteral("DELETE FROM Tiles WHERE tileID = %1").arg(tlist[0]);
-        tlist.removeFirst();
-        if (!query.exec(s)) {
+    QGCCacheEvictor *const evictor = QGCCacheEvictor::instance();
+    (void)evictor->flushAccess(*_db);
+    // Delete least recently used tiles in default set only, one chunk at a time.
+    quint64 amount = task->amount();
+    while (amount > 0) {
+        const qint64 freed = evictor->evictChunk(*_db, _getDefaultTileSet(), amount);
+        if (freed <= 0) {
             break;
         }
+        amount -= qMin(amount, static_cast<quint64>(freed));
+        _compactPending = true;
     }
 
     task->setPruned();
 }
 
-void QGCCacheWorker::_deleteTileSet(QGCMapTask *mtask) {
+bool QGCCacheWorker::_deleteTileSet(QGCMapTask *mtask) {
     if (!_testTask(mtask)) {
-        return;
+        return true;
     }
 
+    // 已删除的部分无法恢复，开始后不响应取消
     QGCDeleteTileSetTask *task = static_cast<QGCDeleteTileSetTask *>(mtask);
-    _deleteTileSet(task->setID());
+    bool ok = true;
+    if (!_deleteTileSetSlice(task->setID(), ok)) {
+        return false;
+    }
+
+    if (!ok) {
+        task->setError("Error deleting tile set");
+        return true;
+    }
     task->setTileSetDeleted();
+    return true;
 }
 
 void QGCCacheWorker::_deleteTileSet(qulonglong id) {
-    QSqlQuery query(*_db);
+    bool ok = true;
+    while (!_deleteTileSetSlice(id, ok)) {
+    }
+}
+
+bool QGCCacheWorker::_deleteTileSetSlice(qulonglong id, bool &ok) {
+    ok = false;
+    // 每片处理该集合中 tileID 最小的 kSliceRows 个瓦片，进度就是数据库本身
+    QSqlQuery &bound = _statements->prepare(
+        QStringLiteral("SELECT tileID FROM SetTiles WHERE setID = ? ORDER BY tileID LIMIT 1 OFFSET ?"));
+    bound.addBindValue(id);
+    bound.addBindValue(kSliceRows - 1);
+    if (!bound.exec()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (find tile set slice):" << bound.lastError().text();
+        return true;
+    }
+    const bool last = !bound.next();
+    const QVariant upper = last ? QVariant(std::numeric_limits<qint64>::max()) : bound.value(0);
+    bound.finish();
+
     // Only delete tiles unique to this set
-    QString s = QStringLiteral(
-                    "DELETE FROM Tiles WHERE tileID IN (SELECT A.tileID FROM "
-                    "SetTiles A JOIN SetTiles B ON A.tileID = B.tileID WHERE "
-                    "B.setID = %1 GROUP BY A.tileID HAVING COUNT(A.tileID) = 1)")
-                    .arg(id);
-    (void)query.exec(s);
-    s = QStringLiteral("DELETE FROM TilesDownload WHERE setID = %1").arg(id);
-    (void)query.exec(s);
-    s = QStringLiteral("DELETE FROM TileSets WHERE setID = %1").arg(id);
-    (void)query.exec(s);
-    s = QStringLiteral("DELETE FROM SetTiles WHERE setID = %1").arg(id);
-    (void)query.exec(s);
+    QSqlQuery &tiles = _statements->prepare(
+        QStringLiteral("DELETE FROM Tiles WHERE tileID IN (%1 AND B.tileID <= ?)").arg(_uniqueTileIDs()));
+    QSqlQuery &setTiles = _statements->prepare(
+        QStringLiteral("DELETE FROM SetTiles WHERE setID = ? AND tileID <= ?"));
+    tiles.addBindValue(id);
+    tiles.addBindValue(upper);
+    setTiles.addBindValue(id);
+    setTiles.addBindValue(upper);
+    // SetTiles 的行只能与其独有的瓦片一起删除，否则瓦片失去引用后再也不会被删除
+    if (!_db->transaction() || !tiles.exec() || !setTiles.exec() || !_db->commit()) {
+        // 集合保留，可以再次删除
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (delete tile set):" << _db->lastError().text()
+            << tiles.lastError().text() << setTiles.lastError().text();
+        (void)_db->rollback();
+        return true;
+    }
+    _compactPending = true;
+    if (!last) {
+        return false;
+    }
+
+    (void)QGCDownloadPlan(*_statements).remove(id);
+    QSqlQuery &sets = _statements->prepare(QStringLiteral("DELETE FROM TileSets WHERE setID = ?"));
+    sets.addBindValue(id);
+    ok = sets.exec();
+    if (!ok) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (delete tile set):" << sets.lastError().text();
+    }
     _updateTotals();
+    return true;
 }
 
 void QGCCacheWorker::_renameTileSet(QGCMapTask *mtask) {
@@ -861,21 +1056,34 @@ void QGCCacheWorker::_renameTileSet(QGCMapTask *mtask) {
 
     QGCRenameTileSetTask *task = static_cast<QGCRenameTileSetTask *>(mtask);
     QSqlQuery query(*_db);
-    const QString s =
-        QStringLiteral("UPDATE TileSets SET name = \"%1\" WHERE setID = %2")
-                          .arg(task->newName())
-                          .arg(task->setID());
-    if (!query.exec(s)) {
+    (void)query.prepare("UPDATE TileSets SET name = ? WHERE setID = ?");
+    query.addBindValue(task->newName());
+    query.addBindValue(task->setID());
+    if (!query.exec()) {
         task->setError("Error renaming tile set");
     }
 }
 
-void QGCCacheWorker::_resetCacheDatabase(QGCMapTask *mtask) {
+bool QGCCacheWorker::_resetCacheDatabase(QGCMapTask *mtask) {
     if (!_testTask(mtask)) {
-        return;
+        return true;
     }
 
+    // 先分片删除瓦片（触发器同时清理 SetTiles 与 Blobs），最后删除已经很小的表并重建。
+    // 已删除的部分无法恢复，开始后不响应取消
     QGCResetTask *task = static_cast<QGCResetTask *>(mtask);
+    QGCTileWriteBuffer::instance()->clear();
+    QSqlQuery &tiles = _statements->prepare(
+        QStringLiteral("DELETE FROM Tiles WHERE tileID IN (SELECT tileID FROM Tiles LIMIT ?)"));
+    tiles.addBindValue(kSliceRows);
+    if (tiles.exec() && (tiles.numRowsAffected() >= kSliceRows)) {
+        _compactPending = true;
+        return false;
+    }
+
+    // 未结束的语句会锁住要删除的表；读线程在重建完成前不再查询
+    _statements->clear();
+    _readPool.close();
     QSqlQuery query(*_db);
     QString s = QStringLiteral("DROP TABLE Tiles");
     (void)query.exec(s);
@@ -883,345 +1091,523 @@ void QGCCacheWorker::_resetCacheDatabase(QGCMapTask *mtask) {
     (void)query.exec(s);
     s = QStringLiteral("DROP TABLE SetTiles");
     (void)query.exec(s);
-    s = QStringLiteral("DROP TABLE TilesDownload");
+    s = QStringLiteral("DROP TABLE DownloadRanges");
+    (void)query.exec(s);
+    s = QStringLiteral("DROP TABLE DownloadPages");
+    (void)query.exec(s);
+    s = QStringLiteral("DROP TABLE Providers");
     (void)query.exec(s);
+    s = QStringLiteral("DROP TABLE CacheStats");
+    (void)query.exec(s);
+    s = QStringLiteral("DROP TABLE Blobs");
+    (void)query.exec(s);
+    s = QStringLiteral("DROP TABLE Packs");
+    (void)query.exec(s);
+    QGCProviderRegistry::instance()->clear();
+    QGCCacheEvictor::instance()->clearPendingAccess();
+    QGCTilePackStore::instance()->discard();
+    QGCTileKeyFilter::instance()->clear();
+    QGCTileWriteBuffer::instance()->clear();
     _valid = _createDB(*_db);
+    if (_valid) {
+        _openPacks();
+    }
+    _readPool.reopen();
+    QGCTileMemoryCache::instance()->clear();
+    _abortJobs(mtask);
     task->setResetCompleted();
+    return true;
 }
 
-void QGCCacheWorker::_importSets(QGCMapTask *mtask) {
+bool QGCCacheWorker::_importSets(QGCMapTask *mtask) {
     if (!_testTask(mtask)) {
-        return;
+        _endJob(mtask);
+        return true;
     }
 
     QGCImportTileTask *task = static_cast<QGCImportTileTask *>(mtask);
     // If replacing, simply copy over it
     if (task->replace()) {
+        // 读线程的只读连接同样打开着数据库与 WAL 文件，先全部关闭
+        _readPool.close();
         // Close and delete old database
         _disconnectDB();
-        (void)QFile::remove(_databasePath);
+        _removeDatabaseFiles();
         // Copy given database
-        (void)QFile::copy(task->path(), _databasePath);
+        const bool copied = QFile::copy(task->path(), _databasePath);
+        if (!copied) {
+            task->setError("Error copying import database");
+        }
+        // 包文件属于被替换的数据库；新数据库引用的包不存在时其瓦片在打开时删除
+        QGCTilePackStore::instance()->discard();
+        QGCTileKeyFilter::instance()->invalidate();
+        (void)QFile::remove(_keyFilterPath());
         task->setProgress(25);
-        _init();
-        if (_valid) {
+        QGCCacheEvictor::instance()->clearPendingAccess();
+        QGCTileMemoryCache::instance()->clear();
+        _abortJobs(mtask);
+        // _init() 成功后连接保持打开，直接使用；复制失败时得到一个空数据库
+        if (_init()) {
             task->setProgress(50);
-            _connectDB();
+            _openKeyFilter();
+        } else if (copied) {
+            task->setError("Error opening imported database");
         }
+        _readPool.reopen();
         task->setProgress(100);
-    } else {
+        task->setImportCompleted();
+        return true;
+    }
+
+    ImportJob &job = _job<ImportJob>(mtask);
+    if (job.aborted || task->isCancelled()) {
+        // 已提交的分片保留，导入到一半的集合照常可用
+        task->setError(job.aborted ? "Cache database was replaced during import" : "Import cancelled");
+        _endJob(mtask);
+        task->setImportCompleted();
+        return true;
+    }
+
+    if (!job.db) {
         // Open imported set
-        QSqlDatabase *dbImport =
-            new QSqlDatabase(QSqlDatabase::addDatabase("QSQLITE", kExportSession));
-        dbImport->setDatabaseName(task->path());
-        dbImport->setConnectOptions("QSQLITE_ENABLE_SHARED_CACHE");
-        if (dbImport->open()) {
-            QSqlQuery query(*dbImport);
-            // Prepare progress report
-            quint64 tileCount = 0;
-            int lastProgress = -1;
-            QString s = QStringLiteral("SELECT COUNT(tileID) FROM Tiles");
-            if (query.exec(s) && query.next()) {
-                // Total number of tiles in imported database
-                tileCount = query.value(0).toULongLong();
+        job.db = std::make_unique<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE", kExportSession));
+        job.db->setDatabaseName(task->path());
+        job.db->setConnectOptions("QSQLITE_ENABLE_SHARED_CACHE");
+        if (!job.db->open()) {
+            task->setError("Error opening import database");
+            _endJob(mtask);
+            task->setImportCompleted();
+            return true;
+        }
+        job.statements = std::make_unique<QGCSqlStatementCache>(*job.db);
+
+        QSqlQuery query(*job.db);
+        // Prepare progress report
+        if (query.exec(QStringLiteral("SELECT COUNT(tileID) FROM Tiles")) && query.next()) {
+            // Total number of tiles in imported database
+            job.tileCount = query.value(0).toULongLong();
+        }
+
+        // v1 数据库以字符串 hash 为键；v2 数据库的 provider id 需要映射为本地 id；
+        // v6 起图像保存在 Blobs 表
+        const int importVersion = _schemaVersion(*job.db);
+        job.legacy = (importVersion < kKeyedSchemaVersion);
+        job.blobs = (importVersion >= kBlobSchemaVersion);
+        if (!job.legacy && query.exec("SELECT id, name FROM Providers")) {
+            while (query.next()) {
+                job.providers.insert(
+                    query.value(0).toUInt(),
+                    QGCProviderRegistry::instance()->id(query.value(1).toString()));
             }
+        }
 
-            if (tileCount > 0) {
-                // Iterate Tile Sets
-                s = QStringLiteral(
-                    "SELECT * FROM TileSets ORDER BY defaultSet DESC, name ASC");
-                if (query.exec(s)) {
-                    quint64 currentCount = 0;
-                    while (query.next()) {
-                        QString name = query.value("name").toString();
-                        const quint64 setID = query.value("setID").toULongLong();
-                        const QString mapType = query.value("typeStr").toString();
-                        const double topleftLat = query.value("topleftLat").toDouble();
-                        const double topleftLon = query.value("topleftLon").toDouble();
-                        const double bottomRightLat =
-                            query.value("bottomRightLat").toDouble();
-                        const double bottomRightLon =
-                            query.value("bottomRightLon").toDouble();
-                        const int minZoom = query.value("minZoom").toInt();
-                        const int maxZoom = query.value("maxZoom").toInt();
-                        const int type = query.value("type").toInt();
-                        const quint32 numTiles = query.value("numTiles").toUInt();
-                        const int defaultSet = query.value("defaultSet").toInt();
-                        quint64 insertSetID = _getDefaultTileSet();
-                        // If not default set, create new one
-                        if (defaultSet == 0) {
-                            // Check if we have this tile set already
-                            if (_findTileSetID(name, insertSetID)) {
-                                int testCount = 0;
-                                // Set with this name already exists. Make name unique.
-                                while (true) {
-                                    const QString testName = QString::asprintf(
-                                        "%s %02d", name.toLatin1().constData(), ++testCount);
-                                    if (!_findTileSetID(testName, insertSetID) ||
-                                        (testCount > 99)) {
-                                        name = testName;
-                                        break;
-                                    }
-                                }
-                            }
-                            // Create new set
-                            QSqlQuery cQuery(*_db);
-                            (void)cQuery.prepare(
-                                "INSERT INTO TileSets("
-                                "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
-                                "bottomRightLon, minZoom, maxZoom, type, numTiles, "
-                                "defaultSet, date"
-                                ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
-                            cQuery.addBindValue(name);
-                            cQuery.addBindValue(mapType);
-                            cQuery.addBindValue(topleftLat);
-                            cQuery.addBindValue(topleftLon);
-                            cQuery.addBindValue(bottomRightLat);
-                            cQuery.addBindValue(bottomRightLon);
-                            cQuery.addBindValue(minZoom);
-                            cQuery.addBindValue(maxZoom);
-                            cQuery.addBindValue(type);
-                            cQuery.addBindValue(numTiles);
-                            cQuery.addBindValue(defaultSet);
-                            cQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
-                            if (!cQuery.exec()) {
-                                task->setError("Error adding imported tile set to database");
-                                break;
-                            } else {
-                                // Get just created (auto-incremented) setID
-                                insertSetID = cQuery.lastInsertId().toULongLong();
-                            }
-                        }
+        if (job.tileCount > 0) {
+            // Iterate Tile Sets
+            if (query.exec(QStringLiteral("SELECT * FROM TileSets ORDER BY defaultSet DESC, name ASC"))) {
+                while (query.next()) {
+                    ImportJob::Set set;
+                    set.name = query.value("name").toString();
+                    set.setID = query.value("setID").toULongLong();
+                    set.mapType = query.value("typeStr").toString();
+                    set.topleftLat = query.value("topleftLat").toDouble();
+                    set.topleftLon = query.value("topleftLon").toDouble();
+                    set.bottomRightLat = query.value("bottomRightLat").toDouble();
+                    set.bottomRightLon = query.value("bottomRightLon").toDouble();
+                    set.minZoom = query.value("minZoom").toInt();
+                    set.maxZoom = query.value("maxZoom").toInt();
+                    set.type = query.value("type").toInt();
+                    set.numTiles = query.value("numTiles").toUInt();
+                    set.defaultSet = query.value("defaultSet").toInt();
+                    job.sets.append(set);
+                }
+            } else {
+                task->setError("No tile set in database");
+            }
+        }
+    }
 
-                        // Find set tiles
-                        QSqlQuery cQuery(*_db);
-                        QSqlQuery subQuery(*dbImport);
-                        const QString sb =
-                            QStringLiteral("SELECT * FROM Tiles WHERE tileID IN (SELECT "
-                                                          "A.tileID FROM SetTiles A JOIN SetTiles B ON "
-                                                          "A.tileID = B.tileID WHERE B.setID = %1 GROUP "
-                                                          "BY A.tileID HAVING COUNT(A.tileID) = 1)")
-                                               .arg(setID);
-                        if (subQuery.exec(sb)) {
-                            quint64 tilesFound = 0;
-                            quint64 tilesSaved = 0;
-                            (void)_db->transaction();
-                            while (subQuery.next()) {
-                                tilesFound++;
-                                const QString hash = subQuery.value("hash").toString();
-                                const QString format = subQuery.value("format").toString();
-                                const QByteArray img = subQuery.value("tile").toByteArray();
-                                const int type = subQuery.value("type").toInt();
-                                // Save tile
-                                (void)cQuery.prepare(
-                                    "INSERT INTO Tiles(hash, format, tile, size, type, date) "
-                                    "VALUES(?, ?, ?, ?, ?, ?)");
-                                cQuery.addBindValue(hash);
-                                cQuery.addBindValue(format);
-                                cQuery.addBindValue(img);
-                                cQuery.addBindValue(img.size());
-                                cQuery.addBindValue(type);
-                                cQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
-                                if (cQuery.exec()) {
-                                    tilesSaved++;
-                                    const quint64 importTileID =
-                                        cQuery.lastInsertId().toULongLong();
-                                    const QString s2 =
-                                        QStringLiteral(
-                                                           "INSERT INTO SetTiles(tileID, setID) VALUES(%1, %2)")
-                                                           .arg(importTileID)
-                                                           .arg(insertSetID);
-                                    (void)cQuery.prepare(s2);
-                                    (void)cQuery.exec();
-                                    currentCount++;
-                                    if (tileCount > 0) {
-                                        const int progress =
-                                            static_cast<int>((static_cast<double>(currentCount) /
-                                                                               static_cast<double>(tileCount)) *
-                                                                              100.0);
-                                        // Avoid calling this if (int) progress hasn't changed.
-                                        if (lastProgress != progress) {
-                                            lastProgress = progress;
-                                            task->setProgress(progress);
-                                        }
-                                    }
-                                }
-                            }
-
-                            (void)_db->commit();
-                            if (tilesSaved > 0) {
-                                // Update tile count (if any added)
-                                s = QStringLiteral(
-                                        "SELECT COUNT(size) FROM Tiles A INNER JOIN SetTiles B "
-                                        "on A.tileID = B.tileID WHERE B.setID = %1")
-                                        .arg(insertSetID);
-                                if (cQuery.exec(s) && cQuery.next()) {
-                                    const quint64 count = cQuery.value(0).toULongLong();
-                                    s = QStringLiteral(
-                                            "UPDATE TileSets SET numTiles = %1 WHERE setID = %2")
-                                            .arg(count)
-                                            .arg(insertSetID);
-                                    (void)cQuery.exec(s);
-                                }
-                            }
-
-                            const qint64 uniqueTiles = tilesFound - tilesSaved;
-                            if (static_cast<quint64>(uniqueTiles) < tileCount) {
-                                tileCount -= uniqueTiles;
-                            } else {
-                                tileCount = 0;
-                            }
-
-                            // If there was nothing new in this set, remove it.
-                            if ((tilesSaved == 0) && (defaultSet == 0)) {
-                                qCDebug(QGCTileCacheWorkerLog)
-                                    << "No unique tiles in" << name << "Removing it.";
-                                _deleteTileSet(insertSetID);
-                            }
+    QElapsedTimer slice;
+    slice.start();
+    int rows = 0;
+    while ((job.set < job.sets.size()) && !_sliceExpired(slice, rows)) {
+        ImportJob::Set &set = job.sets[job.set];
+        if (job.insertSetID == UINT64_MAX) {
+            job.insertSetID = _getDefaultTileSet();
+            // If not default set, create new one
+            if (set.defaultSet == 0) {
+                // Check if we have this tile set already
+                if (_findTileSetID(set.name, job.insertSetID)) {
+                    int testCount = 0;
+                    // Set with this name already exists. Make name unique.
+                    while (true) {
+                        const QString testName = QString::asprintf(
+                            "%s %02d", set.name.toLatin1().constData(), ++testCount);
+                        if (!_findTileSetID(testName, job.insertSetID) ||
+                            (testCount > 99)) {
+                            set.name = testName;
+                            break;
                         }
                     }
+                }
+                // Create new set
+                QSqlQuery cQuery(*_db);
+                (void)cQuery.prepare(
+                    "INSERT INTO TileSets("
+                    "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
+                    "bottomRightLon, minZoom, maxZoom, type, numTiles, "
+                    "defaultSet, date"
+                    ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+                cQuery.addBindValue(set.name);
+                cQuery.addBindValue(set.mapType);
+                cQuery.addBindValue(set.topleftLat);
+                cQuery.addBindValue(set.topleftLon);
+                cQuery.addBindValue(set.bottomRightLat);
+                cQuery.addBindValue(set.bottomRightLon);
+                cQuery.addBindValue(set.minZoom);
+                cQuery.addBindValue(set.maxZoom);
+                cQuery.addBindValue(set.type);
+                cQuery.addBindValue(set.numTiles);
+                cQuery.addBindValue(set.defaultSet);
+                cQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
+                if (!cQuery.exec()) {
+                    task->setError("Error adding imported tile set to database");
+                    job.set = job.sets.size();
+                    break;
+                }
+                // Get just created (auto-incremented) setID
+                job.insertSetID = cQuery.lastInsertId().toULongLong();
+            }
+        }
+
+        // Find set tiles, one page per slice in tileID order
+        QString ids = _uniqueTileIDs();
+        if (!job.cursor.isNull()) {
+            ids += QStringLiteral(" AND B.tileID > ?");
+        }
+        const QString sb = job.blobs
+            ? QStringLiteral("SELECT T.tileID, T.format, B.tile FROM Tiles T "
+                             "JOIN Blobs B ON B.blobID = T.blobID "
+                             "WHERE T.tileID IN (%1) ORDER BY T.tileID LIMIT ?")
+                  .arg(ids)
+            : QStringLiteral("SELECT * FROM Tiles WHERE tileID IN (%1) ORDER BY tileID LIMIT ?")
+                  .arg(ids);
+        QSqlQuery &subQuery = job.statements->prepare(sb);
+        subQuery.addBindValue(set.setID);
+        if (!job.cursor.isNull()) {
+            subQuery.addBindValue(job.cursor);
+        }
+        subQuery.addBindValue(kSliceRows);
+        qsizetype page = 0;
+        bool expired = false;
+        if (subQuery.exec()) {
+            QGCTileBlobStore store(*_statements, _packs());
+            QSqlQuery &cQuery = _statements->prepare(
+                QStringLiteral("INSERT INTO SetTiles(tileID, setID) VALUES(?, ?)"));
+            if (!_db->transaction()) {
+                task->setError("Error importing tiles");
+                job.set = job.sets.size();
+                break;
+            }
+            while (!expired && subQuery.next()) {
+                page++;
+                expired = _sliceExpired(slice, ++rows);
+                job.cursor = subQuery.value("tileID");
+                job.tilesFound++;
+                quint64 key = QGCTileKey::kInvalid;
+                if (job.legacy) {
+                    key = QGCProviderRegistry::instance()->keyFromLegacyHash(
+                        subQuery.value("hash").toString());
                 } else {
-                    task->setError("No tile set in database");
+                    const quint64 importKey = subQuery.value("tileID").toULongLong();
+                    key = QGCTileKey::withProvider(
+                        importKey, job.providers.value(QGCTileKey::provider(importKey)));
+                }
+                if (!QGCTileKey::isValid(key)) {
+                    continue;
+                }
+                const QString format = subQuery.value("format").toString();
+                const QByteArray img = subQuery.value("tile").toByteArray();
+                // 导入文件旁没有包文件，只能导入内嵌的图像
+                if (img.isEmpty()) {
+                    continue;
+                }
+                // Save tile
+                bool inserted = false;
+                (void)store.insertTile(key, format, img,
+                                       QDateTime::currentSecsSinceEpoch(), &inserted);
+                if (inserted) {
+                    job.tilesSaved++;
+                    cQuery.addBindValue(key);
+                    cQuery.addBindValue(job.insertSetID);
+                    (void)cQuery.exec();
+                    job.currentCount++;
+                    if (job.tileCount > 0) {
+                        const int progress =
+                            static_cast<int>((static_cast<double>(job.currentCount) /
+                                              static_cast<double>(job.tileCount)) *
+                                             100.0);
+                        // Avoid calling this if (int) progress hasn't changed.
+                        if (job.lastProgress != progress) {
+                            job.lastProgress = progress;
+                            task->setProgress(progress);
+                        }
+                    }
                 }
             }
-            delete dbImport;
-            QSqlDatabase::removeDatabase(kExportSession);
-            if (tileCount == 0) {
-                task->setError("No unique tiles in imported database");
+            subQuery.finish();
+
+            (void)QGCProviderRegistry::instance()->persist(*_db);
+            // 游标已经越过这一页，提交失败时不能继续，导入以错误结束
+            if (!QGCTilePackStore::instance()->sync() || !_db->commit()) {
+                qCWarning(QGCTileCacheWorkerLog)
+                    << "Map Cache SQL error (commit imported tiles):" << _db->lastError().text();
+                (void)_db->rollback();
+                task->setError("Error importing tiles");
+                job.set = job.sets.size();
+                break;
             }
+        }
+
+        // 最后一页不满，集合导入完成
+        if (expired || (page == kSliceRows)) {
+            continue;
+        }
+
+        if (job.tilesSaved > 0) {
+            // Update tile count (if any added)
+            SetStats stats;
+            if (_getSetStats(job.insertSetID, stats)) {
+                QSqlQuery update(*_db);
+                (void)update.prepare("UPDATE TileSets SET numTiles = ? WHERE setID = ?");
+                update.addBindValue(stats.count);
+                update.addBindValue(job.insertSetID);
+                (void)update.exec();
+            }
+        }
+
+        const qint64 uniqueTiles = job.tilesFound - job.tilesSaved;
+        if (static_cast<quint64>(uniqueTiles) < job.tileCount) {
+            job.tileCount -= uniqueTiles;
         } else {
-            task->setError("Error opening import database");
+            job.tileCount = 0;
         }
+
+        // If there was nothing new in this set, remove it.
+        if ((job.tilesSaved == 0) && (set.defaultSet == 0)) {
+            qCDebug(QGCTileCacheWorkerLog)
+                << "No unique tiles in" << set.name << "Removing it.";
+            _deleteTileSet(job.insertSetID);
+        }
+
+        job.set++;
+        job.insertSetID = UINT64_MAX;
+        job.cursor = QVariant();
+        job.tilesFound = 0;
+        job.tilesSaved = 0;
+    }
+
+    if (job.set < job.sets.size()) {
+        return false;
+    }
+
+    if (job.tileCount == 0) {
+        task->setError("No unique tiles in imported database");
     }
+    _endJob(mtask);
     task->setImportCompleted();
+    return true;
 }
 
-void QGCCacheWorker::_exportSets(QGCMapTask *mtask) {
+bool QGCCacheWorker::_exportSets(QGCMapTask *mtask) {
     if (!_testTask(mtask)) {
-        return;
+        _endJob(mtask);
+        return true;
     }
 
     QGCExportTileTask *task = static_cast<QGCExportTileTask *>(mtask);
-    // Delete target if it exists
-    (void)QFile::remove(task->path());
-    // Create exported database
-    QScopedPointer<QSqlDatabase> dbExport(
-        new QSqlDatabase(QSqlDatabase::addDatabase("QSQLITE", kExportSession)));
-    dbExport->setDatabaseName(task->path());
-    dbExport->setConnectOptions("QSQLITE_ENABLE_SHARED_CACHE");
-    if (dbExport->open()) {
-        if (_createDB(*dbExport, false)) {
-            // Prepare progress report
-            quint64 tileCount = 0;
-            quint64 currentCount = 0;
-            for (int i = 0; i < task->sets().count(); i++) {
-                const QGCCachedTileSet *set = task->sets().at(i);
-                // Default set has no unique tiles
-                if (set->defaultSet()) {
-                    tileCount += set->totalTileCount();
-                } else {
-                    tileCount += set->uniqueTileCount();
-                }
+    ExportJob &job = _job<ExportJob>(mtask);
+    if (job.aborted || task->isCancelled()) {
+        // 不完整的导出文件没有用处
+        task->setError(job.aborted ? "Cache database was replaced during export" : "Export cancelled");
+        _endJob(mtask);
+        (void)QFile::remove(task->path());
+        task->setExportCompleted();
+        return true;
+    }
+
+    if (!job.db) {
+        // Delete target if it exists
+        (void)QFile::remove(task->path());
+        // Create exported database
+        job.db = std::make_unique<QSqlDatabase>(QSqlDatabase::addDatabase("QSQLITE", kExportSession));
+        job.db->setDatabaseName(task->path());
+        job.db->setConnectOptions("QSQLITE_ENABLE_SHARED_CACHE");
+        if (!job.db->open()) {
+            qCCritical(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (create export database):"
+                << job.db->lastError();
+            task->setError("Error opening export database");
+            _endJob(mtask);
+            task->setExportCompleted();
+            return true;
+        }
+        // 瓦片键中的 provider id 只在本数据库内有效，导出映射表供导入时转换
+        if (!_createDB(*job.db, false) ||
+            !QGCProviderRegistry::instance()->save(*job.db)) {
+            task->setError("Error creating export database");
+            _endJob(mtask);
+            task->setExportCompleted();
+            return true;
+        }
+        job.statements = std::make_unique<QGCSqlStatementCache>(*job.db);
+
+        // Prepare progress report
+        for (int i = 0; i < task->sets().count(); i++) {
+            const QGCCachedTileSet *set = task->sets().at(i);
+            // Default set has no unique tiles
+            if (set->defaultSet()) {
+                job.tileCount += set->totalTileCount();
+            } else {
+                job.tileCount += set->uniqueTileCount();
             }
+        }
 
-            if (tileCount == 0) {
-                tileCount = 1;
+        if (job.tileCount == 0) {
+            job.tileCount = 1;
+        }
+    }
+
+    // Iterate sets to save
+    QGCTileBlobStore store(*job.statements);
+    QSqlQuery &setTiles = job.statements->prepare(
+        QStringLiteral("INSERT INTO SetTiles(tileID, setID) VALUES(?, ?)"));
+    QSqlQuery &tile = _statements->prepare(
+        QStringLiteral("SELECT T.format, B.tile, B.pack, B.packOffset, B.size FROM Tiles T "
+                       "JOIN Blobs B ON B.blobID = T.blobID WHERE T.tileID = ?"));
+    QElapsedTimer slice;
+    slice.start();
+    int rows = 0;
+    while ((job.set < task->sets().count()) && !_sliceExpired(slice, rows)) {
+        const QGCCachedTileSet *set = task->sets().at(job.set);
+        if (job.exportSetID == 0) {
+            // Create Tile Exported Set
+            QSqlQuery exportQuery(*job.db);
+            (void)exportQuery.prepare(
+                "INSERT INTO TileSets("
+                "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
+                "bottomRightLon, minZoom, maxZoom, type, numTiles, defaultSet, date"
+                ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+            exportQuery.addBindValue(set->name());
+            exportQuery.addBindValue(set->mapTypeStr());
+            exportQuery.addBindValue(set->topleftLat());
+            exportQuery.addBindValue(set->topleftLon());
+            exportQuery.addBindValue(set->bottomRightLat());
+            exportQuery.addBindValue(set->bottomRightLon());
+            exportQuery.addBindValue(set->minZoom());
+            exportQuery.addBindValue(set->maxZoom());
+            exportQuery.addBindValue(
+                UrlFactory::getQtMapIdFromProviderType(set->type()));
+            exportQuery.addBindValue(set->totalTileCount());
+            exportQuery.addBindValue(set->defaultSet());
+            exportQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
+            if (!exportQuery.exec()) {
+                task->setError("Error adding tile set to exported database");
+                job.set = task->sets().count();
+                break;
             }
 
-            // Iterate sets to save
-            for (int i = 0; i < task->sets().count(); i++) {
-                const QGCCachedTileSet *set = task->sets().at(i);
-                // Create Tile Exported Set
-                QSqlQuery exportQuery(*dbExport);
-                (void)exportQuery.prepare(
-                    "INSERT INTO TileSets("
-                    "name, typeStr, topleftLat, topleftLon, bottomRightLat, "
-                    "bottomRightLon, minZoom, maxZoom, type, numTiles, defaultSet, date"
-                    ") VALUES(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
-                exportQuery.addBindValue(set->name());
-                exportQuery.addBindValue(set->mapTypeStr());
-                exportQuery.addBindValue(set->topleftLat());
-                exportQuery.addBindValue(set->topleftLon());
-                exportQuery.addBindValue(set->bottomRightLat());
-                exportQuery.addBindValue(set->bottomRightLon());
-                exportQuery.addBindValue(set->minZoom());
-                exportQuery.addBindValue(set->maxZoom());
-                exportQuery.addBindValue(
-                    UrlFactory::getQtMapIdFromProviderType(set->type()));
-                exportQuery.addBindValue(set->totalTileCount());
-                exportQuery.addBindValue(set->defaultSet());
-                exportQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
-                if (!exportQuery.exec()) {
-                    task->setError("Error adding tile set to exported database");
-                    break;
-                }
+            // Get just created (auto-incremented) setID
+            job.exportSetID = exportQuery.lastInsertId().toULongLong();
+        }
 
-                // Get just created (auto-incremented) setID
-                const quint64 exportSetID = exportQuery.lastInsertId().toULongLong();
-                // Find set tiles
-                QString s = QStringLiteral("SELECT * FROM SetTiles WHERE setID = %1")
-                                .arg(set->id());
-                QSqlQuery query(*_db);
-                if (!query.exec(s)) {
-                    continue;
-                }
+        // Find set tiles, one page per slice in tileID order
+        QList<QVariant> tileIDs;
+        QSqlQuery &query = _statements->prepare(job.cursor.isNull()
+            ? QStringLiteral("SELECT tileID FROM SetTiles WHERE setID = ? ORDER BY tileID LIMIT ?")
+            : QStringLiteral("SELECT tileID FROM SetTiles WHERE setID = ? AND tileID > ? ORDER BY tileID LIMIT ?"));
+        query.addBindValue(set->id());
+        if (!job.cursor.isNull()) {
+            query.addBindValue(job.cursor);
+        }
+        query.addBindValue(kSliceRows);
+        if (query.exec()) {
+            while (query.next()) {
+                tileIDs.append(query.value(0));
+            }
+        }
+        query.finish();
 
-                (void)dbExport->transaction();
-                while (query.next()) {
-                    const quint64 tileID = query.value("tileID").toULongLong();
-                    // Get tile
-                    s = QStringLiteral("SELECT * FROM Tiles WHERE tileID = \"%1\"")
-                            .arg(tileID);
-                    QSqlQuery subQuery(*_db);
-                    if (!subQuery.exec(s) || !subQuery.next()) {
-                        continue;
-                    }
+        qsizetype page = 0;
+        bool expired = false;
+        if (!job.db->transaction()) {
+            task->setError("Error writing export database");
+            job.set = task->sets().count();
+            break;
+        }
+        for (; !expired && (page < tileIDs.size()); page++) {
+            expired = _sliceExpired(slice, ++rows);
+            job.cursor = tileIDs.at(page);
+            const quint64 tileID = job.cursor.toULongLong();
+            // Get tile
+            tile.addBindValue(job.cursor);
+            if (!tile.exec() || !tile.next()) {
+                continue;
+            }
 
-                    const QString hash = subQuery.value("hash").toString();
-                    const QString format = subQuery.value("format").toString();
-                    const QByteArray img = subQuery.value("tile").toByteArray();
-                    const int type = subQuery.value("type").toInt();
-                    // Save tile
-                    (void)exportQuery.prepare(
-                        "INSERT INTO Tiles(hash, format, tile, size, type, date) "
-                        "VALUES(?, ?, ?, ?, ?, ?)");
-                    exportQuery.addBindValue(hash);
-                    exportQuery.addBindValue(format);
-                    exportQuery.addBindValue(img);
-                    exportQuery.addBindValue(img.size());
-                    exportQuery.addBindValue(type);
-                    exportQuery.addBindValue(QDateTime::currentSecsSinceEpoch());
-                    if (!exportQuery.exec()) {
-                        continue;
-                    }
+            const QString format = tile.value(0).toString();
+            // 导出文件总是内嵌图像，不依赖本机的包文件
+            const QByteArray img = QGCTileBlobStore::image(
+                tile.value(1).toByteArray(), tile.value(2).toLongLong(),
+                tile.value(3).toLongLong(), tile.value(4).toLongLong());
+            tile.finish();
+            if (img.isEmpty()) {
+                continue;
+            }
+            // Save tile (the same tile may belong to several exported sets)
+            if (!store.insertTile(tileID, format, img, QDateTime::currentSecsSinceEpoch())) {
+                continue;
+            }
 
-                    const quint64 exportTileID = exportQuery.lastInsertId().toULongLong();
-                    s = QStringLiteral(
-                            "INSERT INTO SetTiles(tileID, setID) VALUES(%1, %2)")
-                            .arg(exportTileID)
-                            .arg(exportSetID);
-                    (void)exportQuery.prepare(s);
-                    (void)exportQuery.exec();
-                    currentCount++;
-                    task->setProgress(
-                        static_cast<int>((static_cast<double>(currentCount) /
-                                          static_cast<double>(tileCount)) *
-                                         100.0));
-                }
-                (void)dbExport->commit();
+            setTiles.addBindValue(tileID);
+            setTiles.addBindValue(job.exportSetID);
+            (void)setTiles.exec();
+            job.currentCount++;
+            const int progress = static_cast<int>((static_cast<double>(job.currentCount) /
+                                                   static_cast<double>(job.tileCount)) *
+                                                  100.0);
+            if (job.lastProgress != progress) {
+                job.lastProgress = progress;
+                task->setProgress(progress);
             }
-        } else {
-            task->setError("Error creating export database");
         }
-    } else {
-        qCCritical(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (create export database):"
-            << dbExport->lastError();
-        task->setError("Error opening export database");
+        if (!job.db->commit()) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (commit exported tiles):" << job.db->lastError().text();
+            (void)job.db->rollback();
+            task->setError("Error writing export database");
+            job.set = task->sets().count();
+            break;
+        }
+
+        // 最后一页不满，集合导出完成
+        if ((page < tileIDs.size()) || (tileIDs.size() == kSliceRows)) {
+            continue;
+        }
+
+        job.set++;
+        job.exportSetID = 0;
+        job.cursor = QVariant();
     }
-    dbExport.reset();
-    QSqlDatabase::removeDatabase(kExportSession);
+
+    if (job.set < task->sets().count()) {
+        return false;
+    }
+
+    // 导出期间新登记的地图类型
+    (void)QGCProviderRegistry::instance()->save(*job.db);
+    _endJob(mtask);
     task->setExportCompleted();
+    return true;
 }
 
 bool QGCCacheWorker::_testTask(QGCMapTask *mtask) {
@@ -1239,17 +1625,30 @@ bool QGCCacheWorker::_init() {
         qCDebug(QGCTileCacheWorkerLog)
             << "Mapping cache directory:" << _databasePath;
         // Initialize Database
-        if (_connectDB()) {
+        bool connected = _connectDB();
+        if (!connected) {
+            // 只有无法打开的文件才删除重建；迁移失败的数据库保留在最后提交的版本
+            qCCritical(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (open db):" << _db->lastError();
+            _disconnectDB();
+            _removeDatabaseFiles();
+            connected = _connectDB();
+        }
+        if (connected) {
             _valid = _createDB(*_db);
-            if (!_valid) {
+            if (_valid) {
+                _openPacks();
+            } else {
                 _failed = true;
             }
         } else {
             qCCritical(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (open db):" << _db->lastError();
+                << "Map Cache SQL error (create db):" << _db->lastError();
             _failed = true;
         }
-        _disconnectDB();
+        if (_failed) {
+            _disconnectDB();
+        }
     } else {
         qCCritical(QGCTileCacheWorkerLog)
             << "Could not find suitable cache directory.";
@@ -1259,7 +1658,46 @@ bool QGCCacheWorker::_init() {
     return !_failed;
 }
 
+void QGCCacheWorker::_openPacks() {
+    QGCTilePackStore *const packs = QGCTilePackStore::instance();
+    packs->setAppendEnabled(_storage == QGCTileStorage::Pack);
+    const QString directory = QFileInfo(_databasePath).absoluteDir().filePath(kPackDirectory);
+    if (!packs->open(*_db, directory)) {
+        qCWarning(QGCTileCacheWorkerLog) << "Tile packs unavailable, storing images in the database";
+    }
+
+    // 已有图像与所选存储不一致时在空闲时逐块转换
+    _convertPending = packs->isOpen();
+    _compactPending = packs->isOpen();
+}
+
+void QGCCacheWorker::_openKeyFilter() {
+    QGCTileKeyFilter *const filter = QGCTileKeyFilter::instance();
+    const QString path = _keyFilterPath();
+    if (filter->isReady()) {
+        // 工作线程上次退出时写入的文件，之后的写入不会反映到文件中
+        (void)QFile::remove(path);
+        return;
+    }
+
+    SetStats stats;
+    (void)_getSetStats(0, stats);
+    if (!filter->load(path, stats.count)) {
+        (void)filter->rebuild(*_db, stats.count);
+    }
+}
+
+QString QGCCacheWorker::_keyFilterPath() const {
+    return _databasePath + QLatin1String(kKeyFilterSuffix);
+}
+
+QGCTilePackStore *QGCCacheWorker::_packs() const {
+    QGCTilePackStore *const packs = QGCTilePackStore::instance();
+    return packs->appendEnabled() ? packs : nullptr;
+}
+
 bool QGCCacheWorker::_connectDB() {
+    _statements.reset();
     (void)_db.reset(
         new QSqlDatabase(QSqlDatabase::addDatabase("QSQLITE", kSession)));
     _db->setDatabaseName(_databasePath);
@@ -1270,82 +1708,83 @@ bool QGCCacheWorker::_connectDB() {
     _valid = _db->open();
     
     if (_valid) {
-        // 启用 WAL (Write-Ahead Logging) 模式，大幅提高并发写入性能
-        // WAL 模式允许多个读取和一个写入同时进行，而不需要锁整个数据库
-        QSqlQuery query(*_db);
-        if (!query.exec("PRAGMA journal_mode=WAL")) {
-            qCWarning(QGCTileCacheWorkerLog) 
-                << "Failed to enable WAL mode:" << query.lastError().text();
-        } else {
-            // 设置同步模式为 NORMAL（在 WAL 模式下更安全且性能更好）
-            // NORMAL 模式在 WAL 下比 FULL 模式快很多，但仍保证数据完整性
-            (void)query.exec("PRAGMA synchronous=NORMAL");
-            // 设置 WAL 自动检查点大小（默认 1000 页，约 4MB）
-            // 可以根据需要调整，更大的值可以减少检查点频率，提高写入性能
-            (void)query.exec("PRAGMA wal_autocheckpoint=2000");
+        if (_enableWAL(*_db)) {
             // 设置缓存大小（页数，每页 4KB，这里设置为 16MB）
+            QSqlQuery query(*_db);
             (void)query.exec("PRAGMA cache_size=-4096");
             qCDebug(QGCTileCacheWorkerLog) << "WAL mode enabled for better concurrent write performance";
         }
+        _statements = std::make_unique<QGCSqlStatementCache>(*_db);
     }
     
     return _valid;
 }
 
-bool QGCCacheWorker::_createDB(QSqlDatabase &db, bool createDefault) {
-    bool res = false;
+bool QGCCacheWorker::_enableWAL(QSqlDatabase &db) {
+    // 启用 WAL (Write-Ahead Logging) 模式，大幅提高并发写入性能
+    // WAL 模式允许多个读取和一个写入同时进行，而不需要锁整个数据库
     QSqlQuery query(db);
-    if (!query.exec("CREATE TABLE IF NOT EXISTS Tiles ("
-                    "tileID INTEGER PRIMARY KEY NOT NULL, "
-                    "hash TEXT NOT NULL UNIQUE, "
-                    "format TEXT NOT NULL, "
-                    "tile BLOB NULL, "
-                    "size INTEGER, "
-                    "type INTEGER, "
-                    "date INTEGER DEFAULT 0)")) {
+    if (!query.exec("PRAGMA journal_mode=WAL")) {
         qCWarning(QGCTileCacheWorkerLog)
-            << "Map Cache SQL error (create Tiles db):" << query.lastError().text();
-    } else {
-        (void)query.exec(
-            "CREATE INDEX IF NOT EXISTS hash ON Tiles ( hash, size, type ) ");
-        if (!query.exec("CREATE TABLE IF NOT EXISTS TileSets ("
-                        "setID INTEGER PRIMARY KEY NOT NULL, "
-                        "name TEXT NOT NULL UNIQUE, "
-                        "typeStr TEXT, "
-                        "topleftLat REAL DEFAULT 0.0, "
-                        "topleftLon REAL DEFAULT 0.0, "
-                        "bottomRightLat REAL DEFAULT 0.0, "
-                        "bottomRightLon REAL DEFAULT 0.0, "
-                        "minZoom INTEGER DEFAULT 3, "
-                        "maxZoom INTEGER DEFAULT 3, "
-                        "type INTEGER DEFAULT -1, "
-                        "numTiles INTEGER DEFAULT 0, "
-                        "defaultSet INTEGER DEFAULT 0, "
-                        "date INTEGER DEFAULT 0)")) {
-            qCWarning(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (create TileSets db):"
-                << query.lastError().text();
-        } else if (!query.exec("CREATE TABLE IF NOT EXISTS SetTiles ("
-                               "setID INTEGER, "
-                               "tileID INTEGER)")) {
-            qCWarning(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (create SetTiles db):"
-                << query.lastError().text();
-        } else if (!query.exec("CREATE TABLE IF NOT EXISTS TilesDownload ("
-                               "setID INTEGER, "
-                               "hash TEXT NOT NULL UNIQUE, "
-                               "type INTEGER, "
-                               "x INTEGER, "
-                               "y INTEGER, "
-                               "z INTEGER, "
-                               "state INTEGER DEFAULT 0)")) {
-            qCWarning(QGCTileCacheWorkerLog)
-                << "Map Cache SQL error (create TilesDownload db):"
-                << query.lastError().text();
-        } else {
-            // Database it ready for use
-            res = true;
+            << "Failed to enable WAL mode:" << query.lastError().text();
+        return false;
+    }
+
+    // 设置同步模式为 NORMAL（在 WAL 模式下更安全且性能更好）
+    // NORMAL 模式在 WAL 下比 FULL 模式快很多，但仍保证数据完整性
+    (void)query.exec("PRAGMA synchronous=NORMAL");
+    // 设置 WAL 自动检查点大小（默认 1000 页，约 4MB）
+    // 可以根据需要调整，更大的值可以减少检查点频率，提高写入性能
+    (void)query.exec("PRAGMA wal_autocheckpoint=2000");
+    return true;
+}
+
+int QGCCacheWorker::_schemaVersion(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    if (query.exec("PRAGMA user_version") && query.next()) {
+        return query.value(0).toInt();
+    }
+
+    return 0;
+}
+
+QString QGCCacheWorker::_uniqueTileIDs() {
+    // 只属于该集合的瓦片，集合 ID 作为参数绑定；SetTiles 主键按 setID 取出集合，tileID 索引检查是否被其他集合引用
+    return QStringLiteral("SELECT B.tileID FROM SetTiles B WHERE B.setID = ? AND NOT EXISTS "
+                          "(SELECT 1 FROM SetTiles A WHERE A.tileID = B.tileID AND A.setID != B.setID)");
+}
+
+bool QGCCacheWorker::_createDB(QSqlDatabase &db, bool createDefault) {
+    bool res = true;
+    QSqlQuery query(db);
+
+    int version = _schemaVersion(db);
+    // 引入 user_version 之前的缓存数据库
+    if ((version == 0) && query.exec("SELECT hash FROM Tiles LIMIT 0")) {
+        version = 1;
+    }
+
+    if ((version > 0) && (version < kSchemaVersion)) {
+        // 迁移会重写整张表，回滚日志只记录被修改的原有页，
+        // WAL 则会把所有新页写一遍；迁移完成后主连接恢复 WAL（连接一直保持打开）
+        (void)query.exec("PRAGMA journal_mode=DELETE");
+        while (res && (version < kSchemaVersion)) {
+            res = _migrate(db, ++version);
         }
+        if (res && (&db == _db.get())) {
+            (void)_enableWAL(db);
+        }
+    } else if (version > kSchemaVersion) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map cache schema" << version << "is newer than" << kSchemaVersion;
+    }
+
+    res = res && _createSchema(db);
+    if (res && createDefault) {
+        res = QGCProviderRegistry::instance()->load(db);
+    }
+    if (res && (version < kSchemaVersion)) {
+        (void)query.exec(QStringLiteral("PRAGMA user_version = %1").arg(kSchemaVersion));
     }
 
     // Create default tile set
@@ -1374,13 +1813,723 @@ bool QGCCacheWorker::_createDB(QSqlDatabase &db, bool createDefault) {
     }
 
     if (!res) {
-        (void)QFile::remove(_databasePath);
+        // 每个迁移步骤各自提交，失败时数据库停在最后提交的 user_version，离线瓦片集保留
+        qCCritical(QGCTileCacheWorkerLog)
+            << "Map cache schema setup failed at version" << _schemaVersion(db)
+            << db.databaseName();
+        if (&db == _db.get()) {
+            _valid = false;
+            _failed = true;
+        }
     }
 
     return res;
 }
 
+void QGCCacheWorker::_removeDatabaseFiles() {
+    (void)QFile::remove(_databasePath);
+    (void)QFile::remove(_databasePath + QStringLiteral("-wal"));
+    (void)QFile::remove(_databasePath + QStringLiteral("-shm"));
+    (void)QFile::remove(_databasePath + QStringLiteral("-journal"));
+}
+
+bool QGCCacheWorker::_createSchema(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    if (!query.exec("CREATE TABLE IF NOT EXISTS Providers ("
+                    "id INTEGER PRIMARY KEY NOT NULL, "
+                    "name TEXT NOT NULL UNIQUE)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create Providers db):" << query.lastError().text();
+    } else if (!query.exec("CREATE TABLE IF NOT EXISTS Tiles ("
+                           "tileID INTEGER PRIMARY KEY NOT NULL, "
+                           "format TEXT NOT NULL, "
+                           "blobID INTEGER NOT NULL DEFAULT 0, "
+                           "size INTEGER, "
+                           "date INTEGER DEFAULT 0, "
+                           "access INTEGER NOT NULL DEFAULT 0)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create Tiles db):" << query.lastError().text();
+    } else if (!query.exec("CREATE INDEX IF NOT EXISTS TilesAccess ON Tiles (access, date)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create Tiles index):" << query.lastError().text();
+    } else if (!query.exec("CREATE TABLE IF NOT EXISTS TileSets ("
+                           "setID INTEGER PRIMARY KEY NOT NULL, "
+                           "name TEXT NOT NULL UNIQUE, "
+                           "typeStr TEXT, "
+                           "topleftLat REAL DEFAULT 0.0, "
+                           "topleftLon REAL DEFAULT 0.0, "
+                           "bottomRightLat REAL DEFAULT 0.0, "
+                           "bottomRightLon REAL DEFAULT 0.0, "
+                           "minZoom INTEGER DEFAULT 3, "
+                           "maxZoom INTEGER DEFAULT 3, "
+                           "type INTEGER DEFAULT -1, "
+                           "numTiles INTEGER DEFAULT 0, "
+                           "defaultSet INTEGER DEFAULT 0, "
+                           "date INTEGER DEFAULT 0)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create TileSets db):"
+            << query.lastError().text();
+    } else if (!query.exec("CREATE TABLE IF NOT EXISTS SetTiles ("
+                           "setID INTEGER NOT NULL, "
+                           "tileID INTEGER NOT NULL, "
+                           "PRIMARY KEY (setID, tileID)) WITHOUT ROWID") ||
+               !query.exec("CREATE INDEX IF NOT EXISTS SetTilesTile ON SetTiles (tileID)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create SetTiles db):"
+            << query.lastError().text();
+    } else if (!_createDownloadPlans(db)) {
+        qCWarning(QGCTileCacheWorkerLog) << "Map Cache SQL error (create DownloadRanges db)";
+    } else if (!_createStats(db)) {
+        qCWarning(QGCTileCacheWorkerLog) << "Map Cache SQL error (create CacheStats db)";
+    } else if (!_createBlobs(db)) {
+        qCWarning(QGCTileCacheWorkerLog) << "Map Cache SQL error (create Blobs db)";
+    } else {
+        // Database it ready for use
+        return true;
+    }
+
+    return false;
+}
+
+bool QGCCacheWorker::_createStats(QSqlDatabase &db) {
+    // 每个集合一行（setID 0 为整个 Tiles 表），由触发器随写入和删除增量维护，
+    // 统计只需按主键读一行。SetTiles 只统计 Tiles 中存在的瓦片；
+    // 删除瓦片时先级联删除 SetTiles，使集合计数与 Tiles 保持一致
+    static const char *const statements[] = {
+        "CREATE TABLE IF NOT EXISTS CacheStats ("
+        "setID INTEGER PRIMARY KEY NOT NULL, "
+        "tiles INTEGER NOT NULL DEFAULT 0, "
+        "size INTEGER NOT NULL DEFAULT 0, "
+        "uniqueTiles INTEGER NOT NULL DEFAULT 0, "
+        "uniqueSize INTEGER NOT NULL DEFAULT 0)",
+        "INSERT OR IGNORE INTO CacheStats(setID) VALUES(0)",
+
+        "CREATE TRIGGER IF NOT EXISTS TilesInsertStats AFTER INSERT ON Tiles BEGIN "
+        "UPDATE CacheStats SET tiles = tiles + 1, size = size + IFNULL(NEW.size, 0) "
+        "WHERE setID = 0; "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS TilesDeleteStats BEFORE DELETE ON Tiles BEGIN "
+        "DELETE FROM SetTiles WHERE tileID = OLD.tileID; "
+        "UPDATE CacheStats SET tiles = tiles - 1, size = size - IFNULL(OLD.size, 0) "
+        "WHERE setID = 0; "
+        "END",
+
+        "CREATE TRIGGER IF NOT EXISTS TileSetsInsertStats AFTER INSERT ON TileSets BEGIN "
+        "INSERT OR IGNORE INTO CacheStats(setID) VALUES(NEW.setID); "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS TileSetsDeleteStats AFTER DELETE ON TileSets BEGIN "
+        "DELETE FROM CacheStats WHERE setID = OLD.setID; "
+        "END",
+
+        // 新增引用：该集合计数增加；瓦片若原本只属于另一个集合，那个集合失去一个独有瓦片
+        "CREATE TRIGGER IF NOT EXISTS SetTilesInsertStats AFTER INSERT ON SetTiles "
+        "WHEN EXISTS (SELECT 1 FROM Tiles WHERE tileID = NEW.tileID) BEGIN "
+        "UPDATE CacheStats SET tiles = tiles + 1, "
+        "size = size + (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = NEW.tileID) "
+        "WHERE setID = NEW.setID; "
+        "UPDATE CacheStats SET uniqueTiles = uniqueTiles + 1, "
+        "uniqueSize = uniqueSize + (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = NEW.tileID) "
+        "WHERE setID = NEW.setID "
+        "AND (SELECT COUNT(*) FROM SetTiles WHERE tileID = NEW.tileID) = 1; "
+        "UPDATE CacheStats SET uniqueTiles = uniqueTiles - 1, "
+        "uniqueSize = uniqueSize - (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = NEW.tileID) "
+        "WHERE setID = (SELECT setID FROM SetTiles WHERE tileID = NEW.tileID AND setID != NEW.setID) "
+        "AND (SELECT COUNT(*) FROM SetTiles WHERE tileID = NEW.tileID) = 2; "
+        "END",
+        // 删除引用：反向操作；只剩一个集合引用时，该瓦片成为那个集合的独有瓦片
+        "CREATE TRIGGER IF NOT EXISTS SetTilesDeleteStats AFTER DELETE ON SetTiles "
+        "WHEN EXISTS (SELECT 1 FROM Tiles WHERE tileID = OLD.tileID) BEGIN "
+        "UPDATE CacheStats SET tiles = tiles - 1, "
+        "size = size - (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = OLD.tileID) "
+        "WHERE setID = OLD.setID; "
+        "UPDATE CacheStats SET uniqueTiles = uniqueTiles - 1, "
+        "uniqueSize = uniqueSize - (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = OLD.tileID) "
+        "WHERE setID = OLD.setID "
+        "AND NOT EXISTS (SELECT 1 FROM SetTiles WHERE tileID = OLD.tileID); "
+        "UPDATE CacheStats SET uniqueTiles = uniqueTiles + 1, "
+        "uniqueSize = uniqueSize + (SELECT IFNULL(size, 0) FROM Tiles WHERE tileID = OLD.tileID) "
+        "WHERE setID = (SELECT setID FROM SetTiles WHERE tileID = OLD.tileID) "
+        "AND (SELECT COUNT(*) FROM SetTiles WHERE tileID = OLD.tileID) = 1; "
+        "END",
+    };
+
+    QSqlQuery query(db);
+    for (const char *statement : statements) {
+        if (!query.exec(QString::fromLatin1(statement))) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (create stats):" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_createBlobs(QSqlDatabase &db) {
+    // 图像按内容去重，Tiles.blobID 引用；引用计数与 CacheStats 中的存储量
+    // （setID = kBlobStatsID）由触发器维护。pack > 0 时图像在包文件中，tile 为空
+    static const char *const statements[] = {
+        "CREATE TABLE IF NOT EXISTS Blobs ("
+        "blobID INTEGER PRIMARY KEY NOT NULL, "
+        "hash INTEGER NOT NULL, "
+        "refs INTEGER NOT NULL DEFAULT 0, "
+        "size INTEGER NOT NULL, "
+        "tile BLOB NOT NULL, "
+        "pack INTEGER NOT NULL DEFAULT 0, "
+        "packOffset INTEGER NOT NULL DEFAULT 0)",
+        "CREATE INDEX IF NOT EXISTS BlobsHash ON Blobs (hash)",
+        "CREATE INDEX IF NOT EXISTS BlobsPack ON Blobs (pack, size)",
+        "CREATE TABLE IF NOT EXISTS Packs ("
+        "pack INTEGER PRIMARY KEY NOT NULL, "
+        "bytes INTEGER NOT NULL DEFAULT 0)",
+        "INSERT OR IGNORE INTO CacheStats(setID) VALUES(-1)",
+
+        "CREATE TRIGGER IF NOT EXISTS TilesInsertBlob AFTER INSERT ON Tiles BEGIN "
+        "UPDATE Blobs SET refs = refs + 1 WHERE blobID = NEW.blobID; "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS TilesDeleteBlob AFTER DELETE ON Tiles BEGIN "
+        "UPDATE Blobs SET refs = refs - 1 WHERE blobID = OLD.blobID; "
+        "DELETE FROM Blobs WHERE blobID = OLD.blobID AND refs <= 0; "
+        "END",
+
+        "CREATE TRIGGER IF NOT EXISTS BlobsInsertStats AFTER INSERT ON Blobs BEGIN "
+        "UPDATE CacheStats SET tiles = tiles + 1, size = size + NEW.size WHERE setID = -1; "
+        "END",
+        "CREATE TRIGGER IF NOT EXISTS BlobsDeleteStats AFTER DELETE ON Blobs BEGIN "
+        "UPDATE CacheStats SET tiles = tiles - 1, size = size - OLD.size WHERE setID = -1; "
+        "END",
+    };
+    static_assert(kBlobStatsID == -1, "kBlobStatsID is hard-coded in the Blobs triggers");
+
+    QSqlQuery query(db);
+    for (const char *statement : statements) {
+        if (!query.exec(QString::fromLatin1(statement))) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (create blobs):" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_createDownloadPlans(QSqlDatabase &db) {
+    // 下载计划：每个瓦片集每个缩放级别一个矩形范围，完成位图按页保存（见 QGCDownloadPlan）
+    static const char *const statements[] = {
+        "CREATE TABLE IF NOT EXISTS DownloadRanges ("
+        "rangeID INTEGER PRIMARY KEY NOT NULL, "
+        "setID INTEGER NOT NULL, "
+        "provider INTEGER NOT NULL, "
+        "z INTEGER NOT NULL, "
+        "x0 INTEGER NOT NULL, "
+        "y0 INTEGER NOT NULL, "
+        "x1 INTEGER NOT NULL, "
+        "y1 INTEGER NOT NULL, "
+        "cursor INTEGER NOT NULL DEFAULT 0, "
+        "remaining INTEGER NOT NULL)",
+        "CREATE INDEX IF NOT EXISTS DownloadRangesSet ON DownloadRanges (setID, z)",
+        "CREATE TABLE IF NOT EXISTS DownloadPages ("
+        "rangeID INTEGER NOT NULL, "
+        "page INTEGER NOT NULL, "
+        "bits BLOB NOT NULL, "
+        "PRIMARY KEY (rangeID, page)) WITHOUT ROWID",
+
+        "CREATE TRIGGER IF NOT EXISTS DownloadRangesDelete AFTER DELETE ON DownloadRanges BEGIN "
+        "DELETE FROM DownloadPages WHERE rangeID = OLD.rangeID; "
+        "END",
+    };
+
+    QSqlQuery query(db);
+    for (const char *statement : statements) {
+        if (!query.exec(QString::fromLatin1(statement))) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (create download plans):" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_rebuildStats(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // 旧版本清理缓存时只删除 Tiles，留下了指向不存在瓦片的 SetTiles 记录
+    if (!query.exec("DELETE FROM SetTiles WHERE NOT EXISTS "
+                    "(SELECT 1 FROM Tiles T WHERE T.tileID = SetTiles.tileID)") ||
+        !query.exec("DELETE FROM CacheStats WHERE setID >= 0") ||
+        !query.exec("INSERT INTO CacheStats(setID, tiles, size) "
+                    "SELECT 0, COUNT(*), IFNULL(SUM(size), 0) FROM Tiles") ||
+        !query.exec("INSERT INTO CacheStats(setID, tiles, size, uniqueTiles, uniqueSize) "
+                    "SELECT S.setID, COUNT(*), IFNULL(SUM(T.size), 0), "
+                    "SUM(R.refs = 1), IFNULL(SUM(CASE WHEN R.refs = 1 THEN T.size END), 0) "
+                    "FROM SetTiles S "
+                    "JOIN Tiles T ON T.tileID = S.tileID "
+                    "JOIN (SELECT tileID, COUNT(*) AS refs FROM SetTiles GROUP BY tileID) R "
+                    "ON R.tileID = S.tileID "
+                    "WHERE S.setID IN (SELECT setID FROM TileSets) "
+                    "GROUP BY S.setID") ||
+        !query.exec("INSERT OR IGNORE INTO CacheStats(setID) SELECT setID FROM TileSets")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (rebuild stats):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_getSetStats(qint64 setID, SetStats &stats) {
+    QSqlQuery &query = _statements->prepare(
+        QStringLiteral("SELECT tiles, size, uniqueTiles, uniqueSize FROM CacheStats WHERE setID = ?"));
+    query.addBindValue(setID);
+    if (!query.exec() || !query.next()) {
+        qCDebug(QGCTileCacheWorkerLog)
+            << "No stats for tile set" << setID << query.lastError().text();
+        return false;
+    }
+
+    stats.count = query.value(0).toUInt();
+    stats.size = query.value(1).toULongLong();
+    stats.uniqueCount = query.value(2).toUInt();
+    stats.uniqueSize = query.value(3).toULongLong();
+    query.finish();
+    return true;
+}
+
+bool QGCCacheWorker::_migrate(QSqlDatabase &db, int version) {
+    qCDebug(QGCTileCacheWorkerLog) << "Migrating map cache to schema" << version;
+
+    // v6 搬移的数据量与整个缓存相当，分块提交，不放进下面的单个事务
+    if ((version == 6) && !_moveTileImages(db)) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map cache migration to schema" << version << "failed";
+        return false;
+    }
+
+    // 每一步在独立事务中执行，user_version 随事务一起提交，中断后从上一步继续
+    if (!db.transaction()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (begin migration):" << db.lastError().text();
+        return false;
+    }
+
+    bool res = false;
+    switch (version) {
+    case 2:
+        res = _migrateToV2(db);
+        break;
+    case 3:
+        res = _migrateToV3(db);
+        break;
+    case 4:
+        // 建立统计表及触发器，按现有数据一次性重建
+        res = _createStats(db) && _rebuildStats(db);
+        break;
+    case 5:
+        res = _migrateToV5(db);
+        break;
+    case 6:
+        res = _migrateToV6(db);
+        break;
+    case 7:
+        res = _migrateToV7(db);
+        break;
+    case 8:
+        res = _migrateToV8(db);
+        break;
+    default:
+        qCWarning(QGCTileCacheWorkerLog) << "no migration to schema" << version;
+        break;
+    }
+
+    if (res) {
+        QSqlQuery query(db);
+        res = query.exec(QStringLiteral("PRAGMA user_version = %1").arg(version)) &&
+              db.commit();
+    }
+
+    if (!res) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map cache migration to schema" << version << "failed";
+        (void)db.rollback();
+    }
+
+    return res;
+}
+
+bool QGCCacheWorker::_migrateToV2(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // v1 以字符串 hash 标识瓦片。旧表改名后按当前 schema 建表，再复制数据
+    if (!query.exec("ALTER TABLE Tiles RENAME TO TilesV1") ||
+        !query.exec("ALTER TABLE SetTiles RENAME TO SetTilesV1") ||
+        !query.exec("ALTER TABLE TilesDownload RENAME TO TilesDownloadV1")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (rename v1 tables):" << query.lastError().text();
+        return false;
+    }
+    // 按 v2 的表结构建表，后续步骤在此基础上继续迁移
+    if (!query.exec("CREATE TABLE IF NOT EXISTS Providers ("
+                    "id INTEGER PRIMARY KEY NOT NULL, "
+                    "name TEXT NOT NULL UNIQUE)") ||
+        !query.exec("CREATE TABLE Tiles ("
+                    "tileID INTEGER PRIMARY KEY NOT NULL, "
+                    "format TEXT NOT NULL, "
+                    "tile BLOB NULL, "
+                    "size INTEGER, "
+                    "date INTEGER DEFAULT 0)") ||
+        !query.exec("CREATE TABLE SetTiles (setID INTEGER, tileID INTEGER)") ||
+        !query.exec("CREATE TABLE TilesDownload ("
+                    "setID INTEGER NOT NULL, "
+                    "tileID INTEGER NOT NULL, "
+                    "state INTEGER DEFAULT 0, "
+                    "PRIMARY KEY (setID, tileID)) WITHOUT ROWID")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create v2 tables):" << query.lastError().text();
+        return false;
+    }
+    if (!QGCProviderRegistry::instance()->load(db)) {
+        return false;
+    }
+
+    // v1 hash 为 "%010d%08d%08d%03d"（provider hash, x, y, z），由 SQL 直接换算为瓦片键，
+    // 避免把整个瓦片表读入进程再写回
+    if (!query.exec("CREATE TEMP TABLE LegacyProviders ("
+                    "hash INTEGER PRIMARY KEY NOT NULL, "
+                    "id INTEGER NOT NULL)") ||
+        !query.exec("CREATE TEMP TABLE LegacyTiles ("
+                    "oldID INTEGER PRIMARY KEY NOT NULL, "
+                    "tileID INTEGER NOT NULL)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create migration tables):" << query.lastError().text();
+        return false;
+    }
+
+    (void)query.prepare("INSERT OR IGNORE INTO LegacyProviders(hash, id) VALUES(?, ?)");
+    const QStringList types = UrlFactory::getProviderTypes();
+    for (const QString &type : types) {
+        query.addBindValue(UrlFactory::hashFromProviderType(type));
+        query.addBindValue(QGCProviderRegistry::instance()->id(type));
+        (void)query.exec();
+    }
+
+    const QString legacyKey =
+        QStringLiteral("((P.id << %1) | (CAST(substr(%5.hash, 27, 3) AS INTEGER) << %2) | "
+                       "(CAST(substr(%5.hash, 11, 8) AS INTEGER) << %3) | "
+                       "CAST(substr(%5.hash, 19, 8) AS INTEGER))")
+            .arg(QGCTileKey::kProviderShift)
+            .arg(QGCTileKey::kZoomShift)
+            .arg(QGCTileKey::kXShift);
+    const QString legacyJoin =
+        QStringLiteral("JOIN LegacyProviders P ON P.hash = CAST(substr(%1.hash, 1, 10) AS INTEGER) "
+                       "WHERE length(%1.hash) = 29");
+
+    if (!query.exec(QStringLiteral("INSERT INTO LegacyTiles(oldID, tileID) "
+                                   "SELECT T.tileID, %1 FROM TilesV1 T %2")
+                        .arg(legacyKey.arg(QStringLiteral("T")), legacyJoin.arg(QStringLiteral("T"))))) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (map v1 tiles):" << query.lastError().text();
+        return false;
+    }
+
+    // 合成瓦片的 hash 含有可变长度的图层组合键，逐条转换
+    QList<QPair<quint64, quint64>> composites;
+    if (query.exec("SELECT tileID, hash FROM TilesV1 WHERE hash LIKE 'composite\_%' ESCAPE '\'")) {
+        while (query.next()) {
+            const quint64 key = QGCProviderRegistry::instance()->keyFromLegacyHash(
+                query.value(1).toString());
+            if (QGCTileKey::isValid(key)) {
+                composites.append({query.value(0).toULongLong(), key});
+            }
+        }
+    }
+    (void)query.prepare("INSERT OR IGNORE INTO LegacyTiles(oldID, tileID) VALUES(?, ?)");
+    for (const QPair<quint64, quint64> &composite : std::as_const(composites)) {
+        query.addBindValue(composite.first);
+        query.addBindValue(composite.second);
+        (void)query.exec();
+    }
+
+    if (!QGCProviderRegistry::instance()->persist(db) ||
+        !query.exec("INSERT OR IGNORE INTO Tiles(tileID, format, tile, size, date) "
+                    "SELECT L.tileID, T.format, T.tile, T.size, T.date "
+                    "FROM TilesV1 T JOIN LegacyTiles L ON L.oldID = T.tileID") ||
+        !query.exec("INSERT OR IGNORE INTO SetTiles(setID, tileID) "
+                    "SELECT S.setID, L.tileID "
+                    "FROM SetTilesV1 S JOIN LegacyTiles L ON L.oldID = S.tileID") ||
+        !query.exec(QStringLiteral("INSERT OR IGNORE INTO TilesDownload(setID, tileID, state) "
+                                   "SELECT D.setID, %1, D.state FROM TilesDownloadV1 D %2")
+                        .arg(legacyKey.arg(QStringLiteral("D")), legacyJoin.arg(QStringLiteral("D"))))) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (copy v1 tiles):" << query.lastError().text();
+        return false;
+    }
+
+    (void)query.exec("DROP TABLE TilesV1");
+    (void)query.exec("DROP TABLE SetTilesV1");
+    (void)query.exec("DROP TABLE TilesDownloadV1");
+    (void)query.exec("DROP TABLE temp.LegacyProviders");
+    (void)query.exec("DROP TABLE temp.LegacyTiles");
+    return true;
+}
+
+bool QGCCacheWorker::_migrateToV3(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // SetTiles 原先没有任何索引
+    if (!query.exec("ALTER TABLE SetTiles RENAME TO SetTilesV2") ||
+        !query.exec("CREATE TABLE SetTiles ("
+                    "setID INTEGER NOT NULL, "
+                    "tileID INTEGER NOT NULL, "
+                    "PRIMARY KEY (setID, tileID)) WITHOUT ROWID") ||
+        !query.exec("CREATE INDEX SetTilesTile ON SetTiles (tileID)") ||
+        !query.exec("CREATE INDEX IF NOT EXISTS TilesDownloadState "
+                    "ON TilesDownload (setID, state)") ||
+        !query.exec("INSERT OR IGNORE INTO SetTiles(setID, tileID) "
+                    "SELECT setID, tileID FROM SetTilesV2 "
+                    "WHERE setID IS NOT NULL AND tileID IS NOT NULL") ||
+        !query.exec("DROP TABLE SetTilesV2")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (rebuild SetTiles):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_migrateToV5(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // 已有瓦片视为从未访问，按保存时间先后淘汰
+    if (!query.exec("ALTER TABLE Tiles ADD COLUMN access INTEGER NOT NULL DEFAULT 0")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (add Tiles access):" << query.lastError().text();
+        return false;
+    }
+
+    if (!query.exec("CREATE INDEX IF NOT EXISTS TilesAccess ON Tiles (access, date)")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (create Tiles index):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_moveTileImages(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // 上次中断时 blobID 列与 Blobs 已经存在
+    if (!db.transaction()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (begin add Tiles blobID):" << db.lastError().text();
+        return false;
+    }
+    if ((!query.exec("SELECT blobID FROM Tiles LIMIT 0") &&
+         !query.exec("ALTER TABLE Tiles ADD COLUMN blobID INTEGER NOT NULL DEFAULT 0")) ||
+        !_createBlobs(db) || !db.commit()) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (add Tiles blobID):" << query.lastError().text();
+        (void)db.rollback();
+        return false;
+    }
+
+    // 按主键分块读取旧的图像列，去重后写入 Blobs；引用计数直接累加
+    // （UPDATE 不触发 Tiles 的插入触发器）。每块与其 blobID 一起提交，
+    // blobID != 0 的行已经搬移，重新启动后跳过
+    QGCSqlStatementCache statements(db);
+    QGCTileBlobStore store(statements);
+    QSqlQuery select(db);
+    select.setForwardOnly(true);
+    (void)select.prepare("SELECT tileID, tile FROM Tiles "
+                         "WHERE blobID = 0 AND tile IS NOT NULL AND tileID > ? ORDER BY tileID LIMIT ?");
+    QSqlQuery update(db);
+    (void)update.prepare("UPDATE Tiles SET blobID = ?, tile = NULL WHERE tileID = ?");
+    QSqlQuery addRef(db);
+    (void)addRef.prepare("UPDATE Blobs SET refs = refs + 1 WHERE blobID = ?");
+
+    struct Row {
+        quint64 tileID;
+        QByteArray img;
+    };
+    QList<Row> rows;
+    quint64 lastID = 0;
+    quint64 moved = 0;
+    do {
+        rows.clear();
+        if (!db.transaction()) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (begin move tiles):" << db.lastError().text();
+            return false;
+        }
+
+        select.addBindValue(lastID);
+        select.addBindValue(kMigrationChunk);
+        if (!select.exec()) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (read v5 tiles):" << select.lastError().text();
+            (void)db.rollback();
+            return false;
+        }
+        while (select.next()) {
+            rows.append({select.value(0).toULongLong(), select.value(1).toByteArray()});
+        }
+        select.finish();
+
+        for (const Row &row : std::as_const(rows)) {
+            const qint64 blobID = store.store(row.img);
+            update.addBindValue(blobID);
+            update.addBindValue(row.tileID);
+            addRef.addBindValue(blobID);
+            if ((blobID == 0) || !update.exec() || !addRef.exec()) {
+                qCWarning(QGCTileCacheWorkerLog)
+                    << "Map Cache SQL error (move tile to Blobs):" << update.lastError().text();
+                (void)db.rollback();
+                return false;
+            }
+            lastID = row.tileID;
+        }
+
+        if (!db.commit()) {
+            qCWarning(QGCTileCacheWorkerLog)
+                << "Map Cache SQL error (commit moved tiles):" << db.lastError().text();
+            (void)db.rollback();
+            return false;
+        }
+        moved += static_cast<quint64>(rows.size());
+    } while (rows.size() == kMigrationChunk);
+
+    qCDebug(QGCTileCacheWorkerLog) << "Moved" << moved << "tile images to Blobs";
+    return true;
+}
+
+bool QGCCacheWorker::_migrateToV6(QSqlDatabase &db) {
+    // 图像已由 _moveTileImages 搬移，旧列只剩 NULL。DROP COLUMN 需要 SQLite 3.35，
+    // 更早的版本保留该列（可为空，不影响之后的写入）
+    QSqlQuery query(db);
+    if (!query.exec("SELECT sqlite_version()") || !query.next()) {
+        return true;
+    }
+    const QVersionNumber version = QVersionNumber::fromString(query.value(0).toString());
+    query.finish();
+    if (version < QVersionNumber(3, 35)) {
+        qCDebug(QGCTileCacheWorkerLog) << "SQLite" << version << "keeps the empty Tiles.tile column";
+        return true;
+    }
+
+    if (!query.exec("ALTER TABLE Tiles DROP COLUMN tile")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (drop Tiles tile):" << query.lastError().text();
+    }
+
+    return true;
+}
+
+bool QGCCacheWorker::_migrateToV7(QSqlDatabase &db) {
+    QSqlQuery query(db);
+    // 从 v6 之前迁移时 Blobs 已按当前结构建立；图像仍内嵌，空闲时按所选存储转换
+    if (!query.exec("SELECT pack FROM Blobs LIMIT 0") &&
+        (!query.exec("ALTER TABLE Blobs ADD COLUMN pack INTEGER NOT NULL DEFAULT 0") ||
+         !query.exec("ALTER TABLE Blobs ADD COLUMN packOffset INTEGER NOT NULL DEFAULT 0"))) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (add Blobs pack):" << query.lastError().text();
+        return false;
+    }
+
+    return _createBlobs(db);
+}
+
+bool QGCCacheWorker::_migrateToV8(QSqlDatabase &db) {
+    if (!_createDownloadPlans(db)) {
+        return false;
+    }
+
+    // 按 (setID, 提供者, 缩放级别) 分组，每组用包围矩形保存，矩形内不在列表中的瓦片视为已完成。
+    // 稀疏的组按列拆分，仍然稀疏的列逐个瓦片保存，避免位图远大于原来的行数
+    QGCSqlStatementCache statements(db);
+    QGCDownloadPlan plan(statements);
+    const auto addGroup = [&plan](quint64 setID, quint64 first, const QList<QPoint> &tiles) -> bool {
+        const auto dense = [](qint64 area, qsizetype count) {
+            return area <= (static_cast<qint64>(count) * 64 + QGCDownloadPlan::kPageBits);
+        };
+        const quint32 provider = QGCTileKey::provider(first);
+        const int z = QGCTileKey::z(first);
+        int x0 = tiles.constFirst().x();
+        int y0 = tiles.constFirst().y();
+        int x1 = x0;
+        int y1 = y0;
+        for (const QPoint &tile : tiles) {
+            x0 = qMin(x0, tile.x());
+            y0 = qMin(y0, tile.y());
+            x1 = qMax(x1, tile.x());
+            y1 = qMax(y1, tile.y());
+        }
+        if (dense((static_cast<qint64>(x1) - x0 + 1) * (static_cast<qint64>(y1) - y0 + 1), tiles.size())) {
+            return plan.addRange(setID, provider, z, x0, y0, x1, y1, tiles);
+        }
+
+        // 行按 tileID 排序，同一列的瓦片相邻且 y 递增
+        for (qsizetype begin = 0; begin < tiles.size();) {
+            qsizetype end = begin;
+            while ((end < tiles.size()) && (tiles.at(end).x() == tiles.at(begin).x())) {
+                end++;
+            }
+            const QList<QPoint> column = tiles.mid(begin, end - begin);
+            const int x = column.constFirst().x();
+            const int top = column.constFirst().y();
+            const int bottom = column.constLast().y();
+            if (dense(static_cast<qint64>(bottom) - top + 1, column.size())) {
+                if (!plan.addRange(setID, provider, z, x, top, x, bottom, column)) {
+                    return false;
+                }
+            } else {
+                for (const QPoint &tile : column) {
+                    if (!plan.addRange(setID, provider, z, tile.x(), tile.y(), tile.x(), tile.y())) {
+                        return false;
+                    }
+                }
+            }
+            begin = end;
+        }
+        return true;
+    };
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT setID, tileID FROM TilesDownload ORDER BY setID, tileID")) {
+        // 没有下载列表可迁移
+        return true;
+    }
+
+    constexpr quint64 groupMask = ~((Q_UINT64_C(1) << QGCTileKey::kZoomShift) - 1);
+    quint64 setID = 0;
+    quint64 first = QGCTileKey::kInvalid;
+    QList<QPoint> tiles;
+    bool res = true;
+    while (res && query.next()) {
+        const quint64 rowSet = query.value(0).toULongLong();
+        const quint64 key = query.value(1).toULongLong();
+        if (!tiles.isEmpty() && ((rowSet != setID) || ((key & groupMask) != (first & groupMask)))) {
+            res = addGroup(setID, first, tiles);
+            tiles.clear();
+        }
+        if (tiles.isEmpty()) {
+            setID = rowSet;
+            first = key;
+        }
+        tiles.append(QPoint(QGCTileKey::x(key), QGCTileKey::y(key)));
+    }
+    query.finish();
+    if (res && !tiles.isEmpty()) {
+        res = addGroup(setID, first, tiles);
+    }
+    if (!res || !query.exec("DROP TABLE TilesDownload")) {
+        qCWarning(QGCTileCacheWorkerLog)
+            << "Map Cache SQL error (migrate TilesDownload):" << query.lastError().text();
+        return false;
+    }
+
+    return true;
+}
+
 void QGCCacheWorker::_disconnectDB() {
+    // 已准备的语句必须在连接关闭前释放
+    _statements.reset();
     if (_db) {
         _db.reset();
         QSqlDatabase::removeDatabase(kSession);
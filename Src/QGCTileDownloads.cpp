@@ -0,0 +1,458 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileDownloads.h"
+#include "QGCHostConcurrency.h"
+#include "QGCTileNetworkScheduler.h"
+
+#include <QGCFileDownload.h>
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QPointer>
+#include <QtCore/QThread>
+#include <QtNetwork/QNetworkAccessManager>
+#include <QtNetwork/QNetworkReply>
+#include <QtNetwork/QSslError>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY(QGCTileDownloadsLog,
+                   "qgc.qtlocationplugin.qgctiledownloads")
+
+/// 请求者持有的回复，完成时从共享的下载复制结果，各自独立读取
+class QGCTileDownloadReply : public QNetworkReply
+{
+public:
+    QGCTileDownloadReply(QNetworkAccessManager *manager, const QNetworkRequest &request, QGCTileDownloadFlight *flight);
+    ~QGCTileDownloadReply() override;
+
+    /// 请求者自己的 QNetworkAccessManager
+    QNetworkAccessManager *manager() const { return _manager.data(); }
+
+    void abort() override;
+    qint64 bytesAvailable() const override { return (_data.size() - _offset) + QNetworkReply::bytesAvailable(); }
+    bool isSequential() const override { return true; }
+
+    /// 共享下载完成
+    void complete(const QNetworkReply *source, const QByteArray &data);
+    /// 共享下载没有完成（底层请求被销毁或没有发出）
+    void fail(QNetworkReply::NetworkError error, const QString &errorString);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize) override;
+
+private:
+    void _finish(QNetworkReply::NetworkError error);
+
+    QGCTileDownloadFlight *_flight = nullptr;
+    QPointer<QNetworkAccessManager> _manager;
+    QByteArray _data;
+    qsizetype _offset = 0;
+};
+
+/// 一次进行中的下载与跟随它的全部回复
+class QGCTileDownloadFlight : public QObject
+{
+public:
+    QGCTileDownloadFlight(QGCTileDownloads *owner, const QString &url,
+                          QNetworkAccessManager *manager, const QNetworkRequest &request);
+
+    void attach(QGCTileDownloadReply *reply) { _replies.append(reply); }
+    /// 最后一个请求者放弃时撤销排队或中止底层请求
+    void detach(QGCTileDownloadReply *reply);
+
+    /// 交给调度器排队，获得名额时发出
+    void schedule(QGCTileNetworkScheduler *scheduler, const QGeoTileSpec &spec);
+    bool isScheduled() const { return (_ticket != 0); }
+    /// 发出网络请求，排队中时撤销排队
+    QNetworkReply *start();
+
+private:
+    void _finished();
+    void _complete(const QNetworkReply *source, const QByteArray &data);
+    void _fail(QNetworkReply::NetworkError error, const QString &errorString);
+    /// 发起下载的 QNetworkAccessManager 已销毁，其余请求者改用自己的重新下载
+    void _managerLost(QNetworkAccessManager *lost);
+    /// 底层请求结束，归还 QGCHostConcurrency 中占用的名额
+    void _release();
+    /// 请求者在回调中可能释放其他请求者的回复
+    QList<QPointer<QGCTileDownloadReply>> _takeReplies();
+
+    QGCTileDownloads *const _owner;
+    const QString _url;
+    const QString _host;
+    QPointer<QNetworkAccessManager> _manager;
+    const QNetworkRequest _request;
+    QPointer<QGCTileNetworkScheduler> _scheduler;
+    quint64 _ticket = 0;
+    QElapsedTimer _elapsed;
+    QNetworkReply *_reply = nullptr;
+    bool _acquired = false;
+    QList<QGCTileDownloadReply*> _replies;
+};
+
+//-----------------------------------------------------------------------------
+
+QGCTileDownloadReply::QGCTileDownloadReply(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                                           QGCTileDownloadFlight *flight)
+    : _flight(flight)
+    , _manager(manager) {
+    setRequest(request);
+    setUrl(request.url());
+    setOperation(QNetworkAccessManager::GetOperation);
+    (void)open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+QGCTileDownloadReply::~QGCTileDownloadReply() {
+    if (_flight) {
+        _flight->detach(this);
+    }
+}
+
+void QGCTileDownloadReply::abort() {
+    if (isFinished()) {
+        return;
+    }
+
+    if (_flight) {
+        QGCTileDownloadFlight *const flight = _flight;
+        _flight = nullptr;
+        flight->detach(this);
+    }
+
+    setError(QNetworkReply::OperationCanceledError, tr("Operation canceled"));
+    setFinished(true);
+    emit errorOccurred(QNetworkReply::OperationCanceledError);
+    emit finished();
+}
+
+void QGCTileDownloadReply::complete(const QNetworkReply *source, const QByteArray &data) {
+    _flight = nullptr;
+    _data = data;
+    _offset = 0;
+
+    setAttribute(QNetworkRequest::HttpStatusCodeAttribute,
+                 source->attribute(QNetworkRequest::HttpStatusCodeAttribute));
+    setAttribute(QNetworkRequest::HttpReasonPhraseAttribute,
+                 source->attribute(QNetworkRequest::HttpReasonPhraseAttribute));
+    for (const QNetworkReply::RawHeaderPair &header : source->rawHeaderPairs()) {
+        setRawHeader(header.first, header.second);
+    }
+    const QNetworkReply::NetworkError error = source->error();
+    if (error != QNetworkReply::NoError) {
+        setError(error, source->errorString());
+    }
+
+    _finish(error);
+}
+
+void QGCTileDownloadReply::fail(QNetworkReply::NetworkError error, const QString &errorString) {
+    _flight = nullptr;
+    setError(error, errorString);
+    _finish(error);
+}
+
+void QGCTileDownloadReply::_finish(QNetworkReply::NetworkError error) {
+    setFinished(true);
+    if (error != QNetworkReply::NoError) {
+        emit errorOccurred(error);
+    }
+    if (!_data.isEmpty()) {
+        emit readyRead();
+    }
+    emit finished();
+}
+
+qint64 QGCTileDownloadReply::readData(char *data, qint64 maxSize) {
+    const qint64 count = qMin<qint64>(maxSize, _data.size() - _offset);
+    if (count <= 0) {
+        return isFinished() ? -1 : 0;
+    }
+
+    std::memcpy(data, _data.constData() + _offset, static_cast<size_t>(count));
+    _offset += count;
+    return count;
+}
+
+//-----------------------------------------------------------------------------
+
+QGCTileDownloadFlight::QGCTileDownloadFlight(QGCTileDownloads *owner, const QString &url,
+                                             QNetworkAccessManager *manager, const QNetworkRequest &request)
+    : _owner(owner)
+    , _url(url)
+    , _host(QGCHostConcurrency::hostKey(request.url()))
+    , _manager(manager)
+    , _request(request) {}
+
+void QGCTileDownloadFlight::schedule(QGCTileNetworkScheduler *scheduler, const QGeoTileSpec &spec) {
+    _scheduler = scheduler;
+    QPointer<QGCTileDownloadFlight> flight(this);
+    _ticket = scheduler->submit(spec, _host,
+        [flight]() -> QNetworkReply* {
+            return flight ? flight->start() : nullptr;
+        },
+        [flight]() {
+            if (flight) {
+                flight->_ticket = 0;
+                flight->_fail(QNetworkReply::OperationCanceledError, tr("Tile left the viewport"));
+            }
+        });
+}
+
+QNetworkReply *QGCTileDownloadFlight::start() {
+    if (_ticket != 0) {
+        if (_scheduler) {
+            _scheduler->cancel(_ticket);
+        }
+        _ticket = 0;
+    }
+    if (_reply) {
+        return _reply;
+    }
+    if (!_manager) {
+        _managerLost(nullptr);
+        return _reply;
+    }
+
+    _elapsed.start();
+    _reply = _manager->get(_request);
+    _owner->_started++;
+    QGCHostConcurrency::instance()->acquire(_host);
+    _acquired = true;
+    QGCFileDownload::setIgnoreSSLErrorsIfNeeded(*_reply);
+    (void)connect(_reply, &QNetworkReply::finished, this, &QGCTileDownloadFlight::_finished);
+    (void)connect(_reply, &QNetworkReply::sslErrors, this, [this](const QList<QSslError> &errors) {
+        for (QGCTileDownloadReply *follower : std::as_const(_replies)) {
+            emit follower->sslErrors(errors);
+        }
+    });
+    // 发起下载的 QNetworkAccessManager 被销毁时，其回复随之销毁
+    QNetworkAccessManager *const manager = _manager.data();
+    (void)connect(_reply, &QObject::destroyed, this, [this, manager]() {
+        _reply = nullptr;
+        _release();
+        _managerLost(manager);
+    });
+    return _reply;
+}
+
+void QGCTileDownloadFlight::detach(QGCTileDownloadReply *reply) {
+    (void)_replies.removeOne(reply);
+    if (!_replies.isEmpty()) {
+        return;
+    }
+
+    // 尚未发出的下载直接撤销
+    if (_ticket != 0) {
+        _owner->_remove(_url, this);
+        if (_scheduler) {
+            _scheduler->cancel(_ticket);
+        }
+        _ticket = 0;
+        deleteLater();
+        return;
+    }
+    if (!_reply) {
+        return;
+    }
+
+    _owner->_remove(_url, this);
+    QNetworkReply *const network = _reply;
+    _reply = nullptr;
+    (void)network->disconnect(this);
+    _release();
+    network->abort();
+    network->deleteLater();
+    deleteLater();
+}
+
+void QGCTileDownloadFlight::_finished() {
+    QNetworkReply *const network = _reply;
+    _reply = nullptr;
+    (void)network->disconnect(this);
+    _release();
+
+    const QByteArray data = network->readAll();
+
+    // 请求者放弃时已断开连接，这里的中止只来自传输超时
+    bool ok = false;
+    const int retryAfter = network->rawHeader(QByteArrayLiteral("Retry-After")).trimmed().toInt(&ok);
+    QGCHostConcurrency::instance()->record(_host, _elapsed.elapsed(), data.size(),
+                                           network->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt(),
+                                           network->error(), ok ? retryAfter : 0,
+                                           network->attribute(QNetworkRequest::Http2WasUsedAttribute).toBool());
+
+    _complete(network, data);
+    network->deleteLater();
+}
+
+void QGCTileDownloadFlight::_complete(const QNetworkReply *source, const QByteArray &data) {
+    _owner->_remove(_url, this);
+    _owner->_recordFinished(_replies.size(), data.size());
+
+    const QList<QPointer<QGCTileDownloadReply>> replies = _takeReplies();
+    for (const QPointer<QGCTileDownloadReply> &reply : replies) {
+        if (reply) {
+            reply->complete(source, data);
+        }
+    }
+    deleteLater();
+}
+
+void QGCTileDownloadFlight::_fail(QNetworkReply::NetworkError error, const QString &errorString) {
+    _owner->_remove(_url, this);
+
+    const QList<QPointer<QGCTileDownloadReply>> replies = _takeReplies();
+    for (const QPointer<QGCTileDownloadReply> &reply : replies) {
+        if (reply) {
+            reply->fail(error, errorString);
+        }
+    }
+    deleteLater();
+}
+
+void QGCTileDownloadFlight::_managerLost(QNetworkAccessManager *lost) {
+    // 使用同一个 QNetworkAccessManager 的请求者属于同一个正在销毁的引擎，只有它们以取消结束
+    QList<QPointer<QGCTileDownloadReply>> cancelled;
+    QNetworkAccessManager *next = nullptr;
+    for (QGCTileDownloadReply *reply : std::as_const(_replies)) {
+        QNetworkAccessManager *const manager = reply->manager();
+        if (!manager || (manager == lost)) {
+            cancelled.append(reply);
+        } else if (!next) {
+            next = manager;
+        }
+    }
+    for (const QPointer<QGCTileDownloadReply> &reply : std::as_const(cancelled)) {
+        (void)_replies.removeOne(reply.data());
+    }
+
+    if (next) {
+        qCDebug(QGCTileDownloadsLog) << "Reissuing" << _url << "for" << _replies.size() << "requesters";
+        _manager = next;
+        (void)start();
+    } else {
+        _owner->_remove(_url, this);
+        deleteLater();
+    }
+
+    for (const QPointer<QGCTileDownloadReply> &reply : std::as_const(cancelled)) {
+        if (reply) {
+            reply->fail(QNetworkReply::OperationCanceledError, tr("Network access manager destroyed"));
+        }
+    }
+}
+
+void QGCTileDownloadFlight::_release() {
+    if (_acquired) {
+        _acquired = false;
+        QGCHostConcurrency::instance()->release(_host);
+    }
+}
+
+QList<QPointer<QGCTileDownloadReply>> QGCTileDownloadFlight::_takeReplies() {
+    QList<QPointer<QGCTileDownloadReply>> replies;
+    replies.reserve(_replies.size());
+    for (QGCTileDownloadReply *reply : std::as_const(_replies)) {
+        replies.append(reply);
+    }
+    _replies.clear();
+    return replies;
+}
+
+//-----------------------------------------------------------------------------
+
+QGCTileDownloads *QGCTileDownloads::instance() {
+    static QGCTileDownloads downloads;
+    return &downloads;
+}
+
+QNetworkReply *QGCTileDownloads::get(QNetworkAccessManager *manager, const QNetworkRequest &request) {
+    return _get(manager, request, nullptr, nullptr);
+}
+
+QNetworkReply *QGCTileDownloads::get(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                                     QGCTileNetworkScheduler *scheduler, const QGeoTileSpec &spec) {
+    // 调度器只在所属线程使用
+    if (scheduler && (scheduler->thread() != QThread::currentThread())) {
+        scheduler = nullptr;
+    }
+    return _get(manager, request, scheduler, &spec);
+}
+
+QNetworkReply *QGCTileDownloads::_get(QNetworkAccessManager *manager, const QNetworkRequest &request,
+                                      QGCTileNetworkScheduler *scheduler, const QGeoTileSpec *spec) {
+    const QString url = request.url().toString();
+
+    QMutexLocker lock(&_mutex);
+    QGCTileDownloadFlight *flight = _flights.value(url);
+    if (flight) {
+        // 回复的信号只能在同一线程内转发，其他线程的请求者单独下载
+        if (flight->thread() != QThread::currentThread()) {
+            lock.unlock();
+            return manager->get(request);
+        }
+
+        QGCTileDownloadReply *const reply = new QGCTileDownloadReply(manager, request, flight);
+        flight->attach(reply);
+        lock.unlock();
+
+        // 离线下载等不经调度的请求者不等待排队
+        if (!scheduler && flight->isScheduled()) {
+            (void)flight->start();
+        }
+
+        const quint64 coalesced = ++_coalesced;
+        if ((coalesced % kStatsInterval) == 0) {
+            const Stats s = stats();
+            qCDebug(QGCTileDownloadsLog) << "started" << s.started << "coalesced" << s.coalesced
+                                         << "saved bytes" << s.savedBytes << "in flight" << s.inFlight;
+        }
+        return reply;
+    }
+
+    flight = new QGCTileDownloadFlight(this, url, manager, request);
+    (void)_flights.insert(url, flight);
+
+    QGCTileDownloadReply *const reply = new QGCTileDownloadReply(manager, request, flight);
+    flight->attach(reply);
+    lock.unlock();
+
+    if (scheduler) {
+        flight->schedule(scheduler, *spec);
+    } else {
+        (void)flight->start();
+    }
+    return reply;
+}
+
+void QGCTileDownloads::_remove(const QString &url, const QGCTileDownloadFlight *flight) {
+    QMutexLocker lock(&_mutex);
+    const auto found = _flights.constFind(url);
+    if ((found != _flights.constEnd()) && (found.value() == flight)) {
+        (void)_flights.erase(found);
+    }
+}
+
+void QGCTileDownloads::_recordFinished(qsizetype requesters, qsizetype bytes) {
+    if (requesters > 1) {
+        _savedBytes += static_cast<quint64>(requesters - 1) * static_cast<quint64>(bytes);
+    }
+}
+
+QGCTileDownloads::Stats QGCTileDownloads::stats() const {
+    Stats s;
+    s.started = _started;
+    s.coalesced = _coalesced;
+    s.savedBytes = _savedBytes;
+
+    QMutexLocker lock(&_mutex);
+    s.inFlight = _flights.size();
+    return s;
+}
@@ -0,0 +1,123 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileHedging.h"
+
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(QGCTileHedgingLog,
+                   "qgc.qtlocationplugin.qgctilehedging")
+
+QGCTileHedging *QGCTileHedging::instance() {
+    static QGCTileHedging hedging;
+    return &hedging;
+}
+
+void QGCTileHedging::configure(bool enabled, int delay, double budget) {
+    QMutexLocker lock(&_mutex);
+    _delay = qBound(kMinDeadline, delay, kMaxDeadline);
+    _deadline = _delay;
+    _budget = qBound(0., budget, 1.);
+    _tokens = kMaxTokens;
+    _enabled = enabled;
+
+    qCDebug(QGCTileHedgingLog) << "enabled" << enabled << "delay" << _delay << "budget" << _budget;
+}
+
+int QGCTileHedging::beginLookup() {
+    QMutexLocker lock(&_mutex);
+    _tokens = qMin(kMaxTokens, _tokens + _budget);
+    return _deadline;
+}
+
+bool QGCTileHedging::tryHedge() {
+    {
+        QMutexLocker lock(&_mutex);
+        if (_tokens < 1.) {
+            lock.unlock();
+            _denied++;
+            return false;
+        }
+        _tokens -= 1.;
+    }
+
+    _hedged++;
+    return true;
+}
+
+void QGCTileHedging::recordCache(qint64 latencyMs) {
+    QMutexLocker lock(&_mutex);
+    _cache.add(latencyMs);
+    if ((++_cacheSamples % kTuneInterval) == 0) {
+        _tune();
+    }
+}
+
+void QGCTileHedging::recordNetwork(qint64 latencyMs) {
+    QMutexLocker lock(&_mutex);
+    _network.add(latencyMs);
+}
+
+QGCTileHedging::Stats QGCTileHedging::stats() const {
+    Stats s;
+    s.hedged = _hedged;
+    s.networkWon = _networkWon;
+    s.cacheWon = _cacheWon;
+    s.denied = _denied;
+
+    QMutexLocker lock(&_mutex);
+    s.cacheP50 = _cache.percentile(0.5);
+    s.cacheP99 = _cache.percentile(0.99);
+    s.networkP50 = _network.percentile(0.5);
+    s.networkP99 = _network.percentile(0.99);
+    s.deadline = _deadline;
+    return s;
+}
+
+void QGCTileHedging::_tune() {
+    // 缓存查询很少超过 p99；比一次典型的网络下载还慢时不值得继续等待
+    qint64 deadline = _cache.percentile(0.99);
+    const qint64 network = _network.percentile(0.5);
+    if (network > 0) {
+        deadline = qMin(deadline, network);
+    }
+    if (deadline <= 0) {
+        deadline = _delay;
+    }
+    _deadline = static_cast<int>(qBound<qint64>(kMinDeadline, deadline, kMaxDeadline));
+
+    if ((_cacheSamples % (kTuneInterval * 8)) == 0) {
+        qCDebug(QGCTileHedgingLog) << "deadline" << _deadline
+                                   << "cache p50/p99" << _cache.percentile(0.5) << _cache.percentile(0.99)
+                                   << "network p50/p99" << network << _network.percentile(0.99)
+                                   << "hedged" << _hedged << "network won" << _networkWon
+                                   << "cache won" << _cacheWon << "denied" << _denied;
+    }
+}
+
+void QGCTileHedging::Samples::add(qint64 value) {
+    if (values.size() < kMaxSamples) {
+        values.append(value);
+        return;
+    }
+
+    values[next] = value;
+    next = (next + 1) % kMaxSamples;
+}
+
+qint64 QGCTileHedging::Samples::percentile(double p) const {
+    if (values.isEmpty()) {
+        return 0;
+    }
+
+    QList<qint64> sorted = values;
+    const qsizetype index = qMin(sorted.size() - 1, static_cast<qsizetype>(p * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+    return sorted.at(index);
+}
@@ -0,0 +1,193 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileKey.h"
+#include "QGCMapUrlEngine.h"
+
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+Q_LOGGING_CATEGORY(QGCTileKeyLog, "qgc.qtlocationplugin.qgctilekey")
+
+QGCProviderRegistry *QGCProviderRegistry::instance() {
+    static QGCProviderRegistry registry;
+    return &registry;
+}
+
+bool QGCProviderRegistry::load(QSqlDatabase &db) {
+    {
+        QWriteLocker lock(&_lock);
+        _ids.clear();
+        _names.clear();
+        _pending.clear();
+        _next = 1;
+
+        QSqlQuery query(db);
+        if (!query.exec("SELECT id, name FROM Providers")) {
+            qCWarning(QGCTileKeyLog)
+                << "Map Cache SQL error (load Providers):" << query.lastError().text();
+            return false;
+        }
+
+        while (query.next()) {
+            const quint32 id = query.value(0).toUInt();
+            const QString name = query.value(1).toString();
+            _ids.insert(name, id);
+            _names.insert(id, name);
+            _next = qMax(_next, id + 1);
+        }
+        _loaded = true;
+    }
+
+    const QStringList types = UrlFactory::getProviderTypes();
+    for (const QString &type : types) {
+        (void)id(type);
+    }
+
+    return persist(db);
+}
+
+bool QGCProviderRegistry::persist(QSqlDatabase &db) {
+    QList<quint32> pending;
+    QHash<quint32, QString> names;
+    {
+        QReadLocker lock(&_lock);
+        if (_pending.isEmpty()) {
+            return true;
+        }
+        pending = _pending;
+        for (const quint32 id : std::as_const(pending)) {
+            names.insert(id, _names.value(id));
+        }
+    }
+
+    QSqlQuery query(db);
+    (void)query.prepare("INSERT OR IGNORE INTO Providers(id, name) VALUES(?, ?)");
+    for (const quint32 id : std::as_const(pending)) {
+        query.addBindValue(id);
+        query.addBindValue(names.value(id));
+        if (!query.exec()) {
+            qCWarning(QGCTileKeyLog)
+                << "Map Cache SQL error (add provider):" << query.lastError().text();
+            return false;
+        }
+    }
+
+    QWriteLocker lock(&_lock);
+    for (const quint32 id : std::as_const(pending)) {
+        (void)_pending.removeOne(id);
+    }
+    return true;
+}
+
+bool QGCProviderRegistry::save(QSqlDatabase &db) const {
+    QHash<quint32, QString> names;
+    {
+        QReadLocker lock(&_lock);
+        names = _names;
+    }
+
+    QSqlQuery query(db);
+    (void)query.prepare("INSERT OR REPLACE INTO Providers(id, name) VALUES(?, ?)");
+    for (auto it = names.constBegin(); it != names.constEnd(); ++it) {
+        query.addBindValue(it.key());
+        query.addBindValue(it.value());
+        if (!query.exec()) {
+            qCWarning(QGCTileKeyLog)
+                << "Map Cache SQL error (save Providers):" << query.lastError().text();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void QGCProviderRegistry::clear() {
+    QWriteLocker lock(&_lock);
+    _ids.clear();
+    _names.clear();
+    _pending.clear();
+    _next = 1;
+    _loaded = false;
+}
+
+quint32 QGCProviderRegistry::id(const QString &name) {
+    {
+        QReadLocker lock(&_lock);
+        if (!_loaded) {
+            return 0;
+        }
+        const auto found = _ids.constFind(name);
+        if (found != _ids.constEnd()) {
+            return found.value();
+        }
+    }
+
+    QWriteLocker lock(&_lock);
+    if (!_loaded) {
+        return 0;
+    }
+    const auto found = _ids.constFind(name);
+    if (found != _ids.constEnd()) {
+        return found.value();
+    }
+    if (_next > QGCTileKey::kProviderMask) {
+        qCWarning(QGCTileKeyLog) << "Provider id space exhausted:" << name;
+        return 0;
+    }
+
+    const quint32 id = _next++;
+    _ids.insert(name, id);
+    _names.insert(id, name);
+    _pending.append(id);
+    return id;
+}
+
+QString QGCProviderRegistry::name(quint32 id) const {
+    QReadLocker lock(&_lock);
+    return _names.value(id);
+}
+
+QString QGCProviderRegistry::compositeName(const QString &layerStackKey) {
+    return QStringLiteral("Composite:%1").arg(layerStackKey);
+}
+
+quint64 QGCProviderRegistry::keyFromLegacyHash(QStringView hash) {
+    // 多图层合成瓦片: "composite_{layerStackKey}_{x}_{y}_{z}"，layerStackKey 本身含有 '_'
+    static const QLatin1StringView compositePrefix("composite_");
+    if (hash.startsWith(compositePrefix)) {
+        const QStringView body = hash.mid(compositePrefix.size());
+        const qsizetype zPos = body.lastIndexOf(QLatin1Char('_'));
+        const qsizetype yPos = (zPos > 0) ? body.lastIndexOf(QLatin1Char('_'), zPos - 1) : -1;
+        const qsizetype xPos = (yPos > 0) ? body.lastIndexOf(QLatin1Char('_'), yPos - 1) : -1;
+        if (xPos <= 0) {
+            return QGCTileKey::kInvalid;
+        }
+
+        const QString layerStackKey = body.left(xPos).toString();
+        return QGCTileKey::make(id(compositeName(layerStackKey)),
+                                body.mid(xPos + 1, yPos - xPos - 1).toInt(),
+                                body.mid(yPos + 1, zPos - yPos - 1).toInt(),
+                                body.mid(zPos + 1).toInt());
+    }
+
+    // 普通瓦片: "%010d%08d%08d%03d"（provider hash, x, y, z）
+    if (hash.size() != 29) {
+        return QGCTileKey::kInvalid;
+    }
+
+    const QString type = UrlFactory::providerTypeFromHash(hash.mid(0, 10).toInt());
+    if (type.isEmpty()) {
+        return QGCTileKey::kInvalid;
+    }
+
+    return QGCTileKey::make(id(type), hash.mid(10, 8).toInt(),
+                            hash.mid(18, 8).toInt(), hash.mid(26, 3).toInt());
+}
@@ -0,0 +1,222 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileKeyFilter.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtEndian>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+Q_LOGGING_CATEGORY(QGCTileKeyFilterLog, "qgc.qtlocationplugin.qgctilekeyfilter")
+
+namespace {
+
+constexpr quint32 kFileMagic = 0x5147434B; // "QGCK"
+constexpr quint32 kFileVersion = 1;
+
+/// splitmix64 终结函数，两次混合得到双重哈希的两个分量
+quint64 mix(quint64 x) {
+    x ^= x >> 30;
+    x *= Q_UINT64_C(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x *= Q_UINT64_C(0x94d049bb133111eb);
+    x ^= x >> 31;
+    return x;
+}
+
+} // namespace
+
+QGCTileKeyFilter *QGCTileKeyFilter::instance() {
+    static QGCTileKeyFilter filter;
+    return &filter;
+}
+
+bool QGCTileKeyFilter::mayContain(quint64 key) const {
+    QReadLocker lock(&_lock);
+    if (!_ready || !_words) {
+        return true;
+    }
+
+    _lookups.fetch_add(1, std::memory_order_relaxed);
+    const quint64 mask = _bits - 1;
+    const quint64 h1 = mix(key);
+    const quint64 h2 = mix(h1) | 1;
+    for (int i = 0; i < kHashes; i++) {
+        const quint64 bit = (h1 + static_cast<quint64>(i) * h2) & mask;
+        if ((_words[bit >> 6].load(std::memory_order_relaxed) & (Q_UINT64_C(1) << (bit & 63))) == 0) {
+            _skipped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+    return true;
+}
+
+void QGCTileKeyFilter::insert(quint64 key) {
+    QReadLocker lock(&_lock);
+    if (!_ready || !_words) {
+        return;
+    }
+
+    _set(_words.get(), _bits - 1, key);
+    _keys.fetch_add(1, std::memory_order_relaxed);
+}
+
+void QGCTileKeyFilter::clear() {
+    _install(_allocate(kMinBits), kMinBits, 0);
+}
+
+void QGCTileKeyFilter::invalidate() {
+    QWriteLocker lock(&_lock);
+    _ready = false;
+    _words.reset();
+    _bits = 0;
+    _keys = 0;
+}
+
+bool QGCTileKeyFilter::load(const QString &path, quint64 tiles) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    quint64 bits = 0;
+    quint64 keys = 0;
+    quint64 savedTiles = 0;
+    stream >> magic >> version >> bits >> keys >> savedTiles;
+    bool ok = (stream.status() == QDataStream::Ok) && (magic == kFileMagic) &&
+              (version == kFileVersion) && (savedTiles == tiles) &&
+              (bits >= kMinBits) && ((bits & (bits - 1)) == 0);
+
+    Words words;
+    if (ok) {
+        words = _allocate(bits);
+        const quint64 count = bits / 64;
+        QByteArray raw(static_cast<qsizetype>(count * sizeof(quint64)), Qt::Uninitialized);
+        ok = stream.readRawData(raw.data(), raw.size()) == raw.size();
+        const uchar *data = reinterpret_cast<const uchar *>(raw.constData());
+        for (quint64 i = 0; ok && (i < count); i++) {
+            words[i].store(qFromLittleEndian<quint64>(data + i * sizeof(quint64)), std::memory_order_relaxed);
+        }
+    }
+    file.close();
+
+    // 文件只在工作线程停止期间有效，之后的写入不会反映到文件中
+    (void)QFile::remove(path);
+    if (!ok) {
+        qCDebug(QGCTileKeyFilterLog) << "Discarding stale tile key filter" << path;
+        return false;
+    }
+
+    _install(std::move(words), bits, keys);
+    qCDebug(QGCTileKeyFilterLog) << "Loaded tile key filter:" << keys << "keys," << bits << "bits";
+    return true;
+}
+
+bool QGCTileKeyFilter::save(const QString &path, quint64 tiles) const {
+    QReadLocker lock(&_lock);
+    if (!_ready || !_words) {
+        return false;
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream << kFileMagic << kFileVersion << _bits << _keys.load() << tiles;
+    const quint64 count = _bits / 64;
+    QByteArray raw(static_cast<qsizetype>(count * sizeof(quint64)), Qt::Uninitialized);
+    uchar *data = reinterpret_cast<uchar *>(raw.data());
+    for (quint64 i = 0; i < count; i++) {
+        qToLittleEndian<quint64>(_words[i].load(std::memory_order_relaxed), data + i * sizeof(quint64));
+    }
+    (void)stream.writeRawData(raw.constData(), raw.size());
+    if ((stream.status() != QDataStream::Ok) || !file.commit()) {
+        qCWarning(QGCTileKeyFilterLog) << "Failed to save tile key filter" << path << file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool QGCTileKeyFilter::rebuild(QSqlDatabase &db, quint64 tiles) {
+    // 预留一倍余量，避免刚重建就因新瓦片再次写满
+    const quint64 bits = _bitsFor(tiles * 2);
+    Words words = _allocate(bits);
+    quint64 keys = 0;
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (!query.exec("SELECT tileID FROM Tiles")) {
+        qCWarning(QGCTileKeyFilterLog)
+            << "Map Cache SQL error (scan tile keys):" << query.lastError().text();
+        invalidate();
+        return false;
+    }
+    while (query.next()) {
+        _set(words.get(), bits - 1, query.value(0).toULongLong());
+        keys++;
+    }
+
+    _install(std::move(words), bits, keys);
+    qCDebug(QGCTileKeyFilterLog) << "Rebuilt tile key filter:" << keys << "keys," << bits << "bits";
+    return true;
+}
+
+QGCTileKeyFilter::Stats QGCTileKeyFilter::stats() const {
+    QReadLocker lock(&_lock);
+    Stats stats;
+    stats.lookups = _lookups;
+    stats.skipped = _skipped;
+    stats.keys = _keys;
+    stats.bits = _bits;
+    return stats;
+}
+
+QGCTileKeyFilter::Words QGCTileKeyFilter::_allocate(quint64 bits) {
+    Words words(new std::atomic<quint64>[bits / 64]);
+    for (quint64 i = 0; i < bits / 64; i++) {
+        words[i].store(0, std::memory_order_relaxed);
+    }
+    return words;
+}
+
+quint64 QGCTileKeyFilter::_bitsFor(quint64 keys) {
+    // 位数取 2 的幂，下标用掩码计算
+    quint64 bits = kMinBits;
+    while ((bits / kBitsPerKey) < keys) {
+        bits <<= 1;
+    }
+    return bits;
+}
+
+void QGCTileKeyFilter::_set(std::atomic<quint64> *words, quint64 mask, quint64 key) {
+    const quint64 h1 = mix(key);
+    const quint64 h2 = mix(h1) | 1;
+    for (int i = 0; i < kHashes; i++) {
+        const quint64 bit = (h1 + static_cast<quint64>(i) * h2) & mask;
+        (void)words[bit >> 6].fetch_or(Q_UINT64_C(1) << (bit & 63), std::memory_order_relaxed);
+    }
+}
+
+void QGCTileKeyFilter::_install(Words words, quint64 bits, quint64 keys) {
+    QWriteLocker lock(&_lock);
+    _words = std::move(words);
+    _bits = bits;
+    _keys = keys;
+    _ready = true;
+}
@@ -0,0 +1,166 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileLookup.h"
+#include "QGCCacheTile.h"
+#include "QGCMapTasks.h"
+
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QObject>
+#include <QtCore/QThreadStorage>
+
+namespace {
+
+QMutex poolMutex;
+QGCTileLookup *freeList = nullptr;
+int freeCount = 0;
+
+std::atomic<quint64> createdLookups = 0;
+std::atomic<quint64> reusedLookups = 0;
+std::atomic<quint64> deliveredBatches = 0;
+
+} // namespace
+
+/// 每个发起线程一个，收集完成的查询，一批只投递一个事件
+class QGCTileLookup::Dispatcher : public QObject
+{
+public:
+    static Dispatcher *current()
+    {
+        // 线程结束（主线程为 QCoreApplication 销毁）时释放
+        static QThreadStorage<Dispatcher*> storage;
+        if (!storage.hasLocalData()) {
+            storage.setLocalData(new Dispatcher);
+        }
+        return storage.localData();
+    }
+
+    void post(QGCTileLookup *lookup)
+    {
+        QMutexLocker lock(&_mutex);
+        const bool first = _pending.isEmpty();
+        _pending.append(lookup);
+        lock.unlock();
+
+        if (first) {
+            deliveredBatches++;
+            (void)QMetaObject::invokeMethod(this, [this]() { _deliver(); }, Qt::QueuedConnection);
+        }
+    }
+
+private:
+    void _deliver()
+    {
+        QMutexLocker lock(&_mutex);
+        QList<QGCTileLookup*> pending;
+        pending.swap(_pending);
+        lock.unlock();
+
+        for (QGCTileLookup *lookup : std::as_const(pending)) {
+            // 回调可能取消同批中的其他查询或销毁其发起者，逐个检查
+            if (!lookup->_cancelled && lookup->_context && lookup->_callback) {
+                lookup->_callback(lookup->_tile, lookup->_errorString);
+            } else {
+                delete lookup->_tile;
+            }
+            QGCTileLookup::_release(lookup);
+        }
+    }
+
+    QMutex _mutex;
+    QList<QGCTileLookup*> _pending;
+};
+
+QGCTileLookup *QGCTileLookup::create(quint64 key, QObject *context, Callback callback) {
+    QGCTileLookup *const lookup = _acquire();
+    lookup->_key = key;
+    lookup->_context = context;
+    lookup->_callback = std::move(callback);
+    lookup->_dispatcher = Dispatcher::current();
+    return lookup;
+}
+
+QGCTileLookup *QGCTileLookup::create(QGCFetchTileTask *task) {
+    return create(task->key(), task, [task](QGCCacheTile *tile, const QString &errorString) {
+        if (task->isCancelled()) {
+            delete tile;
+        } else if (tile) {
+            task->setTileFetched(tile);
+        } else {
+            task->setError(errorString);
+        }
+        task->deleteLater();
+    });
+}
+
+void QGCTileLookup::setTileFetched(QGCCacheTile *tile) {
+    _finish(tile, QString());
+}
+
+void QGCTileLookup::setError(const QString &errorString) {
+    _finish(nullptr, errorString);
+}
+
+void QGCTileLookup::discard() {
+    _finish(nullptr, QString());
+}
+
+void QGCTileLookup::_finish(QGCCacheTile *tile, const QString &errorString) {
+    _tile = tile;
+    _errorString = errorString;
+    // 回调与归还都在发起线程进行，QPointer 与回调捕获的对象只在该线程访问
+    _dispatcher->post(this);
+}
+
+QGCTileLookup *QGCTileLookup::_acquire() {
+    createdLookups++;
+
+    QMutexLocker lock(&poolMutex);
+    QGCTileLookup *const lookup = freeList;
+    if (lookup) {
+        freeList = lookup->_next;
+        freeCount--;
+        lock.unlock();
+        lookup->_next = nullptr;
+        reusedLookups++;
+        return lookup;
+    }
+    lock.unlock();
+
+    return new QGCTileLookup;
+}
+
+void QGCTileLookup::_release(QGCTileLookup *lookup) {
+    // 释放回调捕获的对象，避免池中的条目延长其生命周期
+    lookup->_callback = nullptr;
+    lookup->_context = nullptr;
+    lookup->_tile = nullptr;
+    lookup->_errorString.clear();
+    lookup->_cancelled = false;
+    lookup->_dispatcher = nullptr;
+
+    QMutexLocker lock(&poolMutex);
+    if (freeCount >= kMaxPooled) {
+        lock.unlock();
+        delete lookup;
+        return;
+    }
+    lookup->_next = freeList;
+    freeList = lookup;
+    freeCount++;
+}
+
+QGCTileLookup::Stats QGCTileLookup::stats() {
+    Stats stats;
+    stats.created = createdLookups;
+    stats.reused = reusedLookups;
+    stats.batches = deliveredBatches;
+    return stats;
+}
@@ -0,0 +1,103 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileMemoryCache.h"
+#include "QGCCacheTile.h"
+
+Q_LOGGING_CATEGORY(QGCTileMemoryCacheLog,
+                   "qgc.qtlocationplugin.qgctilememorycache")
+
+QGCTileMemoryCache *QGCTileMemoryCache::instance() {
+    static QGCTileMemoryCache cache;
+    return &cache;
+}
+
+void QGCTileMemoryCache::setBudget(quint64 bytes) {
+    _budget = bytes;
+    const quint64 limit = bytes / kShardCount;
+    for (Shard &shard : _shards) {
+        QMutexLocker lock(&shard.mutex);
+        _evict(shard, limit);
+    }
+    qCDebug(QGCTileMemoryCacheLog) << "Encoded tile cache budget:" << bytes;
+}
+
+void QGCTileMemoryCache::insert(quint64 key, const QByteArray &img,
+                                const QString &format, const QString &type) {
+    const quint64 limit = _budget / kShardCount;
+    if (img.isEmpty() || (limit == 0)) {
+        return;
+    }
+
+    Shard &shard = _shard(key);
+    QMutexLocker lock(&shard.mutex);
+    const auto found = shard.index.constFind(key);
+    if (found != shard.index.constEnd()) {
+        // 已缓存：瓦片内容不变，只需提升为最近使用
+        shard.lru.splice(shard.lru.begin(), shard.lru, found.value());
+        return;
+    }
+
+    shard.lru.push_front({key, img, format, type});
+    shard.index.insert(key, shard.lru.begin());
+    shard.bytes += _cost(shard.lru.front());
+    _evict(shard, limit);
+}
+
+QGCCacheTile *QGCTileMemoryCache::lookup(quint64 key) {
+    if (_budget == 0) {
+        return nullptr;
+    }
+
+    Shard &shard = _shard(key);
+    QMutexLocker lock(&shard.mutex);
+    const auto found = shard.index.constFind(key);
+    if (found == shard.index.constEnd()) {
+        _misses++;
+        return nullptr;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, found.value());
+    const Entry &entry = shard.lru.front();
+    _hits++;
+    return new QGCCacheTile(entry.key, entry.img, entry.format, entry.type);
+}
+
+void QGCTileMemoryCache::clear() {
+    for (Shard &shard : _shards) {
+        QMutexLocker lock(&shard.mutex);
+        shard.index.clear();
+        shard.lru.clear();
+        shard.bytes = 0;
+    }
+}
+
+void QGCTileMemoryCache::_evict(Shard &shard, quint64 limit) {
+    while ((shard.bytes > limit) && !shard.lru.empty()) {
+        const Entry &entry = shard.lru.back();
+        shard.bytes -= _cost(entry);
+        (void)shard.index.remove(entry.key);
+        shard.lru.pop_back();
+        _evictions++;
+    }
+}
+
+QGCTileMemoryCache::Stats QGCTileMemoryCache::stats() const {
+    Stats s;
+    s.hits = _hits;
+    s.misses = _misses;
+    s.evictions = _evictions;
+    s.budget = _budget;
+    for (const Shard &shard : _shards) {
+        QMutexLocker lock(&shard.mutex);
+        s.bytes += shard.bytes;
+        s.count += shard.index.size();
+    }
+    return s;
+}
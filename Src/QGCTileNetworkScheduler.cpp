@@ -0,0 +1,250 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileNetworkScheduler.h"
+#include "QGCHostConcurrency.h"
+
+#include <QtCore/QList>
+#include <QtNetwork/QNetworkReply>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+Q_LOGGING_CATEGORY(QGCTileNetworkSchedulerLog,
+                   "qgc.qtlocationplugin.qgctilenetworkscheduler")
+
+QGCTileNetworkScheduler::QGCTileNetworkScheduler(QObject *parent)
+    : QObject(parent) {
+    // 名额也可能被离线下载等不经调度的请求占用，它们结束时不会通知这里
+    _retryTimer.setSingleShot(true);
+    _retryTimer.setInterval(kRetryInterval);
+    (void)connect(&_retryTimer, &QTimer::timeout, this, &QGCTileNetworkScheduler::_schedule);
+}
+
+QGCTileNetworkScheduler::~QGCTileNetworkScheduler() {
+    // 排队中的请求者不会再获得名额
+    const QMap<quint64, Request> pending = std::exchange(_pending, {});
+    for (const Request &request : pending) {
+        request.drop();
+    }
+}
+
+quint64 QGCTileNetworkScheduler::submit(const QGeoTileSpec &spec, const QString &host, Start start, Drop drop) {
+    Request request;
+    request.x = spec.x();
+    request.y = spec.y();
+    request.zoom = spec.zoom();
+    request.host = host;
+    request.start = std::move(start);
+    request.drop = std::move(drop);
+    request.generation = _generation;
+
+    const quint64 ticket = _nextTicket++;
+    (void)_pending.insert(ticket, request);
+    _schedule();
+    return ticket;
+}
+
+void QGCTileNetworkScheduler::cancel(quint64 ticket) {
+    if (_pending.remove(ticket) > 0) {
+        _cancelled++;
+    }
+}
+
+void QGCTileNetworkScheduler::setViewport(const QSet<QGeoTileSpec> &visibleTiles) {
+    if (visibleTiles.isEmpty()) {
+        return;
+    }
+
+    const int zoom = visibleTiles.constBegin()->zoom();
+    const int world = 1 << zoom;
+    int minX = std::numeric_limits<int>::max();
+    int maxX = std::numeric_limits<int>::min();
+    int minY = std::numeric_limits<int>::max();
+    int maxY = std::numeric_limits<int>::min();
+    for (const QGeoTileSpec &tile : visibleTiles) {
+        minX = qMin(minX, tile.x());
+        maxX = qMax(maxX, tile.x());
+        minY = qMin(minY, tile.y());
+        maxY = qMax(maxY, tile.y());
+    }
+
+    // 跨越 180° 经线时西半部分的编号接在东半部分之后
+    if ((maxX - minX + 1) > (world / 2)) {
+        int west = std::numeric_limits<int>::max();
+        int east = std::numeric_limits<int>::min();
+        for (const QGeoTileSpec &tile : visibleTiles) {
+            const int x = (tile.x() < (world / 2)) ? (tile.x() + world) : tile.x();
+            west = qMin(west, x);
+            east = qMax(east, x);
+        }
+        minX = west;
+        maxX = east;
+    }
+
+    const double centerX = (minX + maxX + 1) / 2.;
+    const double centerY = (minY + maxY + 1) / 2.;
+    if (_hasViewport && (zoom == _zoom) && (centerX == _centerX) && (centerY == _centerY)) {
+        return;
+    }
+
+    _hasViewport = true;
+    _generation++;
+    _zoom = zoom;
+    _centerX = centerX;
+    _centerY = centerY;
+    _halfWidth = (maxX - minX + 1) / 2.;
+    _halfHeight = (maxY - minY + 1) / 2.;
+
+    if (!_pending.isEmpty()) {
+        _schedule();
+    }
+}
+
+QGCTileNetworkScheduler::Stats QGCTileNetworkScheduler::stats() const {
+    Stats s;
+    s.dispatched = _dispatched;
+    s.dropped = _dropped;
+    s.cancelled = _cancelled;
+    s.pending = _pending.size();
+    s.running = _running.size();
+    return s;
+}
+
+void QGCTileNetworkScheduler::_schedule() {
+    // 同一轮事件中排队的请求一起排序后再发出
+    if (_dispatchQueued) {
+        return;
+    }
+    _dispatchQueued = true;
+    (void)QMetaObject::invokeMethod(this, &QGCTileNetworkScheduler::_dispatch, Qt::QueuedConnection);
+}
+
+void QGCTileNetworkScheduler::_dispatch() {
+    _dispatchQueued = false;
+
+    QList<quint64> stale;
+    QList<QPair<double, quint64>> order;
+    order.reserve(_pending.size());
+    for (auto it = _pending.constBegin(); it != _pending.constEnd(); ++it) {
+        if (_isStale(it.value())) {
+            stale.append(it.key());
+        } else {
+            order.append(qMakePair(_score(it.value()), it.key()));
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [](const QPair<double, quint64> &a, const QPair<double, quint64> &b) {
+        return a.first < b.first;
+    });
+
+    // 回调中请求者可能取消或提交其他下载，每次都从 _pending 重新取出
+    for (const quint64 ticket : std::as_const(stale)) {
+        const auto found = _pending.find(ticket);
+        if (found == _pending.end()) {
+            continue;
+        }
+        const Request request = found.value();
+        (void)_pending.erase(found);
+        _dropped++;
+        request.drop();
+    }
+
+    // 名额按服务统计，包括其他引擎与离线下载正在进行的下载
+    QSet<QString> full;
+    for (const QPair<double, quint64> &entry : std::as_const(order)) {
+        const auto found = _pending.find(entry.second);
+        if (found == _pending.end()) {
+            continue;
+        }
+
+        const QString host = found->host;
+        if (full.contains(host)) {
+            continue;
+        }
+        if (QGCHostConcurrency::instance()->available(host) <= 0) {
+            (void)full.insert(host);
+            continue;
+        }
+
+        const Request request = found.value();
+        (void)_pending.erase(found);
+        QNetworkReply *const reply = request.start();
+        if (!reply) {
+            continue;
+        }
+
+        (void)_running.insert(reply);
+        (void)connect(reply, &QNetworkReply::finished, this, [this, reply]() { _release(reply); });
+        (void)connect(reply, &QObject::destroyed, this, [this, reply]() { _release(reply); });
+
+        const quint64 dispatched = ++_dispatched;
+        if ((dispatched % kStatsInterval) == 0) {
+            _logStats();
+        }
+    }
+
+    if (!full.isEmpty() && !_pending.isEmpty() && !_retryTimer.isActive()) {
+        _retryTimer.start();
+    }
+}
+
+void QGCTileNetworkScheduler::_release(QNetworkReply *reply) {
+    const auto found = _running.find(reply);
+    if (found == _running.end()) {
+        return;
+    }
+
+    (void)_running.erase(found);
+    (void)reply->disconnect(this);
+
+    if (!_pending.isEmpty()) {
+        _schedule();
+    }
+}
+
+double QGCTileNetworkScheduler::_distance(const Request &request) const {
+    // 换算到视口所在缩放级别的瓦片坐标
+    const double scale = std::ldexp(1., _zoom - request.zoom);
+    const double world = std::ldexp(1., _zoom);
+    double dx = ((request.x + 0.5) * scale) - _centerX;
+    const double dy = ((request.y + 0.5) * scale) - _centerY;
+    if (dx > (world / 2.)) {
+        dx -= world;
+    } else if (dx < -(world / 2.)) {
+        dx += world;
+    }
+
+    return qMax(qAbs(dx) / _halfWidth, qAbs(dy) / _halfHeight);
+}
+
+double QGCTileNetworkScheduler::_score(const Request &request) const {
+    if (!_hasViewport) {
+        return 0.;
+    }
+
+    return _distance(request) + (qAbs(request.zoom - _zoom) * kZoomPenalty);
+}
+
+bool QGCTileNetworkScheduler::_isStale(const Request &request) const {
+    // 只丢弃视口变化之前排队的请求，当前视口请求的瓦片总会发出
+    if (!_hasViewport || (request.generation >= _generation)) {
+        return false;
+    }
+
+    return (qAbs(request.zoom - _zoom) > kStaleZoom) || (_distance(request) > kStaleDistance);
+}
+
+void QGCTileNetworkScheduler::_logStats() const {
+    const Stats s = stats();
+    qCDebug(QGCTileNetworkSchedulerLog) << "dispatched" << s.dispatched << "dropped" << s.dropped
+                                        << "cancelled" << s.cancelled << "pending" << s.pending
+                                        << "running" << s.running;
+}
@@ -0,0 +1,482 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTilePackStore.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtSql/QSqlDatabase>
+#include <QtSql/QSqlError>
+#include <QtSql/QSqlQuery>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(QGCTilePackStoreLog, "qgc.qtlocationplugin.qgctilepackstore")
+
+QGCTilePackStore *QGCTilePackStore::instance() {
+    static QGCTilePackStore store;
+    return &store;
+}
+
+QGCTilePackStore::~QGCTilePackStore() {
+    _closeAll();
+}
+
+bool QGCTilePackStore::open(QSqlDatabase &db, const QString &directory) {
+    _closeAll();
+    _directory = directory;
+    _active = 0;
+    _activeBytes = 0;
+    _lastPack = 0;
+    _unsynced.clear();
+
+    // 只在需要追加时建立目录，使用内嵌存储的缓存不留下空目录
+    if (_appendEnabled && !QDir().mkpath(directory)) {
+        qCWarning(QGCTilePackStoreLog) << "Could not create pack directory" << directory;
+        return false;
+    }
+
+    QSqlQuery query(db);
+    if (!query.exec("SELECT pack, bytes FROM Packs ORDER BY pack")) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (read packs):" << query.lastError().text();
+        return false;
+    }
+
+    QSet<qint64> known;
+    QList<qint64> lost;
+    while (query.next()) {
+        const qint64 pack = query.value(0).toLongLong();
+        known.insert(pack);
+        _lastPack = pack;
+        if (_map(pack, false)) {
+            _active = pack;
+            _activeBytes = query.value(1).toLongLong();
+        } else {
+            lost.append(pack);
+        }
+    }
+    query.finish();
+
+    // 崩溃或回滚留下的包文件没有 Packs 记录，其中的字节不被任何图像引用
+    const QStringList files = QDir(directory).entryList({QStringLiteral("pack-*.dat")}, QDir::Files);
+    for (const QString &name : files) {
+        bool ok = false;
+        const qint64 pack = QStringView(name).sliced(5, name.size() - 9).toLongLong(&ok);
+        if (ok && !known.contains(pack)) {
+            (void)QFile::remove(QDir(directory).filePath(name));
+        }
+    }
+
+    // 包文件被删除或数据库被替换时，引用不到图像的瓦片只能删除，由触发器维护统计与引用计数
+    if (!lost.isEmpty()) {
+        qCWarning(QGCTilePackStoreLog) << "Missing tile packs:" << lost;
+        (void)query.prepare("DELETE FROM Packs WHERE pack = ?");
+        for (const qint64 pack : std::as_const(lost)) {
+            query.addBindValue(pack);
+            (void)query.exec();
+        }
+    }
+    if (!query.exec("DELETE FROM Tiles WHERE blobID IN (SELECT blobID FROM Blobs "
+                    "WHERE pack > 0 AND pack NOT IN (SELECT pack FROM Packs))")) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (drop unpacked tiles):" << query.lastError().text();
+    }
+
+    _open = true;
+    qCDebug(QGCTilePackStoreLog) << "Opened" << _packs.size() << "tile packs in" << directory;
+    return true;
+}
+
+void QGCTilePackStore::discard() {
+    _closeAll();
+    if (_directory.isEmpty()) {
+        return;
+    }
+
+    const QDir dir(_directory);
+    const QStringList files = dir.entryList({QStringLiteral("pack-*.dat")}, QDir::Files);
+    for (const QString &name : files) {
+        (void)QFile::remove(dir.filePath(name));
+    }
+}
+
+QGCTilePackStore::Location QGCTilePackStore::append(QSqlDatabase &db, const QByteArray &img) {
+    Location location;
+    if (!_open || img.isEmpty() || (img.size() > kMaxPacked)) {
+        return location;
+    }
+
+    if ((_active == 0) || ((_activeBytes + img.size()) > kPackSize)) {
+        const qint64 pack = _lastPack + 1;
+        if (!_map(pack, true)) {
+            return location;
+        }
+        _lastPack = pack;
+        _active = pack;
+        _activeBytes = 0;
+    }
+
+    if (!_grow(_active, _activeBytes + img.size())) {
+        // 之后的图像写入新的包
+        _active = 0;
+        return location;
+    }
+
+    QFile *file = nullptr;
+    {
+        QReadLocker lock(&_lock);
+        file = _packs.value(_active).file;
+    }
+    if (!file->seek(_activeBytes) || (file->write(img) != img.size())) {
+        qCWarning(QGCTilePackStoreLog) << "Could not append to tile pack:" << file->errorString();
+        return location;
+    }
+
+    // 每次追加都写入完整记录，之前的事务回滚后也能恢复
+    QSqlQuery query(db);
+    (void)query.prepare("INSERT OR REPLACE INTO Packs(pack, bytes) VALUES(?, ?)");
+    query.addBindValue(_active);
+    query.addBindValue(_activeBytes + img.size());
+    if (!query.exec()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (update pack):" << query.lastError().text();
+        return location;
+    }
+
+    location.pack = _active;
+    location.offset = _activeBytes;
+    _activeBytes += img.size();
+    _unsynced.insert(_active);
+    _appended++;
+    _appendedBytes += img.size();
+    return location;
+}
+
+bool QGCTilePackStore::sync() {
+    bool ok = true;
+    QReadLocker lock(&_lock);
+    for (const qint64 pack : std::as_const(_unsynced)) {
+        const auto found = _packs.constFind(pack);
+        if ((found != _packs.constEnd()) && !_fsync(found->file)) {
+            qCWarning(QGCTilePackStoreLog) << "Could not sync tile pack" << pack << ":" << found->file->errorString();
+            ok = false;
+        }
+    }
+    if (ok) {
+        _unsynced.clear();
+    }
+    return ok;
+}
+
+QByteArray QGCTilePackStore::read(qint64 pack, qint64 offset, qint64 size) const {
+    if ((offset < 0) || (size <= 0)) {
+        return QByteArray();
+    }
+
+    QReadLocker lock(&_lock);
+    const auto found = _packs.constFind(pack);
+    if ((found == _packs.constEnd()) || ((offset + size) > found->size)) {
+        return QByteArray();
+    }
+
+    return QByteArray(reinterpret_cast<const char *>(found->data + offset), size);
+}
+
+int QGCTilePackStore::compactStep(QSqlDatabase &db) {
+    if (!_open) {
+        return 0;
+    }
+
+    // 正在追加的包不参与；不再追加时所有包都可能被转换搬空
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    (void)query.prepare("SELECT P.pack, P.bytes, "
+                        "(SELECT IFNULL(SUM(B.size), 0) FROM Blobs B WHERE B.pack = P.pack) AS live "
+                        "FROM Packs P WHERE P.pack != ? "
+                        "ORDER BY live * 1.0 / MAX(P.bytes, 1) LIMIT 1");
+    query.addBindValue(appendEnabled() ? _active : 0);
+    if (!query.exec()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (select pack to compact):" << query.lastError().text();
+        return -1;
+    }
+    if (!query.next()) {
+        return 0;
+    }
+
+    const qint64 pack = query.value(0).toLongLong();
+    const qint64 bytes = query.value(1).toLongLong();
+    const qint64 live = query.value(2).toLongLong();
+    query.finish();
+    if ((live > 0) && (!appendEnabled() || (live >= (bytes * kCompactRatio)))) {
+        return 0;
+    }
+
+    if (!db.transaction()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (begin compaction):" << db.lastError().text();
+        return -1;
+    }
+
+    int moved = 0;
+    if (live == 0) {
+        (void)query.prepare("DELETE FROM Packs WHERE pack = ?");
+        query.addBindValue(pack);
+        if (!query.exec() || !db.commit()) {
+            qCWarning(QGCTilePackStoreLog)
+                << "Map Cache SQL error (drop pack):" << query.lastError().text();
+            (void)db.rollback();
+            return -1;
+        }
+        _retire(pack);
+        return 1;
+    }
+
+    // 先读出整块再更新，不在扫描 Blobs 的同时修改它
+    QList<QPair<qint64, QByteArray>> rows;
+    (void)query.prepare("SELECT blobID, packOffset, size FROM Blobs WHERE pack = ? LIMIT ?");
+    query.addBindValue(pack);
+    query.addBindValue(kChunkBlobs);
+    if (query.exec()) {
+        while (query.next()) {
+            rows.append({query.value(0).toLongLong(),
+                         read(pack, query.value(1).toLongLong(), query.value(2).toLongLong())});
+        }
+    } else {
+        moved = -1;
+    }
+    query.finish();
+
+    for (const QPair<qint64, QByteArray> &row : std::as_const(rows)) {
+        if (row.second.isEmpty() || !_move(db, row.first, row.second)) {
+            moved = -1;
+            break;
+        }
+        moved++;
+    }
+
+    if ((moved < 0) || !sync() || !db.commit()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (compact pack):" << query.lastError().text();
+        (void)db.rollback();
+        return -1;
+    }
+
+    _movedBlobs += moved;
+    qCDebug(QGCTilePackStoreLog) << "Compacted" << moved << "blobs out of pack" << pack;
+    return moved;
+}
+
+int QGCTilePackStore::convertStep(QSqlDatabase &db, bool toPacks) {
+    if (!_open || (toPacks && !appendEnabled())) {
+        return 0;
+    }
+
+    QSqlQuery query(db);
+    query.setForwardOnly(true);
+    if (toPacks) {
+        (void)query.prepare("SELECT blobID, tile FROM Blobs WHERE pack = 0 AND size <= ? LIMIT ?");
+        query.addBindValue(kMaxPacked);
+    } else {
+        (void)query.prepare("SELECT blobID, pack, packOffset, size FROM Blobs WHERE pack > 0 LIMIT ?");
+    }
+    query.addBindValue(kChunkBlobs);
+    if (!query.exec()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (select blobs to convert):" << query.lastError().text();
+        return -1;
+    }
+
+    struct Row {
+        qint64 blobID;
+        QByteArray img;
+    };
+    QList<Row> rows;
+    while (query.next()) {
+        const QByteArray img = toPacks
+            ? query.value(1).toByteArray()
+            : read(query.value(1).toLongLong(), query.value(2).toLongLong(), query.value(3).toLongLong());
+        rows.append({query.value(0).toLongLong(), img});
+    }
+    query.finish();
+    if (rows.isEmpty()) {
+        return 0;
+    }
+
+    if (!db.transaction()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (begin conversion):" << db.lastError().text();
+        return -1;
+    }
+
+    bool ok = true;
+    if (!toPacks) {
+        (void)query.prepare("UPDATE Blobs SET tile = ?, pack = 0, packOffset = 0 WHERE blobID = ?");
+    }
+    for (const Row &row : std::as_const(rows)) {
+        if (row.img.isEmpty()) {
+            ok = false;
+        } else if (toPacks) {
+            ok = _move(db, row.blobID, row.img);
+        } else {
+            query.addBindValue(row.img);
+            query.addBindValue(row.blobID);
+            ok = query.exec();
+        }
+        if (!ok) {
+            break;
+        }
+    }
+
+    if (!ok || !sync() || !db.commit()) {
+        qCWarning(QGCTilePackStoreLog)
+            << "Map Cache SQL error (convert blobs):" << query.lastError().text();
+        (void)db.rollback();
+        return -1;
+    }
+
+    _movedBlobs += rows.size();
+    return static_cast<int>(rows.size());
+}
+
+QGCTilePackStore::Stats QGCTilePackStore::stats() const {
+    Stats s;
+    s.appended = _appended;
+    s.appendedBytes = _appendedBytes;
+    s.movedBlobs = _movedBlobs;
+    s.retiredPacks = _retiredPacks;
+    return s;
+}
+
+QString QGCTilePackStore::_path(qint64 pack) const {
+    return QStringLiteral("%1/pack-%2.dat").arg(_directory).arg(pack, 6, 10, QLatin1Char('0'));
+}
+
+bool QGCTilePackStore::_map(qint64 pack, bool create) {
+    QFile *const file = new QFile(_path(pack));
+    if (!create && !file->exists()) {
+        delete file;
+        return false;
+    }
+
+    // 新包先扩展一步，之后随追加逐步增长，空间不足时才占用 kPackSize
+    uchar *data = nullptr;
+    qint64 size = 0;
+    if (file->open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+        size = file->size();
+        if ((size > 0) || file->resize(kGrowSize)) {
+            size = qMin(file->size(), kPackSize);
+            data = file->map(0, size);
+        }
+    }
+    if (!data) {
+        qCWarning(QGCTilePackStoreLog) << "Could not map tile pack" << file->fileName()
+                                       << ":" << file->errorString();
+        delete file;
+        return false;
+    }
+
+    QWriteLocker lock(&_lock);
+    _packs.insert(pack, {file, data, size});
+    return true;
+}
+
+bool QGCTilePackStore::_grow(qint64 pack, qint64 bytes) {
+    QWriteLocker lock(&_lock);
+    const auto found = _packs.find(pack);
+    if (found == _packs.end()) {
+        return false;
+    }
+    if (bytes <= found->size) {
+        return true;
+    }
+
+    // 读取只在读锁内访问映射，持有写锁时可以安全地重建映射（Windows 不能扩展已映射的文件）
+    const qint64 size = qMin(((bytes + kGrowSize - 1) / kGrowSize) * kGrowSize, kPackSize);
+    QFile *const file = found->file;
+    (void)file->unmap(found->data);
+    found->data = nullptr;
+    if (file->resize(size)) {
+        found->data = file->map(0, size);
+    }
+    if (!found->data) {
+        qCWarning(QGCTilePackStoreLog) << "Could not grow tile pack" << file->fileName()
+                                       << ":" << file->errorString();
+        // 恢复原来的映射，已有的图像仍可读取
+        found->data = file->map(0, found->size);
+        if (!found->data) {
+            found->size = 0;
+        }
+        return false;
+    }
+
+    found->size = size;
+    return true;
+}
+
+void QGCTilePackStore::_unmap(const Pack &pack) {
+    if (pack.data) {
+        (void)pack.file->unmap(pack.data);
+    }
+    delete pack.file;
+}
+
+void QGCTilePackStore::_closeAll() {
+    _open = false;
+    QWriteLocker lock(&_lock);
+    for (const Pack &pack : std::as_const(_packs)) {
+        _unmap(pack);
+    }
+    _packs.clear();
+}
+
+void QGCTilePackStore::_retire(qint64 pack) {
+    {
+        // 获得写锁时正在进行的读取都已结束，读取返回的是副本，不再引用映射
+        QWriteLocker lock(&_lock);
+        const auto found = _packs.find(pack);
+        if (found != _packs.end()) {
+            _unmap(found.value());
+            (void)_packs.erase(found);
+        }
+    }
+
+    // 读连接中较早的快照仍可能指向这个包，读取得到空结果，按未命中处理；
+    // 删除失败时由下次 open() 清理
+    (void)QFile::remove(_path(pack));
+    _retiredPacks++;
+    qCDebug(QGCTilePackStoreLog) << "Retired tile pack" << pack;
+}
+
+bool QGCTilePackStore::_move(QSqlDatabase &db, qint64 blobID, const QByteArray &img) {
+    const Location location = append(db, img);
+    if (location.pack == 0) {
+        return false;
+    }
+
+    QSqlQuery query(db);
+    (void)query.prepare("UPDATE Blobs SET pack = ?, packOffset = ?, tile = X'' WHERE blobID = ?");
+    query.addBindValue(location.pack);
+    query.addBindValue(location.offset);
+    query.addBindValue(blobID);
+    return query.exec();
+}
+
+bool QGCTilePackStore::_fsync(QFile *file) {
+#ifdef Q_OS_WIN
+    return (::_commit(file->handle()) == 0);
+#else
+    return (::fsync(file->handle()) == 0);
+#endif
+}
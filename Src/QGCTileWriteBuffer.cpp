@@ -0,0 +1,171 @@
+/****************************************************************************
+ *
+ * (c) 2009-2024 QGROUNDCONTROL PROJECT <http://www.qgroundcontrol.org>
+ *
+ * QGroundControl is licensed according to the terms in the file
+ * COPYING.md in the root of the source code directory.
+ *
+ ****************************************************************************/
+
+#include "QGCTileWriteBuffer.h"
+#include "QGCCacheTile.h"
+
+Q_LOGGING_CATEGORY(QGCTileWriteBufferLog,
+                   "qgc.qtlocationplugin.qgctilewritebuffer")
+
+QGCTileWriteBuffer *QGCTileWriteBuffer::instance() {
+    static QGCTileWriteBuffer buffer;
+    return &buffer;
+}
+
+void QGCTileWriteBuffer::setWindow(int ms, quint64 bytes) {
+    _windowMs = qMax(0, ms);
+    _maxBytes = bytes;
+    qCDebug(QGCTileWriteBufferLog) << "Write-behind window:" << _windowMs << "ms" << bytes << "bytes";
+}
+
+bool QGCTileWriteBuffer::add(quint64 key, const QByteArray &img, const QString &format,
+                             const QString &type, quint64 set) {
+    _saves++;
+
+    QMutexLocker lock(&_mutex);
+    const bool first = _entries.isEmpty();
+    auto found = _entries.find(key);
+    if (found != _entries.end()) {
+        // 同一瓦片的图像相同，只需记录新的所属集合
+        _duplicates++;
+        if (!found->sets.contains(set)) {
+            found->sets.append(set);
+            found->seq = ++_seq;
+        }
+        return false;
+    }
+
+    Entry entry;
+    entry.key = key;
+    entry.img = img;
+    entry.format = format;
+    entry.type = type;
+    entry.sets = {set};
+    entry.seq = ++_seq;
+    _bytes += static_cast<quint64>(img.size()) + kEntryOverhead;
+    (void)_entries.insert(key, entry);
+    if (first) {
+        _oldest.start();
+    }
+
+    return first || (_bytes >= _maxBytes);
+}
+
+QGCCacheTile *QGCTileWriteBuffer::lookup(quint64 key) const {
+    QMutexLocker lock(&_mutex);
+    const auto found = _entries.constFind(key);
+    if (found == _entries.constEnd()) {
+        return nullptr;
+    }
+
+    return new QGCCacheTile(found->key, found->img, found->format, found->type);
+}
+
+bool QGCTileWriteBuffer::contains(quint64 key) const {
+    QMutexLocker lock(&_mutex);
+    return _entries.contains(key);
+}
+
+bool QGCTileWriteBuffer::isEmpty() const {
+    QMutexLocker lock(&_mutex);
+    return _entries.isEmpty();
+}
+
+bool QGCTileWriteBuffer::isDue() const {
+    return remainingTime() == 0;
+}
+
+qint64 QGCTileWriteBuffer::remainingTime() const {
+    QMutexLocker lock(&_mutex);
+    if (_entries.isEmpty()) {
+        return -1;
+    }
+    if (_bytes >= _maxBytes) {
+        return 0;
+    }
+
+    return qMax<qint64>(0, _windowMs - _oldest.elapsed());
+}
+
+QList<QGCTileWriteBuffer::Entry> QGCTileWriteBuffer::pending() const {
+    QMutexLocker lock(&_mutex);
+    return _entries.values();
+}
+
+void QGCTileWriteBuffer::committed(const QList<Entry> &entries) {
+    QMutexLocker lock(&_mutex);
+    for (const Entry &entry : entries) {
+        const auto found = _entries.constFind(entry.key);
+        if ((found == _entries.constEnd()) || (found->seq != entry.seq)) {
+            continue;
+        }
+        _bytes -= static_cast<quint64>(found->img.size()) + kEntryOverhead;
+        (void)_entries.erase(found);
+    }
+
+    // 写入期间新增的条目从现在开始计时
+    if (!_entries.isEmpty()) {
+        _oldest.start();
+    }
+
+    _flushes++;
+    _flushed += entries.size();
+}
+
+void QGCTileWriteBuffer::failed(const QList<Entry> &entries) {
+    quint64 dropped = 0;
+    {
+        QMutexLocker lock(&_mutex);
+        for (const Entry &entry : entries) {
+            const auto found = _entries.find(entry.key);
+            if (found == _entries.end()) {
+                continue;
+            }
+            // 离线集合的瓦片不会再次下载，只有持续失败时才放弃
+            if (++found->attempts < kMaxAttempts) {
+                continue;
+            }
+            _bytes -= static_cast<quint64>(found->img.size()) + kEntryOverhead;
+            (void)_entries.erase(found);
+            dropped++;
+        }
+
+        // 下一次重试等待一个完整的窗口
+        if (!_entries.isEmpty()) {
+            _oldest.start();
+        }
+    }
+
+    _failed++;
+    if (dropped > 0) {
+        _dropped += dropped;
+        qCWarning(QGCTileWriteBufferLog) << "Dropped" << dropped << "tiles after" << kMaxAttempts << "failed writes";
+    }
+}
+
+void QGCTileWriteBuffer::clear() {
+    QMutexLocker lock(&_mutex);
+    _entries.clear();
+    _bytes = 0;
+}
+
+QGCTileWriteBuffer::Stats QGCTileWriteBuffer::stats() const {
+    Stats stats;
+    stats.saves = _saves;
+    stats.duplicates = _duplicates;
+    stats.flushes = _flushes;
+    stats.flushed = _flushed;
+    stats.failed = _failed;
+    stats.dropped = _dropped;
+
+    QMutexLocker lock(&_mutex);
+    stats.bytes = _bytes;
+    stats.count = _entries.size();
+    return stats;
+}
@@ -8,9 +8,14 @@
  ****************************************************************************/
 
 #include "QGeoFileTileCacheQGC.h"
+#include "QGCCacheEvictor.h"
 #include "QGCMapEngine.h"
 #include "QGCMapTasks.h"
 #include "QGCMapUrlEngine.h"
+#include "QGCTileKey.h"
+#include "QGCTileKeyFilter.h"
+#include "QGCTileMemoryCache.h"
+#include "QGCTileWriteBuffer.h"
 
 #include <QtCore/QDir>
 #include <QtCore/QLoggingCategory>
@@ -31,6 +36,8 @@ QGeoFileTileCacheQGC::QGeoFileTileCacheQGC(const QVariantMap &parameters,
     setMaxDiskUsage(_getDefaultMaxDiskCache());
     setCostStrategyMemory(QGeoFileTileCache::ByteSize);
     setMaxMemoryUsage(_getMemLimit(parameters));
+    QGCTileMemoryCache::instance()->setBudget(_getEncodedMemLimit(parameters));
+    _setWriteWindow(parameters);
     setCostStrategyTexture(QGeoFileTileCache::ByteSize);
     setMinTextureUsage(_getDefaultMinTexture());
     setExtraTextureUsage(_getDefaultExtraTexture() - minTextureUsage());
@@ -78,60 +85,160 @@ uint32_t QGeoFileTileCacheQGC::_getMemLimit(const QVariantMap &parameters) {
     return memLimit;
 }
 
+quint64 QGeoFileTileCacheQGC::_getEncodedMemLimit(const QVariantMap &parameters) {
+    // 已编码瓦片 LRU 的字节预算，0 表示关闭
+    if (parameters.contains(QStringLiteral("mapping.cache.lru.size"))) {
+        bool ok = false;
+        const quint64 limit = parameters.value(QStringLiteral("mapping.cache.lru.size"))
+                                  .toString()
+                                  .toULongLong(&ok);
+        if (ok) {
+            return qMin(limit, static_cast<quint64>(pow(1024, 3)));
+        }
+    }
+
+    return _getDefaultEncodedMemLimit();
+}
+
+void QGeoFileTileCacheQGC::_setWriteWindow(const QVariantMap &parameters) {
+    // 写后缓冲的时间窗口（毫秒）与字节上限，窗口为 0 时每次调度都写入
+    QGCTileWriteBuffer *const buffer = QGCTileWriteBuffer::instance();
+    bool ok = false;
+    int window = parameters.value(QStringLiteral("mapping.cache.write.window")).toString().toInt(&ok);
+    if (!ok) {
+        window = buffer->window();
+    }
+    quint64 bytes = parameters.value(QStringLiteral("mapping.cache.write.size")).toString().toULongLong(&ok);
+    if (!ok) {
+        bytes = _getDefaultWriteLimit();
+    }
+    buffer->setWindow(qMin(window, kMaxWriteWindow), qMin(bytes, static_cast<quint64>(pow(1024, 3))));
+}
+
 quint32 QGeoFileTileCacheQGC::_getMaxMemCacheSetting() { return 1024 * 1024; }
 
 quint32 QGeoFileTileCacheQGC::getMaxDiskCacheSetting() { return 1024; }
 
+QGCTileStorage QGeoFileTileCacheQGC::getStorage(const QVariantMap &parameters) {
+    const QString storage =
+        parameters.value(QStringLiteral("mapping.cache.storage")).toString().toLower();
+    return (storage == QStringLiteral("pack")) ? QGCTileStorage::Pack : QGCTileStorage::SQLite;
+}
+
+QGCCacheIdlePolicy QGeoFileTileCacheQGC::getIdlePolicy(const QVariantMap &parameters) {
+    const QString policy =
+        parameters.value(QStringLiteral("mapping.cache.idle")).toString().toLower();
+    return (policy == QStringLiteral("lowpower")) ? QGCCacheIdlePolicy::LowPower
+                                                  : QGCCacheIdlePolicy::Persistent;
+}
+
 void QGeoFileTileCacheQGC::cacheTile(const QString &type, int x, int y, int z,
                                      const QByteArray &image,
                                      const QString &format, qulonglong set) {
-    const QString hash = UrlFactory::getTileHash(type, x, y, z);
-    cacheTile(type, hash, image, format, set);
+    cacheTile(type, UrlFactory::getTileKey(type, x, y, z), image, format, set);
 }
 
-void QGeoFileTileCacheQGC::cacheTile(const QString &type, const QString &hash,
+void QGeoFileTileCacheQGC::cacheTile(const QString &type, quint64 key,
                                      const QByteArray &image,
                                      const QString &format, qulonglong set) {
-    QGCCacheTile *const tile = new QGCCacheTile(hash, image, format, type, set);
-    QGCSaveTileTask *const task = new QGCSaveTileTask(tile);
-    (void)getQGCMapEngine()->addTask(task);
+    // 地图类型映射尚未加载（缓存数据库未就绪）
+    if (!QGCTileKey::isValid(key)) {
+        return;
+    }
+
+    // 离线下载的瓦片不进入内存 LRU，避免冲掉正在浏览的工作集
+    if (set == UINT64_MAX) {
+        QGCTileMemoryCache::instance()->insert(key, image, format, type);
+    }
+    // 直接进入写后缓冲，不创建瓦片副本和任务对象
+    (void)getQGCMapEngine()->saveTile(key, image, format, type, set);
 }
 
 QGCFetchTileTask *QGeoFileTileCacheQGC::createFetchTileTask(const QString &type,
                                                             int x, int y,
                                                             int z) {
-    const QString hash = UrlFactory::getTileHash(type, x, y, z);
-    QGCFetchTileTask *const task = new QGCFetchTileTask(hash);
+    QGCFetchTileTask *const task =
+        new QGCFetchTileTask(UrlFactory::getTileKey(type, x, y, z));
     return task;
 }
 
+QGCTileLookup *QGeoFileTileCacheQGC::fetchTile(const QString &type, int x, int y, int z,
+                                               QObject *context, QGCTileLookup::Callback callback) {
+    return _fetch(UrlFactory::getTileKey(type, x, y, z), context, std::move(callback));
+}
+
+QGCTileLookup *QGeoFileTileCacheQGC::_fetch(quint64 key, QObject *context,
+                                            QGCTileLookup::Callback callback) {
+    QGCTileLookup *const lookup = QGCTileLookup::create(key, context, std::move(callback));
+    // 提交失败时查询已以错误结束，回调照常在下一次事件循环中执行
+    (void)getQGCMapEngine()->addLookup(lookup);
+    return lookup;
+}
+
+QGCCacheTile *QGeoFileTileCacheQGC::getCachedTile(const QString &type, int x,
+                                                  int y, int z) {
+    return _lookupMemory(UrlFactory::getTileKey(type, x, y, z));
+}
+
+bool QGeoFileTileCacheQGC::mayBeCached(const QString &type, int x, int y, int z) {
+    return _mayBeCached(UrlFactory::getTileKey(type, x, y, z));
+}
+
+bool QGeoFileTileCacheQGC::_mayBeCached(quint64 key) {
+    // 无效键交给工作线程按原流程报告
+    return !QGCTileKey::isValid(key) || QGCTileKeyFilter::instance()->mayContain(key) ||
+           QGCTileWriteBuffer::instance()->contains(key);
+}
+
+QGCCacheTile *QGeoFileTileCacheQGC::_lookupMemory(quint64 key) {
+    QGCCacheTile *tile = QGCTileMemoryCache::instance()->lookup(key);
+    // 离线下载的瓦片不进入 LRU，写入数据库之前从写后缓冲读取
+    if (!tile) {
+        tile = QGCTileWriteBuffer::instance()->lookup(key);
+    }
+    // 内存命中不经过数据库，同样记为访问，防止常看的瓦片被磁盘淘汰
+    if (tile) {
+        QGCCacheEvictor::instance()->touch(key);
+    }
+    return tile;
+}
+
+quint64 QGeoFileTileCacheQGC::_compositeKey(const QString &layerStackKey,
+                                            int x, int y, int z) {
+    // 每种图层组合作为一个独立的地图类型登记
+    return UrlFactory::getTileKey(
+        QGCProviderRegistry::compositeName(layerStackKey), x, y, z);
+}
+
 void QGeoFileTileCacheQGC::cacheCompositeTile(const QString &layerStackKey, int x, int y, int z,
                                                const QByteArray &image, const QString &format) {
-    // 生成合成瓦片的哈希键
-    // 格式: "composite_{layerStackKey}_{x}_{y}_{z}"
-    QString hash = QString("composite_%1_%2_%3_%4")
-                    .arg(layerStackKey)
-                    .arg(x, 8, 10, QChar('0'))
-                    .arg(y, 8, 10, QChar('0'))
-                    .arg(z, 3, 10, QChar('0'));
-    
-    // 使用特殊的类型标识符 "Composite"
-    cacheTile("Composite", hash, image, format, UINT64_MAX);
+    cacheTile(QGCProviderRegistry::compositeName(layerStackKey),
+              _compositeKey(layerStackKey, x, y, z), image, format, UINT64_MAX);
 }
 
 QGCFetchTileTask *QGeoFileTileCacheQGC::createFetchCompositeTileTask(const QString &layerStackKey, 
                                                                       int x, int y, int z) {
-    // 生成合成瓦片的哈希键（与 cacheCompositeTile 保持一致）
-    QString hash = QString("composite_%1_%2_%3_%4")
-                    .arg(layerStackKey)
-                    .arg(x, 8, 10, QChar('0'))
-                    .arg(y, 8, 10, QChar('0'))
-                    .arg(z, 3, 10, QChar('0'));
-    
-    QGCFetchTileTask *const task = new QGCFetchTileTask(hash);
+    // 瓦片键与 cacheCompositeTile 保持一致
+    QGCFetchTileTask *const task =
+        new QGCFetchTileTask(_compositeKey(layerStackKey, x, y, z));
     return task;
 }
 
+QGCTileLookup *QGeoFileTileCacheQGC::fetchCompositeTile(const QString &layerStackKey,
+                                                        int x, int y, int z, QObject *context,
+                                                        QGCTileLookup::Callback callback) {
+    return _fetch(_compositeKey(layerStackKey, x, y, z), context, std::move(callback));
+}
+
+QGCCacheTile *QGeoFileTileCacheQGC::getCachedCompositeTile(
+    const QString &layerStackKey, int x, int y, int z) {
+    return _lookupMemory(_compositeKey(layerStackKey, x, y, z));
+}
+
+bool QGeoFileTileCacheQGC::mayBeCachedComposite(const QString &layerStackKey, int x, int y, int z) {
+    return _mayBeCached(_compositeKey(layerStackKey, x, y, z));
+}
+
 QString QGeoFileTileCacheQGC::_getCachePath(const QVariantMap &parameters) {
     QString cacheDir;
     if (parameters.contains(QStringLiteral("mapping.cache.directory"))) {
@@ -13,11 +13,13 @@
 #include "MapProvider.h"
 #include "QGCMapEngine.h"
 #include "QGCMapUrlEngine.h"
+#include "QGCTileCacheReadPool.h"
+#include "QGCTileDownloads.h"
+#include "QGCTileHedging.h"
 #include "QGeoFileTileCacheQGC.h"
 
-#include <QGCFileDownload.h>
-
 #include <QtCore/QFile>
+#include <QtCore/QTimerEvent>
 #include <QtLocation/private/qgeotilespec_p.h>
 #include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QSslError>
@@ -29,10 +31,10 @@ QByteArray QGeoTiledMapReplyQGC::_bingNoTileImage;
 QByteArray QGeoTiledMapReplyQGC::_badTile;
 
 QGeoTiledMapReplyQGC::QGeoTiledMapReplyQGC(
-    QNetworkAccessManager *networkManager, const QNetworkRequest &request,
-    const QGeoTileSpec &spec, QObject *parent)
+    QNetworkAccessManager *networkManager, QGCTileNetworkScheduler *networkScheduler,
+    const QNetworkRequest &request, const QGeoTileSpec &spec, QObject *parent)
     : QGeoTiledMapReply(spec, parent), _networkManager(networkManager),
-    _request(request) {
+    _networkScheduler(networkScheduler), _request(request) {
     _initDataFromResources();
 
     (void)connect(
@@ -49,9 +51,10 @@ QGeoTiledMapReplyQGC::QGeoTiledMapReplyQGC(
 }
 
 QGeoTiledMapReplyQGC::QGeoTiledMapReplyQGC(
-    QNetworkAccessManager *networkManager,
+    QNetworkAccessManager *networkManager, QGCTileNetworkScheduler *networkScheduler,
     const QGeoTileSpec &spec, QObject *parent)
-    : QGeoTiledMapReply(spec, parent), _networkManager(networkManager) {
+    : QGeoTiledMapReply(spec, parent), _networkManager(networkManager),
+    _networkScheduler(networkScheduler) {
     _initDataFromResources();
 
     (void)connect(
@@ -68,18 +71,90 @@ QGeoTiledMapReplyQGC::QGeoTiledMapReplyQGC(
 
 void QGeoTiledMapReplyQGC::initializeFromCache() {
     if (!_request.url().isEmpty()) {
-        QGCFetchTileTask *const task = QGeoFileTileCacheQGC::createFetchTileTask(
-            UrlFactory::getProviderTypeFromQtMapId(tileSpec().mapId()), 
-            tileSpec().x(), tileSpec().y(), tileSpec().zoom());
-        (void)connect(task, &QGCFetchTileTask::tileFetched, this,
-                       &QGeoTiledMapReplyQGC::_cacheReply);
-        (void)connect(task, &QGCMapTask::error, this,
-                       &QGeoTiledMapReplyQGC::_cacheError);
-        getQGCMapEngine()->addTask(task);
+        const QString type = UrlFactory::getProviderTypeFromQtMapId(tileSpec().mapId());
+        // 内存 LRU 命中时直接完成，不经过工作线程和 SQLite
+        QGCCacheTile *const cached = QGeoFileTileCacheQGC::getCachedTile(
+            type, tileSpec().x(), tileSpec().y(), tileSpec().zoom());
+        if (cached) {
+            _cacheReply(cached);
+            return;
+        }
+
+        // 确定未缓存：不经过工作线程，直接请求网络
+        if (!QGeoFileTileCacheQGC::mayBeCached(
+                type, tileSpec().x(), tileSpec().y(), tileSpec().zoom())) {
+            _cacheError(QGCMapTask::taskFetchTile, QString());
+            return;
+        }
+
+        // 回复销毁后查询不再回调，回调中无需检查 this
+        _cacheElapsed.start();
+        _cacheLookup = QGeoFileTileCacheQGC::fetchTile(
+            type, tileSpec().x(), tileSpec().y(), tileSpec().zoom(), this,
+            [this](QGCCacheTile *tile, const QString &errorString) {
+                _cacheLookup = nullptr;
+                _stopHedgeTimer();
+                QGCTileCacheReadPool::recordUsed();
+                QGCTileHedging::instance()->recordCache(_cacheElapsed.elapsed());
+                if (tile) {
+                    _cancelHedge();
+                    _cacheReply(tile);
+                } else if (!_hedgeReply) {
+                    _cacheError(QGCMapTask::taskFetchTile, errorString);
+                }
+                // 否则对冲的网络请求仍在进行，等待其结果
+            });
+
+        QGCTileHedging *const hedging = QGCTileHedging::instance();
+        if (_cacheLookup && hedging->enabled()) {
+            _hedgeTimerId = startTimer(hedging->beginLookup(), Qt::PreciseTimer);
+        }
     }
 }
 
-QGeoTiledMapReplyQGC::~QGeoTiledMapReplyQGC() {}
+QGeoTiledMapReplyQGC::~QGeoTiledMapReplyQGC() { cancelCacheLookup(_cacheLookup); }
+
+void QGeoTiledMapReplyQGC::timerEvent(QTimerEvent *event) {
+    if (event->timerId() != _hedgeTimerId) {
+        QGeoTiledMapReply::timerEvent(event);
+        return;
+    }
+
+    _stopHedgeTimer();
+    _hedge();
+}
+
+void QGeoTiledMapReplyQGC::_stopHedgeTimer() {
+    if (_hedgeTimerId != 0) {
+        killTimer(_hedgeTimerId);
+        _hedgeTimerId = 0;
+    }
+}
+
+void QGeoTiledMapReplyQGC::_cancelHedge() {
+    if (!_hedgeReply) {
+        return;
+    }
+
+    // 断开连接后再中止，避免中止触发的错误结束本回复
+    QNetworkReply *const reply = _hedgeReply;
+    _hedgeReply = nullptr;
+    (void)reply->disconnect(this);
+    (void)disconnect(this, nullptr, reply, nullptr);
+    reply->abort();
+    reply->deleteLater();
+    QGCTileHedging::instance()->recordCacheWon();
+}
+
+void QGeoTiledMapReplyQGC::cancelCacheLookup(QGCTileLookup *&lookup) {
+    if (!lookup) {
+        return;
+    }
+
+    // 查询仍在队列中时由读线程跳过；已经完成的结果不再回调
+    lookup->cancel();
+    lookup = nullptr;
+}
 
 void QGeoTiledMapReplyQGC::_initDataFromResources() {
     if (_bingNoTileImage.isEmpty()) {
@@ -106,13 +181,23 @@ void QGeoTiledMapReplyQGC::_networkReplyFinished() {
         return;
     }
     reply->deleteLater();
+    if (reply == _hedgeReply) {
+        _hedgeReply = nullptr;
+    }
 
     if (reply->error() != QNetworkReply::NoError) {
         return;
     }
 
+    // 对冲的网络请求结果无效时与 _networkReplyError 一样继续等待缓存
+    const auto fail = [this](QGeoTiledMapReply::Error error, const QString &errorString) {
+        if (!_cacheLookup) {
+            setError(error, errorString);
+        }
+    };
+
     if (!reply->isOpen()) {
-        setError(QGeoTiledMapReply::ParseError, tr("Empty Reply"));
+        fail(QGeoTiledMapReply::ParseError, tr("Empty Reply"));
         return;
     }
 
@@ -120,15 +205,15 @@ void QGeoTiledMapReplyQGC::_networkReplyFinished() {
         reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
     if ((statusCode < HTTP_Response::SUCCESS_OK) ||
         (statusCode >= HTTP_Response::REDIRECTION_MULTIPLE_CHOICES)) {
-        setError(QGeoTiledMapReply::CommunicationError,
-                 reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute)
-                     .toString());
+        fail(QGeoTiledMapReply::CommunicationError,
+             reply->attribute(QNetworkRequest::HttpReasonPhraseAttribute)
+                 .toString());
         return;
     }
 
     QByteArray image = reply->readAll();
     if (image.isEmpty()) {
-        setError(QGeoTiledMapReply::ParseError, tr("Image is Empty"));
+        fail(QGeoTiledMapReply::ParseError, tr("Image is Empty"));
         return;
     }
 
@@ -137,8 +222,8 @@ void QGeoTiledMapReplyQGC::_networkReplyFinished() {
     Q_CHECK_PTR(mapProvider);
 
     if (mapProvider->isBingProvider() && (image == _bingNoTileImage)) {
-        setError(QGeoTiledMapReply::CommunicationError,
-                 tr("Bing Tile Above Zoom Level"));
+        fail(QGeoTiledMapReply::CommunicationError,
+             tr("Bing Tile Above Zoom Level"));
         return;
     }
 
@@ -147,18 +232,29 @@ void QGeoTiledMapReplyQGC::_networkReplyFinished() {
             std::dynamic_pointer_cast<const ElevationProvider>(mapProvider);
         image = elevationProvider->serialize(image);
         if (image.isEmpty()) {
-            setError(QGeoTiledMapReply::ParseError,
-                     tr("Failed to Serialize Terrain Tile"));
+            fail(QGeoTiledMapReply::ParseError,
+                 tr("Failed to Serialize Terrain Tile"));
             return;
         }
     }
-    setMapImageData(image);
 
     const QString format = mapProvider->getImageFormat(image);
     if (format.isEmpty()) {
-        setError(QGeoTiledMapReply::ParseError, tr("Unknown Format"));
+        fail(QGeoTiledMapReply::ParseError, tr("Unknown Format"));
         return;
     }
+
+    QGCTileHedging::instance()->recordNetwork(_networkElapsed.elapsed());
+    // 图像有效后，对冲的网络请求才算先于缓存返回
+    if (_cacheLookup) {
+        cancelCacheLookup(_cacheLookup);
+        _stopHedgeTimer();
+        // 被放弃的缓存查询至少已经用了这么久；不计入时最慢的样本总被丢掉，p99 与期限会不断下降
+        QGCTileHedging::instance()->recordCache(_cacheElapsed.elapsed());
+        QGCTileHedging::instance()->recordNetworkWon();
+    }
+
+    setMapImageData(image);
     setMapImageFormat(format);
 
     QGeoFileTileCacheQGC::cacheTile(mapProvider->getMapName(), tileSpec().x(),
@@ -170,6 +266,12 @@ void QGeoTiledMapReplyQGC::_networkReplyFinished() {
 
 void QGeoTiledMapReplyQGC::_networkReplyError(
     QNetworkReply::NetworkError error) {
+    // 对冲的网络请求失败时继续等待缓存
+    if (_cacheLookup && _hedgeReply && (sender() == _hedgeReply.data())) {
+        _hedgeReply = nullptr;
+        return;
+    }
+
     if (error != QNetworkReply::OperationCanceledError) {
         const QNetworkReply *const reply =
             qobject_cast<const QNetworkReply *>(sender());
@@ -243,7 +345,22 @@ void QGeoTiledMapReplyQGC::_cacheError(QGCMapTask::TaskType type,
     (void)createNetworkRequest(_request);
 }
 
-void QGeoTiledMapReplyQGC::abort() { QGeoTiledMapReply::abort(); }
+void QGeoTiledMapReplyQGC::_hedge() {
+    if (!_cacheLookup || _hedgeReply || isFinished() || !isInternetAvailable()) {
+        return;
+    }
+    if (!QGCTileHedging::instance()->tryHedge()) {
+        return;
+    }
+
+    _hedgeReply = createNetworkRequest(_request);
+}
+
+void QGeoTiledMapReplyQGC::abort() {
+    cancelCacheLookup(_cacheLookup);
+    _stopHedgeTimer();
+    QGeoTiledMapReply::abort();
+}
 
 QNetworkReply* QGeoTiledMapReplyQGC::createNetworkRequest(const QNetworkRequest &request, bool connectSignals) {
     if (!_networkManager) {
@@ -253,15 +370,17 @@ QNetworkReply* QGeoTiledMapReplyQGC::createNetworkRequest(const QNetworkRequest
 
     QNetworkRequest req = request;
     req.setOriginatingObject(this);
+    _networkElapsed.start();
     
-    QNetworkReply *const reply = _networkManager->get(req);
+    // 其他地图、图层或离线下载正在获取同一瓦片时跟随其下载；新的下载按视口排队
+    QNetworkReply *const reply = QGCTileDownloads::instance()->get(
+        _networkManager, req, _networkScheduler.data(), tileSpec());
     if (!reply) {
         qCWarning(QGeoTiledMapReplyQGCLog) << "Failed to create network reply";
         return nullptr;
     }
     
     reply->setParent(this);
-    QGCFileDownload::setIgnoreSSLErrorsIfNeeded(*reply);
 
     if (connectSignals) {
         (void)connect(reply, &QNetworkReply::finished, this,
@@ -14,6 +14,7 @@
 #include "QGeoFileTileCacheQGC.h"
 #include "QGCMapEngine.h"
 #include "QGCFileDownload.h"
+#include "QGCTileCacheReadPool.h"
 #include "QGeoTileFetcherQGC.h"
 
 #include <QtLocation/private/qgeotilespec_p.h>
@@ -27,12 +28,13 @@ Q_LOGGING_CATEGORY(QGeoMultiLayerMapReplyQGCLog,
 
 QGeoMultiLayerMapReplyQGC::QGeoMultiLayerMapReplyQGC(
     QNetworkAccessManager *networkManager,
+    QGCTileNetworkScheduler *networkScheduler,
     const QGeoTileSpec &spec,
     const MapLayerStack &layerStack,
     int compositeMapId,
     QObject *parent)
     // 使用延迟初始化构造函数，避免父类自动从缓存获取
-    : QGeoTiledMapReplyQGC(networkManager, spec, parent)
+    : QGeoTiledMapReplyQGC(networkManager, networkScheduler, spec, parent)
     , _layerStack(layerStack)
     , _compositeMapId(compositeMapId > 0 ? compositeMapId : layerStack.generateMapId())
 {
@@ -55,6 +57,8 @@ QGeoMultiLayerMapReplyQGC::QGeoMultiLayerMapReplyQGC(
 }
 
 QGeoMultiLayerMapReplyQGC::~QGeoMultiLayerMapReplyQGC() {
+    _cancelCacheLookups();
+
     // 清理所有回复
     for (QNetworkReply *reply : _replies) {
         if (reply) {
@@ -66,6 +70,9 @@ QGeoMultiLayerMapReplyQGC::~QGeoMultiLayerMapReplyQGC() {
 }
 
 void QGeoMultiLayerMapReplyQGC::abort() {
+    // 尚在排队的缓存查询不再执行
+    _cancelCacheLookups();
+
     // 中止所有网络请求
     for (QNetworkReply *reply : _replies) {
         if (reply) {
@@ -76,6 +83,14 @@ void QGeoMultiLayerMapReplyQGC::abort() {
     QGeoTiledMapReplyQGC::abort();
 }
 
+void QGeoMultiLayerMapReplyQGC::_cancelCacheLookups() {
+    cancelCacheLookup(_compositeLookup);
+    for (QGCTileLookup *&lookup : _cacheLookups) {
+        cancelCacheLookup(lookup);
+    }
+    _cacheLookups.clear();
+}
+
 void QGeoMultiLayerMapReplyQGC::_startFetching() {
     const QGeoTileSpec &spec = tileSpec();
     int x = spec.x();
@@ -126,35 +141,46 @@ void QGeoMultiLayerMapReplyQGC::_startFetching() {
     // 文件系统未命中，尝试从数据库获取合成瓦片缓存
     QString layerStackKey = _layerStack.generateCacheKey();
     if (!layerStackKey.isEmpty()) {
-        QGCFetchTileTask *compositeTask = QGeoFileTileCacheQGC::createFetchCompositeTileTask(
+        // 内存 LRU 命中时同步完成
+        QGCCacheTile *const cached = QGeoFileTileCacheQGC::getCachedCompositeTile(
             layerStackKey, x, y, zoom);
-        if (compositeTask) {
-            (void)connect(compositeTask, &QGCFetchTileTask::tileFetched, this,
-                           [this](QGCCacheTile *tile) {
-                               if (tile) {
-                                   QByteArray imgData = tile->img();
-                                   QString imgFormat = tile->format();
-                                   if (!imgData.isEmpty() && !imgFormat.isEmpty()) {
-                                       setMapImageData(imgData);
-                                       setMapImageFormat(imgFormat);
-                                       setCached(true);
-                                       setFinished(true);
-                                   } else {
-                                       qCWarning(QGeoMultiLayerMapReplyQGCLog) << "Invalid composite tile data";
-                                       setError(QGeoTiledMapReply::ParseError, tr("Invalid composite tile data"));
-                                       setFinished(true);
-                                   }
-                                   delete tile;
-                               }
-                           });
-            (void)connect(compositeTask, &QGCMapTask::error, this,
-                           [this](QGCMapTask::TaskType type, const QString &errorString) {
-                               Q_UNUSED(type);
-                               Q_UNUSED(errorString);
-                               // 缓存未命中，继续获取单个图层
-                               _startFetchingLayers();
-                           });
-            getQGCMapEngine()->addTask(compositeTask);
+        if (cached) {
+            setMapImageData(cached->img());
+            setMapImageFormat(cached->format());
+            setCached(true);
+            setFinished(true);
+            delete cached;
+            return;
+        }
+
+        // 过滤器确定未缓存时不查询数据库，直接获取单个图层
+        if (QGeoFileTileCacheQGC::mayBeCachedComposite(layerStackKey, x, y, zoom)) {
+            _compositeLookup = QGeoFileTileCacheQGC::fetchCompositeTile(
+                layerStackKey, x, y, zoom, this,
+                [this](QGCCacheTile *tile, const QString &errorString) {
+                    Q_UNUSED(errorString);
+                    _compositeLookup = nullptr;
+                    QGCTileCacheReadPool::recordUsed();
+                    if (!tile) {
+                        // 缓存未命中，继续获取单个图层
+                        _startFetchingLayers();
+                        return;
+                    }
+
+                    QByteArray imgData = tile->img();
+                    QString imgFormat = tile->format();
+                    if (!imgData.isEmpty() && !imgFormat.isEmpty()) {
+                        setMapImageData(imgData);
+                        setMapImageFormat(imgFormat);
+                        setCached(true);
+                        setFinished(true);
+                    } else {
+                        qCWarning(QGeoMultiLayerMapReplyQGCLog) << "Invalid composite tile data";
+                        setError(QGeoTiledMapReply::ParseError, tr("Invalid composite tile data"));
+                        setFinished(true);
+                    }
+                    delete tile;
+                });
             return;  // 等待缓存结果
         }
     }
@@ -170,6 +196,7 @@ void QGeoMultiLayerMapReplyQGC::_startFetchingLayers() {
     int zoom = spec.zoom();
 
     _pendingReplies = 0;
+    int memoryHits = 0;
 
     // 首先尝试从缓存获取单个图层
     for (const MapLayer &layer : _visibleLayers) {
@@ -184,19 +211,50 @@ void QGeoMultiLayerMapReplyQGC::_startFetchingLayers() {
             continue;
         }
 
-        // 尝试从缓存获取
+        // 尝试从缓存获取，内存 LRU 命中时不创建任务
         QString providerType = UrlFactory::getProviderTypeFromQtMapId(layer.mapId());
-        QGCFetchTileTask *task = QGeoFileTileCacheQGC::createFetchTileTask(providerType, x, y, zoom);
-        
-        if (task) {
-            _cacheTasks.insert(layer.mapId(), task);
-            (void)connect(task, &QGCFetchTileTask::tileFetched, this,
-                           &QGeoMultiLayerMapReplyQGC::_cacheReply);
-            (void)connect(task, &QGCMapTask::error, this,
-                           &QGeoMultiLayerMapReplyQGC::_cacheError);
-            getQGCMapEngine()->addTask(task);
-            _pendingReplies++;
+        QGCCacheTile *const cached = QGeoFileTileCacheQGC::getCachedTile(providerType, x, y, zoom);
+        if (cached) {
+            TileImageData tileData;
+            tileData.imageData = cached->img();
+            tileData.format = cached->format();
+            tileData.isValid = !tileData.imageData.isEmpty() && !tileData.format.isEmpty();
+            if (tileData.isValid) {
+                _tiles.insert(layer.mapId(), tileData);
+            }
+            delete cached;
+            memoryHits++;
+            continue;
+        }
+
+        // 确定未缓存的图层直接请求网络
+        if (!QGeoFileTileCacheQGC::mayBeCached(providerType, x, y, zoom)) {
+            _createLayerNetworkRequest(layer.mapId(), x, y, zoom);
+            continue;
         }
+
+        // 回调总是在之后的事件循环中执行，插入哈希表不会晚于回调
+        const int mapId = layer.mapId();
+        QGCTileLookup *const lookup = QGeoFileTileCacheQGC::fetchTile(
+            providerType, x, y, zoom, this,
+            [this, mapId](QGCCacheTile *tile, const QString &errorString) {
+                Q_UNUSED(errorString);
+                _cacheLookups.remove(mapId);
+                QGCTileCacheReadPool::recordUsed();
+                if (tile) {
+                    _layerCacheReply(mapId, tile);
+                } else {
+                    _layerCacheMiss(mapId);
+                }
+            });
+        _cacheLookups.insert(mapId, lookup);
+        _pendingReplies++;
+    }
+
+    // 所有图层都在内存中命中，直接合成
+    if ((_pendingReplies == 0) && (memoryHits > 0)) {
+        _compositeTiles();
+        return;
     }
 
     // 如果没有缓存任务，直接开始网络请求
@@ -217,29 +275,7 @@ void QGeoMultiLayerMapReplyQGC::_startFetchingLayers() {
     }
 }
 
-void QGeoMultiLayerMapReplyQGC::_cacheReply(QGCCacheTile *tile) {
-    QGCFetchTileTask *task = qobject_cast<QGCFetchTileTask*>(sender());
-    if (!task || !tile) {
-        if (tile) {
-            delete tile;
-        }
-        return;
-    }
-
-    // 找到对应的图层
-    int mapId = -1;
-    for (auto it = _cacheTasks.begin(); it != _cacheTasks.end(); ++it) {
-        if (it.value() == task) {
-            mapId = it.key();
-            break;
-        }
-    }
-
-    if (mapId < 0) {
-        delete tile;
-        return;
-    }
-
+void QGeoMultiLayerMapReplyQGC::_layerCacheReply(int mapId, QGCCacheTile *tile) {
     // 存储瓦片数据（在删除 tile 之前保存数据）
     TileImageData tileData;
     tileData.imageData = tile->img();
@@ -249,11 +285,7 @@ void QGeoMultiLayerMapReplyQGC::_cacheReply(QGCCacheTile *tile) {
     if (tileData.isValid) {
         _tiles.insert(mapId, tileData);
     }
-
-    // 清理
-    _cacheTasks.remove(mapId);
     delete tile;
-    task->deleteLater();
 
     // 检查是否全部完成
     _pendingReplies--;
@@ -262,45 +294,22 @@ void QGeoMultiLayerMapReplyQGC::_cacheReply(QGCCacheTile *tile) {
     }
 }
 
-void QGeoMultiLayerMapReplyQGC::_cacheError(QGCMapTask::TaskType type,
-                                             QStringView errorString) {
-    Q_UNUSED(errorString);
-    Q_UNUSED(type);
-
-    QGCFetchTileTask *task = qobject_cast<QGCFetchTileTask*>(sender());
-    if (!task) {
-        return;
-    }
-
-    // 找到对应的图层
-    int mapId = -1;
-    for (auto it = _cacheTasks.begin(); it != _cacheTasks.end(); ++it) {
-        if (it.value() == task) {
-            mapId = it.key();
-            break;
-        }
-    }
-
-    if (mapId < 0) {
-        return;
-    }
+void QGeoMultiLayerMapReplyQGC::_layerCacheMiss(int mapId) {
+    // 缓存查询结束，网络请求另行计数
+    _pendingReplies--;
 
     // 缓存未命中，发起网络请求
     const QGeoTileSpec &spec = tileSpec();
-    const MapLayer *layer = nullptr;
-    for (const MapLayer &l : _visibleLayers) {
-        if (l.mapId() == mapId) {
-            layer = &l;
+    for (const MapLayer &layer : std::as_const(_visibleLayers)) {
+        if (layer.mapId() == mapId) {
+            _createLayerNetworkRequest(mapId, spec.x(), spec.y(), spec.zoom());
             break;
         }
     }
 
-    if (layer) {
-        _createLayerNetworkRequest(mapId, spec.x(), spec.y(), spec.zoom());
+    if (_pendingReplies == 0) {
+        _compositeTiles();
     }
-
-    _cacheTasks.remove(mapId);
-    task->deleteLater();
 }
 
 void QGeoMultiLayerMapReplyQGC::_networkReplyFinished() {
@@ -337,6 +346,24 @@ void QGeoMultiLayerMapReplyQGC::_networkReplyFinished() {
     reply->deleteLater();
     _replies.remove(mapId);
 
+    // 瓦片离开视口时请求被取消，其余图层同样不再需要，不显示错误瓦片
+    if (replyError == QNetworkReply::OperationCanceledError) {
+        _cancelCacheLookups();
+        for (QNetworkReply *other : std::as_const(_replies)) {
+            if (other) {
+                (void)other->disconnect(this);
+                other->abort();
+                other->deleteLater();
+            }
+        }
+        _replies.clear();
+        _pendingReplies = 0;
+        if (!isFinished()) {
+            setFinished(true);
+        }
+        return;
+    }
+
     // 处理结果
     if (!processSuccess) {
         // 处理失败，检查错误类型
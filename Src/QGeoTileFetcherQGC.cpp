@@ -15,14 +15,22 @@
 #include "QGeoTiledMappingManagerEngineQGC.h"
 #include "QGCTileCompositor.h"
 #include "QGeoFileTileCacheQGC.h"
+#include "QGCHostConcurrency.h"
 
+#include <QtCore/QSet>
 #include <QtLocation/private/qgeotiledmappingmanagerengine_p.h>
 #include <QtLocation/private/qgeotilespec_p.h>
+#include <QtNetwork/QNetworkAccessManager>
 #include <QtNetwork/QNetworkRequest>
+#if QT_CONFIG(ssl)
+#include <QtNetwork/QSslConfiguration>
+#endif
 
 Q_LOGGING_CATEGORY(QGeoTileFetcherQGCLog,
                    "qgc.qtlocationplugin.qgeotilefetcherqgc")
 
+std::atomic_bool QGeoTileFetcherQGC::s_http2 = false;
+
 QGeoTileFetcherQGC::QGeoTileFetcherQGC(QNetworkAccessManager *networkManager,
                                        const QVariantMap &parameters,
                                        QGeoTiledMappingManagerEngineQGC *parent)
@@ -66,7 +74,7 @@ QGeoTiledMapReply *QGeoTileFetcherQGC::getTileImage(const QGeoTileSpec &spec) {
         return nullptr;
     }
 
-    return new QGeoTiledMapReplyQGC(m_networkManager, request, spec);
+    return new QGeoTiledMapReplyQGC(m_networkManager, networkScheduler(), request, spec);
 }
 
 bool QGeoTileFetcherQGC::initialized() const {
@@ -98,6 +106,51 @@ void QGeoTileFetcherQGC::handleReply(QGeoTiledMapReply *reply,
     }
 }
 
+uint32_t QGeoTileFetcherQGC::concurrentDownloads(const QString &type) {
+    const QUrl url = UrlFactory::getTileURL(type, 0, 0, 1);
+    return static_cast<uint32_t>(QGCHostConcurrency::instance()->window(QGCHostConcurrency::hostKey(url)));
+}
+
+void QGeoTileFetcherQGC::setHttp2Enabled(bool enabled) {
+    s_http2 = enabled;
+    // 分片主机各自需要一次握手，多路复用时只保留一个
+    MapProvider::setSingleHost(enabled);
+}
+
+void QGeoTileFetcherQGC::preconnect(QNetworkAccessManager *networkManager, const QList<int> &mapIds) {
+    if (!networkManager) {
+        return;
+    }
+
+    QSet<QString> connected;
+    for (const int mapId : mapIds) {
+        const SharedMapProvider provider = UrlFactory::getMapProviderFromQtMapId(mapId);
+        if (!provider) {
+            continue;
+        }
+
+        const QUrl url = provider->getTileURL(0, 0, provider->minimumZoomLevel());
+        const QString origin = url.adjusted(QUrl::RemovePath | QUrl::RemoveQuery | QUrl::RemoveFragment).toString();
+        if (url.host().isEmpty() || connected.contains(origin)) {
+            continue;
+        }
+        (void)connected.insert(origin);
+
+        if (url.scheme() == QStringLiteral("https")) {
+#if QT_CONFIG(ssl)
+            QSslConfiguration ssl = QSslConfiguration::defaultConfiguration();
+            ssl.setAllowedNextProtocols({QSslConfiguration::ALPNProtocolHTTP2, QSslConfiguration::NextProtocolHttp1_1});
+            networkManager->connectToHostEncrypted(url.host(), static_cast<quint16>(url.port(443)), ssl);
+#endif
+        } else if (url.scheme() == QStringLiteral("http")) {
+            networkManager->connectToHost(url.host(), static_cast<quint16>(url.port(80)));
+        } else {
+            continue;
+        }
+        qCDebug(QGeoTileFetcherQGCLog) << "Preconnect" << origin << provider->getMapName();
+    }
+}
+
 QNetworkRequest QGeoTileFetcherQGC::getNetworkRequest(int mapId, int x, int y,
                                                       int zoom) {
     const SharedMapProvider mapProvider =
@@ -137,6 +190,11 @@ MapLayerStack QGeoTileFetcherQGC::getLayerStackForMapId(int mapId) const
     return MapLayerStack();
 }
 
+QGCTileNetworkScheduler *QGeoTileFetcherQGC::networkScheduler() const
+{
+    return m_engine ? m_engine->networkScheduler() : nullptr;
+}
+
 QGeoTiledMapReply *QGeoTileFetcherQGC::getMultiLayerTileImage(const QGeoTileSpec &spec, const MapLayerStack &layerStack)
 {
     if (layerStack.isEmpty()) {
@@ -182,7 +240,7 @@ QGeoTiledMapReply *QGeoTileFetcherQGC::getMultiLayerTileImage(const QGeoTileSpec
             return nullptr;
         }
 
-        return new QGeoTiledMapReplyQGC(m_networkManager, request, spec);
+        return new QGeoTiledMapReplyQGC(m_networkManager, networkScheduler(), request, spec);
     }
     
     // 多图层模式：获取生成的 mapId（用于文件保存）
@@ -199,5 +257,5 @@ QGeoTiledMapReply *QGeoTileFetcherQGC::getMultiLayerTileImage(const QGeoTileSpec
     }
     
     // 直接使用原始的 spec，compositeMapId 会在 QGeoMultiLayerMapReplyQGC 中使用
-    return new QGeoMultiLayerMapReplyQGC(m_networkManager, spec, layerStack, compositeMapId);
+    return new QGeoMultiLayerMapReplyQGC(m_networkManager, networkScheduler(), spec, layerStack, compositeMapId);
 }
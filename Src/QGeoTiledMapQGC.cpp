@@ -9,12 +9,13 @@
 
 #include "QGeoTiledMapQGC.h"
 #include "QGeoTiledMappingManagerEngineQGC.h"
+#include "QGCTileNetworkScheduler.h"
 
 Q_LOGGING_CATEGORY(QGeoTiledMapQGCLog, "qgc.qtlocationplugin.qgeotiledmapqgc")
 
 QGeoTiledMapQGC::QGeoTiledMapQGC(QGeoTiledMappingManagerEngineQGC *engine,
                                  QObject *parent)
-    : QGeoTiledMap(engine, parent) {}
+    : QGeoTiledMap(engine, parent), m_engine(engine) {}
 
 QGeoTiledMapQGC::~QGeoTiledMapQGC() {}
 
@@ -22,3 +23,11 @@ QGeoMap::Capabilities QGeoTiledMapQGC::capabilities() const {
     return Capabilities(SupportsVisibleRegion | SupportsAnchoringCoordinate |
                         SupportsVisibleArea);
 }
+
+void QGeoTiledMapQGC::evaluateCopyrights(const QSet<QGeoTileSpec> &visibleTiles) {
+    // 可见瓦片变化时更新网络调度的视口，排队中的下载按新的屏幕中心重新排序
+    if (m_engine && m_engine->networkScheduler()) {
+        m_engine->networkScheduler()->setViewport(visibleTiles);
+    }
+    QGeoTiledMap::evaluateCopyrights(visibleTiles);
+}
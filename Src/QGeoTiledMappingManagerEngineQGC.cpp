@@ -22,6 +22,8 @@
 #include "QGeoFileTileCacheQGC.h"
 #include "QGeoTiledMapQGC.h"
 #include "QGCMapUrlEngine.h"
+#include "QGCTileHedging.h"
+#include "QGCTileNetworkScheduler.h"
 #include "TmsMapProvider.h"
 #include "TiandiMapProvider.h"
 
@@ -62,6 +64,11 @@ QGeoTiledMappingManagerEngineQGC::QGeoTiledMappingManagerEngineQGC(const QVarian
     // 解析图层配置
     parseLayerConfiguration(parameters);
 
+    // 单主机模式影响之后生成的全部瓦片 URL
+    if (parameters.contains(QStringLiteral("mapping.network.http2"))) {
+        QGeoTileFetcherQGC::setHttp2Enabled(parameters.value(QStringLiteral("mapping.network.http2")).toBool());
+    }
+
     QList<QGeoMapType> mapList;
     const QList<SharedMapProvider> providers = UrlFactory::getProviders();
     for (const SharedMapProvider &provider : providers) {
@@ -89,8 +96,10 @@ QGeoTiledMappingManagerEngineQGC::QGeoTiledMappingManagerEngineQGC(const QVarian
 
     // MapEngine must be init after fileTileCache
     static std::once_flag mapEngineInit;
-    std::call_once(mapEngineInit, [fileTileCache]() {
-        getQGCMapEngine()->init(fileTileCache->getDatabaseFilePath());
+    std::call_once(mapEngineInit, [fileTileCache, &parameters]() {
+        getQGCMapEngine()->init(fileTileCache->getDatabaseFilePath(),
+                                QGeoFileTileCacheQGC::getStorage(parameters),
+                                QGeoFileTileCacheQGC::getIdlePolicy(parameters));
     });
 
     m_prefetchStyle = QGeoTiledMap::PrefetchTwoNeighbourLayers;
@@ -111,6 +120,10 @@ QGeoTiledMappingManagerEngineQGC::QGeoTiledMappingManagerEngineQGC(const QVarian
         m_networkManager->setCache(diskCache);
     }
 
+    parseNetworkConfiguration(parameters);
+
+    m_networkScheduler = new QGCTileNetworkScheduler(this);
+
     QGeoTileFetcherQGC* const tileFetcher = new QGeoTileFetcherQGC(m_networkManager, parameters, this);
 
     *error = QGeoServiceProvider::NoError;
@@ -189,6 +202,46 @@ void QGeoTiledMappingManagerEngineQGC::parseLayerConfiguration(const QVariantMap
     }
 }
 
+void QGeoTiledMappingManagerEngineQGC::parseNetworkConfiguration(const QVariantMap &parameters)
+{
+    if (parameters.contains(QStringLiteral("mapping.network.hedge"))) {
+        bool ok = false;
+        int delay = parameters.value(QStringLiteral("mapping.network.hedge.delay")).toString().toInt(&ok);
+        if (!ok) {
+            delay = 100;
+        }
+        double budget = parameters.value(QStringLiteral("mapping.network.hedge.budget")).toString().toDouble(&ok);
+        if (!ok) {
+            budget = 5.;
+        }
+        QGCTileHedging::instance()->configure(parameters.value(QStringLiteral("mapping.network.hedge")).toBool(),
+                                              delay, budget / 100.);
+    }
+
+    if (!QGeoTileFetcherQGC::http2Enabled()) {
+        return;
+    }
+
+    // 预连接图层配置中的提供者以及 mapping.network.preconnect 列出的提供者（逗号分隔），
+    // 都没有时预连接地图默认显示的第一个地图类型
+    QList<int> mapIds;
+    for (const MapLayer &layer : m_layerStack.layers()) {
+        mapIds.append(layer.mapId());
+    }
+    const QStringList types = parameters.value(QStringLiteral("mapping.network.preconnect")).toString().split(QLatin1Char(','), Qt::SkipEmptyParts);
+    for (const QString &type : types) {
+        const int mapId = UrlFactory::getQtMapIdFromProviderType(type.trimmed());
+        if (mapId > 0) {
+            mapIds.append(mapId);
+        }
+    }
+    if (mapIds.isEmpty() && !supportedMapTypes().isEmpty()) {
+        mapIds.append(supportedMapTypes().constFirst().mapId());
+    }
+
+    QGeoTileFetcherQGC::preconnect(m_networkManager, mapIds);
+}
+
 MapLayerStack QGeoTiledMappingManagerEngineQGC::getLayerStackForMapId(int mapId) const
 {
     // 如果启用了多图层模式，忽略 mapId 的变化，始终返回全局图层配置